@@ -0,0 +1,922 @@
+/***********************************************************/
+/* This program is a load generator for the 'net-enabled'  */
+/* version of tictactoe. Bot players play as Player 2      */
+/* against a group of servers, which may be killed and     */
+/* restarted along the way, and report how fast they play. */
+/***********************************************************/
+
+/* #include files go here */
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* The bots play with the client's own protocol code, built without its main() and without its
+ * messages (thousands of bots would spend their time printing them) */
+#define TTT_NO_MAIN
+#define printf(...) ((void)(0 && printf(__VA_ARGS__)))
+#include "tictactoeClient.c"
+#undef printf
+
+/**************************/
+/* ENVIRONMENT STRUCTURES */
+/**************************/
+
+/* The number of buckets of a latency histogram (4 per power of 2 microseconds). */
+#define HISTOGRAM_BUCKETS 128
+
+/* Structure for a histogram of latencies with log-linear buckets. */
+struct Histogram {
+    unsigned long buckets[HISTOGRAM_BUCKETS];   // number of latencies recorded in each bucket
+    unsigned long count;                        // number of latencies recorded
+    uint64_t max;                               // largest latency recorded (in microseconds)
+};
+
+/* Structure for the results of a bot, added up once every bot has stopped. */
+struct Bench_Stats {
+    long results[4];                // games unfinished, drawn, won by Player 1, and won by Player 2
+    long failovers;                 // number of connections lost with games in progress
+    long gaveUp;                    // number of times no server could be found
+    long turnedAway;                // number of connections turned away by a full server
+    long refused;                   // number of multiplexed games turned down by a full server
+    struct Histogram rtt;           // time (in microseconds) the server took to answer each move
+    struct Histogram reconnect;     // time (in microseconds) from losing a server to the next answer
+};
+
+/* Structure for the benchmark configuration provided on the command line. */
+struct Bench_Config {
+    struct Client_Config client;    // board variant, protocol version, server, discovery timeouts, and games per bot
+    int numBots;                    // number of bot players playing at once
+    int duration;                   // time (in seconds) the bots start new games for
+    int perfect;                    // whether the bots play perfectly instead of randomly
+    int numServers;                 // number of servers started by the benchmark (0 to use a running server)
+    int serverGames;                // maximum number of games each started server plays simultaneously
+    int killInterval;               // time (in milliseconds) between killing one of the started servers, 0 to never
+    const char *groupList;          // multicast groups the bots look for servers in (and the started servers join)
+};
+
+/* Structure for a bot player, which plays its games over one connection at a time. */
+struct Bot {
+    pthread_t thread;                       // thread playing the bot's games
+    const struct Bench_Config *config;      // the benchmark configuration
+    int mcd;                                // socket descriptor of the multicast groups
+    struct sockaddr_in serverAddr;          // the server the bot plays its next games on
+    struct Discovery discovery;             // the retransmission state of the bot's REQUEST_GAME commands
+    struct Connection conn;                 // the connection to the server (conn.sd is -1 if not connected)
+    struct TTT_Game *games;                 // the bot's games (one unless the connection is multiplexed)
+    uint64_t *sentAt;                       // time each game's last move was sent, 0 if not waiting for an answer
+    uint64_t *retryAt;                      // time each game turned down by the server is started again, 0 if it was not
+    int numPlaying;                         // number of games in progress
+    uint64_t lostAt;                        // time the bot lost its server, 0 if it has not
+    struct Bench_Stats stats;               // the bot's results
+};
+
+/****************************/
+/* BENCHMARK INIT FUNCTIONS */
+/****************************/
+
+/* The largest number of bot players. */
+#define MAX_BOTS 16384
+/* The default number of bot players. */
+#define DEFAULT_BOTS 64
+/* The default time (in seconds) the bots start new games for. */
+#define DEFAULT_DURATION 10
+/* The largest number of servers the benchmark can start. */
+#define MAX_SERVERS 16
+/* The default maximum number of games each started server plays simultaneously. */
+#define DEFAULT_SERVER_GAMES 4096
+/* The stack size (in bytes) of each bot's thread. */
+#define BOT_STACK_SIZE (256 * 1024)
+
+void bench_error(const char *msg, int errnum, int terminate);
+void handle_bench_error(const char *msg, int errnum);
+void extract_bench_args(int argc, char *argv[], struct Bench_Config *config);
+void raise_file_limit(void);
+
+/************************/
+/* BOT PLAYER FUNCTIONS */
+/************************/
+
+/* The time (in seconds) a bot waits for the server to answer before giving up on it. */
+#define BOT_TIMEOUT 5
+/* The time (in milliseconds) a bot waits before starting a game the server turned down again. */
+#define REFUSED_RETRY_DELAY 50
+/* The number of 3x3 board states indexed by their base 3 encoding. */
+#define PERFECT_TABLE_SIZE 19683
+/* The score of a board state that has not been solved yet. */
+#define UNSOLVED 2
+
+uint64_t bench_time(void);
+void *run_bot(void *arg);
+int connect_bot(struct Bot *bot);
+void start_game(struct Bot *bot, int slot);
+void resume_bot_game(struct Bot *bot, int slot);
+void finish_game(struct Bot *bot, int slot);
+void refuse_game(struct Bot *bot, int slot);
+uint64_t retry_refused_games(struct Bot *bot);
+void lose_connection(struct Bot *bot);
+void turn_away(struct Bot *bot);
+void init_perfect_moves(void);
+int solve_board(struct TTT_Game *game, int index, int isP2Turn);
+int perfect_move(const struct TTT_Game *game);
+
+/*******************************/
+/* FAILURE INJECTION FUNCTIONS */
+/*******************************/
+
+/* The server program started by the benchmark. */
+#define BENCH_SERVER "./tictactoeServer"
+/* The time (in milliseconds) started servers get to join the multicast group before the bots start. */
+#define SERVER_STARTUP_WAIT 500
+/* The time (in milliseconds) a killed server stays down before it is started again. */
+#define SERVER_RESTART_DELAY 1000
+/* The time (in milliseconds) the main thread waits between checks of the servers. */
+#define MONITOR_INTERVAL 10
+
+pid_t start_server(const struct Bench_Config *config, int index);
+void stop_server(pid_t pid, int sig);
+
+/************************/
+/* STATISTICS FUNCTIONS */
+/************************/
+
+void record_latency(struct Histogram *hist, uint64_t latency);
+int histogram_bucket(uint64_t latency);
+uint64_t histogram_percentile(const struct Histogram *hist, double fraction);
+void merge_histogram(struct Histogram *total, const struct Histogram *hist);
+void merge_stats(struct Bench_Stats *total, const struct Bench_Stats *stats);
+void print_histogram(const char *name, const struct Histogram *hist, double scale, const char *unit);
+
+/* Whether the bots still start new games. */
+static atomic_int benchRunning = 1;
+/* The best move for Player 2 on each 3x3 board state (0 if none) by its base 3 encoding. */
+static signed char perfectMoves[PERFECT_TABLE_SIZE];
+/* Player 2's score on each 3x3 board state with both players playing perfectly (1 win, 0 draw, -1 loss). */
+static signed char perfectScores[PERFECT_TABLE_SIZE];
+
+/**
+ * @brief This program benchmarks a group of TicTacToe servers. Every bot player runs on its
+ * own thread and plays games, one per connection or many over a multiplexed connection, with
+ * the client's protocol code, moving randomly or perfectly. The benchmark can start the servers
+ * itself and kill one of them every so often, so the bots playing on it fail over to the other
+ * servers through the multicast group. Once the bots stop, it prints the games played per
+ * second, the percentiles of the time the servers took to answer each move, and the
+ * percentiles of the time it took the bots to get an answer from another server after losing
+ * theirs.
+ *
+ * @param argc Non-negative value representing the number of arguments passed to the program
+ * from the environment in which the program is run.
+ * @param argv Pointer to the first element of an array of argc + 1 pointers, of which the
+ * last one is NULL and the previous ones, if any, point to strings that represent the
+ * arguments passed to the program from the host environment. If argv[0] is not a NULL
+ * pointer (or, equivalently, if argc > 0), it points to a string that represents the program
+ * name, which is empty if the program name is not available from the host environment.
+ * @return If the return statement is used, the return value is used as the argument to the
+ * implicit call to exit(). The values zero and EXIT_SUCCESS indicate successful termination,
+ * the value EXIT_FAILURE indicates unsuccessful termination.
+ */
+int main(int argc, char *argv[]) {
+    int i, err, numKilled = 0, down = -1;
+    uint64_t start, deadline, nextKill, restartAt = 0, elapsed;
+    pid_t servers[MAX_SERVERS];
+    pthread_attr_t attr;
+    struct Bot *bots;
+    struct Bench_Config config;
+    struct Bench_Stats total = {{0}};
+    long played;
+
+    /* Extract arguments to their respective variables */
+    extract_bench_args(argc, argv, &config);
+    srand(time(NULL) ^ getpid());
+    raise_file_limit();
+    if (config.perfect) init_perfect_moves();
+
+    /* Start the servers and give them time to join the multicast group */
+    for (i = 0; i < config.numServers; i++) servers[i] = start_server(&config, i);
+    if (config.numServers > 0) usleep(SERVER_STARTUP_WAIT * 1000);
+
+    /* Start every bot player */
+    if ((bots = calloc(config.numBots, sizeof(struct Bot))) == NULL) bench_error("main: calloc", errno, 1);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, BOT_STACK_SIZE);
+    for (i = 0; i < config.numBots; i++) {
+        struct Bot *bot = &bots[i];
+        bot->config = &config;
+        if ((bot->games = calloc(config.client.numGames, sizeof(struct TTT_Game))) == NULL) bench_error("main: calloc", errno, 1);
+        if ((bot->sentAt = calloc(config.client.numGames, sizeof(uint64_t))) == NULL) bench_error("main: calloc", errno, 1);
+        if ((bot->retryAt = calloc(config.client.numGames, sizeof(uint64_t))) == NULL) bench_error("main: calloc", errno, 1);
+        bot->mcd = create_multicast_endpoint(&config.client);
+        bot->serverAddr.sin_family = AF_INET;
+        bot->serverAddr.sin_addr.s_addr = config.client.address;
+        bot->serverAddr.sin_port = htons(config.client.port);
+    }
+    printf("[+]Benchmark running %d bot(s) for %d second(s)...\n", config.numBots, config.duration);
+    start = bench_time();
+    for (i = 0; i < config.numBots; i++) {
+        if ((err = pthread_create(&bots[i].thread, &attr, run_bot, &bots[i])) != 0) bench_error("main: pthread_create", err, 1);
+    }
+
+    /* Kill one of the servers every so often, starting it again after a while */
+    deadline = start + (uint64_t)config.duration * 1000000;
+    nextKill = start + (uint64_t)config.killInterval * 1000;
+    while (bench_time() < deadline) {
+        uint64_t now = bench_time();
+        if (down >= 0 && now >= restartAt) {
+            servers[down] = start_server(&config, down);
+            down = -1;
+        } else if (down < 0 && config.killInterval > 0 && now >= nextKill) {
+            down = rand() % config.numServers;
+            stop_server(servers[down], SIGKILL);
+            numKilled++;
+            restartAt = now + SERVER_RESTART_DELAY * 1000;
+            nextKill = now + (uint64_t)config.killInterval * 1000;
+        }
+        usleep(MONITOR_INTERVAL * 1000);
+    }
+
+    /* Let the bots finish the games they are playing */
+    atomic_store(&benchRunning, 0);
+    for (i = 0; i < config.numBots; i++) {
+        pthread_join(bots[i].thread, NULL);
+        merge_stats(&total, &bots[i].stats);
+    }
+    elapsed = bench_time() - start;
+    for (i = 0; i < config.numServers; i++) {
+        if (i != down) stop_server(servers[i], SIGTERM);
+    }
+
+    /* Print the results */
+    played = total.results[1] + total.results[2] + total.results[3];
+    printf("Played %ld game(s) in %.2f s (%.1f games/sec) with %d bot(s): Player 1 won %ld, Player 2 won %ld, %ld draw(s), %ld unfinished\n",
+        played, elapsed / 1e6, played / (elapsed / 1e6), config.numBots, total.results[2], total.results[3], total.results[1], total.results[0]);
+    print_histogram("Move round trip", &total.rtt, 1, "us");
+    print_histogram("Reconnect", &total.reconnect, 1000, "ms");
+    printf("Servers killed: %d, connections lost with games in progress: %ld, turned away by full servers: %ld, games turned down by full servers: %ld, no server found: %ld\n",
+        numKilled, total.failovers, total.turnedAway, total.refused, total.gaveUp);
+    return 0;
+}
+
+/**
+ * @brief Prints the provided error message of the benchmark itself and corresponding errno
+ * message (if present) and terminates the process if asked to do so. The messages of the
+ * client code the bots play with are left out.
+ *
+ * @param msg The error description message to display.
+ * @param errnum This is the error number, usually errno.
+ * @param terminate Whether or not the process should be terminated.
+ */
+void bench_error(const char *msg, int errnum, int terminate) {
+    if (errnum) {
+        fprintf(stderr, "ERROR: %s: %s\n", msg, strerror(errnum));
+    } else {
+        fprintf(stderr, "ERROR: %s\n", msg);
+    }
+    if (terminate) exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Prints a string describing the initialization error and provided error number (if
+ * nonzero), the correct command usage, and exits the process signaling unsuccessful termination.
+ *
+ * @param msg The error description message to display.
+ * @param errnum This is the error number, usually errno.
+ */
+void handle_bench_error(const char *msg, int errnum) {
+    bench_error(msg, errnum, 0);
+    fprintf(stderr, "Usage is: tictactoeBench [-b bots] [-g games-per-bot] [-d seconds] [-r random|perfect] [-S servers] [-G server-games] [-K kill-ms] [-s board-size] [-k win-length] [-t discovery-ms] [-T max-discovery-ms] [-a attempts] [-p protocol-version] [-m group[,group...]] [-P multicast-port] <remote-port> <remote-IP>\n");
+    /* Exits the process signaling unsuccessful termination */
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Extracts the user provided arguments to their respective local variables and performs
+ * validation on their formatting. If any errors are found, the function terminates the process.
+ *
+ * @param argc The number of arguments passed to the program.
+ * @param argv Pointer to the first element of an array of argc + 1 pointers, of which the
+ * last one is NULL and the previous ones, if any, point to strings that represent the
+ * arguments passed to the program from the host environment. If argv[0] is not a NULL
+ * pointer (or, equivalently, if argc > 0), it points to a string that represents the program
+ * name, which is empty if the program name is not available from the host environment.
+ * @param config The benchmark configuration to fill in from the arguments.
+ */
+void extract_bench_args(int argc, char *argv[], struct Bench_Config *config) {
+    int opt, mcPort = MC_PORT;
+    struct Client_Config *client = &config->client;
+    /* Set the defaults for the optional arguments */
+    client->size = ROWS;
+    client->winLength = 0;
+    client->discoveryTimeout = DEFAULT_DISCOVERY_TIMEOUT;
+    client->maxDiscoveryTimeout = DEFAULT_MAX_DISCOVERY_TIMEOUT;
+    client->discoveryAttempts = MC_ATTEMPTS;
+    client->numGames = 1;
+    client->version = FRAMED_VERSION;
+    client->mcInterface.s_addr = htonl(INADDR_ANY);
+    client->mcTTL = DEFAULT_MC_TTL;
+    client->mcLoop = 1;
+    client->cachePath = NULL;
+    config->groupList = MC_GROUP;
+    config->numBots = DEFAULT_BOTS;
+    config->duration = DEFAULT_DURATION;
+    config->perfect = 0;
+    config->numServers = 0;
+    config->serverGames = DEFAULT_SERVER_GAMES;
+    config->killInterval = 0;
+    /* Extract and validate the optional arguments */
+    while ((opt = getopt(argc, argv, "b:g:d:r:S:G:K:s:k:t:T:a:p:m:P:")) != -1) {
+        switch (opt) {
+            case 'b':
+                config->numBots = strtol(optarg, NULL, 10);
+                if (config->numBots < 1 || config->numBots > MAX_BOTS) handle_bench_error("extract_bench_args: Invalid number of bots", 0);
+                break;
+            case 'g':
+                client->numGames = strtol(optarg, NULL, 10);
+                if (client->numGames < 1 || client->numGames > MAX_FRAMED_CHANNELS) handle_bench_error("extract_bench_args: Invalid number of games", 0);
+                break;
+            case 'd':
+                config->duration = strtol(optarg, NULL, 10);
+                if (config->duration < 1) handle_bench_error("extract_bench_args: Invalid duration", 0);
+                break;
+            case 'r':
+                if (strcmp(optarg, "random") == 0) {
+                    config->perfect = 0;
+                } else if (strcmp(optarg, "perfect") == 0) {
+                    config->perfect = 1;
+                } else {
+                    handle_bench_error("extract_bench_args: Invalid strategy", 0);
+                }
+                break;
+            case 'S':
+                config->numServers = strtol(optarg, NULL, 10);
+                if (config->numServers < 1 || config->numServers > MAX_SERVERS) handle_bench_error("extract_bench_args: Invalid number of servers", 0);
+                break;
+            case 'G':
+                config->serverGames = strtol(optarg, NULL, 10);
+                if (config->serverGames < 1) handle_bench_error("extract_bench_args: Invalid number of server games", 0);
+                break;
+            case 'K':
+                config->killInterval = strtol(optarg, NULL, 10);
+                if (config->killInterval < 1) handle_bench_error("extract_bench_args: Invalid kill interval", 0);
+                break;
+            case 's':
+                client->size = strtol(optarg, NULL, 10);
+                if (client->size < MIN_BOARD_SIZE || client->size > MAX_BOARD_SIZE) handle_bench_error("extract_bench_args: Invalid board size", 0);
+                break;
+            case 'k':
+                client->winLength = strtol(optarg, NULL, 10);
+                if (client->winLength < MIN_BOARD_SIZE || client->winLength > MAX_BOARD_SIZE) handle_bench_error("extract_bench_args: Invalid win length", 0);
+                break;
+            case 't':
+                client->discoveryTimeout = strtol(optarg, NULL, 10);
+                if (client->discoveryTimeout < 1) handle_bench_error("extract_bench_args: Invalid discovery timeout", 0);
+                break;
+            case 'T':
+                client->maxDiscoveryTimeout = strtol(optarg, NULL, 10);
+                if (client->maxDiscoveryTimeout < 1) handle_bench_error("extract_bench_args: Invalid maximum discovery timeout", 0);
+                break;
+            case 'a':
+                client->discoveryAttempts = strtol(optarg, NULL, 10);
+                if (client->discoveryAttempts < 1) handle_bench_error("extract_bench_args: Invalid number of discovery attempts", 0);
+                break;
+            case 'p':
+                client->version = strtol(optarg, NULL, 10);
+                if (client->version != VERSION && client->version != FRAMED_VERSION) handle_bench_error("extract_bench_args: Protocol version not supported", 0);
+                break;
+            case 'm':
+                config->groupList = optarg;
+                break;
+            case 'P':
+                mcPort = strtol(optarg, NULL, 10);
+                if (mcPort < 1 || mcPort != (u_int16_t)mcPort) handle_bench_error("extract_bench_args: Invalid multicast port number", 0);
+                break;
+            default:
+                handle_bench_error("extract_bench_args: Invalid option", 0);
+        }
+    }
+    /* The number of marks in a row needed to win defaults to the board size */
+    if (client->winLength == 0) client->winLength = client->size;
+    if (client->winLength > client->size) handle_bench_error("extract_bench_args: Win length larger than board size", 0);
+    if (client->discoveryTimeout > client->maxDiscoveryTimeout) handle_bench_error("extract_bench_args: Discovery timeout larger than its maximum", 0);
+    /* A version 6 game number is a single byte */
+    if (client->version == VERSION && client->numGames > MAX_CHANNELS) handle_bench_error("extract_bench_args: Too many games for protocol version 6", 0);
+    if ((client->numGroups = parse_groups(config->groupList, mcPort, client->groups)) == ERROR_CODE) handle_bench_error("extract_bench_args: Invalid multicast groups", 0);
+    if (config->killInterval > 0 && config->numServers == 0) handle_bench_error("extract_bench_args: Only servers started by the benchmark can be killed", 0);
+    /* If positional arg count correct, extract them to their respective variables */
+    if (argc - optind != NUM_ARGS) handle_bench_error("argc: Invalid number of command line arguments", 0);
+    /* Extract and validate remote port number (of the first started server) */
+    client->port = strtol(argv[optind], NULL, 10);
+    if (client->port < 1 || client->port + config->numServers - 1 != (u_int16_t)(client->port + config->numServers - 1)) handle_bench_error("extract_bench_args: Invalid port number", 0);
+    /* Extract and validate remote IP address */
+    client->address = inet_addr(argv[optind+1]);
+    if (client->address == INADDR_NONE || client->address == INADDR_ANY) handle_bench_error("remote-IP: Invalid server address", 0);
+}
+
+/**
+ * @brief Raises the limit on open socket descriptors as far as allowed, since every bot keeps
+ * a connection and a multicast socket open.
+ */
+void raise_file_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+        bench_error("raise_file_limit: getrlimit", errno, 0);
+        return;
+    }
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0) bench_error("raise_file_limit: setrlimit", errno, 0);
+}
+
+/**
+ * @brief Gets the time of a monotonic clock to measure latencies with.
+ *
+ * @return The time (in microseconds) since an arbitrary point in the past.
+ */
+uint64_t bench_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * @brief Thread entry point that plays the bot's games until the benchmark ends and the games
+ * in progress have ended. A game ends the single game connection it was played over, while the
+ * games of a multiplexed connection are started again with the same game number as they end.
+ * A bot that loses its server finds another one through the multicast group and resumes its
+ * games there.
+ *
+ * @param arg The bot to run.
+ * @return NULL once the bot has stopped.
+ */
+void *run_bot(void *arg) {
+    struct Bot *bot = (struct Bot *)arg;
+    const int numGames = bot->config->client.numGames;
+    Command_Handler commands[] = {new_game, move, game_over, resume_game};
+    bot->conn.sd = -1;
+    while (atomic_load(&benchRunning) || bot->numPlaying > 0) {
+        int slot, i;
+        uint64_t now, retryAt;
+        struct TTT_Game *game;
+        struct TCP_Buffer msg = {0};
+        if (bot->conn.sd < 0) {
+            if (connect_bot(bot) == ERROR_CODE) break;
+            continue;
+        }
+        /* With every game turned down, there is nothing to wait for but the time to start them again */
+        if ((retryAt = retry_refused_games(bot)) != 0 && bot->numPlaying == 0) {
+            if ((now = bench_time()) < retryAt) usleep(retryAt - now);
+            continue;
+        }
+        /* A server that closed the connection, answered with an invalid command, or stopped answering is lost */
+        if (get_tcp_command(&bot->conn, &msg) <= 0) {
+            lose_connection(bot);
+            continue;
+        } else if (msg.command == SERVER_FULL) {
+            turn_away(bot);
+            continue;
+        }
+        /* Route the command to the game started with its game number */
+        slot = (numGames > 1) ? msg.gameNum : 0;
+        if (slot < 0 || slot >= numGames || (game = &bot->games[slot])->conn == NULL) continue;
+        /* A full server answers a new multiplexed game with GAME_OVER before any move is made */
+        if (msg.command == GAME_OVER && game->multiplexed && !game->resuming) {
+            for (i = 0; i < game->numSquares && game->board[i] == 0; i++);
+            if (i == game->numSquares) {
+                refuse_game(bot, slot);
+                continue;
+            }
+        }
+        now = bench_time();
+        if (bot->sentAt[slot] != 0) record_latency(&bot->stats.rtt, now - bot->sentAt[slot]);
+        if (bot->lostAt != 0) {
+            record_latency(&bot->stats.reconnect, now - bot->lostAt);
+            bot->lostAt = 0;
+        }
+        /* A server that would not take a game over from its replica is sent the whole board instead */
+        if (msg.command == GAME_OVER && game->resuming && game->useReplica) {
+            game->useReplica = 0;
+            resume_bot_game(bot, slot);
+            continue;
+        }
+        commands[(int)msg.command](&msg, game);
+        if (game->conn == NULL) {
+            finish_game(bot, slot);
+        } else {
+            /* Only a move that did not end the game is answered with a move */
+            bot->sentAt[slot] = (game->winner < 0) ? now : 0;
+        }
+    }
+    /* Games still in progress were abandoned */
+    bot->stats.results[0] += bot->numPlaying;
+    if (bot->conn.sd >= 0) {
+        flush_output(&bot->conn);
+        if (close(bot->conn.sd) < 0) bench_error("run_bot: close-connection", errno, 0);
+    }
+    if (close(bot->mcd) < 0) bench_error("run_bot: close-multicast", errno, 0);
+    return NULL;
+}
+
+/**
+ * @brief Connects the bot to the server it plays on, or if it lost its server (or the server
+ * refuses the connection), to the least loaded server of the multicast group, and starts
+ * (or resumes) the bot's games over the connection.
+ *
+ * @param bot The bot to connect.
+ * @return The socket descriptor of the connection, or an error code if no server was found.
+ */
+int connect_bot(struct Bot *bot) {
+    int slot, sd = ERROR_CODE;
+    const struct Bench_Config *config = bot->config;
+    struct sockaddr_in serverAddr;
+    struct timeval timeout = {BOT_TIMEOUT, 0};
+    /* Skip a server the bot already lost, since its games are resumed from their replicas */
+    if (bot->lostAt == 0) {
+        sd = create_endpoint(&serverAddr, SOCK_STREAM, bot->serverAddr.sin_addr.s_addr, ntohs(bot->serverAddr.sin_port));
+        if (connect(sd, (struct sockaddr *)&serverAddr, sizeof(struct sockaddr_in)) < 0) {
+            bot->lostAt = bench_time();
+        }
+    }
+    if (bot->lostAt != 0 && get_new_server(bot->mcd, &config->client, &bot->discovery, &sd, &bot->serverAddr) == ERROR_CODE) {
+        bot->stats.gaveUp++;
+        return ERROR_CODE;
+    }
+    if (setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) bench_error("connect_bot: setsockopt", errno, 0);
+    init_connection(&bot->conn, sd, config->client.version);
+    /* Multiplex the connection, then start or resume every game */
+    if (config->client.numGames > 1 && send_command(&bot->conn, MULTIPLEX, 0, 0, NULL, 0) == ERROR_CODE) bench_error("connect_bot: send_multiplex", errno, 0);
+    for (slot = 0; slot < config->client.numGames; slot++) {
+        if (bot->games[slot].conn != NULL) {
+            resume_bot_game(bot, slot);
+        } else if (atomic_load(&benchRunning)) {
+            start_game(bot, slot);
+        }
+    }
+    return sd;
+}
+
+/**
+ * @brief Starts a new game of the bot over its connection.
+ *
+ * @param bot The bot playing the game.
+ * @param slot The index of the game among the bot's games (its game number if multiplexed).
+ */
+void start_game(struct Bot *bot, int slot) {
+    struct TTT_Game *game = &bot->games[slot];
+    init_game(&bot->conn, &bot->serverAddr, &bot->config->client, game);
+    game->multiplexed = (bot->config->client.numGames > 1);
+    game->gameNum = (game->multiplexed) ? slot : -1;
+    game->exitOnLeave = 0;
+    game->chooseMove = (bot->config->perfect) ? perfect_move : random_move;
+    bot->numPlaying++;
+    bot->retryAt[slot] = 0;
+    send_new_game(game);
+    /* A command that could not be sent is sent again once the lost connection is noticed */
+    game->conn = &bot->conn;
+    bot->sentAt[slot] = bench_time();
+}
+
+/**
+ * @brief Resumes a game of the bot that was in progress on the server it lost, taking it over
+ * from the replica on the server now connected to, or uploading the whole board if a server
+ * already turned the replica down. A game the lost server never answered is started again
+ * instead.
+ *
+ * @param bot The bot playing the game.
+ * @param slot The index of the game among the bot's games (its game number if multiplexed).
+ */
+void resume_bot_game(struct Bot *bot, int slot) {
+    int i;
+    struct TTT_Game *game = &bot->games[slot];
+    const struct sockaddr_in originAddr = game->serverAddr;
+    game->serverAddr = bot->serverAddr;
+    /* A multiplexed game is resumed with the game number it is routed by, whichever command was sent last */
+    if (game->multiplexed) game->gameNum = slot;
+    for (i = 0; i < game->numSquares && game->board[i] == 0; i++);
+    if (i == game->numSquares) {
+        if (!game->multiplexed) game->gameNum = -1;
+        send_new_game(game);
+    } else if (game->useReplica) {
+        send_resume_replica(game, &originAddr);
+        game->resuming = 1;
+    } else {
+        send_resume_game(game);
+        game->resuming = 1;
+    }
+    game->conn = &bot->conn;
+    bot->sentAt[slot] = bench_time();
+}
+
+/**
+ * @brief Tallies how a game of the bot ended. The connection of a single game is closed, and
+ * a multiplexed game is started again with the same game number unless the benchmark is over.
+ *
+ * @param bot The bot playing the game.
+ * @param slot The index of the game among the bot's games.
+ */
+void finish_game(struct Bot *bot, int slot) {
+    bot->stats.results[bot->games[slot].winner + 1]++;
+    bot->numPlaying--;
+    bot->sentAt[slot] = 0;
+    if (bot->config->client.numGames == 1) {
+        flush_output(&bot->conn);
+        if (close(bot->conn.sd) < 0) bench_error("finish_game: close-connection", errno, 0);
+        bot->conn.sd = -1;
+    } else if (atomic_load(&benchRunning)) {
+        start_game(bot, slot);
+    }
+}
+
+/**
+ * @brief Tallies a multiplexed game the server turned down for lack of an open game, and sets
+ * its slot aside until the bot starts it again after a short wait, so a full server is not
+ * sent NEW_GAME over and over.
+ *
+ * @param bot The bot playing the game.
+ * @param slot The index of the game among the bot's games.
+ */
+void refuse_game(struct Bot *bot, int slot) {
+    bot->stats.refused++;
+    bot->numPlaying--;
+    bot->sentAt[slot] = 0;
+    bot->games[slot].conn = NULL;
+    bot->retryAt[slot] = bench_time() + REFUSED_RETRY_DELAY * 1000;
+}
+
+/**
+ * @brief Starts the games of the bot the server turned down again once they have waited long
+ * enough. Once the benchmark is over they are not started again.
+ *
+ * @param bot The bot playing the games.
+ * @return The earliest time a game still waits to be started again, 0 if none does.
+ */
+uint64_t retry_refused_games(struct Bot *bot) {
+    int slot;
+    uint64_t now = bench_time(), next = 0;
+    for (slot = 0; slot < bot->config->client.numGames; slot++) {
+        if (bot->retryAt[slot] == 0) continue;
+        if (!atomic_load(&benchRunning)) {
+            bot->retryAt[slot] = 0;
+        } else if (bot->retryAt[slot] <= now) {
+            start_game(bot, slot);
+        } else if (next == 0 || bot->retryAt[slot] < next) {
+            next = bot->retryAt[slot];
+        }
+    }
+    return next;
+}
+
+/**
+ * @brief Closes the connection of a bot that lost its server. If games were in progress, the
+ * time is noted so the time to get an answer from another server can be measured, and games
+ * the server never answered after they were resumed are resumed with the whole board next.
+ *
+ * @param bot The bot that lost its server.
+ */
+void lose_connection(struct Bot *bot) {
+    int slot;
+    if (close(bot->conn.sd) < 0) bench_error("lose_connection: close-connection", errno, 0);
+    bot->conn.sd = -1;
+    if (bot->numPlaying == 0) return;
+    bot->stats.failovers++;
+    if (bot->lostAt == 0) bot->lostAt = bench_time();
+    for (slot = 0; slot < bot->config->client.numGames; slot++) {
+        bot->sentAt[slot] = 0;
+        /* A server closing the connection instead of answering a resumed game did not accept the replica */
+        if (bot->games[slot].resuming) bot->games[slot].useReplica = 0;
+    }
+}
+
+/**
+ * @brief Closes the connection of a bot turned away by a full server, which the bot leaves for
+ * the least loaded server of the multicast group like a server it lost. Its games were never
+ * started there, so they are started again on the next server.
+ *
+ * @param bot The bot that was turned away.
+ */
+void turn_away(struct Bot *bot) {
+    int slot;
+    if (close(bot->conn.sd) < 0) bench_error("turn_away: close-connection", errno, 0);
+    bot->conn.sd = -1;
+    bot->stats.turnedAway++;
+    if (bot->lostAt == 0) bot->lostAt = bench_time();
+    for (slot = 0; slot < bot->config->client.numGames; slot++) bot->sentAt[slot] = 0;
+}
+
+/**
+ * @brief Solves every 3x3 board state Player 2 can reach so perfect bots can look up their
+ * moves.
+ */
+void init_perfect_moves(void) {
+    struct TTT_Game game = {0};
+    memset(perfectScores, UNSOLVED, sizeof(perfectScores));
+    game.size = ROWS;
+    game.winLength = ROWS;
+    game.numSquares = GAME_SIZE;
+    solve_board(&game, 0, 0);
+}
+
+/**
+ * @brief Scores a 3x3 board state for Player 2 with both players playing perfectly, using the
+ * client's own win and draw checks, and notes Player 2's best move on it. Scores are memoized
+ * by the base 3 encoding of the board, where each square is a digit that is 0 if the square is
+ * empty, 1 for Player 1, and 2 for Player 2.
+ *
+ * @param game The board state to score (restored before returning).
+ * @param index The base 3 encoding of the board state.
+ * @param isP2Turn Whether Player 2 moves next.
+ * @return 1 if Player 2 wins, 0 if the game is a draw, and -1 if Player 1 wins.
+ */
+int solve_board(struct TTT_Game *game, int index, int isP2Turn) {
+    int square, power, score, best;
+    if (perfectScores[index] != UNSOLVED) return perfectScores[index];
+    if ((score = check_win(game))) {
+        best = (score > 0) ? -1 : 1;
+    } else if (check_draw(game)) {
+        best = 0;
+    } else {
+        /* Try every empty square, keeping the best score of the player moving */
+        best = (isP2Turn) ? -UNSOLVED : UNSOLVED;
+        for (square = 0, power = 1; square < GAME_SIZE; square++, power *= 3) {
+            if (game->board[square] != 0) continue;
+            game->board[square] = (isP2Turn) ? P2_MARK : P1_MARK;
+            score = solve_board(game, index + power * ((isP2Turn) ? 2 : 1), !isP2Turn);
+            game->board[square] = 0;
+            if ((isP2Turn) ? score > best : score < best) {
+                best = score;
+                if (isP2Turn) perfectMoves[index] = square + 1;
+            }
+        }
+    }
+    perfectScores[index] = best;
+    return best;
+}
+
+/**
+ * @brief Chooses the move of a perfect bot. The 3x3 board is played perfectly from the solved
+ * board states, while larger boards (too large to solve) take a winning square, then a square
+ * Player 1 would win with, then a random one.
+ *
+ * @param game The current game of TicTacToe being played.
+ * @return The move to make.
+ */
+int perfect_move(const struct TTT_Game *game) {
+    int i, pass;
+    struct TTT_Game board = *game;
+    if (game->size == ROWS && game->winLength == ROWS) {
+        int index = 0, power = 1;
+        for (i = 0; i < GAME_SIZE; i++, power *= 3) {
+            if (game->board[i] != 0) index += power * ((game->board[i] == P1_MARK) ? 1 : 2);
+        }
+        if (perfectMoves[index] > 0) return perfectMoves[index];
+    }
+    for (pass = 0; pass < 2; pass++) {
+        const char mark = (pass == 0) ? P2_MARK : P1_MARK;
+        for (i = 0; i < board.numSquares; i++) {
+            if (board.board[i] != 0) continue;
+            board.board[i] = mark;
+            if (check_win(&board)) return i + 1;
+            board.board[i] = 0;
+        }
+    }
+    return random_move(game);
+}
+
+/**
+ * @brief Starts a server for the benchmark at the port after the previous server's, with its
+ * messages discarded. The server joins every multicast group the bots look for servers in.
+ *
+ * @param config The benchmark configuration.
+ * @param index The index of the server (its port is the remote port plus the index).
+ * @return The process ID of the server.
+ */
+pid_t start_server(const struct Bench_Config *config, int index) {
+    pid_t pid;
+    char port[BUFFER_SIZE], games[BUFFER_SIZE], mcPort[BUFFER_SIZE];
+    snprintf(port, sizeof(port), "%d", config->client.port + index);
+    snprintf(games, sizeof(games), "%d", config->serverGames);
+    snprintf(mcPort, sizeof(mcPort), "%d", ntohs(config->client.groups[0].sin_port));
+    if ((pid = fork()) < 0) bench_error("start_server: fork", errno, 1);
+    if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+        }
+        execl(BENCH_SERVER, BENCH_SERVER, "-g", games, "-l", "error", "-G", config->groupList, "-P", mcPort, port, (char *)NULL);
+        _exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+/**
+ * @brief Stops a server started by the benchmark and waits for it to exit.
+ *
+ * @param pid The process ID of the server.
+ * @param sig The signal to stop the server with (SIGKILL to simulate a crash).
+ */
+void stop_server(pid_t pid, int sig) {
+    if (kill(pid, sig) < 0) bench_error("stop_server: kill", errno, 0);
+    if (waitpid(pid, NULL, 0) < 0) bench_error("stop_server: waitpid", errno, 0);
+}
+
+/**
+ * @brief Records a latency in a histogram.
+ *
+ * @param hist The histogram to record the latency in.
+ * @param latency The latency (in microseconds).
+ */
+void record_latency(struct Histogram *hist, uint64_t latency) {
+    hist->buckets[histogram_bucket(latency)]++;
+    hist->count++;
+    if (latency > hist->max) hist->max = latency;
+}
+
+/**
+ * @brief Finds the histogram bucket of a latency. Latencies below 4 microseconds have a bucket
+ * each, and every larger power of 2 is split into 4 buckets of equal width.
+ *
+ * @param latency The latency (in microseconds).
+ * @return The index of the bucket.
+ */
+int histogram_bucket(uint64_t latency) {
+    int octave, bucket;
+    if (latency < 4) return latency;
+    octave = 63 - __builtin_clzll(latency);
+    bucket = 4 * (octave - 1) + (int)((latency >> (octave - 2)) & 3);
+    return (bucket < HISTOGRAM_BUCKETS) ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+/**
+ * @brief Finds a percentile of the latencies recorded in a histogram, to within the width of
+ * its bucket.
+ *
+ * @param hist The histogram of latencies.
+ * @param fraction The fraction of the latencies at or below the percentile.
+ * @return The largest latency (in microseconds) of the bucket the percentile falls in, but no
+ * more than the largest latency recorded.
+ */
+uint64_t histogram_percentile(const struct Histogram *hist, double fraction) {
+    int bucket;
+    unsigned long count = 0, rank = (unsigned long)(fraction * hist->count + 0.5);
+    uint64_t bound;
+    if (rank == 0) rank = 1;
+    for (bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        if ((count += hist->buckets[bucket]) >= rank) break;
+    }
+    if (bucket < 4) {
+        bound = bucket;
+    } else {
+        int octave = bucket / 4 + 1;
+        bound = ((uint64_t)(4 + bucket % 4 + 1) << (octave - 2)) - 1;
+    }
+    /* The last bucket also holds every larger latency, and no bucket holds more than the largest */
+    return (bound < hist->max) ? bound : hist->max;
+}
+
+/**
+ * @brief Adds the latencies of one histogram to another.
+ *
+ * @param total The histogram to add the latencies to.
+ * @param hist The histogram of latencies to add.
+ */
+void merge_histogram(struct Histogram *total, const struct Histogram *hist) {
+    int bucket;
+    for (bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) total->buckets[bucket] += hist->buckets[bucket];
+    total->count += hist->count;
+    if (hist->max > total->max) total->max = hist->max;
+}
+
+/**
+ * @brief Adds the results of a bot to the results of the benchmark.
+ *
+ * @param total The results of the benchmark.
+ * @param stats The results of the bot.
+ */
+void merge_stats(struct Bench_Stats *total, const struct Bench_Stats *stats) {
+    int i;
+    for (i = 0; i < 4; i++) total->results[i] += stats->results[i];
+    total->failovers += stats->failovers;
+    total->gaveUp += stats->gaveUp;
+    total->turnedAway += stats->turnedAway;
+    total->refused += stats->refused;
+    merge_histogram(&total->rtt, &stats->rtt);
+    merge_histogram(&total->reconnect, &stats->reconnect);
+}
+
+/**
+ * @brief Prints the percentiles of the latencies recorded in a histogram.
+ *
+ * @param name The name of the latencies.
+ * @param hist The histogram of latencies.
+ * @param scale The number of microseconds in the unit printed.
+ * @param unit The unit printed.
+ */
+void print_histogram(const char *name, const struct Histogram *hist, double scale, const char *unit) {
+    if (hist->count == 0) {
+        printf("%s: no samples\n", name);
+        return;
+    }
+    printf("%s (%s): p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f (%lu samples)\n", name, unit,
+        histogram_percentile(hist, 0.5) / scale, histogram_percentile(hist, 0.9) / scale, histogram_percentile(hist, 0.99) / scale,
+        histogram_percentile(hist, 0.999) / scale, hist->max / scale, hist->count);
+}
@@ -9,71 +9,232 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <ifaddrs.h>
+#include <limits.h>
 #include <netdb.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 /**************************/
 /* ENVIRONMENT STRUCTURES */
 /**************************/
 
-/* The number of rows for the TicIacToe board. */
+/* The number of rows for the default TicIacToe board. */
 #define ROWS 3
-/* The number of columns for the TicIacToe board. */
+/* The number of columns for the default TicIacToe board. */
 #define COLUMNS 3
-/* The size (in bytes) of the game state. */
+/* The size (in bytes) of the default game state. */
 #define GAME_SIZE (ROWS * COLUMNS)
+/* The smallest number of rows and columns (and marks in a row to win) a board can have. */
+#define MIN_BOARD_SIZE 3
+/* The largest number of rows and columns a board can have. */
+#define MAX_BOARD_SIZE 8
+/* The largest number of squares a board can have. */
+#define MAX_SQUARES (MAX_BOARD_SIZE * MAX_BOARD_SIZE)
+/* The largest size (in bytes) of a version 7 frame, its header included. */
+#define MAX_FRAME_SIZE 2048
+/* The largest number of multicast groups servers are looked for in. */
+#define MAX_GROUPS 8
+/* The largest number of servers remembered from their GAME_AVAILABLE replies. */
+#define MAX_KNOWN_SERVERS 8
+/* The largest size (in bytes) of a datagram servers publish to the watch channel. */
+#define WATCH_DATAGRAM_SIZE 1400
+
+/* Structure for the load a server advertises with the GAME_AVAILABLE command. */
+struct Server_Load {
+    char version;               // version number of the load information
+    char reserved;              // unused (keeps the counts aligned)
+    uint16_t freeSlots;         // number of games available to new players (network byte order)
+    uint16_t activeGames;       // number of games being played (network byte order)
+    uint16_t pendingSearches;   // number of moves being searched for (network byte order)
+};
 
 /* Structure to send and recieve UCP player messages. */
 struct UDP_Buffer {
     char version;           // version number
     char command;           // player command
+    struct Server_Load load;    // load of the server (GAME_AVAILABLE only)
+};
+
+/* Structure for a server that answered the REQUEST_GAME command. */
+struct Server_Candidate {
+    struct sockaddr_in addr;        // address of the server
+    int hasLoad;                    // whether the server advertised its load
+    int freeSlots;                  // number of games available to new players
+    int activeGames;                // number of games being played
+    int pendingSearches;            // number of moves being searched for
+    long rtt;                       // time (in microseconds) the server took to answer
+};
+
+/* Structure for a server that answered the REQUEST_GAME command before, which is connected to directly when the client needs a new server. */
+struct Known_Server {
+    struct sockaddr_in addr;        // address of the server
+    long rtt;                       // time (in microseconds) the server last took to answer
+    time_t lastSeen;                // time the server last answered or accepted a connection
 };
 
-/* Structure to send and recieve TCP player messages. */
+/* Structure for a TCP player message, decoded from a version 6 command or a command of a version 7 frame. */
 struct TCP_Buffer {
     char version;   // version number
     char command;   // player command
-    char data;      // data for command if applicable
-    char gameNum;   // game number
+    char data;      // data for command if applicable (a move is always an ASCII digit)
+    int gameNum;    // game number (a single byte in version 6, 32 bits in version 7)
+};
+
+/* Structure for the connection to the server and the version 7 frames sent and received over it. */
+struct Connection {
+    int sd;                         // socket descriptor for connected player
+    int version;                    // protocol version spoken over the connection
+    int answered;                   // whether the server has sent a command over the connection
+    char input[MAX_FRAME_SIZE];     // the last frame (or version 6 command) received
+    int inputPos;                   // index of the next command of the input frame to take
+    int inputLength;                // number of bytes of the input frame
+    char output[MAX_FRAME_SIZE];    // frame of commands queued to be sent
+    int outputLength;               // number of bytes of the output frame (0 if nothing is queued)
 };
 
 /* Structure for each game of TicTacToe. */
 struct TTT_Game {
-    int sd;                         // socket descriptor for connected player
+    struct Connection *conn;        // connection of the connected player (NULL once a multiplexed game has ended)
     int gameNum;                    // game number
     int winner;                     // player who won, 0 if draw, -1 if game not over
-    char board[GAME_SIZE];          // TicTacToe game board state
+    int size;                       // number of rows and columns of the board
+    int winLength;                  // number of marks in a row needed to win
+    int numSquares;                 // number of squares on the board
+    char board[MAX_SQUARES];        // TicTacToe game board state (0 for an empty square)
+    struct sockaddr_in serverAddr;  // address of the server the game is being played on
+    int useReplica;                 // whether to resume the game from the replica of the server it was played on
+    int resuming;                   // whether the game was resumed and the server has not answered yet
+    int multiplexed;                // whether the game shares its connection with other games
+    int exitOnLeave;                // whether leaving the game ends the process (the single interactive game)
+    int (*chooseMove)(const struct TTT_Game *game);     // chooses Player 2's moves automatically (NULL to ask the user)
+};
+
+/* Structure for the header of a datagram a server publishes to the spectators on the watch channel. */
+struct Watch_Header {
+    char version;                   // version number
+    char command;                   // WATCH_MOVES or WATCH_SNAPSHOT
+    unsigned char count[2];         // number of records following the header (little endian)
+    unsigned char serverID[4];      // random ID of the server playing the games (little endian)
+};
+
+/* Structure for a move (or the end) of a game published to the watch channel. */
+struct Watch_Move {
+    unsigned char gameNum[4];       // game ID on the server playing the game (little endian)
+    char variant;                   // encoded board variant of the game
+    char kind;                      // WATCH_P1_MOVE, WATCH_P2_MOVE, or WATCH_GAME_END
+    unsigned char square;           // square marked (from 1), or the winner of an ended game (WATCH_ABANDONED if it was left)
+    unsigned char numMoves;         // number of squares marked once the move is made
+};
+
+/* Structure for the board of a game in a snapshot published to the watch channel. */
+struct Watch_Board {
+    unsigned char gameNum[4];       // game ID on the server playing the game (little endian)
+    char variant;                   // encoded board variant of the game
+    unsigned char numMoves;         // number of squares marked
+    char reserved[2];               // unused (keeps the bitboards aligned)
+    unsigned char p1Marks[8];       // bitboard of the squares marked by Player 1 (little endian)
+    unsigned char p2Marks[8];       // bitboard of the squares marked by Player 2 (little endian)
+};
+
+/* Structure for a game followed on the watch channel. */
+struct Watched_Game {
+    int used;                       // whether the game is being followed
+    uint32_t serverID;              // random ID of the server playing the game
+    int numMoves;                   // number of squares marked
+    struct TTT_Game game;           // the game's board (and game ID)
+};
+
+/* Structure for the client configuration provided on the command line. */
+struct Client_Config {
+    int port;                       // remote port number of the server
+    unsigned long address;          // remote IP address of the server
+    int size;                       // number of rows and columns of the board
+    int winLength;                  // number of marks in a row needed to win
+    int discoveryTimeout;           // initial time (in milliseconds) to wait for a server to answer the REQUEST_GAME command
+    int maxDiscoveryTimeout;        // largest time (in milliseconds) the wait backs off to
+    int discoveryAttempts;          // number of REQUEST_GAME commands sent before giving up
+    int numGames;                   // number of games played over one multiplexed connection (1 for a single interactive game)
+    int version;                    // protocol version spoken first (a single game falls back to version 6)
+    struct sockaddr_in groups[MAX_GROUPS];  // multicast groups asked for a server, nearest first
+    int numGroups;                  // number of multicast groups
+    struct in_addr mcInterface;     // address of the interface multicast commands are sent from (INADDR_ANY for the default route)
+    int mcTTL;                      // number of hops multicast commands are sent across
+    int mcLoop;                     // whether multicast commands are looped back to servers on the same host
+    const char *cachePath;          // path of the file the known servers are kept in between runs (NULL to keep them in memory only)
+    struct sockaddr_in watchAddr;   // multicast group and port of the watch channel
+    int watch;                      // whether to watch the games published to the watch channel instead of playing
+};
+
+/* Structure for the adaptive retransmission state and counters of the REQUEST_GAME command. */
+struct Discovery {
+    int timeout;                    // current time (in milliseconds) to wait for a server to answer
+    long srtt;                      // smoothed time (in microseconds) for the first server to answer, 0 if not measured
+    long rttvar;                    // variation (in microseconds) of the time for the first server to answer
+    int numRequests;                // number of REQUEST_GAME commands sent
+    int numRetransmits;             // number of REQUEST_GAME commands sent again after nobody answered in time
+    int numWidened;                 // number of REQUEST_GAME commands sent to a wider group after a nearer one could not help
+    int numRefused;                 // number of times every server that answered refused the connection
+    int numDirect;                  // number of times a known server was connected to without asking the multicast group
+    struct Known_Server known[MAX_KNOWN_SERVERS];   // servers that answered before, fastest first
+    int numKnown;                   // number of known servers
 };
 
 /*****************************/
 /* GENERAL PURPOSE FUNCTIONS */
 /*****************************/
 
-/* The number of command line arguments. */
-#define NUM_ARGS 3
+/* The number of positional command line arguments. */
+#define NUM_ARGS 2
 /* The maximum size of a buffer for the program. */
 #define BUFFER_SIZE 100
-/* The number of seconds spend waiting before multicast group times out. */
-#define MC_TIMEOUT 30
-/* The number of attempts before giving up on multicast group. */
-#define MC_ATTEMPTS 5
+/* The default initial number of milliseconds spent waiting for the multicast group to answer. */
+#define DEFAULT_DISCOVERY_TIMEOUT 250
+/* The default largest number of milliseconds the wait for the multicast group backs off to. */
+#define DEFAULT_MAX_DISCOVERY_TIMEOUT 8000
+/* The smallest number of milliseconds the wait for the multicast group adapts down to. */
+#define MIN_DISCOVERY_TIMEOUT 50
+/* The default number of attempts before giving up on multicast group. */
+#define MC_ATTEMPTS 8
+/* The number of milliseconds spent collecting GAME_AVAILABLE replies after the first one. */
+#define DISCOVERY_WINDOW 200
+/* The largest number of games one multiplexed version 6 connection can play (one for each game number). */
+#define MAX_CHANNELS 256
+/* The largest number of games one multiplexed version 7 connection can play. */
+#define MAX_FRAMED_CHANNELS 65536
+/* The maximum number of servers considered from one REQUEST_GAME command. */
+#define MAX_CANDIDATES 16
+/* The number of servers connected to at once, the first to accept winning. */
+#define PARALLEL_CONNECTS 4
+/* The number of seconds spent waiting for any of the servers connected to at once to accept. */
+#define CONNECT_TIMEOUT 5
+/* The number of times its answer took a known server is given to accept a direct connection. */
+#define KNOWN_CONNECT_FACTOR 4
+/* The fewest milliseconds known servers are given to accept a direct connection. */
+#define MIN_KNOWN_CONNECT_TIMEOUT 20
+/* The number of seconds a known server is remembered for after it last answered. */
+#define KNOWN_SERVER_TTL 3600
+/* The name of the file in the home directory the known servers are kept in between runs. */
+#define KNOWN_SERVERS_FILE ".tictactoe_servers"
 /* The error code used to signal an invalid move. */
 #define ERROR_CODE -1
 
 void print_error(const char *msg, int errnum, int terminate);
 void handle_init_error(const char *msg, int errnum);
-void extract_args(char *argv[], int *port, unsigned long *address);
+void extract_args(int argc, char *argv[], struct Client_Config *config);
 
 /********************************/
 /* SOCKET AND NETWORK FUNCTIONS */
@@ -81,14 +242,30 @@ void extract_args(char *argv[], int *port, unsigned long *address);
 
 /* The protocol version number used. */
 #define VERSION 6
-/* The port number for the multicast group. */
+/* The protocol version number of the framed protocol, which servers that do not speak it refuse. */
+#define FRAMED_VERSION 7
+/* The default port number for the multicast groups. */
 #define MC_PORT 1818
-/* The network IP address for the multicast group. */
+/* The default network IP address for the multicast group. */
 #define MC_GROUP "239.0.0.1"
+/* The default number of hops multicast commands are sent across (the local network only). */
+#define DEFAULT_MC_TTL 1
 
 int create_endpoint(struct sockaddr_in *socketAddr, int type, unsigned long address, int port);
-void get_new_server(int mcd, const struct sockaddr_in *groupAddr, int *sd, int resume);
-void set_timeout(int sd, int seconds);
+int parse_groups(const char *list, int port, struct sockaddr_in *groups);
+int parse_interface(const char *name, struct in_addr *addr);
+int create_multicast_endpoint(const struct Client_Config *config);
+int get_new_server(int mcd, const struct Client_Config *config, struct Discovery *discovery, int *sd, struct sockaddr_in *serverAddr);
+int collect_candidates(int mcd, struct Server_Candidate *candidates, int timeout, const struct timeval *sent, struct timeval *firstReply);
+int connect_known_server(struct Discovery *discovery, const struct Client_Config *config, int *sd, struct sockaddr_in *serverAddr);
+void remember_server(struct Discovery *discovery, const struct sockaddr_in *addr, long rtt, time_t seen);
+void forget_server(struct Discovery *discovery, const struct sockaddr_in *addr);
+void load_known_servers(struct Discovery *discovery, const char *path);
+void save_known_servers(const struct Discovery *discovery, const char *path);
+void rank_candidates(struct Server_Candidate *candidates, int numCandidates);
+int jitter(int milliseconds);
+void update_discovery_rtt(struct Discovery *discovery, const struct timeval *sent, const struct timeval *replied, const struct Client_Config *config);
+void set_blocking(int sd, int blocking);
 void print_client_info();
 
 /******************************/
@@ -100,14 +277,23 @@ void print_client_info();
 /* The baord marker used for Player 2 */
 #define P2_MARK 'O'
 
-void init_game(int sd, struct TTT_Game *game);
+void init_connection(struct Connection *conn, int sd, int version);
+void init_game(struct Connection *conn, const struct sockaddr_in *serverAddr, const struct Client_Config *config, struct TTT_Game *game);
+char encode_variant(const struct TTT_Game *game);
+void pack_board(const struct TTT_Game *game, unsigned char *packed);
 int get_udp_command(int sd, struct sockaddr_in *playerAddr, struct UDP_Buffer *datagram);
 void send_request_game(int mcd, const struct sockaddr_in *groupAddr);
-int get_tcp_command(int sd, struct TCP_Buffer *msg);
+int recv_bytes(int sd, char *buffer, int length);
+int get_tcp_command(struct Connection *conn, struct TCP_Buffer *msg);
+int send_command(struct Connection *conn, char command, char data, int gameNum, const char *trailing, int trailingLength);
+int flush_output(struct Connection *conn);
 void send_new_game(struct TTT_Game *game);
 void send_game_over(struct TTT_Game *game);
 void send_resume_game(struct TTT_Game *game);
+void send_resume_replica(struct TTT_Game *game, const struct sockaddr_in *originAddr);
+void send_multiplex(struct Connection *conn);
 int get_move(const struct TTT_Game *game);
+int random_move(const struct TTT_Game *game);
 int validate_move(int choice, const struct TTT_Game *game);
 int send_p2_move(const struct TTT_Game *game);
 int check_win(const struct TTT_Game *game);
@@ -115,7 +301,42 @@ int check_draw(const struct TTT_Game *game);
 int check_game_over(struct TTT_Game *game);
 void print_board(const struct TTT_Game *game);
 void leave_game(struct TTT_Game *game);
-void tictactoe(int mcd, const struct sockaddr_in *groupAddr, int sd);
+void tictactoe(int mcd, int sd, const struct sockaddr_in *serverAddr, const struct Client_Config *config, struct Discovery *discovery);
+void tictactoe_multiplexed(int sd, const struct sockaddr_in *serverAddr, const struct Client_Config *config);
+
+/***********************/
+/* SPECTATOR FUNCTIONS */
+/***********************/
+
+/* The default port number of the watch channel. */
+#define WATCH_PORT 1819
+/* The version number of the datagrams published to the watch channel. */
+#define WATCH_VERSION 1
+/* The size (in bytes) of the header of a datagram published to the watch channel. */
+#define WATCH_HEADER_SIZE sizeof(struct Watch_Header)
+/* The number of games followed at once (must be a power of 2). */
+#define WATCH_TABLE_SIZE 4096
+/* The kind of a published move made by Player 1. */
+#define WATCH_P1_MOVE 1
+/* The kind of a published move made by Player 2. */
+#define WATCH_P2_MOVE 2
+/* The kind of a published end of a game. */
+#define WATCH_GAME_END 3
+/* The winner published for a game that was left before it was over. */
+#define WATCH_ABANDONED 0xFF
+/* The UDP command from a server to the watch channel with the moves made in its games. */
+#define WATCH_MOVES 0x0A
+/* The UDP command from a server to the watch channel with the boards of the games it is playing. */
+#define WATCH_SNAPSHOT 0x0B
+
+int parse_channel(const char *arg, struct sockaddr_in *addr);
+int create_watch_endpoint(const struct Client_Config *config);
+uint64_t unpack_bytes(const unsigned char *src, int length);
+int decode_watch_variant(char variant, struct TTT_Game *game);
+struct Watched_Game *find_watched_game(struct Watched_Game *table, uint32_t serverID, int gameNum);
+void watch_move(struct Watched_Game *table, uint32_t serverID, const struct Watch_Move *record);
+void watch_board(struct Watched_Game *table, uint32_t serverID, const struct Watch_Board *record);
+void watch_games(const struct Client_Config *config);
 
 /*******************/
 /* PLAYER COMMANDS */
@@ -123,8 +344,22 @@ void tictactoe(int mcd, const struct sockaddr_in *groupAddr, int sd);
 
 /* The size (in bytes) of each UDP game command. */
 #define UDP_CMD_SIZE 2
+/* The size (in bytes) of the GAME_AVAILABLE command with the server's load. */
+#define GAME_AVAILABLE_SIZE (UDP_CMD_SIZE + sizeof(struct Server_Load))
+/* The version number of the load information sent with the GAME_AVAILABLE command. */
+#define LOAD_VERSION 1
 /* The size (in bytes) of each TCP game command. */
 #define TCP_CMD_SIZE 4
+/* The size (in bytes) of the header of a version 7 frame (version, flags, and length of the commands). */
+#define FRAME_HEADER_SIZE 4
+/* The size (in bytes) of each command of a version 7 frame (command, data, and 32-bit game number). */
+#define FRAMED_CMD_SIZE 6
+/* The number of bytes of a packed bitboard for a board with the given number of squares. */
+#define MASK_BYTES(numSquares) (((numSquares) + 7) / 8)
+/* The size (in bytes) of the packed board following the version 7 RESUME_GAME command (both packed bitboards). */
+#define PACKED_BOARD_SIZE(numSquares) (2 * MASK_BYTES(numSquares))
+/* The size (in bytes) of the ticket following the RESUME_REPLICA command (origin port and both packed bitboards). */
+#define RESUME_TICKET_SIZE(numSquares) (2 + PACKED_BOARD_SIZE(numSquares))
 
 /* Function pointer type for function to handle player commands. */
 typedef void (*Command_Handler)(const struct TCP_Buffer *msg, struct TTT_Game *game);
@@ -136,6 +371,12 @@ typedef void (*Command_Handler)(const struct TCP_Buffer *msg, struct TTT_Game *g
 #define GAME_OVER 0x02
 /* The TCP command to resume a previously started game. */
 #define RESUME_GAME 0x03
+/* The TCP command to resume a game replicated from the server it was being played on. */
+#define RESUME_REPLICA 0x07
+/* The TCP command to play a game for every game number over the connection. */
+#define MULTIPLEX 0x08
+/* The TCP command from a server that has no game for the client, which should find another server. */
+#define SERVER_FULL 0x09
 
 /* The UDP command for a client to request an open game from the multicast group. */
 #define REQUEST_GAME 0x04
@@ -146,7 +387,7 @@ void new_game(const struct TCP_Buffer *msg, struct TTT_Game *game);
 void move(const struct TCP_Buffer *msg, struct TTT_Game *game);
 void game_over(const struct TCP_Buffer *msg, struct TTT_Game *game);
 void resume_game(const struct TCP_Buffer *msg, struct TTT_Game *game);
-void game_available(int mcd, const struct sockaddr_in *groupAddr, int *sd, struct sockaddr_in *serverAddr);
+int game_available(int *sd, const struct Server_Candidate *candidates, int numCandidates, int timeout);
 
 /**
  * @brief This program creates and sets up a TicTacToe client which acts as Player 2 in a
@@ -169,38 +410,43 @@ void game_available(int mcd, const struct sockaddr_in *groupAddr, int *sd, struc
  * implicit call to exit(). The values zero and EXIT_SUCCESS indicate successful termination,
  * the value EXIT_FAILURE indicates unsuccessful termination.
  */
+#ifndef TTT_NO_MAIN
 int main(int argc, char *argv[]) {
-    int mcd, sd, portNumber;
-    unsigned long serverNetAddr;
-    struct sockaddr_in multicastAddr, serverAddr;
+    int mcd, sd = -1, i;
+    struct Server_Candidate server = {0};
+    struct Client_Config config;
+    static struct Discovery discovery;
 
-    /* If arg count correct, extract arguments to their respective variables */
-    if (argc != NUM_ARGS) handle_init_error("argc: Invalid number of command line arguments", 0);
-    extract_args(argv, &portNumber, &serverNetAddr);
+    /* Extract arguments to their respective variables */
+    extract_args(argc, argv, &config);
+    srand(time(NULL) ^ getpid());
+    /* Follow the games published to the watch channel instead of playing one */
+    if (config.watch) watch_games(&config);
 
     /* Print client information  */
     print_client_info();
 
-    /* Create multicast socket and set timeout for multicast group */
-    mcd = create_endpoint(&multicastAddr, SOCK_DGRAM, inet_addr(MC_GROUP), MC_PORT);
-    printf("Communication endpoint for multicast group at %s (port %hu)\n", inet_ntoa(multicastAddr.sin_addr), multicastAddr.sin_port);
-    set_timeout(mcd, MC_TIMEOUT);
-
-    /* Create server socket to connect to */
-    sd = create_endpoint(&serverAddr, SOCK_STREAM, serverNetAddr, portNumber);
-    /* Find server to connect to if initial server fails */
-    printf("Attempting to connect to server...\n");
-    if (connect(sd, (struct sockaddr *)&serverAddr, sizeof(struct sockaddr_in)) != -1) {
-        printf("Connected to server at %s (port %hu)\n", inet_ntoa(serverAddr.sin_addr), serverAddr.sin_port);
-    } else {
-        print_error("connect", errno, 0);
-        get_new_server(mcd, &multicastAddr, &sd, 0);
+    /* Create multicast socket (answers are waited for with adaptive timeouts) */
+    mcd = create_multicast_endpoint(&config);
+    for (i = 0; i < config.numGroups; i++) {
+        printf("Communication endpoint for multicast group at %s (port %hu)\n", inet_ntoa(config.groups[i].sin_addr), config.groups[i].sin_port);
     }
-    /* Start the game of TicTacToe */
-    tictactoe(mcd, &multicastAddr, sd);
+
+    /* Connect to the server, or find another one (a known one first) if it fails */
+    if (config.cachePath) load_known_servers(&discovery, config.cachePath);
+    server.addr.sin_family = AF_INET;
+    server.addr.sin_addr.s_addr = config.address;
+    server.addr.sin_port = htons(config.port);
+    if (game_available(&sd, &server, 1, CONNECT_TIMEOUT * 1000) == ERROR_CODE) {
+        if (get_new_server(mcd, &config, &discovery, &sd, &server.addr) == ERROR_CODE) exit(EXIT_FAILURE);
+    }
+    /* Start the game of TicTacToe (or all the games multiplexed over the connection) */
+    if (config.numGames > 1) tictactoe_multiplexed(sd, &server.addr, &config);
+    tictactoe(mcd, sd, &server.addr, &config, &discovery);
 
     return 0;
 }
+#endif
 
 /**
  * @brief Prints the provided error message and corresponding errno message (if present) and
@@ -230,7 +476,8 @@ void print_error(const char *msg, int errnum, int terminate) {
  */
 void handle_init_error(const char *msg, int errnum) {
     print_error(msg, errnum, 0);
-    printf("Usage is: tictactoeClient <remote-port> <remote-IP>\n");
+    printf("Usage is: tictactoeClient [-s board-size] [-k win-length] [-t discovery-ms] [-T max-discovery-ms] [-a attempts] [-g games] [-p protocol-version] [-G group[,group...]] [-P multicast-port] [-i interface] [-L ttl] [-x] [-C cache-file] <remote-port> <remote-IP>\n");
+    printf("      or: tictactoeClient -W group[:port] [-i interface]\n");
     /* Exits the process signaling unsuccessful termination */
     exit(EXIT_FAILURE);
 }
@@ -239,21 +486,111 @@ void handle_init_error(const char *msg, int errnum) {
  * @brief Extracts the user provided arguments to their respective local variables and performs
  * validation on their formatting. If any errors are found, the function terminates the process.
  * 
+ * @param argc The number of arguments passed to the program.
  * @param argv Pointer to the first element of an array of argc + 1 pointers, of which the
  * last one is NULL and the previous ones, if any, point to strings that represent the
  * arguments passed to the program from the host environment. If argv[0] is not a NULL
  * pointer (or, equivalently, if argc > 0), it points to a string that represents the program
  * name, which is empty if the program name is not available from the host environment.
- * @param port The remote port number that the client will communicate on
- * @param address The remote IP address of the server
+ * @param config The client configuration to fill in from the arguments.
  */
-void extract_args(char *argv[], int *port, unsigned long *address) {
+void extract_args(int argc, char *argv[], struct Client_Config *config) {
+    int opt, mcPort = MC_PORT;
+    const char *groupList = MC_GROUP;
+    /* Set the defaults for the optional arguments */
+    config->size = ROWS;
+    config->winLength = 0;
+    config->discoveryTimeout = DEFAULT_DISCOVERY_TIMEOUT;
+    config->maxDiscoveryTimeout = DEFAULT_MAX_DISCOVERY_TIMEOUT;
+    config->discoveryAttempts = MC_ATTEMPTS;
+    config->numGames = 1;
+    config->version = FRAMED_VERSION;
+    config->mcInterface.s_addr = htonl(INADDR_ANY);
+    config->mcTTL = DEFAULT_MC_TTL;
+    config->mcLoop = 1;
+    config->cachePath = NULL;
+    config->watch = 0;
+    if (getenv("HOME")) {
+        static char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", getenv("HOME"), KNOWN_SERVERS_FILE);
+        config->cachePath = path;
+    }
+    /* Extract and validate the optional arguments */
+    while ((opt = getopt(argc, argv, "s:k:t:T:a:g:p:G:P:i:L:xC:W:")) != -1) {
+        switch (opt) {
+            case 's':
+                config->size = strtol(optarg, NULL, 10);
+                if (config->size < MIN_BOARD_SIZE || config->size > MAX_BOARD_SIZE) handle_init_error("extract_args: Invalid board size", 0);
+                break;
+            case 'k':
+                config->winLength = strtol(optarg, NULL, 10);
+                if (config->winLength < MIN_BOARD_SIZE || config->winLength > MAX_BOARD_SIZE) handle_init_error("extract_args: Invalid win length", 0);
+                break;
+            case 't':
+                config->discoveryTimeout = strtol(optarg, NULL, 10);
+                if (config->discoveryTimeout < 1) handle_init_error("extract_args: Invalid discovery timeout", 0);
+                break;
+            case 'T':
+                config->maxDiscoveryTimeout = strtol(optarg, NULL, 10);
+                if (config->maxDiscoveryTimeout < 1) handle_init_error("extract_args: Invalid maximum discovery timeout", 0);
+                break;
+            case 'a':
+                config->discoveryAttempts = strtol(optarg, NULL, 10);
+                if (config->discoveryAttempts < 1) handle_init_error("extract_args: Invalid number of discovery attempts", 0);
+                break;
+            case 'g':
+                config->numGames = strtol(optarg, NULL, 10);
+                if (config->numGames < 1 || config->numGames > MAX_FRAMED_CHANNELS) handle_init_error("extract_args: Invalid number of games", 0);
+                break;
+            case 'p':
+                config->version = strtol(optarg, NULL, 10);
+                if (config->version != VERSION && config->version != FRAMED_VERSION) handle_init_error("extract_args: Protocol version not supported", 0);
+                break;
+            case 'G':
+                groupList = optarg;
+                break;
+            case 'P':
+                mcPort = strtol(optarg, NULL, 10);
+                if (mcPort < 1 || mcPort != (u_int16_t)mcPort) handle_init_error("extract_args: Invalid multicast port number", 0);
+                break;
+            case 'i':
+                if (parse_interface(optarg, &config->mcInterface) == ERROR_CODE) handle_init_error("extract_args: Invalid multicast interface", 0);
+                break;
+            case 'L':
+                config->mcTTL = strtol(optarg, NULL, 10);
+                if (config->mcTTL < 0 || config->mcTTL > 255) handle_init_error("extract_args: Invalid multicast TTL", 0);
+                break;
+            case 'x':
+                config->mcLoop = 0;
+                break;
+            case 'C':
+                config->cachePath = (*optarg) ? optarg : NULL;
+                break;
+            case 'W':
+                if (parse_channel(optarg, &config->watchAddr) == ERROR_CODE) handle_init_error("extract_args: Invalid watch channel", 0);
+                config->watch = 1;
+                break;
+            default:
+                handle_init_error("extract_args: Invalid option", 0);
+        }
+    }
+    /* The number of marks in a row needed to win defaults to the board size */
+    if (config->winLength == 0) config->winLength = config->size;
+    if (config->winLength > config->size) handle_init_error("extract_args: Win length larger than board size", 0);
+    if (config->discoveryTimeout > config->maxDiscoveryTimeout) handle_init_error("extract_args: Discovery timeout larger than its maximum", 0);
+    /* A version 6 game number is a single byte */
+    if (config->version == VERSION && config->numGames > MAX_CHANNELS) handle_init_error("extract_args: Too many games for protocol version 6", 0);
+    if ((config->numGroups = parse_groups(groupList, mcPort, config->groups)) == ERROR_CODE) handle_init_error("extract_args: Invalid multicast groups", 0);
+    /* Spectators need no server to play on */
+    if (config->watch && argc == optind) return;
+    /* If positional arg count correct, extract them to their respective variables */
+    if (argc - optind != NUM_ARGS) handle_init_error("argc: Invalid number of command line arguments", 0);
     /* Extract and validate remote port number */
-    *port = strtol(argv[1], NULL, 10);
-    if (*port < 1 || *port != (u_int16_t)(*port)) handle_init_error("extract_args: Invalid port number", 0);
+    config->port = strtol(argv[optind], NULL, 10);
+    if (config->port < 1 || config->port != (u_int16_t)(config->port)) handle_init_error("extract_args: Invalid port number", 0);
     /* Extract and validate remote IP address */
-	*address = inet_addr(argv[2]);
-	if (*address == INADDR_NONE || *address == INADDR_ANY) handle_init_error("remote-IP: Invalid server address", 0);
+	config->address = inet_addr(argv[optind+1]);
+	if (config->address == INADDR_NONE || config->address == INADDR_ANY) handle_init_error("remote-IP: Invalid server address", 0);
 }
 
 /**
@@ -292,94 +629,567 @@ int create_endpoint(struct sockaddr_in *socketAddr, int type, unsigned long addr
 }
 
 /**
- * @brief Messages the multicast server group for a new server that is available for the
- * client to connect to.
+ * @brief Parses a comma-separated list of multicast group addresses, nearest group first.
  * 
- * @param mcd The socket descriptor of the multicast group.
- * @param groupAddr The address of the multicast group.
+ * @param list The list of multicast group addresses.
+ * @param port The port number of the multicast groups.
+ * @param groups The socket address structures of the multicast groups.
+ * @return The number of multicast groups, or an error code if an address is not a multicast
+ * address or there are too many of them.
+ */
+int parse_groups(const char *list, int port, struct sockaddr_in *groups) {
+    int numGroups = 0;
+    while (*list) {
+        char address[INET_ADDRSTRLEN];
+        int length = strcspn(list, ",");
+        if (numGroups == MAX_GROUPS || length == 0 || length >= INET_ADDRSTRLEN) return ERROR_CODE;
+        memcpy(address, list, length);
+        address[length] = '\0';
+        bzero(&groups[numGroups], sizeof(struct sockaddr_in));
+        groups[numGroups].sin_family = AF_INET;
+        groups[numGroups].sin_port = htons(port);
+        if (inet_pton(AF_INET, address, &groups[numGroups].sin_addr) != 1 || !IN_MULTICAST(ntohl(groups[numGroups].sin_addr.s_addr))) return ERROR_CODE;
+        numGroups++;
+        list += length;
+        if (*list == ',') list++;
+    }
+    return (numGroups > 0) ? numGroups : ERROR_CODE;
+}
+
+/**
+ * @brief Finds the IPv4 address of a network interface, given either its name (e.g. eth1) or
+ * the address itself.
+ * 
+ * @param name The name or IPv4 address of the interface.
+ * @param addr The IPv4 address of the interface.
+ * @return 0 if the interface was found, otherwise an error code.
+ */
+int parse_interface(const char *name, struct in_addr *addr) {
+    struct ifaddrs *interfaces, *ifa;
+    int rv = ERROR_CODE;
+    if (inet_pton(AF_INET, name, addr) == 1) return 0;
+    if (getifaddrs(&interfaces) < 0) {
+        print_error("parse_interface: getifaddrs", errno, 0);
+        return ERROR_CODE;
+    }
+    for (ifa = interfaces; ifa; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_INET && strcmp(ifa->ifa_name, name) == 0) {
+            *addr = ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
+            rv = 0;
+            break;
+        }
+    }
+    freeifaddrs(interfaces);
+    return rv;
+}
+
+/**
+ * @brief Creates the socket REQUEST_GAME commands are sent to the multicast groups from, sent
+ * out of the configured interface with the configured TTL. If the socket can't be created, the
+ * function terminates the process.
+ * 
+ * @param config The client configuration with the multicast options.
+ * @return The socket descriptor of the multicast groups.
+ */
+int create_multicast_endpoint(const struct Client_Config *config) {
+    int mcd;
+    unsigned char ttl = config->mcTTL, loop = config->mcLoop;
+    if ((mcd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) print_error("create_multicast_endpoint: socket", errno, 1);
+    if (setsockopt(mcd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) {
+        print_error("create_multicast_endpoint: setsockopt-ttl", errno, 0);
+    }
+    if (setsockopt(mcd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) {
+        print_error("create_multicast_endpoint: setsockopt-loop", errno, 0);
+    }
+    if (config->mcInterface.s_addr != htonl(INADDR_ANY) && setsockopt(mcd, IPPROTO_IP, IP_MULTICAST_IF, &config->mcInterface, sizeof(struct in_addr)) < 0) {
+        print_error("create_multicast_endpoint: setsockopt-interface", errno, 0);
+    }
+    printf("[+]DGRAM socket created successfully.\n");
+    return mcd;
+}
+
+/**
+ * @brief Finds a new server that is available for the client to connect to. The servers that
+ * answered before are connected to directly first, and the multicast server group is only
+ * messaged if none of them accepts in a few times its usual answer time. Every server that
+ * answers within a short window is a candidate, and the client connects to the least loaded
+ * one that accepts the connection. The nearest group is asked first, and the next wider group
+ * is asked right away if nobody in it answers in time or every server that answered refused.
+ * The REQUEST_GAME command is sent again to the widest group if nobody answers in time,
+ * waiting twice as long each time, and the wait adapts to how quickly servers have answered
+ * before. Every wait is randomized so that clients who lost the same server do not all ask
+ * again at the same time.
+ * 
+ * @param mcd The socket descriptor of the multicast groups.
+ * @param config The client configuration with the discovery timeouts.
+ * @param discovery The retransmission state of the REQUEST_GAME command, kept between calls.
  * @param sd The socket descriptor of the server comminication endpoint.
- * @param resume Whether or not a game is being resumed or started.
+ * @param serverAddr The address of the server left (which is forgotten), then of the server
+ * connected to.
+ * @return The socket descriptor of the server connected to, or an error code if no server
+ * could be found in the configured number of attempts.
  */
-void get_new_server(int mcd, const struct sockaddr_in *groupAddr, int *sd, int resume) {
-    int rv;
-    struct sockaddr_in clientAddress;
-    struct UDP_Buffer datagram = {0};
+int get_new_server(int mcd, const struct Client_Config *config, struct Discovery *discovery, int *sd, struct sockaddr_in *serverAddr) {
+    int attempts = 0, retransmitted = 0, group = 0;
+    struct Server_Candidate candidates[MAX_CANDIDATES];
 
+    if (discovery->timeout == 0) discovery->timeout = config->discoveryTimeout;
     /* Closes the previous server connection if it was still open */
-    if (sd >= 0) {
+    if (*sd >= 0) {
         if (close(*sd) < 0) print_error("leave_game: close-connection", errno, 0);
+        *sd = -1;
+    }
+    /* The server left is gone or full, so try the other servers that answered before */
+    forget_server(discovery, serverAddr);
+    if (connect_known_server(discovery, config, sd, serverAddr) >= 0) {
+        if (config->cachePath) save_known_servers(discovery, config->cachePath);
+        return *sd;
     }
-    /* Message server group for new server to connect to */
-    send_request_game(mcd, groupAddr);
-    while ((rv = get_udp_command(mcd, &clientAddress, &datagram)) <= 0) {
-        if (rv == 0) exit(0);
-    }
-    /* Process received command */
-    switch (datagram.command) {
-        case REQUEST_GAME:
-            print_error("tictactoe: handling of UDP command GAME_AVAILABLE unsupporded by server", 0, 0);
-        case GAME_AVAILABLE:
-            game_available(mcd, groupAddr, sd, &clientAddress);
+    while (1) {
+        int winner, numCandidates, wait = jitter(discovery->timeout);
+        struct timeval sent, replied;
+        /* Message server group for new server to connect to */
+        send_request_game(mcd, &config->groups[group]);
+        gettimeofday(&sent, NULL);
+        discovery->numRequests++;
+        if ((numCandidates = collect_candidates(mcd, candidates, wait, &sent, &replied)) == 0) {
+            /* Nobody nearby answered in time -> ask the next wider group (a late reply can't be timed) */
+            if (group + 1 < config->numGroups) {
+                group++;
+                discovery->numWidened++;
+                retransmitted = 1;
+                printf("Nobody responded within %d ms. Asking the multicast group at %s\n", wait, inet_ntoa(config->groups[group].sin_addr));
+                continue;
+            }
+            /* Nobody answered in time -> back off and ask again */
+            if (++attempts >= config->discoveryAttempts) {
+                print_error("get_new_server: Nobody has responded. Leaving game", 0, 0);
+                return ERROR_CODE;
+            }
+            discovery->timeout = (2 * discovery->timeout < config->maxDiscoveryTimeout) ? 2 * discovery->timeout : config->maxDiscoveryTimeout;
+            discovery->numRetransmits++;
+            retransmitted = 1;
+            printf("Nobody responded within %d ms. Waiting up to %d ms for the next attempt\n", wait, discovery->timeout);
+            continue;
+        }
+        /* Only a reply to a command that was not sent again shows how long answering takes */
+        if (!retransmitted) update_discovery_rtt(discovery, &sent, &replied, config);
+        /* Remember every server that answered, then try them from least to most loaded */
+        for (winner = 0; winner < numCandidates; winner++) {
+            if (!retransmitted) remember_server(discovery, &candidates[winner].addr, candidates[winner].rtt, time(NULL));
+        }
+        rank_candidates(candidates, numCandidates);
+        if ((winner = game_available(sd, candidates, numCandidates, CONNECT_TIMEOUT * 1000)) >= 0) {
+            *serverAddr = candidates[winner].addr;
+            printf("Discovery: %d request(s), %d retransmission(s), %d widened, %d refused, %d direct, smoothed RTT %.2f ms, timeout %d ms\n",
+                discovery->numRequests, discovery->numRetransmits, discovery->numWidened, discovery->numRefused, discovery->numDirect, discovery->srtt / 1000.0, discovery->timeout);
+            if (config->cachePath) save_known_servers(discovery, config->cachePath);
+            return *sd;
+        }
+        /* Every server nearby refused -> ask the next wider group */
+        discovery->numRefused++;
+        if (group + 1 < config->numGroups) {
+            group++;
+            discovery->numWidened++;
+            retransmitted = 0;
+            printf("Every server that responded refused. Asking the multicast group at %s\n", inet_ntoa(config->groups[group].sin_addr));
+            continue;
+        }
+        /* Give the servers that refused a moment before asking again */
+        if (++attempts >= config->discoveryAttempts) {
+            print_error("get_new_server: Maximum attempts to connect to new server exceeded", 0, 0);
+            return ERROR_CODE;
+        }
+        usleep(jitter(discovery->timeout) * 1000);
+        retransmitted = 0;
+    }
+}
+
+/**
+ * @brief Collects the GAME_AVAILABLE replies to the REQUEST_GAME command. Waits for the first
+ * reply until the given timeout, then keeps collecting replies for a short window so every
+ * server that answers can be considered.
+ * 
+ * @param mcd The socket descriptor of the multicast group.
+ * @param candidates The servers that replied.
+ * @param timeout The number of milliseconds to wait for the first reply.
+ * @param sent The time the REQUEST_GAME command was sent.
+ * @param firstReply The time the first reply arrived.
+ * @return The number of servers that replied (0 if nobody replied in time).
+ */
+int collect_candidates(int mcd, struct Server_Candidate *candidates, int timeout, const struct timeval *sent, struct timeval *firstReply) {
+    int rv, numCandidates = 0;
+    struct timeval deadline, now, wait = {timeout / 1000, (timeout % 1000) * 1000};
+    gettimeofday(&now, NULL);
+    timeradd(&now, &wait, &deadline);
+    while (numCandidates < MAX_CANDIDATES) {
+        int i;
+        fd_set readFDS;
+        struct timeval remaining;
+        struct sockaddr_in serverAddr;
+        struct UDP_Buffer datagram = {0};
+        struct Server_Candidate *candidate = &candidates[numCandidates];
+        /* Only wait for what is left of the timeout (or of the window after the first reply) */
+        gettimeofday(&now, NULL);
+        timersub(&deadline, &now, &remaining);
+        if (remaining.tv_sec < 0) break;
+        FD_ZERO(&readFDS);
+        FD_SET(mcd, &readFDS);
+        if ((rv = select(mcd + 1, &readFDS, NULL, NULL, &remaining)) < 0 && errno == EINTR) continue;
+        if (rv <= 0) break;
+        if ((rv = get_udp_command(mcd, &serverAddr, &datagram)) == 0) {
             break;
+        } else if (rv < 0) {
+            continue;
+        } else if (datagram.command != GAME_AVAILABLE) {
+            print_error("collect_candidates: handling of UDP command REQUEST_GAME unsupporded by client", 0, 0);
+            continue;
+        }
+        /* Ignore repeated replies from the same server */
+        for (i = 0; i < numCandidates; i++) {
+            if (candidates[i].addr.sin_addr.s_addr == serverAddr.sin_addr.s_addr && candidates[i].addr.sin_port == serverAddr.sin_port) break;
+        }
+        if (i < numCandidates) continue;
+        /* Servers from before the load was advertised only send the command */
+        candidate->addr = serverAddr;
+        candidate->hasLoad = (rv >= (int)GAME_AVAILABLE_SIZE && datagram.load.version == LOAD_VERSION);
+        candidate->freeSlots = (candidate->hasLoad) ? ntohs(datagram.load.freeSlots) : 0;
+        candidate->activeGames = (candidate->hasLoad) ? ntohs(datagram.load.activeGames) : 0;
+        candidate->pendingSearches = (candidate->hasLoad) ? ntohs(datagram.load.pendingSearches) : 0;
+        gettimeofday(&now, NULL);
+        candidate->rtt = (now.tv_sec - sent->tv_sec) * 1000000L + (now.tv_usec - sent->tv_usec);
+        printf("Server at %s (port %hu) issued a GAME_AVAILABLE command", inet_ntoa(serverAddr.sin_addr), serverAddr.sin_port);
+        if (candidate->hasLoad) {
+            printf(" (%d free, %d active, %d searching)", candidate->freeSlots, candidate->activeGames, candidate->pendingSearches);
+        }
+        printf("\n");
+        /* Start the collection window once the first server replies */
+        if (numCandidates++ == 0) {
+            struct timeval window = {0, DISCOVERY_WINDOW * 1000};
+            gettimeofday(firstReply, NULL);
+            timeradd(firstReply, &window, &deadline);
+        }
     }
+    return numCandidates;
 }
 
 /**
- * @brief Sets the time to wait before a timeout on recvfrom calls to the specified number
- * of seconds, or turns it off if zero seconds was entered.
+ * @brief Connects to the servers that answered the REQUEST_GAME command before, fastest first
+ * and a few at a time, without asking the multicast group. The servers are given a few times
+ * as long as the slowest of them took to answer to accept (at most the first wait for the
+ * multicast group), and are all forgotten if none of them accepts.
  * 
- * @param sd The socket descriptor of the comminication endpoint.
- * @param seconds The number of seconds to wait before a timeout.
+ * @param discovery The retransmission state of the REQUEST_GAME command with the known servers.
+ * @param config The client configuration with the discovery timeouts.
+ * @param sd The socket descriptor of the server comminication endpoint.
+ * @param serverAddr The address of the server connected to.
+ * @return The socket descriptor of the server connected to, or an error code if no known
+ * server accepted the connection.
+ */
+int connect_known_server(struct Discovery *discovery, const struct Client_Config *config, int *sd, struct sockaddr_in *serverAddr) {
+    int i, winner, timeout = MIN_KNOWN_CONNECT_TIMEOUT;
+    time_t now = time(NULL);
+    struct Server_Candidate candidates[MAX_KNOWN_SERVERS];
+    /* Forget the servers that have not answered for too long */
+    for (i = discovery->numKnown - 1; i >= 0; i--) {
+        if (now - discovery->known[i].lastSeen > KNOWN_SERVER_TTL) forget_server(discovery, &discovery->known[i].addr);
+    }
+    if (discovery->numKnown == 0) return ERROR_CODE;
+    bzero(candidates, sizeof(candidates));
+    for (i = 0; i < discovery->numKnown; i++) {
+        candidates[i].addr = discovery->known[i].addr;
+        if (KNOWN_CONNECT_FACTOR * discovery->known[i].rtt / 1000 > timeout) timeout = KNOWN_CONNECT_FACTOR * discovery->known[i].rtt / 1000;
+    }
+    if (timeout > config->discoveryTimeout) timeout = config->discoveryTimeout;
+    printf("[+]Connecting to %d known server(s) for up to %d ms each.\n", discovery->numKnown, timeout);
+    if ((winner = game_available(sd, candidates, discovery->numKnown, timeout)) == ERROR_CODE) {
+        discovery->numKnown = 0;
+        return ERROR_CODE;
+    }
+    *serverAddr = candidates[winner].addr;
+    discovery->known[winner].lastSeen = now;
+    discovery->numDirect++;
+    printf("Discovery: %d direct connection(s) to known servers, %d request(s)\n", discovery->numDirect, discovery->numRequests);
+    return *sd;
+}
+
+/**
+ * @brief Remembers a server that answered the REQUEST_GAME command, keeping the known servers
+ * from fastest to slowest. If every slot is taken, the slowest server is forgotten (unless the
+ * new one is slower still).
+ * 
+ * @param discovery The retransmission state of the REQUEST_GAME command with the known servers.
+ * @param addr The address of the server.
+ * @param rtt The time (in microseconds) the server took to answer.
+ * @param seen The time the server answered.
  */
-void set_timeout(int sd, int seconds) {
-    struct timeval time = {0};
-    time.tv_sec = seconds;
+void remember_server(struct Discovery *discovery, const struct sockaddr_in *addr, long rtt, time_t seen) {
+    int i;
+    forget_server(discovery, addr);
+    if (discovery->numKnown == MAX_KNOWN_SERVERS) {
+        if (rtt >= discovery->known[MAX_KNOWN_SERVERS - 1].rtt) return;
+        discovery->numKnown--;
+    }
+    for (i = discovery->numKnown; i > 0 && discovery->known[i-1].rtt > rtt; i--) discovery->known[i] = discovery->known[i-1];
+    discovery->known[i].addr = *addr;
+    discovery->known[i].rtt = rtt;
+    discovery->known[i].lastSeen = seen;
+    discovery->numKnown++;
+}
 
-    /* Sets the recvfrom timeout option */
-    if (setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &time, sizeof(time)) < 0) {
-        print_error("set_timeout", errno, 0);
+/**
+ * @brief Forgets a known server (if it is known), since it went away or had no game.
+ * 
+ * @param discovery The retransmission state of the REQUEST_GAME command with the known servers.
+ * @param addr The address of the server.
+ */
+void forget_server(struct Discovery *discovery, const struct sockaddr_in *addr) {
+    int i;
+    for (i = 0; i < discovery->numKnown; i++) {
+        if (discovery->known[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr && discovery->known[i].addr.sin_port == addr->sin_port) break;
     }
+    if (i == discovery->numKnown) return;
+    discovery->numKnown--;
+    memmove(&discovery->known[i], &discovery->known[i+1], (discovery->numKnown - i) * sizeof(struct Known_Server));
 }
 
 /**
- * @brief Prints the client network information.
+ * @brief Loads the servers known from previous runs, one per line with the address, port,
+ * answer time (in microseconds), and the time it last answered. Servers that have not answered
+ * for too long are skipped, and a missing file is not an error.
  * 
+ * @param discovery The retransmission state of the REQUEST_GAME command to add the servers to.
+ * @param path The path of the file the known servers are kept in.
  */
-void print_client_info() {
-    int hostname;
-    char hostbuffer[BUFFER_SIZE], *IP_addr;
-    struct hostent *host_entry;
+void load_known_servers(struct Discovery *discovery, const char *path) {
+    FILE *file;
+    char address[INET_ADDRSTRLEN];
+    int port;
+    long rtt, seen;
+    time_t now = time(NULL);
+    if ((file = fopen(path, "r")) == NULL) {
+        if (errno != ENOENT) print_error("load_known_servers: fopen", errno, 0);
+        return;
+    }
+    while (fscanf(file, "%15s %d %ld %ld", address, &port, &rtt, &seen) == 4) {
+        struct sockaddr_in addr;
+        bzero(&addr, sizeof(struct sockaddr_in));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, address, &addr.sin_addr) != 1 || port < 1 || port != (u_int16_t)port || rtt < 0) continue;
+        if (now - seen > KNOWN_SERVER_TTL) continue;
+        remember_server(discovery, &addr, rtt, seen);
+    }
+    fclose(file);
+}
+
+/**
+ * @brief Saves the known servers for the next run, replacing the file in one step so a client
+ * reading it never sees it half written.
+ * 
+ * @param discovery The retransmission state of the REQUEST_GAME command with the known servers.
+ * @param path The path of the file the known servers are kept in.
+ */
+void save_known_servers(const struct Discovery *discovery, const char *path) {
+    int i;
+    FILE *file;
+    char tempPath[PATH_MAX];
+    snprintf(tempPath, sizeof(tempPath), "%s.%d", path, getpid());
+    if ((file = fopen(tempPath, "w")) == NULL) {
+        print_error("save_known_servers: fopen", errno, 0);
+        return;
+    }
+    for (i = 0; i < discovery->numKnown; i++) {
+        const struct Known_Server *server = &discovery->known[i];
+        fprintf(file, "%s %d %ld %ld\n", inet_ntoa(server->addr.sin_addr), ntohs(server->addr.sin_port), server->rtt, (long)server->lastSeen);
+    }
+    if (fclose(file) != 0 || rename(tempPath, path) < 0) {
+        print_error("save_known_servers: rename", errno, 0);
+        unlink(tempPath);
+    }
+}
+
+/**
+ * @brief Orders the candidate servers from least to most loaded: servers that advertised
+ * their load before those that did not, then by most free games, fewest moves being searched
+ * for, and fewest games being played. Ties are broken randomly so clients spread out.
+ * 
+ * @param candidates The servers that replied.
+ * @param numCandidates The number of servers that replied.
+ */
+void rank_candidates(struct Server_Candidate *candidates, int numCandidates) {
+    int i, j;
+    /* Shuffle, then stable sort so that equally loaded servers stay in random order */
+    for (i = numCandidates - 1; i > 0; i--) {
+        struct Server_Candidate temp = candidates[i];
+        j = rand() % (i + 1);
+        candidates[i] = candidates[j];
+        candidates[j] = temp;
+    }
+    for (i = 1; i < numCandidates; i++) {
+        struct Server_Candidate temp = candidates[i];
+        for (j = i; j > 0; j--) {
+            const struct Server_Candidate *prev = &candidates[j-1];
+            int better = (temp.hasLoad != prev->hasLoad) ? temp.hasLoad
+                       : (temp.freeSlots != prev->freeSlots) ? temp.freeSlots > prev->freeSlots
+                       : (temp.pendingSearches != prev->pendingSearches) ? temp.pendingSearches < prev->pendingSearches
+                       : temp.activeGames < prev->activeGames;
+            if (!better) break;
+            candidates[j] = candidates[j-1];
+        }
+        candidates[j] = temp;
+    }
+}
+
+/**
+ * @brief Randomizes a wait so that clients waiting the same time spread out, picking a time
+ * between half of the wait and all of it.
+ * 
+ * @param milliseconds The number of milliseconds to wait.
+ * @return The randomized number of milliseconds to wait.
+ */
+int jitter(int milliseconds) {
+    return milliseconds / 2 + rand() % (milliseconds / 2 + 1);
+}
 
-    /* Retrieve the hostname */
-    if ((hostname = gethostname(hostbuffer, sizeof(hostbuffer))) == -1) {
-        print_error("print_client_info: gethostname", errno, 1);
+/**
+ * @brief Updates the smoothed time for the multicast group to answer with the time the first
+ * reply to a REQUEST_GAME command took, and the wait for the next answer from it (the same way
+ * TCP computes its retransmission timeout).
+ * 
+ * @param discovery The retransmission state of the REQUEST_GAME command.
+ * @param sent The time the REQUEST_GAME command was sent.
+ * @param replied The time the first reply arrived.
+ * @param config The client configuration with the discovery timeouts.
+ */
+void update_discovery_rtt(struct Discovery *discovery, const struct timeval *sent, const struct timeval *replied, const struct Client_Config *config) {
+    struct timeval elapsed;
+    long rtt, timeout;
+    timersub(replied, sent, &elapsed);
+    rtt = elapsed.tv_sec * 1000000L + elapsed.tv_usec;
+    if (discovery->srtt == 0) {
+        discovery->srtt = rtt;
+        discovery->rttvar = rtt / 2;
+    } else {
+        discovery->rttvar = (3 * discovery->rttvar + labs(discovery->srtt - rtt)) / 4;
+        discovery->srtt = (7 * discovery->srtt + rtt) / 8;
+    }
+    /* Wait for the smoothed time plus 4 times its variation, within the configured bounds */
+    timeout = (discovery->srtt + 4 * discovery->rttvar) / 1000;
+    if (timeout < MIN_DISCOVERY_TIMEOUT) timeout = MIN_DISCOVERY_TIMEOUT;
+    if (timeout > config->maxDiscoveryTimeout) timeout = config->maxDiscoveryTimeout;
+    discovery->timeout = timeout;
+}
+
+/**
+ * @brief Sets the socket to blocking or non-blocking mode.
+ * 
+ * @param sd The socket descriptor of the comminication endpoint.
+ * @param blocking Whether the socket should block.
+ */
+void set_blocking(int sd, int blocking) {
+    int flags;
+    /* Add or remove the non-blocking flag from the current socket flags */
+    if ((flags = fcntl(sd, F_GETFL, 0)) < 0 || fcntl(sd, F_SETFL, (blocking) ? flags & ~O_NONBLOCK : flags | O_NONBLOCK) < 0) {
+        print_error("set_blocking: fcntl", errno, 0);
     }
-    /* Retrieve the host information */
-    if ((host_entry = gethostbyname(hostbuffer)) == NULL) {
-        print_error("print_client_info: gethostbyname", errno, 1);
+}
+
+/**
+ * @brief Prints the client network information. The address is taken from the first network
+ * interface that is up (other than loopback) instead of resolving the hostname, which could
+ * block on a name server before the client even starts looking for a server.
+ * 
+ */
+void print_client_info() {
+    struct ifaddrs *interfaces, *ifa;
+    char address[INET_ADDRSTRLEN] = "127.0.0.1";
+
+    /* Retrieve the addresses of the network interfaces */
+    if (getifaddrs(&interfaces) < 0) {
+        print_error("print_client_info: getifaddrs", errno, 0);
+    } else {
+        for (ifa = interfaces; ifa; ifa = ifa->ifa_next) {
+            if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET) continue;
+            if (!(ifa->ifa_flags & IFF_UP) || (ifa->ifa_flags & IFF_LOOPBACK)) continue;
+            inet_ntop(AF_INET, &((struct sockaddr_in *)ifa->ifa_addr)->sin_addr, address, sizeof(address));
+            break;
+        }
+        freeifaddrs(interfaces);
     }
-    /* Convert the host internet network address to an ASCII string */
-    IP_addr = inet_ntoa(*((struct in_addr *)host_entry->h_addr_list[0]));
     /* Print the IP address for the client */
-    printf("[+]Established client at %s\n", IP_addr);
+    printf("[+]Established client at %s\n", address);
 }
 
 /**
- * @brief Initializes the starting state of the game.
+ * @brief Initializes a new connection to the server with nothing received or queued.
  * 
+ * @param conn The connection to initialize.
  * @param sd The socket descriptor of the connected player's comminication endpoint.
+ * @param version The protocol version to speak over the connection.
+ */
+void init_connection(struct Connection *conn, int sd, int version) {
+    conn->sd = sd;
+    conn->version = version;
+    conn->answered = 0;
+    conn->inputPos = 0;
+    conn->inputLength = 0;
+    conn->outputLength = 0;
+}
+
+/**
+ * @brief Initializes the starting state of the game.
+ * 
+ * @param conn The connection of the connected player.
+ * @param serverAddr The address of the server connected to.
+ * @param config The client configuration with the board variant to play.
  * @param game The current game of TicTacToe being played.
  */
-void init_game(int sd, struct TTT_Game *game) {
-    int i;
+void init_game(struct Connection *conn, const struct sockaddr_in *serverAddr, const struct Client_Config *config, struct TTT_Game *game) {
     printf("[+]Initializing shared game state.\n");
     /* Initialize game attributes */
-    game->sd = sd;
+    game->conn = conn;
+    game->serverAddr = *serverAddr;
+    game->useReplica = 1;
+    game->resuming = 0;
+    game->multiplexed = 0;
+    game->exitOnLeave = 1;
+    game->chooseMove = NULL;
     game->gameNum = -1;
     game->winner = -1;
+    game->size = config->size;
+    game->winLength = config->winLength;
+    game->numSquares = config->size * config->size;
     /* Initializes the shared state (aka the board)  */
-    for (i = 1; i <= sizeof(game->board); i++) {
-        game->board[i-1] = i + '0';
+    memset(game->board, 0, sizeof(game->board));
+}
+
+/**
+ * @brief Encodes the board variant of the game for the NEW_GAME and RESUME_GAME commands. The
+ * low 4 bits are the board size and the high 4 bits are the number of marks in a row needed to
+ * win. The default board is encoded as 0 so servers that only play it still understand it.
+ * 
+ * @param game The current game of TicTacToe being played.
+ * @return The encoded board variant.
+ */
+char encode_variant(const struct TTT_Game *game) {
+    if (game->size == ROWS && game->winLength == ROWS) return 0;
+    return (char)((game->winLength << 4) | game->size);
+}
+
+/**
+ * @brief Packs the board into the bitboards of both players' marks, least significant bit
+ * first, for the RESUME_REPLICA ticket and the version 7 RESUME_GAME command.
+ * 
+ * @param game The current game of TicTacToe being played.
+ * @param packed The buffer (PACKED_BOARD_SIZE bytes) to pack Player 1's and then Player 2's bitboard into.
+ */
+void pack_board(const struct TTT_Game *game, unsigned char *packed) {
+    int i, maskBytes = MASK_BYTES(game->numSquares);
+    memset(packed, 0, PACKED_BOARD_SIZE(game->numSquares));
+    for (i = 0; i < game->numSquares; i++) {
+        if (game->board[i] == P1_MARK) packed[i / 8] |= 1 << (i % 8);
+        if (game->board[i] == P2_MARK) packed[maskBytes + i / 8] |= 1 << (i % 8);
     }
 }
 
@@ -396,7 +1206,7 @@ int get_udp_command(int sd, struct sockaddr_in *playerAddr, struct UDP_Buffer *d
     int bytes = 0;
     socklen_t fromLength = sizeof(struct sockaddr_in);
     /* Receive and validate command from remote player */
-    if ((bytes = recvfrom(sd, datagram, UDP_CMD_SIZE, 0, (struct sockaddr *)playerAddr, &fromLength)) <= 0) {
+    if ((bytes = recvfrom(sd, datagram, sizeof(struct UDP_Buffer), 0, (struct sockaddr *)playerAddr, &fromLength)) <= 0) {
         /* Check for error receiving command */
         if (bytes == 0) {
             print_error("get_udp_command: Received empty datagram. Datagram discarded", 0, 0);
@@ -443,47 +1253,108 @@ void send_request_game(int mcd, const struct sockaddr_in *groupAddr) {
 }
 
 /**
- * @brief Handles the GAME_AVAILABLE command from the remote server. Attempts to connect to
- * the server that sent the command. If a connection is unable to be established, the client
- * messages the multicast server group for a new server.
+ * @brief Handles the GAME_AVAILABLE commands from the remote servers. Connects to the servers
+ * that sent the command a few at a time, from least to most loaded. The connections to each
+ * group of servers are started at once and the first server to accept wins, so a server that
+ * advertises games but is not answering only slows the client down if every server it is
+ * raced against fails too.
  * 
- * @param mcd The socket descriptor of the multicast group.
  * @param sd The socket descriptor of the server comminication endpoint.
- * @param serverAddr The address of the server comminication endpoint.
- */
-void game_available(int mcd, const struct sockaddr_in *groupAddr, int *sd, struct sockaddr_in *serverAddr) {
-    static int attempts = MC_ATTEMPTS;
-
-    printf("Server at %s (port %hu) issued a GAME_AVAILABLE command\n", inet_ntoa(serverAddr->sin_addr), serverAddr->sin_port);
-    /* Create server socket to connect to and print client information*/
-    *sd = create_endpoint(serverAddr, SOCK_STREAM, serverAddr->sin_addr.s_addr, ntohs(serverAddr->sin_port));
-    /* Attempt to connect to the server */
-    printf("Attempting to connect to server...\n");
-    if (connect(*sd, (struct sockaddr *)serverAddr, sizeof(struct sockaddr_in)) == -1) {
-        print_error("game_available: connect", errno, 0);
-        if (attempts-- <= 0) print_error("game_available: Maximum attempts to connect to new server exceeded", 0, 1);
-        /* Attempt to find new server to connect to */
-        get_new_server(mcd, groupAddr, sd, 0);
-    } else {
-        printf("Connected to server at %s (port %hu)\n", inet_ntoa(serverAddr->sin_addr), serverAddr->sin_port);
+ * @param candidates The servers that sent the command, from least to most loaded.
+ * @param numCandidates The number of servers that sent the command.
+ * @param timeout The number of milliseconds each group of servers has to accept.
+ * @return The index of the server connected to, or an error code if no server accepted.
+ */
+int game_available(int *sd, const struct Server_Candidate *candidates, int numCandidates, int timeout) {
+    int first, i;
+    for (first = 0; first < numCandidates; first += PARALLEL_CONNECTS) {
+        int sds[PARALLEL_CONNECTS], numRacing = 0, winner = ERROR_CODE;
+        int count = (numCandidates - first < PARALLEL_CONNECTS) ? numCandidates - first : PARALLEL_CONNECTS;
+        struct timeval deadline, now, wait = {timeout / 1000, (timeout % 1000) * 1000};
+        /* Start connecting to every server of the group at once */
+        for (i = 0; i < count; i++) {
+            struct sockaddr_in serverAddr = candidates[first + i].addr;
+            sds[i] = create_endpoint(&serverAddr, SOCK_STREAM, serverAddr.sin_addr.s_addr, ntohs(serverAddr.sin_port));
+            set_blocking(sds[i], 0);
+            printf("Attempting to connect to server at %s (port %hu)...\n", inet_ntoa(serverAddr.sin_addr), serverAddr.sin_port);
+            if (connect(sds[i], (struct sockaddr *)&serverAddr, sizeof(struct sockaddr_in)) == 0) {
+                if (winner < 0) winner = i;
+            } else if (errno == EINPROGRESS) {
+                numRacing++;
+            } else {
+                print_error("game_available: connect", errno, 0);
+                if (close(sds[i]) < 0) print_error("game_available: close-connection", errno, 0);
+                sds[i] = -1;
+            }
+        }
+        /* Wait for the first server to accept the connection */
+        gettimeofday(&now, NULL);
+        timeradd(&now, &wait, &deadline);
+        while (winner < 0 && numRacing > 0) {
+            int rv, maxSD = -1;
+            fd_set writeFDS;
+            struct timeval remaining;
+            gettimeofday(&now, NULL);
+            timersub(&deadline, &now, &remaining);
+            if (remaining.tv_sec < 0) break;
+            FD_ZERO(&writeFDS);
+            for (i = 0; i < count; i++) {
+                if (sds[i] < 0) continue;
+                FD_SET(sds[i], &writeFDS);
+                if (sds[i] > maxSD) maxSD = sds[i];
+            }
+            if ((rv = select(maxSD + 1, NULL, &writeFDS, NULL, &remaining)) <= 0) {
+                if (rv < 0 && errno == EINTR) continue;
+                if (rv < 0) print_error("game_available: select", errno, 0);
+                break;
+            }
+            /* A finished connection attempt is writable, whether or not it succeeded */
+            for (i = 0; i < count && winner < 0; i++) {
+                int error = 0;
+                socklen_t length = sizeof(error);
+                if (sds[i] < 0 || !FD_ISSET(sds[i], &writeFDS)) continue;
+                if (getsockopt(sds[i], SOL_SOCKET, SO_ERROR, &error, &length) < 0) error = errno;
+                if (error == 0) {
+                    winner = i;
+                } else {
+                    print_error("game_available: connect", error, 0);
+                    if (close(sds[i]) < 0) print_error("game_available: close-connection", errno, 0);
+                    sds[i] = -1;
+                    numRacing--;
+                }
+            }
+        }
+        /* Cancel the connections that lost the race */
+        for (i = 0; i < count; i++) {
+            if (sds[i] >= 0 && i != winner && close(sds[i]) < 0) print_error("game_available: close-connection", errno, 0);
+        }
+        if (winner >= 0) {
+            const struct sockaddr_in *serverAddr = &candidates[first + winner].addr;
+            set_blocking(sds[winner], 1);
+            *sd = sds[winner];
+            printf("Connected to server at %s (port %hu)\n", inet_ntoa(serverAddr->sin_addr), serverAddr->sin_port);
+            return first + winner;
+        }
+        print_error("game_available: No server accepted the connection", 0, 0);
     }
+    return ERROR_CODE;
 }
 
 /**
- * @brief Gets a TCP command from the remote player and attempts to validate the data and
- * syntax based on the current protocol.
+ * @brief Receives exactly the given number of bytes from the remote player.
  * 
  * @param sd The socket descriptor of the connected player's comminication endpoint.
- * @param msg The buffer to store the command that the remote player sent.
- * @return The number of bytes received for the command, or an error code if an error occured. 
+ * @param buffer The buffer to store the bytes received.
+ * @param length The number of bytes to receive.
+ * @return The number of bytes received, 0 if the remote player disconnected, or an error code
+ * if an error occured.
  */
-int get_tcp_command(int sd, struct TCP_Buffer *msg) {
+int recv_bytes(int sd, char *buffer, int length) {
     int bytes = 0;
-    /* Receive message from remote player */
-    while (bytes < TCP_CMD_SIZE) {
+    while (bytes < length) {
         int rv;
         /* Receive partial message */
-        if ((rv = recv(sd, msg+bytes, TCP_CMD_SIZE, 0)) <= 0) {
+        if ((rv = recv(sd, buffer + bytes, length - bytes, 0)) <= 0) {
             if (rv == 0) {
                 print_error("get_tcp_command: Player 1 has disconnected", 0, 0);
                 return 0;
@@ -495,15 +1366,144 @@ int get_tcp_command(int sd, struct TCP_Buffer *msg) {
         /* Update total bytes received for message */
         bytes += rv;
     }
+    return bytes;
+}
+
+/**
+ * @brief Gets a TCP command from the remote player and attempts to validate the data and
+ * syntax based on the protocol version spoken over the connection. The commands queued for
+ * the remote player are sent first, and the commands of a version 7 frame are taken one at
+ * a time once the whole frame has been received.
+ * 
+ * @param conn The connection of the connected player.
+ * @param msg The buffer to store the command that the remote player sent.
+ * @return The number of bytes taken for the command, 0 if the remote player disconnected, or
+ * an error code if an error occured.
+ */
+int get_tcp_command(struct Connection *conn, struct TCP_Buffer *msg) {
+    int rv, size;
+    unsigned char *bytes;
+    /* A server that cannot be sent to has gone away */
+    if (flush_output(conn) == ERROR_CODE) return 0;
+    if (conn->inputPos >= conn->inputLength) {
+        /* Receive the next frame (or version 6 command) once the last one is used up */
+        conn->inputPos = conn->inputLength = 0;
+        if ((rv = recv_bytes(conn->sd, conn->input, (conn->version == FRAMED_VERSION) ? FRAME_HEADER_SIZE : TCP_CMD_SIZE)) <= 0) return rv;
+        /* A full server turns the client away with a version 6 command, whatever version the client speaks */
+        if (conn->input[0] == VERSION && conn->input[1] == SERVER_FULL) {
+            msg->version = VERSION;
+            msg->command = SERVER_FULL;
+            conn->inputLength = 0;
+            conn->answered = 1;
+            return TCP_CMD_SIZE;
+        }
+        if (conn->input[0] != conn->version) {  // check for correct version
+            print_error("get_tcp_command: Protocol version not supported", 0, 0);
+            return ERROR_CODE;
+        }
+        if (conn->version == FRAMED_VERSION) {
+            int length = ((unsigned char)conn->input[2] << 8) | (unsigned char)conn->input[3];
+            if (FRAME_HEADER_SIZE + length > MAX_FRAME_SIZE) {
+                print_error("get_tcp_command: Invalid frame length", 0, 0);
+                return ERROR_CODE;
+            }
+            if ((rv = recv_bytes(conn->sd, conn->input + FRAME_HEADER_SIZE, length)) <= 0 && length > 0) return rv;
+            conn->inputPos = FRAME_HEADER_SIZE;
+            conn->inputLength = FRAME_HEADER_SIZE + length;
+            /* An empty frame has no command to take */
+            if (length == 0) return get_tcp_command(conn, msg);
+        } else {
+            conn->inputLength = TCP_CMD_SIZE;
+        }
+    }
+    /* Take the next command of the frame */
+    bytes = (unsigned char *)conn->input + conn->inputPos;
+    if (conn->version == FRAMED_VERSION) {
+        size = FRAMED_CMD_SIZE;
+        if (conn->inputPos + size > conn->inputLength) {
+            print_error("get_tcp_command: Truncated command in frame", 0, 0);
+            return ERROR_CODE;
+        }
+        msg->version = FRAMED_VERSION;
+        msg->command = bytes[0];
+        /* Moves are sent as the square number itself */
+        msg->data = (msg->command == MOVE) ? bytes[1] + '0' : bytes[1];
+        msg->gameNum = (int)(((uint32_t)bytes[2] << 24) | ((uint32_t)bytes[3] << 16) | ((uint32_t)bytes[4] << 8) | bytes[5]);
+    } else {
+        size = TCP_CMD_SIZE;
+        msg->version = bytes[0];
+        msg->command = bytes[1];
+        msg->data = bytes[2];
+        msg->gameNum = bytes[3];
+    }
+    conn->inputPos += size;
+    conn->answered = 1;
     /* Validate the received message */
-    if (msg->version != VERSION) {  // check for correct version
-        print_error("get_tcp_command: Protocol version not supported", 0, 0);
-        return ERROR_CODE;
-    } else if (msg->command < NEW_GAME || msg->command > GAME_OVER) {  // check for valid command
+    if (msg->command < NEW_GAME || msg->command > GAME_OVER) {  // check for valid command
         print_error("get_tcp_command: Invalid TCP command", 0, 0);
         return ERROR_CODE;
     }
-    return bytes;
+    return size;
+}
+
+/**
+ * @brief Sends a TCP command, and the board or ticket that follows it, to the remote player.
+ * Version 6 commands are sent right away, while version 7 commands are queued in the
+ * connection's frame, which is sent before the client next waits for the remote player.
+ * 
+ * @param conn The connection of the connected player.
+ * @param command The command to send.
+ * @param data The data for the command.
+ * @param gameNum The game number of the command.
+ * @param trailing The bytes following the command (NULL if none).
+ * @param trailingLength The number of bytes following the command.
+ * @return The number of bytes sent or queued, or an error code if there was an issue.
+ */
+int send_command(struct Connection *conn, char command, char data, int gameNum, const char *trailing, int trailingLength) {
+    unsigned char *bytes;
+    if (conn->version != FRAMED_VERSION) {
+        /* Pack command information into message, followed by the board or ticket */
+        char msg[TCP_CMD_SIZE + MAX_SQUARES] = {VERSION, command, data, gameNum};
+        if (trailingLength > 0) memcpy(msg + TCP_CMD_SIZE, trailing, trailingLength);
+        if (send(conn->sd, msg, TCP_CMD_SIZE + trailingLength, MSG_NOSIGNAL) < 0) return ERROR_CODE;
+        return TCP_CMD_SIZE + trailingLength;
+    }
+    /* Queue the command in the connection's frame, leaving room for the frame header */
+    if (conn->outputLength + FRAMED_CMD_SIZE + trailingLength > MAX_FRAME_SIZE && flush_output(conn) == ERROR_CODE) return ERROR_CODE;
+    if (conn->outputLength == 0) conn->outputLength = FRAME_HEADER_SIZE;
+    bytes = (unsigned char *)conn->output + conn->outputLength;
+    bytes[0] = command;
+    /* Moves are sent as the square number itself */
+    bytes[1] = (command == MOVE) ? data - '0' : data;
+    bytes[2] = (uint32_t)gameNum >> 24;
+    bytes[3] = (uint32_t)gameNum >> 16;
+    bytes[4] = (uint32_t)gameNum >> 8;
+    bytes[5] = gameNum;
+    if (trailingLength > 0) memcpy(bytes + FRAMED_CMD_SIZE, trailing, trailingLength);
+    conn->outputLength += FRAMED_CMD_SIZE + trailingLength;
+    return FRAMED_CMD_SIZE + trailingLength;
+}
+
+/**
+ * @brief Sends the version 7 frame of commands queued for the remote player.
+ * 
+ * @param conn The connection of the connected player.
+ * @return The number of bytes sent (0 if no commands were queued), or an error code if there was an issue.
+ */
+int flush_output(struct Connection *conn) {
+    int length = conn->outputLength;
+    if (length == 0) return 0;
+    /* Fill in the frame header with the length of the commands */
+    conn->output[0] = FRAMED_VERSION;
+    conn->output[1] = 0;
+    conn->output[2] = (length - FRAME_HEADER_SIZE) >> 8;
+    conn->output[3] = length - FRAME_HEADER_SIZE;
+    conn->outputLength = 0;
+    if (send(conn->sd, conn->output, length, MSG_NOSIGNAL) < 0) {
+        print_error("flush_output", errno, 0);
+        return ERROR_CODE;
+    }
+    return length;
 }
 
 /**
@@ -524,13 +1524,11 @@ void new_game(const struct TCP_Buffer *msg, struct TTT_Game *game) {
  * @param game The current game of TicTacToe being played.
  */
 void send_new_game(struct TTT_Game *game) {
-    struct TCP_Buffer msg = {0};
-    /* Pack command information into message */
-    msg.version = VERSION;
-    msg.command = NEW_GAME;
+    /* A multiplexed game is started with the game number its commands are routed by */
+    const int gameNum = (game->multiplexed) ? game->gameNum : 0;
     /* Send the command to the remote player */
     printf("Client sent the NEW_GAME command to Player 1\n");
-    if (send(game->sd, &msg, TCP_CMD_SIZE, MSG_NOSIGNAL) < 0) {
+    if (send_command(game->conn, NEW_GAME, encode_variant(game), gameNum, NULL, 0) == ERROR_CODE) {
         print_error("send_new_game", errno, 0);
         leave_game(game);
     }
@@ -548,17 +1546,20 @@ void send_new_game(struct TTT_Game *game) {
 void move(const struct TCP_Buffer *msg, struct TTT_Game *game) {
     /* Retrieve game number from remote player if not established */
     if (game->gameNum < 0) game->gameNum = msg->gameNum;
+    /* The server answered, so it accepted the resumed game */
+    game->resuming = 0;
+    game->useReplica = 1;
     /* Get move from remote player */
     int move = msg->data - '0';
     printf("The remote player issued a MOVE command\n");
-    printf("Player 1 chose the move:  %c\n", msg->data);
+    printf("Player 1 chose the move:  %d\n", move);
     /* Check that the received move is valid */
     if (validate_move(move, game)) {
         /* Update the board (for Player 1) and check if someone won */
         game->board[move-1] = P1_MARK;
         if (check_game_over(game)) {
-            /* If Player 1 won, send GAME_OVER command and leave game */
-            send_game_over(game);
+            /* If Player 1 won, send GAME_OVER command and leave game (in version 7 Player 1 sends it along with the move) */
+            if (game->conn->version != FRAMED_VERSION) send_game_over(game);
             return;
         }
         print_board(game);
@@ -570,7 +1571,10 @@ void move(const struct TCP_Buffer *msg, struct TTT_Game *game) {
         }
         /* Update the board (for Player 2) and check if someone won after the exchange */
         game->board[move-1] = P2_MARK;
-        check_game_over(game);
+        if (check_game_over(game) && game->conn->version == FRAMED_VERSION) {
+            /* In version 7 the player making the last move sends GAME_OVER in the same frame */
+            send_game_over(game);
+        }
     } else {
         leave_game(game);
     }
@@ -605,14 +1609,9 @@ void game_over(const struct TCP_Buffer *msg, struct TTT_Game *game) {
  * @param game The current game of TicTacToe being played.
  */
 void send_game_over(struct TTT_Game *game) {
-    struct TCP_Buffer msg = {0};
-    /* Pack command information into message */
-    msg.version = VERSION;
-    msg.command = GAME_OVER;
-    msg.gameNum = game->gameNum;
     /* Send the command to the remote player */
     printf("Client sent the GAME_OVER command to Player 1\n");
-    if (send(game->sd, &msg, TCP_CMD_SIZE, MSG_NOSIGNAL) < 0) {
+    if (send_command(game->conn, GAME_OVER, 0, game->gameNum, NULL, 0) == ERROR_CODE) {
         print_error("send_game_over", errno, 0);
     }
     /* Leave the game */
@@ -632,44 +1631,79 @@ void resume_game(const struct TCP_Buffer *msg, struct TTT_Game *game) {
 }
 
 /**
- * @brief Sends RESUME_GAME command to the remote player to start of in-progress game.
+ * @brief Sends RESUME_GAME command to the remote player to start of in-progress game. The
+ * board follows the command in the same message, as a mark for every square in version 6
+ * and as the packed bitboards of both players in version 7.
  * 
  * @param game The current game of TicTacToe being played.
  */
 void send_resume_game(struct TTT_Game *game) {
-    int i;
-    char boardState[GAME_SIZE] = {0};
-    struct TCP_Buffer msg = {0};
+    int i, length = game->numSquares;
+    char boardState[MAX_SQUARES] = {0};
 
-    /* Reset game number to default state */
-    game->gameNum = -1;
-    /* Pack command information into message */
-    msg.version = VERSION;
-    msg.command = RESUME_GAME;
-    msg.gameNum = game->gameNum;
-    /* Send the command to the remote player */
-    printf("Client sent the RESUME_GAME command to Player 1\n");
-    if (send(game->sd, &msg, TCP_CMD_SIZE, MSG_NOSIGNAL) < 0) {
-        print_error("send_resume_game", errno, 0);
-        leave_game(game);
-    }
+    /* Reset game number to default state (a multiplexed game keeps the game number it is routed by) */
+    if (!game->multiplexed) game->gameNum = -1;
     /* Pack shared board state information into message */
-    for (i = 0; i < GAME_SIZE; i++) {
-        char state = game->board[i];
-        if (state == P1_MARK || state == P2_MARK) {
-            boardState[i] = state;
+    if (game->conn->version == FRAMED_VERSION) {
+        pack_board(game, (unsigned char *)boardState);
+        length = PACKED_BOARD_SIZE(game->numSquares);
+    } else {
+        for (i = 0; i < game->numSquares; i++) {
+            char state = game->board[i];
+            if (state == P1_MARK || state == P2_MARK) {
+                boardState[i] = state;
+            }
         }
     }
-    /* Send the shared board state to the remote player */
-    printf("Client sent the current board state to Player 1\n");
-    if (send(game->sd, &boardState, GAME_SIZE, MSG_NOSIGNAL) < 0) {
+    /* Send the command and the shared board state to the remote player */
+    printf("Client sent the RESUME_GAME command and the current board state to Player 1\n");
+    if (send_command(game->conn, RESUME_GAME, encode_variant(game), game->gameNum, boardState, length) == ERROR_CODE) {
         print_error("send_resume_game", errno, 0);
         leave_game(game);
     }
 }
 
 /**
- * @brief Gets the next move the client should make from the user.
+ * @brief Sends RESUME_REPLICA command to the remote player to take over the in-progress game
+ * from the replica of the server it was being played on. The ticket following the command is
+ * the port of that server and the packed bitboards of both players' marks, all sent together.
+ * 
+ * @param game The current game of TicTacToe being played.
+ * @param originAddr The address of the server the game was being played on.
+ */
+void send_resume_replica(struct TTT_Game *game, const struct sockaddr_in *originAddr) {
+    char ticket[RESUME_TICKET_SIZE(MAX_SQUARES)];
+    /* The game number the previous server sent goes with the command */
+    const int gameNum = game->gameNum;
+
+    /* Pack the port of the previous server (network byte order) and the bitboards into the ticket */
+    memcpy(ticket, &originAddr->sin_port, 2);
+    pack_board(game, (unsigned char *)ticket + 2);
+    /* Reset game number to default state */
+    game->gameNum = -1;
+    /* Send the command and ticket to the remote player */
+    printf("Client sent the RESUME_REPLICA command to Player 1\n");
+    if (send_command(game->conn, RESUME_REPLICA, encode_variant(game), gameNum, ticket, RESUME_TICKET_SIZE(game->numSquares)) == ERROR_CODE) {
+        print_error("send_resume_replica", errno, 0);
+        leave_game(game);
+    }
+}
+
+/**
+ * @brief Sends MULTIPLEX command to the remote player so the connection can play a game for
+ * every game number.
+ * 
+ * @param conn The connection of the connected player.
+ */
+void send_multiplex(struct Connection *conn) {
+    /* Send the command to the remote player */
+    printf("Client sent the MULTIPLEX command to Player 1\n");
+    if (send_command(conn, MULTIPLEX, 0, 0, NULL, 0) == ERROR_CODE) print_error("send_multiplex", errno, 1);
+}
+
+/**
+ * @brief Gets the next move the client should make from the user, unless the game chooses
+ * its moves automatically.
  * 
  * @param game The current game of TicTacToe being played.
  * @return The optimal move to make in order to win. 
@@ -677,6 +1711,7 @@ void send_resume_game(struct TTT_Game *game) {
 int get_move(const struct TTT_Game *game) {
     int choice;
     char input[BUFFER_SIZE];
+    if (game->chooseMove != NULL) return game->chooseMove(game);
     /* Prompt for next move from user */
     printf("Player 2, enter a number:  ");
     /* Read line of user input */
@@ -687,7 +1722,21 @@ int get_move(const struct TTT_Game *game) {
 }
 
 /**
- * @brief Determines whether a given move is legal (i.e. number 1-9) and valid (i.e. hasn't
+ * @brief Chooses a random empty square as the client's next move.
+ * 
+ * @param game The current game of TicTacToe being played.
+ * @return The move to make.
+ */
+int random_move(const struct TTT_Game *game) {
+    int choice;
+    do {
+        choice = rand() % game->numSquares + 1;
+    } while (game->board[choice-1] != 0);
+    return choice;
+}
+
+/**
+ * @brief Determines whether a given move is legal (i.e. a square on the board) and valid (i.e. hasn't
  * already been played) for the current game.
  * 
  * @param choice The player move to be validated.
@@ -696,13 +1745,12 @@ int get_move(const struct TTT_Game *game) {
  */
 int validate_move(int choice, const struct TTT_Game *game) {
     /* Check to see if the choice is a move on the board */
-    if (choice < 1 || choice > 9) {
-        print_error("Invalid move: Must be a number [1-9]", 0, 0);
+    if (choice < 1 || choice > game->numSquares) {
+        print_error("Invalid move: Must be a square on the board", 0, 0);
         return 0;
     }
-    /* Check to see if the square chosen has a digit in it, if */
-    /* square 8 has an '8' then it is a valid choice */
-    if (game->board[choice-1] != (choice + '0')) {
+    /* Check to see if the square chosen is empty */
+    if (game->board[choice-1] != 0) {
         print_error("Invalid move: Square already taken", 0, 0);
         return 0;
     }
@@ -721,22 +1769,16 @@ int validate_move(int choice, const struct TTT_Game *game) {
  * @return The move that was sent, or an error code if there was an issue. 
  */
 int send_p2_move(const struct TTT_Game *game) {
-    struct TCP_Buffer msg = {0};
     /* Get move to send to remote player */
     int move = get_move(game);
     while (!validate_move(move, game)) move = get_move(game);
-    /* Pack move information into message */
-    msg.version = VERSION;
-    msg.command = MOVE;
-    msg.data = move + '0';
-    msg.gameNum = game->gameNum;
     /* Send the move to the remote player */
-    printf("Client sent the move:  %c\n", msg.data);
-    if (send(game->sd, &msg, TCP_CMD_SIZE, MSG_NOSIGNAL) < 0) {
+    printf("Client sent the move:  %d\n", move);
+    if (send_command(game->conn, MOVE, move + '0', game->gameNum, NULL, 0) == ERROR_CODE) {
         print_error("send_p2_move", errno, 0);
         return ERROR_CODE;
     }
-    return (msg.data - '0');
+    return move;
 }
 
 /**
@@ -746,30 +1788,29 @@ int send_p2_move(const struct TTT_Game *game) {
  * @return True if a player has won the game and false if the game is still going on. 
  */
 int check_win(const struct TTT_Game *game) {
-    const int score = sizeof(game->board) + 1;
+    /* The row and column steps of the 4 line directions (row, column, diagonal, anti-diagonal) */
+    static const int steps[4][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}};
+    const int score = game->numSquares + 1, size = game->size, length = game->winLength;
+    int row, col, dir, i;
     /***********************************************************************/
-    /* Brute force check to see if someone won. Return a +/- score if the  */
-    /* game is 'over' or return 0 if game should go on.                    */
+    /* Check every line of winLength squares to see if someone won. Return */
+    /* a +/- score if the game is 'over' or return 0 if game should go on. */
     /***********************************************************************/
-    if (game->board[0] == game->board[1] && game->board[1] == game->board[2]) { // row matches
-        return (game->board[0] == P1_MARK) ? score : -score;
-    } else if (game->board[3] == game->board[4] && game->board[4] == game->board[5]) { // row matches
-        return (game->board[3] == P1_MARK) ? score : -score;
-    } else if (game->board[6] == game->board[7] && game->board[7] == game->board[8]) { // row matches
-        return (game->board[6] == P1_MARK) ? score : -score;
-    } else if (game->board[0] == game->board[3] && game->board[3] == game->board[6]) { // column matches
-        return (game->board[0] == P1_MARK) ? score : -score;
-    } else if (game->board[1] == game->board[4] && game->board[4] == game->board[7]) { // column matches
-        return (game->board[1] == P1_MARK) ? score : -score;
-    } else if (game->board[2] == game->board[5] && game->board[5] == game->board[8]) { // column matches
-        return (game->board[2] == P1_MARK) ? score : -score;
-    } else if (game->board[0] == game->board[4] && game->board[4] == game->board[8]) { // diagonal matches
-        return (game->board[0] == P1_MARK) ? score : -score;
-    } else if (game->board[2] == game->board[4] && game->board[4] == game->board[6]) { // diagonal matches
-        return (game->board[2] == P1_MARK) ? score : -score;
-    } else {
-        return 0;  // return of 0 means keep playing
+    for (row = 0; row < size; row++) {
+        for (col = 0; col < size; col++) {
+            char mark = game->board[row * size + col];
+            if (mark == 0) continue;
+            for (dir = 0; dir < 4; dir++) {
+                int endRow = row + steps[dir][0] * (length-1), endCol = col + steps[dir][1] * (length-1);
+                if (endRow >= size || endCol < 0 || endCol >= size) continue;
+                for (i = 1; i < length; i++) {
+                    if (game->board[(row + steps[dir][0] * i) * size + col + steps[dir][1] * i] != mark) break;
+                }
+                if (i == length) return (mark == P1_MARK) ? score : -score;
+            }
+        }
     }
+    return 0;  // return of 0 means keep playing
 }
 
 /**
@@ -781,9 +1822,9 @@ int check_win(const struct TTT_Game *game) {
 int check_draw(const struct TTT_Game *game) {
     int i;
     /* Check each board square */
-    for (i = 0; i < sizeof(game->board); i++) {
+    for (i = 0; i < game->numSquares; i++) {
         /* Check if current square has been played */
-        if (game->board[i] == (i+1)+'0') return 0;
+        if (game->board[i] == 0) return 0;
     }
     return 1;
 }
@@ -816,22 +1857,28 @@ int check_game_over(struct TTT_Game *game) {
  * @param game The current game of TicTacToe being played.
  */
 void print_board(const struct TTT_Game *game) {
+    int row, col, size = game->size;
     /*****************************************************************/
     /* Brute force print out the board and all the squares/values    */
     /*****************************************************************/
     /* Print header info */
     printf("\n\n\tTicTacToe Game #%d\n\n", game->gameNum);
     printf("Player 1 (%c)  -  Player 2 (%c)\n\n\n", P1_MARK, P2_MARK);
-    /* Print current state of board */
-    printf("     |     |     \n");
-    printf("  %c  |  %c  |  %c \n", game->board[0], game->board[1], game->board[2]);
-    printf("_____|_____|_____\n");
-    printf("     |     |     \n");
-    printf("  %c  |  %c  |  %c \n", game->board[3], game->board[4], game->board[5]);
-    printf("_____|_____|_____\n");
-    printf("     |     |     \n");
-    printf("  %c  |  %c  |  %c \n", game->board[6], game->board[7], game->board[8]);
-    printf("     |     |     \n\n");
+    /* Print current state of board (the mark or the square number of each square) */
+    for (row = 0; row < size; row++) {
+        for (col = 0; col < size; col++) printf((col < size-1) ? "     |" : "     \n");
+        for (col = 0; col < size; col++) {
+            char mark = game->board[row * size + col];
+            if (mark != 0) {
+                printf("  %c  ", mark);
+            } else {
+                printf("%3d  ", row * size + col + 1);
+            }
+            printf((col < size-1) ? "|" : "\n");
+        }
+        for (col = 0; col < size && row < size-1; col++) printf((col < size-1) ? "_____|" : "_____\n");
+    }
+    for (col = 0; col < size; col++) printf((col < size-1) ? "     |" : "     \n\n");
 }
 
 /**
@@ -846,8 +1893,14 @@ void leave_game(struct TTT_Game *game) {
     } else {
         printf("Game #%d has ended. Leaving the game\n", game->gameNum);
     }
-    /* Close connection to remote player */
-    if (close(game->sd) < 0) print_error("leave_game: close-connection", errno, 0);
+    /* The connection of a multiplexed game is still playing the other games (and others close their own) */
+    if (!game->exitOnLeave) {
+        game->conn = NULL;
+        return;
+    }
+    /* Send anything still queued and close connection to remote player */
+    flush_output(game->conn);
+    if (close(game->conn->sd) < 0) print_error("leave_game: close-connection", errno, 0);
     exit(EXIT_SUCCESS);
 }
 
@@ -856,16 +1909,20 @@ void leave_game(struct TTT_Game *game) {
  * there is a draw, or there is no other server available to connect to if the remote
  * player leaves the game.
  * 
- * @param mcd The socket descriptor of the multicast group.
- * @param groupAddr The address of the multicast group.
+ * @param mcd The socket descriptor of the multicast groups.
  * @param sd The socket descriptor of the connected player's comminication endpoint.
+ * @param serverAddr The address of the server connected to.
+ * @param config The client configuration with the board variant to play.
+ * @param discovery The retransmission state of the REQUEST_GAME command.
  */
-void tictactoe(int mcd, const struct sockaddr_in *groupAddr, int sd) {
+void tictactoe(int mcd, int sd, const struct sockaddr_in *serverAddr, const struct Client_Config *config, struct Discovery *discovery) {
+    static struct Connection conn;
     struct TTT_Game game = {0};
     Command_Handler commands[] = {new_game, move, game_over, resume_game};
 
     /* Initialize the game */
-    init_game(sd, &game);
+    init_connection(&conn, sd, config->version);
+    init_game(&conn, serverAddr, config, &game);
     send_new_game(&game);
     /* Play the game */
     while (1) {
@@ -873,17 +1930,307 @@ void tictactoe(int mcd, const struct sockaddr_in *groupAddr, int sd) {
         struct TCP_Buffer msg = {0};
         printf("[+]Waiting for remote player to issue a command...\n");
         /* Get the command for the current game */
-        if ((rv = get_tcp_command(game.sd, &msg)) > 0) {
+        if ((rv = get_tcp_command(&conn, &msg)) > 0 && msg.command != SERVER_FULL) {
             /* Process received command for current game */
             commands[(int)msg.command](&msg, &game);
-        } else if (rv == 0) {
-            /* Remote player disconnected -> message server group for new game */
-            get_new_server(mcd, groupAddr, &sd, 0);
-            /* Resume the game with the new connected player */
-            send_resume_game(&game);
+        } else if (rv >= 0) {
+            /* The server the game was being played on */
+            struct sockaddr_in originAddr = game.serverAddr;
+            if (rv > 0) printf("Server has no open games. Looking for another server\n");
+            if (!conn.answered) {
+                /* A server closing the connection instead of answering does not speak version 7 if it refused a new game or the whole board */
+                if (conn.version == FRAMED_VERSION && (!game.resuming || !game.useReplica)) {
+                    printf("Server closed the connection without answering. Falling back to protocol version %d\n", VERSION);
+                    conn.version = VERSION;
+                }
+                /* Nor did it accept the replica */
+                if (game.resuming) game.useReplica = 0;
+            }
+            /* Remote player disconnected (or turned the client away) -> message server group for new game */
+            if (get_new_server(mcd, config, discovery, &conn.sd, &game.serverAddr) == ERROR_CODE) exit(EXIT_FAILURE);
+            init_connection(&conn, conn.sd, conn.version);
+            /* Resume the game with the new connected player, uploading the whole board if the replica failed */
+            if (game.useReplica) {
+                send_resume_replica(&game, &originAddr);
+            } else {
+                send_resume_game(&game);
+            }
+            game.resuming = 1;
         } else {
             /* Invalid command received -> reset game */
             leave_game(&game);
         }
     }
 }
+
+/**
+ * @brief Plays many games of TicTacToe over one connection, choosing the moves automatically.
+ * Every game is started at once with its own game number, and the commands for all the games
+ * are handled in whatever order the remote player sends them. Prints how the games ended and
+ * terminates once every game has ended or the remote player leaves.
+ * 
+ * @param sd The socket descriptor of the connected player's comminication endpoint.
+ * @param serverAddr The address of the server connected to.
+ * @param config The client configuration with the board variant and number of games to play.
+ */
+void tictactoe_multiplexed(int sd, const struct sockaddr_in *serverAddr, const struct Client_Config *config) {
+    static struct Connection conn;
+    int i, numPlaying = config->numGames, results[4] = {0};
+    struct TTT_Game *games;
+    Command_Handler commands[] = {new_game, move, game_over, resume_game};
+
+    if ((games = calloc(config->numGames, sizeof(struct TTT_Game))) == NULL) print_error("tictactoe_multiplexed: calloc", errno, 1);
+    /* Start every game with its own game number (all in one frame in version 7) */
+    init_connection(&conn, sd, config->version);
+    send_multiplex(&conn);
+    for (i = 0; i < config->numGames; i++) {
+        init_game(&conn, serverAddr, config, &games[i]);
+        games[i].gameNum = i;
+        games[i].multiplexed = 1;
+        games[i].exitOnLeave = 0;
+        games[i].chooseMove = random_move;
+        send_new_game(&games[i]);
+    }
+    /* Play the games until every one of them has ended */
+    while (numPlaying > 0) {
+        struct TTT_Game *game;
+        struct TCP_Buffer msg = {0};
+        if (get_tcp_command(&conn, &msg) <= 0 || msg.command == SERVER_FULL) {
+            if (msg.command == SERVER_FULL) {
+                print_error("tictactoe_multiplexed: Server has no open games", 0, 0);
+            } else if (!conn.answered && conn.version == FRAMED_VERSION) {
+                print_error("tictactoe_multiplexed: Server closed the connection without answering (try protocol version 6)", 0, 0);
+            } else {
+                print_error("tictactoe_multiplexed: Connection lost", 0, 0);
+            }
+            break;
+        }
+        /* Route the command to the game started with its game number */
+        if (msg.gameNum < 0 || msg.gameNum >= config->numGames || (game = &games[msg.gameNum])->conn == NULL) {
+            print_error("tictactoe_multiplexed: No game with the game number. Command discarded", 0, 0);
+            continue;
+        }
+        commands[(int)msg.command](&msg, game);
+        if (game->conn == NULL) {
+            /* Tally who won (a game turned down by the server has no winner) */
+            results[game->winner + 1]++;
+            numPlaying--;
+        }
+    }
+    printf("Played %d game(s): Player 1 won %d, Player 2 won %d, %d draw(s), %d unfinished\n",
+        config->numGames, results[2], results[3], results[1], results[0] + numPlaying);
+    flush_output(&conn);
+    if (close(sd) < 0) print_error("tictactoe_multiplexed: close-connection", errno, 0);
+    free(games);
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * @brief Parses the multicast group (and optional port) of a watch channel.
+ *
+ * @param arg The watch channel, as group[:port].
+ * @param addr The address to store the watch channel in.
+ * @return 0 if the watch channel is valid, ERROR_CODE otherwise.
+ */
+int parse_channel(const char *arg, struct sockaddr_in *addr) {
+    char group[INET_ADDRSTRLEN];
+    int port = WATCH_PORT, length = strcspn(arg, ":");
+    if (length == 0 || length >= INET_ADDRSTRLEN) return ERROR_CODE;
+    memcpy(group, arg, length);
+    group[length] = '\0';
+    if (arg[length] == ':') {
+        port = strtol(arg + length + 1, NULL, 10);
+        if (port < 1 || port != (u_int16_t)port) return ERROR_CODE;
+    }
+    bzero(addr, sizeof(struct sockaddr_in));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    if (inet_pton(AF_INET, group, &addr->sin_addr) != 1 || !IN_MULTICAST(ntohl(addr->sin_addr.s_addr))) return ERROR_CODE;
+    return 0;
+}
+
+/**
+ * @brief Creates the socket the games published to the watch channel are received on, joining
+ * the channel's multicast group on the configured interface. Any number of spectators can
+ * join, since the network delivers each datagram to all of them. If the socket can't be
+ * created, the function terminates the process.
+ *
+ * @param config The client configuration with the watch channel and multicast interface.
+ * @return The socket descriptor of the watch channel.
+ */
+int create_watch_endpoint(const struct Client_Config *config) {
+    int wd, reuse = 1;
+    struct sockaddr_in addr;
+    struct ip_mreq mreq;
+    if ((wd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) print_error("create_watch_endpoint: socket", errno, 1);
+    /* Let any number of spectators on the host join the channel */
+    if (setsockopt(wd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) print_error("create_watch_endpoint: setsockopt-reuse", errno, 0);
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = config->watchAddr.sin_port;
+    if (bind(wd, (struct sockaddr *)&addr, sizeof(addr)) < 0) print_error("create_watch_endpoint: bind", errno, 1);
+    mreq.imr_multiaddr = config->watchAddr.sin_addr;
+    mreq.imr_interface = config->mcInterface;
+    if (setsockopt(wd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) print_error("create_watch_endpoint: setsockopt-membership", errno, 1);
+#ifdef IP_MULTICAST_ALL
+    /* Only receive the watch channel's datagrams, not those of every group joined on the port */
+    reuse = 0;
+    if (setsockopt(wd, IPPROTO_IP, IP_MULTICAST_ALL, &reuse, sizeof(reuse)) < 0) print_error("create_watch_endpoint: setsockopt-all", errno, 0);
+#endif
+    printf("[+]Watching games on channel at %s (port %hu)\n", inet_ntoa(config->watchAddr.sin_addr), ntohs(config->watchAddr.sin_port));
+    return wd;
+}
+
+/**
+ * @brief Unpacks a value packed into a buffer least significant byte first.
+ *
+ * @param src The buffer the bytes were packed into.
+ * @param length The number of bytes to unpack.
+ * @return The unpacked value.
+ */
+uint64_t unpack_bytes(const unsigned char *src, int length) {
+    int i;
+    uint64_t value = 0;
+    for (i = 0; i < length; i++) value |= (uint64_t)src[i] << (8 * i);
+    return value;
+}
+
+/**
+ * @brief Decodes the board variant of a published game (0 for the default board, otherwise
+ * the win length in the high nibble and the board size in the low nibble).
+ *
+ * @param variant The encoded board variant.
+ * @param game The game to set the board size and win length of.
+ * @return 0 if the variant is valid, ERROR_CODE otherwise.
+ */
+int decode_watch_variant(char variant, struct TTT_Game *game) {
+    unsigned char data = variant;
+    game->size = (data == 0) ? ROWS : (data & 0xF);
+    game->winLength = (data == 0) ? ROWS : (data >> 4);
+    if (game->size < MIN_BOARD_SIZE || game->size > MAX_BOARD_SIZE) return ERROR_CODE;
+    if (game->winLength < MIN_BOARD_SIZE || game->winLength > game->size) return ERROR_CODE;
+    game->numSquares = game->size * game->size;
+    return 0;
+}
+
+/**
+ * @brief Finds the slot of the table of followed games a game is kept in (a game followed in
+ * the slot before is replaced).
+ *
+ * @param table The table of followed games.
+ * @param serverID The random ID of the server playing the game.
+ * @param gameNum The game ID on the server playing the game.
+ * @return The slot of the game.
+ */
+struct Watched_Game *find_watched_game(struct Watched_Game *table, uint32_t serverID, int gameNum) {
+    return &table[(serverID * 2654435761u + (uint32_t)gameNum) & (WATCH_TABLE_SIZE - 1)];
+}
+
+/**
+ * @brief Applies a published move (or end) to the game it was made in. Games are followed
+ * from their first move, or from the next snapshot of their board, and a game whose moves were
+ * missed is dropped until the next snapshot.
+ *
+ * @param table The table of followed games.
+ * @param serverID The random ID of the server playing the game.
+ * @param record The published move.
+ */
+void watch_move(struct Watched_Game *table, uint32_t serverID, const struct Watch_Move *record) {
+    int gameNum = unpack_bytes(record->gameNum, sizeof(record->gameNum));
+    struct Watched_Game *entry = find_watched_game(table, serverID, gameNum);
+    int following = entry->used && entry->serverID == serverID && entry->game.gameNum == gameNum;
+    if (record->kind == WATCH_GAME_END) {
+        if (!following) return;
+        /* Print the final board and how the game ended */
+        if (entry->numMoves == record->numMoves) print_board(&entry->game);
+        if (record->square == WATCH_ABANDONED) {
+            printf("==> Game %08x-#%d was left after %d moves\n", serverID, gameNum, record->numMoves);
+        } else if (record->square == 0) {
+            printf("==> Game %08x-#%d is a draw\n", serverID, gameNum);
+        } else {
+            printf("==> Game %08x-#%d: Player %d wins\n", serverID, gameNum, record->square);
+        }
+        entry->used = 0;
+        return;
+    }
+    if (record->kind != WATCH_P1_MOVE && record->kind != WATCH_P2_MOVE) return;
+    /* Start following a game from its first move */
+    if (record->numMoves == 1) {
+        bzero(entry, sizeof(struct Watched_Game));
+        if (decode_watch_variant(record->variant, &entry->game) == ERROR_CODE) return;
+        entry->used = 1;
+        entry->serverID = serverID;
+        entry->game.gameNum = gameNum;
+        following = 1;
+    }
+    if (!following) return;
+    /* Drop the game until the next snapshot if a move was missed */
+    if (record->numMoves != entry->numMoves + 1 || record->square < 1 || record->square > entry->game.numSquares || entry->game.board[record->square-1] != 0) {
+        entry->used = 0;
+        return;
+    }
+    entry->game.board[record->square-1] = (record->kind == WATCH_P1_MOVE) ? P1_MARK : P2_MARK;
+    entry->numMoves++;
+    printf("Game %08x-#%d: Player %d chose square %d\n", serverID, gameNum, record->kind, record->square);
+}
+
+/**
+ * @brief Follows a game from the board published in a snapshot, unless it is already being
+ * followed and no moves were missed.
+ *
+ * @param table The table of followed games.
+ * @param serverID The random ID of the server playing the game.
+ * @param record The published board.
+ */
+void watch_board(struct Watched_Game *table, uint32_t serverID, const struct Watch_Board *record) {
+    int i, gameNum = unpack_bytes(record->gameNum, sizeof(record->gameNum));
+    struct Watched_Game *entry = find_watched_game(table, serverID, gameNum);
+    uint64_t p1Marks = unpack_bytes(record->p1Marks, sizeof(record->p1Marks));
+    uint64_t p2Marks = unpack_bytes(record->p2Marks, sizeof(record->p2Marks));
+    if (entry->used && entry->serverID == serverID && entry->game.gameNum == gameNum && entry->numMoves == record->numMoves) return;
+    bzero(entry, sizeof(struct Watched_Game));
+    if (decode_watch_variant(record->variant, &entry->game) == ERROR_CODE) return;
+    entry->serverID = serverID;
+    entry->game.gameNum = gameNum;
+    for (i = 0; i < entry->game.numSquares; i++) {
+        if (p1Marks & (1ULL << i)) entry->game.board[i] = P1_MARK;
+        if (p2Marks & (1ULL << i)) entry->game.board[i] = P2_MARK;
+        if (entry->game.board[i] != 0) entry->numMoves++;
+    }
+    entry->used = 1;
+    printf("Game %08x-#%d: Watching a %dx%d game from move %d\n", serverID, gameNum, entry->game.size, entry->game.size, entry->numMoves);
+    print_board(&entry->game);
+}
+
+/**
+ * @brief Follows the games every server of the watch channel publishes, printing each move as
+ * it is made and each board as its game ends, until the process is stopped.
+ *
+ * @param config The client configuration with the watch channel.
+ */
+void watch_games(const struct Client_Config *config) {
+    int wd = create_watch_endpoint(config);
+    unsigned char datagram[WATCH_DATAGRAM_SIZE];
+    static struct Watched_Game table[WATCH_TABLE_SIZE];
+    /* Print each move as it arrives, even when the output is piped */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    while (1) {
+        const struct Watch_Header *header = (const struct Watch_Header *)datagram;
+        int i, count, length = recv(wd, datagram, sizeof(datagram), 0);
+        uint32_t serverID;
+        if (length < 0) {
+            if (errno != EINTR) print_error("watch_games: recv", errno, 1);
+            continue;
+        }
+        /* Discard datagrams that are not whole watch channel datagrams */
+        if (length < (int)WATCH_HEADER_SIZE || header->version != WATCH_VERSION) continue;
+        count = unpack_bytes(header->count, sizeof(header->count));
+        serverID = unpack_bytes(header->serverID, sizeof(header->serverID));
+        if (header->command == WATCH_MOVES && length == (int)(WATCH_HEADER_SIZE + count * sizeof(struct Watch_Move))) {
+            for (i = 0; i < count; i++) watch_move(table, serverID, (const struct Watch_Move *)(datagram + WATCH_HEADER_SIZE) + i);
+        } else if (header->command == WATCH_SNAPSHOT && length == (int)(WATCH_HEADER_SIZE + count * sizeof(struct Watch_Board))) {
+            for (i = 0; i < count; i++) watch_board(table, serverID, (const struct Watch_Board *)(datagram + WATCH_HEADER_SIZE) + i);
+        }
+    }
+}
@@ -0,0 +1,729 @@
+/***********************************************************/
+/* This program is a microbenchmark of the game logic of   */
+/* the 'net-enabled' version of tictactoe. It times the    */
+/* server's board checks, move validation, and searches    */
+/* over fixed sets of board states, away from the network. */
+/***********************************************************/
+
+/* #include files go here (the server's own come first, since it needs _GNU_SOURCE before any) */
+/* The kernels are timed straight from the server's own code, built without its main() */
+#define TTT_NO_MAIN
+#include "tictactoeServer.c"
+
+/**************************/
+/* ENVIRONMENT STRUCTURES */
+/**************************/
+
+/* The largest number of board states in a corpus. */
+#define MAX_CORPUS 8192
+/* The number of corpora of board states the kernels run over. */
+#define NUM_CORPORA 5
+/* The largest number of kernel results a baseline file can hold. */
+#define MAX_RESULTS 64
+/* The largest length of a kernel result's name (kernel and corpus). */
+#define RESULT_NAME_SIZE 64
+
+/* Structure for a board state of a corpus. */
+struct Position {
+    uint64_t p1Marks;       // bitboard of the squares marked by Player 1
+    uint64_t p2Marks;       // bitboard of the squares marked by Player 2
+};
+
+/* Structure for a fixed corpus of board states, the same on every run. */
+struct Corpus {
+    const char *name;                       // name the corpus is reported by
+    const struct Board_Variant *variant;    // board variant of every board state
+    struct Position positions[MAX_CORPUS];  // the board states
+    int numPositions;                       // number of board states
+};
+
+/* Structure for a kernel of the game logic and the corpus it is timed over. */
+struct Kernel {
+    const char *name;           // name of the server function timed
+    int corpus;                 // index of the corpus the kernel runs over
+    int coldTable;              // whether the transposition table is cleared before each pass
+    long (*run)(const struct Corpus *corpus, long *nodes, uint64_t *checksum);  // runs one pass over the corpus, returns the number of operations
+};
+
+/* Structure for the timing of a kernel, as printed and saved to a baseline file. */
+struct Kernel_Result {
+    char name[RESULT_NAME_SIZE];    // kernel and corpus names ("kernel/corpus")
+    double nsPerOp;                 // time (in nanoseconds) of each operation in the fastest sample
+    double nodesPerSec;             // board states searched per second in the fastest sample (0 if not a search)
+    uint64_t checksum;              // combined results of one pass, which only change if the kernel's answers do
+    long opsPerPass;                // number of operations of each pass over the corpus
+};
+
+/* Structure for the microbenchmark command line options. */
+struct Microbench_Config {
+    int numSamples;             // number of timed samples of each kernel
+    int sampleTime;             // minimum time (in milliseconds) of each sample
+    const char *filter;         // only kernels whose name contains it are run (NULL for every kernel)
+    const char *savePath;       // baseline file the results are saved to (NULL to not save them)
+    const char *comparePath;    // baseline file the results are compared to (NULL to not compare them)
+    double threshold;           // slowdown (in percent) from the baseline reported as a regression
+};
+
+/*********************************/
+/* MICROBENCHMARK INIT FUNCTIONS */
+/*********************************/
+
+/* The default number of timed samples of each kernel. */
+#define DEFAULT_SAMPLES 10
+/* The default minimum time (in milliseconds) of each sample. */
+#define DEFAULT_SAMPLE_TIME 50
+/* The default slowdown (in percent) from the baseline reported as a regression. */
+#define DEFAULT_THRESHOLD 10
+
+void handle_microbench_error(const char *msg, int errnum);
+void extract_microbench_args(int argc, char *argv[], struct Microbench_Config *config);
+
+/********************/
+/* CORPUS FUNCTIONS */
+/********************/
+
+/* The number of random games played to sample the board states of larger boards. */
+#define SAMPLE_GAMES 100000
+/* The seed of the random games, so every run samples the same board states. */
+#define SAMPLE_SEED 0x2545F4914F6CDD1DULL
+/* The fewest marks on a 4x4 board state searched to the end of the game. */
+#define LATE_GAME_MARKS 6
+/* The depth (in moves) of the fixed-depth alpha-beta searches of 5x5 board states. */
+#define FIXED_SEARCH_DEPTH 4
+
+void build_corpora(void);
+void explore_positions(struct Corpus *corpus, struct TTT_Game *game, int isP1Turn, int p1Only, char *visited);
+void sample_positions(struct Corpus *corpus, int p1Only, int minMarks, int maxMarks, int maxPositions);
+void add_position(struct Corpus *corpus, const struct TTT_Game *game);
+void load_position(struct TTT_Game *game, const struct Corpus *corpus, int i);
+
+/********************/
+/* KERNEL FUNCTIONS */
+/********************/
+
+long run_check_win(const struct Corpus *corpus, long *nodes, uint64_t *checksum);
+long run_check_draw(const struct Corpus *corpus, long *nodes, uint64_t *checksum);
+long run_validate_move(const struct Corpus *corpus, long *nodes, uint64_t *checksum);
+long run_validate_marks(const struct Corpus *corpus, long *nodes, uint64_t *checksum);
+long run_canonical_board(const struct Corpus *corpus, long *nodes, uint64_t *checksum);
+long run_load_v6(const struct Corpus *corpus, long *nodes, uint64_t *checksum);
+long run_load_v7(const struct Corpus *corpus, long *nodes, uint64_t *checksum);
+long run_find_table_move(const struct Corpus *corpus, long *nodes, uint64_t *checksum);
+long run_search_best_move(const struct Corpus *corpus, long *nodes, uint64_t *checksum);
+long run_alpha_beta(const struct Corpus *corpus, long *nodes, uint64_t *checksum);
+
+/********************/
+/* TIMING FUNCTIONS */
+/********************/
+
+void time_sample(const struct Kernel *kernel, const struct Microbench_Config *config, struct Kernel_Result *result);
+void print_result(const struct Kernel_Result *result);
+int save_baseline(const char *path, const struct Kernel_Result *results, int numResults);
+int load_baseline(const char *path, struct Kernel_Result *results);
+int compare_baseline(const struct Kernel_Result *baseline, int numBaseline, const struct Kernel_Result *results, int numResults, double threshold);
+
+/* The corpora of board states: every reachable 3x3 board state, those with Player 1 to move,
+ * and board states sampled from random games on larger boards. */
+static struct Corpus corpora[NUM_CORPORA];
+/* The kernels timed, in the order they are printed. */
+static const struct Kernel kernels[] = {
+    {"check_win", 0, 0, run_check_win},
+    {"check_win", 2, 0, run_check_win},
+    {"check_draw", 0, 0, run_check_draw},
+    {"validate_move", 1, 0, run_validate_move},
+    {"validate_marks", 1, 0, run_validate_marks},
+    {"validate_marks", 3, 0, run_validate_marks},
+    {"canonical_board", 2, 0, run_canonical_board},
+    {"load_shared_state_v6", 1, 0, run_load_v6},
+    {"load_shared_state_v7", 1, 0, run_load_v7},
+    {"find_table_move", 1, 0, run_find_table_move},
+    {"search_best_move", 1, 1, run_search_best_move},
+    {"search_best_move", 3, 1, run_search_best_move},
+    {"alpha_beta", 4, 1, run_alpha_beta}
+};
+/* The connection the boards of RESUME_GAME commands are loaded from. */
+static struct Connection benchConn;
+/* The metrics the kernels keep, as a shard or worker would (searches count their board states). */
+static struct Metrics benchMetrics;
+
+/**
+ * @brief This program microbenchmarks the game logic of the TicTacToe server. Each kernel (a
+ * server function) is run over a fixed corpus of board states, pass after pass, for a number
+ * of samples, and the time of each operation (and number of board states searched per second)
+ * in its fastest sample is printed. The results can be saved to a baseline file, and compared
+ * to one saved earlier so that a slowdown shows up before the server is deployed.
+ *
+ * @param argc Non-negative value representing the number of arguments passed to the program
+ * from the environment in which the program is run.
+ * @param argv Pointer to the first element of an array of argc + 1 pointers, of which the
+ * last one is NULL and the previous ones, if any, point to strings that represent the
+ * arguments passed to the program from the host environment. If argv[0] is not a NULL
+ * pointer (or, equivalently, if argc > 0), it points to a string that represents the program
+ * name, which is empty if the program name is not available from the host environment.
+ * @return If the return statement is used, the return value is used as the argument to the
+ * implicit call to exit(). The values zero and EXIT_SUCCESS indicate successful termination,
+ * the value EXIT_FAILURE indicates unsuccessful termination.
+ */
+int main(int argc, char *argv[]) {
+    int i, round, numResults = 0, numBaseline = 0;
+    static struct Kernel_Result results[MAX_RESULTS], baseline[MAX_RESULTS];
+    const struct Kernel *selected[MAX_RESULTS];
+    struct Microbench_Config config;
+
+    /* Extract arguments to their respective variables */
+    extract_microbench_args(argc, argv, &config);
+    if (config.comparePath != NULL && (numBaseline = load_baseline(config.comparePath, baseline)) == ERROR_CODE) {
+        handle_microbench_error("main: Invalid baseline file", 0);
+    }
+    /* Prepare the search engine and move table the way the server does, without its messages */
+    logLevel = LOG_ERROR;
+    threadMetrics = &benchMetrics;
+    init_search_engine(DEFAULT_SEARCH_TIME);
+    init_move_table();
+    build_corpora();
+
+    /* Pick the kernels to time */
+    for (i = 0; i < (int)(sizeof(kernels) / sizeof(kernels[0])); i++) {
+        struct Kernel_Result *result = &results[numResults];
+        snprintf(result->name, sizeof(result->name), "%s/%s", kernels[i].name, corpora[kernels[i].corpus].name);
+        if (config.filter != NULL && strstr(result->name, config.filter) == NULL) continue;
+        selected[numResults++] = &kernels[i];
+    }
+    /* Time every kernel once per round, so a slow spell of the machine doesn't hit only one */
+    for (round = 0; round < config.numSamples; round++) {
+        for (i = 0; i < numResults; i++) time_sample(selected[i], &config, &results[i]);
+    }
+    printf("%-40s %10s %12s %14s\n", "kernel/corpus", "ops/pass", "ns/op", "nodes/sec");
+    for (i = 0; i < numResults; i++) print_result(&results[i]);
+
+    /* Save the results and compare them to the baseline */
+    if (config.savePath != NULL && save_baseline(config.savePath, results, numResults) == ERROR_CODE) {
+        print_error("main: Could not save the baseline", errno, 1);
+    }
+    if (config.comparePath != NULL && compare_baseline(baseline, numBaseline, results, numResults, config.threshold) > 0) {
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
+
+/**
+ * @brief Prints a string describing the initialization error and provided error number (if
+ * nonzero), the correct command usage, and exits the process signaling unsuccessful termination.
+ *
+ * @param msg The error description message to display.
+ * @param errnum This is the error number, usually errno.
+ */
+void handle_microbench_error(const char *msg, int errnum) {
+    print_error(msg, errnum, 0);
+    printf("Usage is: tictactoeMicrobench [-r samples] [-m sample-ms] [-f filter] [-o save-baseline] [-c compare-baseline] [-x threshold-percent]\n");
+    /* Exits the process signaling unsuccessful termination */
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Extracts the user provided arguments to their respective local variables and performs
+ * validation on their formatting. If any errors are found, the function terminates the process.
+ *
+ * @param argc Non-negative value representing the number of arguments passed to the program
+ * from the environment in which the program is run.
+ * @param argv Pointer to the first element of an array of argc + 1 pointers, of which the
+ * last one is NULL and the previous ones, if any, point to strings that represent the
+ * arguments passed to the program from the host environment. If argv[0] is not a NULL
+ * pointer (or, equivalently, if argc > 0), it points to a string that represents the program
+ * name, which is empty if the program name is not available from the host environment.
+ * @param config The microbenchmark options to store the extracted arguments in.
+ */
+void extract_microbench_args(int argc, char *argv[], struct Microbench_Config *config) {
+    int opt;
+    config->numSamples = DEFAULT_SAMPLES;
+    config->sampleTime = DEFAULT_SAMPLE_TIME;
+    config->filter = NULL;
+    config->savePath = NULL;
+    config->comparePath = NULL;
+    config->threshold = DEFAULT_THRESHOLD;
+    /* Extract and validate the optional arguments */
+    while ((opt = getopt(argc, argv, "r:m:f:o:c:x:")) != -1) {
+        switch (opt) {
+            case 'r':
+                config->numSamples = strtol(optarg, NULL, 10);
+                if (config->numSamples < 1) handle_microbench_error("extract_microbench_args: Invalid number of samples", 0);
+                break;
+            case 'm':
+                config->sampleTime = strtol(optarg, NULL, 10);
+                if (config->sampleTime < 1) handle_microbench_error("extract_microbench_args: Invalid sample time", 0);
+                break;
+            case 'f':
+                config->filter = optarg;
+                break;
+            case 'o':
+                config->savePath = optarg;
+                break;
+            case 'c':
+                config->comparePath = optarg;
+                break;
+            case 'x':
+                config->threshold = strtod(optarg, NULL);
+                if (config->threshold <= 0) handle_microbench_error("extract_microbench_args: Invalid regression threshold", 0);
+                break;
+            default:
+                handle_microbench_error("extract_microbench_args: Invalid option", 0);
+        }
+    }
+    /* There are no positional args */
+    if (argc != optind) handle_microbench_error("argc: Invalid number of command line arguments", 0);
+}
+
+/**
+ * @brief Builds every corpus of board states. The 3x3 corpora hold every reachable board state,
+ * and the corpora of larger boards hold board states sampled from seeded random games.
+ */
+void build_corpora(void) {
+    char *visited;
+    struct TTT_Game game = {0};
+    if ((visited = calloc(MOVE_TABLE_SIZE, sizeof(char))) == NULL) print_error("build_corpora: calloc", errno, 1);
+    /* Every board state reachable from an empty board, finished games included */
+    corpora[0].name = "3x3-all";
+    game.variant = corpora[0].variant = get_variant(ROWS, ROWS);
+    explore_positions(&corpora[0], &game, 1, 0, visited);
+    /* Every board state with Player 1 to move (as loaded, validated, and searched by the server) */
+    memset(visited, 0, MOVE_TABLE_SIZE);
+    corpora[1].name = "3x3-p1";
+    corpora[1].variant = game.variant;
+    explore_positions(&corpora[1], &game, 1, 1, visited);
+    free(visited);
+    /* Board states of random 4x4 and 5x5 games */
+    corpora[2].name = "4x4-sampled";
+    corpora[2].variant = get_variant(4, 4);
+    sample_positions(&corpora[2], 0, 0, 16, MAX_CORPUS);
+    corpora[3].name = "4x4-late-p1";
+    corpora[3].variant = get_variant(4, 4);
+    sample_positions(&corpora[3], 1, LATE_GAME_MARKS, 16, 256);
+    corpora[4].name = "5x5k4-midgame-p1";
+    corpora[4].variant = get_variant(5, 4);
+    sample_positions(&corpora[4], 1, 4, 10, 256);
+}
+
+/**
+ * @brief Adds every board state reachable from the current one to a corpus, once each. The
+ * search stops at finished games, which are added unless only Player 1's turns are.
+ *
+ * @param corpus The corpus of board states being built.
+ * @param game The game board being explored.
+ * @param isP1Turn Whether it is Player 1's turn or not.
+ * @param p1Only Whether only unfinished board states with Player 1 to move are added.
+ * @param visited The board states that have already been visited.
+ */
+void explore_positions(struct Corpus *corpus, struct TTT_Game *game, int isP1Turn, int p1Only, char *visited) {
+    int i, index = encode_board(game), over = check_win(game) || check_draw(game);
+    if (visited[index]) return;
+    visited[index] = 1;
+    if (!p1Only || (isP1Turn && !over)) add_position(corpus, game);
+    if (over) return;
+    /* Visit the states reached by each possible move */
+    for (i = 0; i < GAME_SIZE; i++) {
+        if (is_open_square(i, game)) {
+            uint64_t *marks = (isP1Turn) ? &game->p1Marks : &game->p2Marks;
+            *marks |= SQUARE_BIT(i);
+            explore_positions(corpus, game, !isP1Turn, p1Only, visited);
+            *marks &= ~SQUARE_BIT(i);
+        }
+    }
+}
+
+/**
+ * @brief Adds the board states of seeded random games to a corpus until it holds the given
+ * number of board states (or the games run out).
+ *
+ * @param corpus The corpus of board states being built (its variant already set).
+ * @param p1Only Whether only unfinished board states with Player 1 to move are added.
+ * @param minMarks The fewest marks on a board state added.
+ * @param maxMarks The most marks on a board state added.
+ * @param maxPositions The number of board states to add.
+ */
+void sample_positions(struct Corpus *corpus, int p1Only, int minMarks, int maxMarks, int maxPositions) {
+    int i, numMarks;
+    uint64_t state = SAMPLE_SEED;
+    struct TTT_Game game = {0};
+    game.variant = corpus->variant;
+    for (i = 0; i < SAMPLE_GAMES && corpus->numPositions < maxPositions; i++) {
+        init_shared_state(&game);
+        for (numMarks = 0; corpus->numPositions < maxPositions; numMarks++) {
+            int over = check_win(&game) || check_draw(&game), square;
+            if (numMarks >= minMarks && numMarks <= maxMarks && (!p1Only || (numMarks % 2 == 0 && !over))) add_position(corpus, &game);
+            if (over) break;
+            /* Mark a random empty square for the player to move */
+            do {
+                square = next_random(&state) % corpus->variant->numSquares;
+            } while (!is_open_square(square, &game));
+            if (numMarks % 2 == 0) game.p1Marks |= SQUARE_BIT(square);
+            else game.p2Marks |= SQUARE_BIT(square);
+        }
+    }
+}
+
+/**
+ * @brief Adds the board state of a game to a corpus.
+ *
+ * @param corpus The corpus of board states being built.
+ * @param game The game whose board state is added.
+ */
+void add_position(struct Corpus *corpus, const struct TTT_Game *game) {
+    if (corpus->numPositions == MAX_CORPUS) print_error("add_position: Corpus is full", 0, 1);
+    corpus->positions[corpus->numPositions].p1Marks = game->p1Marks;
+    corpus->positions[corpus->numPositions].p2Marks = game->p2Marks;
+    corpus->numPositions++;
+}
+
+/**
+ * @brief Sets up a game with one of the board states of a corpus.
+ *
+ * @param game The game to set up.
+ * @param corpus The corpus of board states.
+ * @param i The index of the board state in the corpus.
+ */
+void load_position(struct TTT_Game *game, const struct Corpus *corpus, int i) {
+    game->variant = corpus->variant;
+    game->p1Marks = corpus->positions[i].p1Marks;
+    game->p2Marks = corpus->positions[i].p2Marks;
+    game->winner = -1;
+}
+
+/**
+ * @brief Checks every board state of the corpus for a winner.
+ *
+ * @param corpus The corpus of board states.
+ * @param nodes Unused (the kernel does not search).
+ * @param checksum The combined results of the pass.
+ * @return The number of operations of the pass.
+ */
+long run_check_win(const struct Corpus *corpus, long *nodes, uint64_t *checksum) {
+    int i;
+    struct TTT_Game game = {0};
+    for (i = 0; i < corpus->numPositions; i++) {
+        load_position(&game, corpus, i);
+        *checksum = *checksum * 31 + check_win(&game);
+    }
+    return corpus->numPositions;
+}
+
+/**
+ * @brief Checks every board state of the corpus for a full board.
+ *
+ * @param corpus The corpus of board states.
+ * @param nodes Unused (the kernel does not search).
+ * @param checksum The combined results of the pass.
+ * @return The number of operations of the pass.
+ */
+long run_check_draw(const struct Corpus *corpus, long *nodes, uint64_t *checksum) {
+    int i;
+    struct TTT_Game game = {0};
+    for (i = 0; i < corpus->numPositions; i++) {
+        load_position(&game, corpus, i);
+        *checksum = *checksum * 31 + check_draw(&game);
+    }
+    return corpus->numPositions;
+}
+
+/**
+ * @brief Validates every move Player 1 can make on the board states of the corpus (invalid
+ * moves are left out, since the time taken to log them would be timed instead).
+ *
+ * @param corpus The corpus of board states (with Player 1 to move).
+ * @param nodes Unused (the kernel does not search).
+ * @param checksum The combined results of the pass.
+ * @return The number of operations of the pass.
+ */
+long run_validate_move(const struct Corpus *corpus, long *nodes, uint64_t *checksum) {
+    int i, square;
+    long ops = 0;
+    struct TTT_Game game = {0};
+    for (i = 0; i < corpus->numPositions; i++) {
+        load_position(&game, corpus, i);
+        for (square = 1; square <= corpus->variant->numSquares; square++) {
+            if (!is_open_square(square-1, &game)) continue;
+            *checksum = *checksum * 31 + validate_move(square, &game);
+            ops++;
+        }
+    }
+    return ops;
+}
+
+/**
+ * @brief Validates the bitboards of every board state of the corpus as received by RESUME_GAME.
+ *
+ * @param corpus The corpus of board states (with Player 1 to move).
+ * @param nodes Unused (the kernel does not search).
+ * @param checksum The combined results of the pass.
+ * @return The number of operations of the pass.
+ */
+long run_validate_marks(const struct Corpus *corpus, long *nodes, uint64_t *checksum) {
+    int i;
+    struct TTT_Game game = {0};
+    game.variant = corpus->variant;
+    for (i = 0; i < corpus->numPositions; i++) {
+        *checksum = *checksum * 31 + validate_marks(&game, corpus->positions[i].p1Marks, corpus->positions[i].p2Marks);
+    }
+    return corpus->numPositions;
+}
+
+/**
+ * @brief Finds the canonical form (under rotation and reflection) of every board state of the
+ * corpus, as the position cache does.
+ *
+ * @param corpus The corpus of board states.
+ * @param nodes Unused (the kernel does not search).
+ * @param checksum The combined results of the pass.
+ * @return The number of operations of the pass.
+ */
+long run_canonical_board(const struct Corpus *corpus, long *nodes, uint64_t *checksum) {
+    int i;
+    for (i = 0; i < corpus->numPositions; i++) {
+        uint64_t canonP1, canonP2;
+        int symmetry = canonical_board(corpus->variant, corpus->positions[i].p1Marks, corpus->positions[i].p2Marks, &canonP1, &canonP2);
+        *checksum = (*checksum * 31 + symmetry) * 31 + (canonP1 ^ (canonP2 << 1));
+    }
+    return corpus->numPositions;
+}
+
+/**
+ * @brief Loads every board state of the corpus as received with a version 6 RESUME_GAME command,
+ * a mark for every square, copied into the connection's input buffer the way read_input would.
+ *
+ * @param corpus The corpus of board states (with Player 1 to move).
+ * @param nodes Unused (the kernel does not search).
+ * @param checksum The combined results of the pass.
+ * @return The number of operations of the pass.
+ */
+long run_load_v6(const struct Corpus *corpus, long *nodes, uint64_t *checksum) {
+    int i, square;
+    const int numSquares = corpus->variant->numSquares;
+    struct TTT_Game game = {0};
+    game.variant = corpus->variant;
+    game.conn = &benchConn;
+    benchConn.version = VERSION;
+    for (i = 0; i < corpus->numPositions; i++) {
+        const struct Position *pos = &corpus->positions[i];
+        for (square = 0; square < numSquares; square++) {
+            benchConn.input[square] = (pos->p1Marks & SQUARE_BIT(square)) ? P1_MARK : (pos->p2Marks & SQUARE_BIT(square)) ? P2_MARK : 0;
+        }
+        benchConn.inputHead = 0;
+        benchConn.inputLength = numSquares;
+        *checksum = *checksum * 31 + load_shared_state(&game) + game.p1Marks;
+    }
+    return corpus->numPositions;
+}
+
+/**
+ * @brief Loads every board state of the corpus as received with a version 7 RESUME_GAME command,
+ * the packed bitboards of both players, copied into the connection's input buffer the way
+ * read_input would.
+ *
+ * @param corpus The corpus of board states (with Player 1 to move).
+ * @param nodes Unused (the kernel does not search).
+ * @param checksum The combined results of the pass.
+ * @return The number of operations of the pass.
+ */
+long run_load_v7(const struct Corpus *corpus, long *nodes, uint64_t *checksum) {
+    int i;
+    const int maskBytes = MASK_BYTES(corpus->variant->numSquares);
+    struct TTT_Game game = {0};
+    game.variant = corpus->variant;
+    game.conn = &benchConn;
+    benchConn.version = FRAMED_VERSION;
+    for (i = 0; i < corpus->numPositions; i++) {
+        pack_bytes((unsigned char *)benchConn.input, corpus->positions[i].p1Marks, maskBytes);
+        pack_bytes((unsigned char *)benchConn.input + maskBytes, corpus->positions[i].p2Marks, maskBytes);
+        benchConn.inputHead = 0;
+        benchConn.inputLength = 2 * maskBytes;
+        *checksum = *checksum * 31 + load_shared_state(&game) + game.p1Marks;
+    }
+    return corpus->numPositions;
+}
+
+/**
+ * @brief Looks up Player 1's move for every board state of the corpus in the move table.
+ *
+ * @param corpus The corpus of board states (with Player 1 to move).
+ * @param nodes Unused (the kernel does not search).
+ * @param checksum The combined results of the pass.
+ * @return The number of operations of the pass.
+ */
+long run_find_table_move(const struct Corpus *corpus, long *nodes, uint64_t *checksum) {
+    int i;
+    struct TTT_Game game = {0};
+    for (i = 0; i < corpus->numPositions; i++) {
+        load_position(&game, corpus, i);
+        *checksum = *checksum * 31 + find_table_move(&game);
+    }
+    return corpus->numPositions;
+}
+
+/**
+ * @brief Searches for Player 1's move, with no time limit, on every board state of the corpus.
+ *
+ * @param corpus The corpus of board states (with Player 1 to move).
+ * @param nodes The number of board states searched.
+ * @param checksum The combined results of the pass.
+ * @return The number of operations of the pass.
+ */
+long run_search_best_move(const struct Corpus *corpus, long *nodes, uint64_t *checksum) {
+    int i;
+    struct TTT_Game game = {0};
+    unsigned long searched = atomic_load(&benchMetrics.counters[METRIC_SEARCH_NODES]);
+    for (i = 0; i < corpus->numPositions; i++) {
+        load_position(&game, corpus, i);
+        *checksum = *checksum * 31 + search_best_move(&game, 0);
+    }
+    /* search_best_move counts the board states it searched in the thread's metrics */
+    *nodes += atomic_load(&benchMetrics.counters[METRIC_SEARCH_NODES]) - searched;
+    return corpus->numPositions;
+}
+
+/**
+ * @brief Runs a fixed-depth alpha-beta search (the server's minimax) from every board state of
+ * the corpus, Player 1 to move.
+ *
+ * @param corpus The corpus of board states (with Player 1 to move).
+ * @param nodes The number of board states searched.
+ * @param checksum The combined results of the pass.
+ * @return The number of operations of the pass.
+ */
+long run_alpha_beta(const struct Corpus *corpus, long *nodes, uint64_t *checksum) {
+    int i;
+    for (i = 0; i < corpus->numPositions; i++) {
+        const struct Position *pos = &corpus->positions[i];
+        uint64_t keys[NUM_SYMMETRIES];
+        struct Search search = {0};
+        search.variant = corpus->variant;
+        /* Hash the board state the way search_best_move does */
+        hash_board(corpus->variant, pos->p1Marks, pos->p2Marks, keys);
+        *checksum = *checksum * 31 + alpha_beta(&search, pos->p1Marks, pos->p2Marks, 0, keys, FIXED_SEARCH_DEPTH, 0, -INT32_MAX, INT32_MAX, -1);
+        *nodes += search.nodes;
+    }
+    return corpus->numPositions;
+}
+
+/**
+ * @brief Takes a timed sample of a kernel over its corpus, running pass after pass until the
+ * sample time is up. Only the fastest sample of a kernel is kept, since anything else running
+ * on the machine can only slow a sample down.
+ *
+ * @param kernel The kernel to time.
+ * @param config The microbenchmark options.
+ * @param result The timing of the kernel, updated if the sample is its fastest.
+ */
+void time_sample(const struct Kernel *kernel, const struct Microbench_Config *config, struct Kernel_Result *result) {
+    uint64_t elapsed = 0, passChecksum = 0;
+    long ops = 0, nodes = 0;
+    double nsPerOp;
+    while (elapsed < (uint64_t)config->sampleTime * 1000000) {
+        uint64_t start;
+        /* Searches start from an empty transposition table, so every pass searches the same */
+        if (kernel->coldTable) memset(transpositionTable, 0, TT_SIZE * sizeof(struct TT_Entry));
+        passChecksum = 0;
+        start = monotonic_time();
+        result->opsPerPass = kernel->run(&corpora[kernel->corpus], &nodes, &passChecksum);
+        elapsed += monotonic_time() - start;
+        ops += result->opsPerPass;
+    }
+    result->checksum = passChecksum;
+    nsPerOp = (double)elapsed / ops;
+    if (result->nsPerOp == 0 || nsPerOp < result->nsPerOp) {
+        result->nsPerOp = nsPerOp;
+        result->nodesPerSec = nodes / (elapsed / 1e9);
+    }
+}
+
+/**
+ * @brief Prints the timing of a kernel.
+ *
+ * @param result The timing of the kernel.
+ */
+void print_result(const struct Kernel_Result *result) {
+    if (result->nodesPerSec > 0) {
+        printf("%-40s %10ld %12.1f %14.0f\n", result->name, result->opsPerPass, result->nsPerOp, result->nodesPerSec);
+    } else {
+        printf("%-40s %10ld %12.1f %14s\n", result->name, result->opsPerPass, result->nsPerOp, "-");
+    }
+}
+
+/**
+ * @brief Saves the kernel results to a baseline file, one kernel per line.
+ *
+ * @param path The path of the baseline file.
+ * @param results The kernel results.
+ * @param numResults The number of kernel results.
+ * @return 0 if the baseline was saved, or an error code if there was an issue.
+ */
+int save_baseline(const char *path, const struct Kernel_Result *results, int numResults) {
+    int i;
+    FILE *out = fopen(path, "w");
+    if (out == NULL) return ERROR_CODE;
+    fprintf(out, "# kernel/corpus ns/op nodes/sec checksum\n");
+    for (i = 0; i < numResults; i++) {
+        fprintf(out, "%s %.3f %.0f %016llx\n", results[i].name, results[i].nsPerOp, results[i].nodesPerSec, (unsigned long long)results[i].checksum);
+    }
+    if (fclose(out) != 0) return ERROR_CODE;
+    printf("[+]Saved %d result(s) to %s\n", numResults, path);
+    return 0;
+}
+
+/**
+ * @brief Loads the kernel results saved to a baseline file.
+ *
+ * @param path The path of the baseline file.
+ * @param results The kernel results loaded (MAX_RESULTS at most).
+ * @return The number of kernel results loaded, or an error code if there was an issue.
+ */
+int load_baseline(const char *path, struct Kernel_Result *results) {
+    int numResults = 0;
+    char line[256];
+    FILE *in = fopen(path, "r");
+    if (in == NULL) return ERROR_CODE;
+    while (fgets(line, sizeof(line), in) != NULL) {
+        struct Kernel_Result *result = &results[numResults];
+        unsigned long long checksum;
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (numResults == MAX_RESULTS || sscanf(line, "%63s %lf %lf %llx", result->name, &result->nsPerOp, &result->nodesPerSec, &checksum) != 4) {
+            fclose(in);
+            return ERROR_CODE;
+        }
+        result->checksum = checksum;
+        numResults++;
+    }
+    fclose(in);
+    return numResults;
+}
+
+/**
+ * @brief Compares the kernel results to a baseline and prints the change of each. A kernel
+ * slower than its baseline by more than the threshold is a regression, and a kernel whose
+ * checksum changed now gives different answers (e.g. a search picks another of equal moves).
+ *
+ * @param baseline The kernel results of the baseline.
+ * @param numBaseline The number of kernel results of the baseline.
+ * @param results The kernel results.
+ * @param numResults The number of kernel results.
+ * @param threshold The slowdown (in percent) reported as a regression.
+ * @return The number of regressions.
+ */
+int compare_baseline(const struct Kernel_Result *baseline, int numBaseline, const struct Kernel_Result *results, int numResults, double threshold) {
+    int i, j, numRegressions = 0;
+    printf("%-40s %12s %12s %9s\n", "kernel/corpus", "baseline", "ns/op", "change");
+    for (i = 0; i < numResults; i++) {
+        double change;
+        for (j = 0; j < numBaseline && strcmp(baseline[j].name, results[i].name) != 0; j++);
+        if (j == numBaseline) {
+            printf("%-40s %12s %12.1f %9s\n", results[i].name, "-", results[i].nsPerOp, "new");
+            continue;
+        }
+        change = 100 * (results[i].nsPerOp / baseline[j].nsPerOp - 1);
+        printf("%-40s %12.1f %12.1f %+8.1f%%%s%s\n", results[i].name, baseline[j].nsPerOp, results[i].nsPerOp, change,
+            (change > threshold) ? "  REGRESSION" : "", (results[i].checksum != baseline[j].checksum) ? "  (answers changed)" : "");
+        numRegressions += (change > threshold);
+    }
+    if (numRegressions > 0) {
+        printf("%d kernel(s) slower than the baseline by more than %.1f%%\n", numRegressions, threshold);
+    }
+    return numRegressions;
+}
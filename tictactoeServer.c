@@ -5,57 +5,580 @@
 /***********************************************************/
 
 /* #include files go here */
+#ifdef __linux__
+#define _GNU_SOURCE     // for recvmmsg() and sendmmsg()
+#endif
 #include <arpa/inet.h>
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <ifaddrs.h>
 #include <netdb.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
 
 /**************************/
 /* ENVIRONMENT STRUCTURES */
 /**************************/
 
-/* The number of rows for the TicIacToe board. */
+/* The number of rows for the default TicIacToe board. */
 #define ROWS 3
-/* The number of columns for the TicIacToe board. */
+/* The number of columns for the default TicIacToe board. */
 #define COLUMNS 3
-/* The size (in bytes) of the game state. */
+/* The size (in bytes) of the default game state. */
 #define GAME_SIZE (ROWS * COLUMNS)
-/* The maximum number of games the server can play simultaneously. */
-#define MAX_GAMES 10
+/* The smallest number of rows and columns (and marks in a row to win) a board can have. */
+#define MIN_BOARD_SIZE 3
+/* The largest number of rows and columns a board can have. */
+#define MAX_BOARD_SIZE 8
+/* The largest number of squares a board can have. */
+#define MAX_SQUARES (MAX_BOARD_SIZE * MAX_BOARD_SIZE)
+/* An upper bound on the number of winning lines a board can have. */
+#define MAX_LINES (4 * MAX_SQUARES)
+/* An upper bound on the number of winning lines through a single square. */
+#define MAX_SQUARE_LINES (4 * MAX_BOARD_SIZE)
+/* The number of rotations and reflections of a square board (including leaving it as is). */
+#define NUM_SYMMETRIES 8
+/* The bitboard with only the given square of the game board set. */
+#define SQUARE_BIT(square) ((uint64_t)1 << (square))
+/* The bitboard with every square of a board with the given number of squares set. */
+#define BOARD_MASK(numSquares) (((numSquares) == 64) ? ~(uint64_t)0 : SQUARE_BIT(numSquares) - 1)
+/* The default maximum number of games the server can play simultaneously. */
+#define DEFAULT_MAX_GAMES 10
+/* The number of bits of a game ID used for the game's slot in the game roster. */
+#define GAME_SLOT_BITS 20
+/* The largest maximum number of games the server can be configured to play simultaneously. */
+#define MAX_GAMES (1 << GAME_SLOT_BITS)
+/* The number of games of the game roster initialized together as players need them. */
+#define ROSTER_SLAB_SIZE 256
+/* The size (in bytes) of a cache line, which the games and connections are aligned to. */
+#define CACHE_LINE_SIZE 64
+/* The number of searches each worker of the worker pool can have waiting. */
+#define WORK_QUEUE_SIZE 256
+/* The largest size (in bytes) of a version 7 frame, its header included. */
+#define MAX_FRAME_SIZE 2048
+/* The size (in bytes) of each connection's input ring buffer (must be a power of 2 that fits a whole frame). */
+#define INPUT_BUFFER_SIZE 2048
+/* The size (in bytes) of each connection's queue of commands to send together (one version 7 frame). */
+#define OUTPUT_BUFFER_SIZE MAX_FRAME_SIZE
+/* The fewest buckets of a shard's table of multiplexed games (must be a power of 2). */
+#define CHANNEL_BUCKETS 16
+/* The number of bits of a deadline (in ticks) each level of a timer wheel covers. */
+#define TIMER_LEVEL_BITS 6
+/* The number of slots of each level of a timer wheel. */
+#define TIMER_SLOTS (1 << TIMER_LEVEL_BITS)
+/* The number of levels of a timer wheel (each level's slots are as long as the whole level below). */
+#define TIMER_LEVELS 3
+/* The number of buckets of the table of games reserved for remote players (must be a power of 2). */
+#define RESERVATION_BUCKETS 256
+/* The largest number of multicast groups the server joins. */
+#define MAX_GROUPS 8
+/* The largest size (in bytes) of a datagram published to the watch channel (fits an Ethernet frame). */
+#define WATCH_DATAGRAM_SIZE 1400
+/* The number of buffers an io_uring instance provides the kernel to receive into (must be a power of 2). */
+#define URING_BUFFERS 512
+/* The number of buffers one socket's received bytes may fill before its receive pauses until they are taken. */
+#define URING_MAX_CHUNKS 8
+/* The maximum number of UDP datagrams received or sent together. */
+#define UDP_BATCH_SIZE 64
+/* The largest size (in bytes) of a logged message. */
+#define LOG_MESSAGE_SIZE 192
+/* The number of counters each thread keeps metrics for. */
+#define NUM_COUNTERS 16
+/* The number of latency histograms each thread keeps metrics for. */
+#define NUM_HISTOGRAMS 7
+/* The number of buckets of a latency histogram (an underflow bucket, 4 per power of 2, and an overflow bucket). */
+#define HISTOGRAM_BUCKETS 98
+
+/* Structure for the load a server advertises with the GAME_AVAILABLE command. */
+struct Server_Load {
+    char version;               // version number of the load information
+    char reserved;              // unused (keeps the counts aligned)
+    uint16_t freeSlots;         // number of games available to new players (network byte order)
+    uint16_t activeGames;       // number of games being played (network byte order)
+    uint16_t pendingSearches;   // number of moves being searched for (network byte order)
+};
+
+/* Structure for the state of a game a server replicates to the rest of the multicast group. */
+struct Game_State {
+    char variant;                   // encoded board variant of the game
+    char closed;                    // whether the game has ended (and its replica can be dropped)
+    unsigned char serverID[4];      // random ID of the server playing the game (little endian)
+    unsigned char gameNum[4];       // game ID on the server playing the game (little endian)
+    unsigned char wireNum[4];       // game number the remote player was sent (little endian)
+    unsigned char p1Marks[8];       // bitboard of the squares marked by Player 1 (little endian)
+    unsigned char p2Marks[8];       // bitboard of the squares marked by Player 2 (little endian)
+};
+
+/* Structure for the header of a datagram a server publishes to the spectators on the watch channel. */
+struct Watch_Header {
+    char version;                   // version number
+    char command;                   // WATCH_MOVES or WATCH_SNAPSHOT
+    unsigned char count[2];         // number of records following the header (little endian)
+    unsigned char serverID[4];      // random ID of the server playing the games (little endian)
+};
+
+/* Structure for a move (or the end) of a game published to the watch channel. */
+struct Watch_Move {
+    unsigned char gameNum[4];       // game ID on the server playing the game (little endian)
+    char variant;                   // encoded board variant of the game
+    char kind;                      // WATCH_P1_MOVE, WATCH_P2_MOVE, or WATCH_GAME_END
+    unsigned char square;           // square marked (from 1), or the winner of an ended game (WATCH_ABANDONED if it was left)
+    unsigned char numMoves;         // number of squares marked once the move is made
+};
+
+/* Structure for the board of a game in a snapshot published to the watch channel. */
+struct Watch_Board {
+    unsigned char gameNum[4];       // game ID on the server playing the game (little endian)
+    char variant;                   // encoded board variant of the game
+    unsigned char numMoves;         // number of squares marked
+    char reserved[2];               // unused (keeps the bitboards aligned)
+    unsigned char p1Marks[8];       // bitboard of the squares marked by Player 1 (little endian)
+    unsigned char p2Marks[8];       // bitboard of the squares marked by Player 2 (little endian)
+};
 
 /* Structure to send and recieve UDP player messages. */
 struct UDP_Buffer {
     char version;           // version number
     char command;           // player command
+    union {
+        struct Server_Load load;    // load of the server (GAME_AVAILABLE only)
+        struct Game_State state;    // state of a game played by the server (GAME_STATE only)
+    };
+};
+
+/* Structure for a batch of UDP player messages received or sent together. */
+struct UDP_Batch {
+    int count;                                      // number of datagrams in the batch
+    struct UDP_Buffer datagrams[UDP_BATCH_SIZE];    // the datagrams
+    struct sockaddr_in addrs[UDP_BATCH_SIZE];       // address each datagram came from (or is sent to)
 };
 
-/* Structure to send and recieve TCP player messages. */
+/* Structure for a TCP player message, decoded from a version 6 command or a command of a version 7 frame. */
 struct TCP_Buffer {
     char version;           // version number
     char command;           // player command
-    char data;              // data for command if applicable
-    char gameNum;           // game number
+    char data;              // data for command if applicable (a move is always an ASCII digit)
+    int gameNum;            // game number (a single byte in version 6, 32 bits in version 7)
+};
+
+/* Structure describing a socket descriptor that is ready to be processed. */
+struct Ready_Event {
+    int fd;                 // socket descriptor that is ready to be read
+    int tag;                // identifier the socket descriptor was registered with
+};
+
+/* Structure for the commands queued for a socket, sent together with those of other sockets. */
+struct Send_Request {
+    int fd;                 // socket descriptor to send to
+    const char *data;       // bytes to send
+    int length;             // number of bytes to send
+    int result;             // number of bytes sent, or the negative errno if the send failed
+};
+
+struct Event_Engine;
+
+/* Structure for a readiness notification backend used by the event engine. */
+struct Event_Backend {
+    const char *name;                                                       // name of the backend
+    int (*init)(struct Event_Engine *engine);                               // create backend resources
+    int (*add)(struct Event_Engine *engine, int fd, int tag);               // watch a socket descriptor
+    void (*remove)(struct Event_Engine *engine, int fd);                    // stop watching a socket descriptor
+    int (*wait)(struct Event_Engine *engine, struct Ready_Event *events, int maxEvents, int timeout);  // block for ready sockets
+    int (*accept)(struct Event_Engine *engine, int fd, struct sockaddr_in *addr, socklen_t *addrLength);  // take a new connection (NULL to call accept)
+    int (*recv)(struct Event_Engine *engine, int fd, char *buffer, int length);  // take received bytes (NULL to call recv)
+    void (*send)(struct Event_Engine *engine, struct Send_Request *requests, int count);  // send to many sockets at once (NULL to call send)
+    void (*watchOutput)(struct Event_Engine *engine, int fd, int tag, int blocked);  // watch a socket for room to send instead of input (or go back)
+};
+
+/* Structure for the event engine that tracks which socket descriptors are ready. */
+struct Event_Engine {
+    const struct Event_Backend *backend;    // readiness backend in use
+    int epfd;                               // epoll instance (epoll backend only)
+    int maxSD;                              // the max socket descriptor registered (select backend only)
+    fd_set activeFDS;                       // the set of registered socket descriptors (select backend only)
+    fd_set writeFDS;                        // the set of socket descriptors waiting to be sent to again (select backend only)
+    int tags[FD_SETSIZE];                   // the tag of each registered socket descriptor (select backend only)
+    struct Uring *uring;                    // io_uring instance and the state of its sockets (io_uring backend only)
+};
+
+#ifdef HAVE_IO_URING
+/* Structure for the state of a socket descriptor registered with the io_uring backend. */
+struct Uring_Watch {
+    int tag;                        // identifier reported back when the socket is ready
+    uint32_t generation;            // number of times the descriptor was registered (to drop completions of earlier ones)
+    int kind;                       // multishot request watching the socket (poll, accept, or receive), 0 if unregistered
+    int armed;                      // whether the multishot request is still active
+    int starved;                    // whether the receive stopped for lack of buffers and waits for one to be returned
+    int reported;                   // whether the socket is on the list of ready sockets
+    int awaitingOutput;             // whether a poll waits for the socket to be sent to again
+    int firstChunk;                 // buffer of the oldest received bytes not yet taken (-1 if none)
+    int lastChunk;                  // buffer of the newest received bytes not yet taken (-1 if none)
+    int chunkOffset;                // number of bytes of the oldest buffer already taken
+    int numChunks;                  // number of buffers holding received bytes not yet taken
+    int paused;                     // whether the receive was cancelled until fewer buffers are held
+    int closed;                     // 0 while receiving, URING_EOF once the peer closed, or the negative errno ending the receive
+};
+
+/* Structure for an io_uring instance, its rings, and the buffers the kernel receives into. */
+struct Uring {
+    int fd;                                 // io_uring instance
+    unsigned *sqHead;                       // index of the oldest submission the kernel has not consumed
+    unsigned *sqTail;                       // index of the next submission to queue
+    unsigned *sqArray;                      // indirection array of the submission ring
+    unsigned sqMask;                        // number of submission ring entries, minus 1
+    struct io_uring_sqe *sqes;              // submission queue entries
+    unsigned numQueued;                     // number of submissions queued but not yet submitted
+    unsigned *cqHead;                       // index of the oldest completion not yet handled
+    unsigned *cqTail;                       // index of the next completion the kernel posts
+    unsigned cqMask;                        // number of completion ring entries, minus 1
+    struct io_uring_cqe *cqes;              // completion queue entries
+    struct io_uring_buf_ring *bufRing;      // ring of buffers provided to the kernel for multishot receives
+    char *buffers;                          // memory of the provided buffers
+    int numFreeBuffers;                     // number of buffers owned by the kernel
+    int numStarved;                         // number of sockets waiting for a buffer to be returned
+    int chunkLength[URING_BUFFERS];         // number of bytes received into each buffer
+    int chunkNext[URING_BUFFERS];           // next buffer received for the same socket (-1 if none)
+    struct Uring_Watch *watches;            // state of each socket descriptor, by descriptor
+    int numWatches;                         // number of socket descriptors the watch table covers
+    int *ready;                             // sockets ready to be reported, in the order they became ready
+    int numReady;                           // number of sockets ready to be reported
+    int *accepted;                          // connections accepted by the multishot accept and not yet taken
+    int acceptedHead;                       // index of the oldest connection not yet taken
+    int numAccepted;                        // index past the newest connection accepted
+    int acceptedCapacity;                   // number of connections the accepted list can hold
+    struct Send_Request *sending;           // batch of sends being submitted
+    int numSent;                            // number of sends of the batch that completed
+};
+#endif
+
+/* Structure for a message waiting in the ring buffer of the logger. */
+struct Log_Entry {
+    atomic_size_t sequence;         // position in the ring buffer the entry can next be written (or read) at
+    int level;                      // log level of the message
+    struct timespec time;           // time the message was logged
+    char text[LOG_MESSAGE_SIZE];    // the message (without a trailing newline)
+};
+
+/* Structure for a latency histogram with log-linear buckets (4 buckets per power of 2 nanoseconds). */
+struct Histogram {
+    atomic_ulong buckets[HISTOGRAM_BUCKETS];    // number of latencies recorded in each bucket
+    atomic_ulong sum;                           // sum of every latency recorded (in nanoseconds)
+};
+
+/* Structure for the metrics of a thread, only ever updated by the thread itself. */
+struct Metrics {
+    atomic_ulong counters[NUM_COUNTERS];            // number of times each counted event happened
+    struct Histogram histograms[NUM_HISTOGRAMS];    // latencies of each timed operation
+};
+
+/* Structure for a board variant (board size and number of marks in a row needed to win). */
+struct Board_Variant {
+    int size;                                               // number of rows and columns
+    int winLength;                                          // number of marks in a row needed to win
+    int numSquares;                                         // number of squares on the board
+    int numLines;                                           // number of winning lines
+    uint64_t lines[MAX_LINES];                              // bitboards of every winning line
+    int numSquareLines[MAX_SQUARES];                        // number of winning lines through each square
+    uint64_t squareLines[MAX_SQUARES][MAX_SQUARE_LINES];    // bitboards of the winning lines through each square
+    int moveOrder[MAX_SQUARES];                             // squares ordered from the center outward
+    uint8_t symmetries[NUM_SYMMETRIES][MAX_SQUARES];        // square each square is moved to by each rotation or reflection
+    const uint64_t *rowSymmetries;                          // bitboard each row's marks are moved to by each rotation or reflection
+    uint64_t symmetryKeys[2][MAX_SQUARES][NUM_SYMMETRIES];  // Zobrist key of each player marking each square, as seen through each symmetry
+    uint64_t zobristKey;                                    // hash key distinguishing the variant's board states
+};
+
+/* Structure for an entry of the transposition table (or the position cache). */
+struct TT_Entry {
+    uint64_t check;                 // hash of the board state XORed with the data
+    uint64_t data;                  // packed score, best square, search depth, and bound (or best move and depth)
+};
+
+/* Structure for the state of a search for the best move. */
+struct Search {
+    const struct Board_Variant *variant;    // board variant being searched
+    struct timespec start;                  // time the search started
+    int timeLimit;                          // maximum time (in milliseconds) to search, or 0 for no limit
+    int aborted;                            // whether the search ran out of time
+    long nodes;                             // number of board states searched
+    int history[MAX_SQUARES];               // how often each square caused a cutoff, weighted by depth
+};
+
+/* Structure for a game replicated from another server of the multicast group. */
+struct Replica {
+    uint32_t serverID;                      // random ID of the server playing the game
+    int gameNum;                            // game ID on the server playing the game
+    int originPort;                         // port of the server playing the game
+    int wireNum;                            // game number the remote player was sent
+    const struct Board_Variant *variant;    // board size and number of marks in a row needed to win
+    uint64_t p1Marks;                       // bitboard of the squares marked by Player 1
+    uint64_t p2Marks;                       // bitboard of the squares marked by Player 2
+    time_t updated;                         // time the replica was last updated
+    struct Journal_Entry *record;           // record carrying the game over in the journal (NULL if not recovered from it)
+    struct Replica *next;                   // next replica in the same bucket of the replica table
+};
+
+/* Structure for a game state recorded in the journal, as an entry of a shard's move log or a
+ * record of the checkpoint table (fixed layout, in the byte order of the machine writing it). */
+struct Journal_Entry {
+    uint64_t sequence;      // sequence number of the entry on the shard that wrote it (0 if unused)
+    uint64_t p1Marks;       // bitboard of the squares marked by Player 1
+    uint64_t p2Marks;       // bitboard of the squares marked by Player 2
+    int32_t gameNum;        // generation-tagged game ID
+    int32_t wireNum;        // game number the remote player was sent
+    int32_t slot;           // index of the game's record in the checkpoint table
+    uint32_t originID;      // random ID of the server the game was played on
+    uint16_t originPort;    // port of the server the game was played on
+    char variant;           // encoded board variant of the game
+    char closed;            // whether the game has ended
+    char reserved[4];       // unused (keeps the checksum aligned)
+    uint64_t checksum;      // checksum of the rest of the entry (a torn entry never matches)
+};
+
+/* Structure for the header of the journal file, followed by the checkpoint table and a move log per shard. */
+struct Journal_Header {
+    char magic[4];          // bytes identifying a journal file (written last, once the file is laid out)
+    uint32_t layout;        // version number of the file layout
+    uint32_t serverID;      // random ID of the server that wrote the journal
+    uint32_t port;          // port of the server that wrote the journal
+    uint32_t numSlots;      // number of records in the checkpoint table (one per game the server can play)
+    uint32_t numShards;     // number of move logs (one per shard)
+    uint32_t logSize;       // number of entries in each move log
+    uint32_t reserved;      // unused (keeps the checkpoint table aligned)
+};
+
+/* Structure for a shard's part of the journal, which only the shard itself writes. */
+struct Journal {
+    struct Journal_Entry *table;    // checkpoint table of the server's games (NULL if the journal is disabled)
+    struct Journal_Entry *log;      // the shard's move log
+    int logLength;                  // number of entries appended to the move log since the last checkpoint
+    uint64_t sequence;              // sequence number of the last entry appended
+};
+
+/* Structure for a timer of a shard's timer wheel, embedded in the game or connection it times. */
+struct Timer {
+    struct Timer *next;                     // next timer in the same slot of the timer wheel
+    struct Timer **pprev;                   // link pointing to the timer (NULL if the timer is not scheduled)
+    uint64_t expires;                       // tick the timer expires at
+    void (*expire)(struct Timer *timer);    // handler called once the timer expires
+};
+
+/* Structure for the feed of a shard's moves to the spectators on the watch channel. The moves
+ * of all the shard's games are queued in one datagram while the shard handles its events, then
+ * published together, so watchers cost the games nothing but a few stores per move. */
+struct Watch_Feed {
+    unsigned char datagram[WATCH_DATAGRAM_SIZE];  // datagram of the moves made since the feed was last published
+    int length;                             // number of bytes of the datagram (0 if no moves are queued)
+    struct Timer snapshotTimer;             // deadline for publishing the boards of every game the shard is playing
+};
+
+/* Structure for a hierarchical timer wheel. Each level has a slot for every tick (or every
+ * slot of the level below) until it wraps around, so scheduling, cancelling, and expiring a
+ * timer take constant time however many timers are scheduled. */
+struct Timer_Wheel {
+    struct Timer *slots[TIMER_LEVELS][TIMER_SLOTS];     // lists of the timers expiring in each slot of each level
+    uint64_t tick;                                      // last tick whose timers have expired
+    int numTimers;                                      // number of timers scheduled
+};
+
+/* Structure for a game held for a remote player that was sent GAME_AVAILABLE, until it connects. */
+struct Reservation {
+    in_addr_t addr;                 // IP address the REQUEST_GAME command came from (network byte order)
+    in_port_t port;                 // port the REQUEST_GAME command came from (network byte order)
+    struct Timer timer;             // expiry of the reservation
+    struct Server *serv;            // server holding the game
+    struct Reservation *next;       // next reservation in the same bucket of the table (or on the free list)
 };
 
-/* Structure for each game of TicTacToe. */
+struct Game_Roster;
+
+/* Structure for each game of TicTacToe. The fields read while handling every command come
+ * first and fill the game's first cache line, and the fields only used to claim, reset, and
+ * close games follow in the next one. */
 struct TTT_Game {
-    int sd;                 // socket descriptor for connected player
-    int gameNum;            // game number
-    int winner;             // player who won, 0 if draw, -1 if game not over
-    char board[GAME_SIZE];  // TicTacToe game board state
+    uint64_t p1Marks;               // bitboard of the squares marked by Player 1
+    uint64_t p2Marks;               // bitboard of the squares marked by Player 2
+    const struct Board_Variant *variant;    // board size and number of marks in a row needed to win
+    struct Connection *conn;        // connection of the player (NULL if the game is open)
+    struct TTT_Game *nextChannel;   // next game in the same bucket of the shard's table of multiplexed games
+    int gameNum;                    // generation-tagged game ID (slot and generation)
+    int channel;                    // game number the game is routed by on a multiplexed connection, -1 if not multiplexed
+    int winner;                     // player who won, 0 if draw, -1 if game not over
+    int searching;                  // whether the worker pool is searching for Player 1's move
+    int slot;                       // index of the game in the game roster
+    unsigned int generation;        // number of times the game slot has been claimed
+    struct Game_Roster *roster;     // game roster the game belongs to
+    struct Shard *shard;            // shard playing the game
+    struct TTT_Game *nextGame;      // next game played over the same multiplexed connection
+    struct TTT_Game *prevGame;      // previous game played over the same multiplexed connection
+    struct Timer moveTimer;         // deadline for Player 2's next command while Player 2 is to move
+    struct TTT_Game *nextHeld;      // next game of the same connection whose state is held back until its move is sent
+    struct TTT_Game **pprevHeld;    // link pointing to the game (NULL if its state is not held back)
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/* Structure for the connection of a remote player, which plays a single game or, once
+ * multiplexed, a game for every game number the remote player starts one with. The buffers
+ * come last, so the rest of the connection shares the first cache lines and is all that has
+ * to be cleared when the connection is reused. */
+struct Connection {
+    int sd;                                 // socket descriptor for connected player (-1 once closed)
+    int slot;                               // index of the connection in the shard's connection table
+    int multiplexed;                        // whether commands are routed to games by their game number
+    int closing;                            // whether the connection is closing (and resetting its games)
+    struct Shard *shard;                    // shard the connection belongs to
+    int version;                            // protocol version the remote player speaks (0 until its first command)
+    int numGames;                           // number of games played over the connection
+    struct TTT_Game *game;                  // game played over the connection if it is not multiplexed
+    struct TTT_Game *games;                 // list of the games played over the connection once multiplexed
+    int inputHead;                          // index of the oldest byte in the input buffer
+    int inputLength;                        // number of bytes in the input buffer
+    int frameLength;                        // number of bytes of the version 7 frame being processed not yet taken
+    int outputLength;                       // number of bytes in the output queue (0 if nothing is queued)
+    int outputSealed;                       // number of bytes at the front of the output queue already framed and waiting to be sent
+    int outputBlocked;                      // whether the socket could not take the whole queue (input waits until it drains)
+    int flushPending;                       // whether the connection is on the shard's list of queues to send
+    struct TTT_Game *heldStates;            // games whose state is replicated once the moves queued for them have been sent
+    struct Connection *nextFlush;           // next connection with commands to send once the shard has handled its events
+    struct Connection *nextClosed;          // next connection closed since the shard's last events
+    int readPending;                        // whether the connection is on the shard's list of connections with input left over
+    struct Connection *nextRead;            // next connection with input left over once the shard has handled its events
+    int handshaken;                         // whether the remote player has sent a whole command
+    uint64_t lastInput;                     // tick the remote player last sent anything at
+    struct Timer idleTimer;                 // deadline for the remote player's first command, then for any input
+    char input[INPUT_BUFFER_SIZE];          // ring buffer of bytes received from the player not yet processed
+    char output[OUTPUT_BUFFER_SIZE];        // queue of commands to send (version 6 commands or version 7 frames)
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/* Structure for the growable roster of games, reserved up front and initialized in slabs as games are needed. */
+struct Game_Roster {
+    struct TTT_Game *games;         // the games by slot, reserved for the roster's capacity
+    int size;                       // number of game slots initialized
+    int capacity;                   // maximum number of game slots that may be initialized
+    int firstID;                    // game ID slot of the roster's first game (unique across shards)
+    int *openSlots;                 // stack of slots for games that are open to play
+    int numOpen;                    // number of slots on the stack of open games
+    atomic_int numActive;           // number of games with a connected player (read by other shards)
+};
+
+/* Structure for the server command line options. */
+struct Server_Config {
+    int port;                       // port number the server listens on
+    int maxGames;                   // maximum number of games played simultaneously
+    int numThreads;                 // number of server threads (shards) playing games
+    int searchTime;                 // maximum time (in milliseconds) spent searching for each move
+    int numWorkers;                 // number of worker threads searching for moves
+    int logLevel;                   // most detailed log level written
+    int logJSON;                    // whether log messages are written as JSON lines
+    int metricsPort;                // port number the metrics endpoint listens on (0 if disabled)
+    const char *journalPath;        // path of the game state journal file (NULL if disabled)
+    int handshakeTimeout;           // time (in seconds) a new connection has to send its first command (0 if unlimited)
+    int idleTimeout;                // time (in seconds) a connection may go without sending anything (0 if unlimited)
+    int moveTimeout;                // time (in seconds) Player 2 has to answer each move (0 if unlimited)
+    const char *eventBackend;       // name of the event engine backend to use (NULL for the best available)
+    struct sockaddr_in groups[MAX_GROUPS];  // multicast groups joined (games are replicated to the first)
+    int numGroups;                  // number of multicast groups joined
+    struct in_addr mcInterface;     // address of the interface the multicast groups are joined on (INADDR_ANY for the default)
+    int mcTTL;                      // number of hops game states are replicated across
+    int mcLoop;                     // whether game states are looped back to servers on the same host
+    struct sockaddr_in watchAddr;   // multicast group and port the games are published to for spectators
+    int watch;                      // whether the games are published to spectators
+};
+
+struct Server;
+
+/* Structure for a shard of the server, which plays its own games on its own thread. */
+struct Shard {
+    int id;                                 // index of the shard (shard 0 runs on the main thread)
+    pthread_t thread;                       // thread running the shard's event loop
+    struct Server *serv;                    // server the shard belongs to
+    struct Event_Engine engine;             // the event engine for the shard's sockets
+    struct Game_Roster roster;              // the roster of the shard's playable TicTacToe games
+    int wakeFDS[2];                         // pipe used to wake the shard when connections are handed off
+    pthread_mutex_t handoffLock;            // lock protecting the handoff queue
+    int *handoffQueue;                      // ring buffer of connections handed off to the shard
+    int handoffHead;                        // index of the oldest connection in the handoff queue
+    int numHandoffs;                        // number of connections in the handoff queue
+    atomic_int numPending;                  // number of handed off connections not yet assigned a game
+    pthread_mutex_t finishedLock;           // lock protecting the list of finished searches
+    struct Search_Job *finishedJobs;        // searches finished by the worker pool for the shard's games
+    struct Search_Job *jobs;                // the search of each game of the roster, by slot
+    struct TTT_Game **channelTable;         // table of the games of every multiplexed connection, by connection and game number
+    int channelMask;                        // number of buckets of the table of multiplexed games, minus 1
+    struct Connection *connectionArena;     // the connections by slot, reserved for every game the shard can play
+    struct Connection **connections;        // connections of the shard's players by slot (NULL if free)
+    int *freeConnections;                   // stack of free slots of the connection table
+    int numFreeConnections;                 // number of slots on the stack of free connection slots
+    struct Connection *closedConnections;   // connections closed since the shard's last events
+    struct Connection *pendingFlushes;      // connections with commands queued since the shard's last events
+    struct Connection *pendingReads;        // connections with input left over once they used their share of a pass
+    struct Timer_Wheel timers;              // the deadlines of the shard's connections and games
+    struct Journal journal;                 // the shard's part of the game state journal
+    struct Watch_Feed watch;                // the shard's moves waiting to be published to spectators
+    struct Metrics metrics;                 // metrics of the shard's thread
+};
+
+/* Structure for a search for Player 1's move handed to the worker pool. */
+struct Search_Job {
+    struct Shard *shard;                    // shard playing the game, which sends the move
+    int slot;                               // slot of the game in the shard's roster
+    int gameNum;                            // game number when the search started (to detect reset games)
+    struct TTT_Game board;                  // copy of the game when the search started
+    int timeLimit;                          // maximum time (in milliseconds) to search
+    int move;                               // best move found by the search
+    int busy;                               // whether the job has been submitted and not yet finished by the shard
+    struct Search_Job *next;                // next job in the shard's list of finished searches
+};
+
+struct Worker_Pool;
+
+/* Structure for a worker thread of the worker pool. */
+struct Worker {
+    pthread_t thread;                       // thread running the worker
+    struct Worker_Pool *pool;               // worker pool the worker belongs to
+    int id;                                 // index of the worker in the pool
+    pthread_mutex_t lock;                   // lock protecting the worker's job queue
+    struct Search_Job *queue[WORK_QUEUE_SIZE];  // ring buffer of jobs waiting for the worker
+    int head;                               // index of the oldest job in the queue
+    int numJobs;                            // number of jobs in the queue
+    struct Metrics metrics;                 // metrics of the worker's thread
+};
+
+/* Structure for the pool of worker threads searching for moves. */
+struct Worker_Pool {
+    struct Worker *workers;                 // the worker threads of the pool
+    int numWorkers;                         // number of worker threads (0 if moves are searched inline)
+    atomic_int numQueued;                   // number of jobs waiting in every worker's queue
+    atomic_int numSearches;                 // number of jobs submitted and not yet finished
+    atomic_uint nextWorker;                 // worker given the next submitted job
+    pthread_mutex_t sleepLock;              // lock protecting idle workers going to sleep
+    pthread_cond_t wakeup;                  // condition signaled when a job is submitted
 };
 
 /* Structure for the server . */
@@ -63,20 +586,35 @@ struct Server {
     int sd;                                 // socket descriptor for the server
     int mcd;                                // socket descriptor for the multicast group
     int mcrd;                               // socket descriptor for responding from the multicast group
-    int maxSD;                              // the max socket descriptor seen so far
-    fd_set socketFDS;                       // the set of socket discriptors to act on
     struct sockaddr_in serverAddr;          // the socket address structure for the server
     struct sockaddr_in multicastAddr;       // the socket address structure for the multicast group
     struct sockaddr_in mcResponseAddr;      // the socket address structure for responding from the multicast group
-    struct TTT_Game gameRoster[MAX_GAMES];  // the array of playable TicTacToe games
+    struct sockaddr_in groupAddr;           // the address game states are replicated to the multicast group at
+    int watchSD;                            // socket descriptor the shards publish to the watch channel from (-1 if disabled)
+    struct sockaddr_in watchAddr;           // the address of the watch channel spectators join
+    struct Shard *shards;                   // the shards playing the server's games
+    int numShards;                          // number of shards (and threads) of the server
+    struct Worker_Pool pool;                // the worker threads searching for Player 1's moves
+    struct Reservation *reservationTable[RESERVATION_BUCKETS];  // games held for remote players sent GAME_AVAILABLE, by IP address
+    struct Reservation *freeReservations;   // list of unused reservations (one for every game the server can play)
+    atomic_int numReserved;                 // number of games held for remote players (read by the metrics thread)
+    int reservationTicks;                   // ticks a game is held for a remote player sent GAME_AVAILABLE
+    int metricsSD;                          // socket descriptor for the metrics endpoint (-1 if disabled)
+    struct sockaddr_in metricsAddr;         // the socket address structure for the metrics endpoint
+    pthread_t metricsThread;                // thread answering requests to the metrics endpoint
+    struct Journal_Header *journal;         // the mapped game state journal file (NULL if disabled)
+    size_t journalSize;                     // the size (in bytes) of the journal file
+    int handshakeTicks;                     // ticks a new connection has to send its first command (0 if unlimited)
+    int idleTicks;                          // ticks a connection may go without sending anything (0 if unlimited)
+    int moveTicks;                          // ticks Player 2 has to answer each move (0 if unlimited)
 };
 
 /*****************************/
 /* GENERAL PURPOSE FUNCTIONS */
 /*****************************/
 
-/* The number of command line arguments. */
-#define NUM_ARGS 2
+/* The number of positional command line arguments. */
+#define NUM_ARGS 1
 /* The maximum size of a buffer for the program. */
 #define BUFFER_SIZE 100
 /* The error code used to signal an invalid move. */
@@ -84,7 +622,98 @@ struct Server {
 
 void print_error(const char *msg, int errnum, int terminate);
 void handle_init_error(const char *msg, int errnum);
-void extract_args(char *argv[], int *port);
+void extract_args(int argc, char *argv[], struct Server_Config *config);
+
+/*********************/
+/* LOGGING FUNCTIONS */
+/*********************/
+
+/* The log levels, from errors only to every command and board. */
+#define LOG_ERROR 0
+#define LOG_INFO 1
+#define LOG_DEBUG 2
+/* The number of messages the ring buffer of the logger holds (must be a power of 2). */
+#define LOG_RING_SIZE 4096
+/* The number of microseconds the logger sleeps when it has nothing to write. */
+#define LOG_IDLE_WAIT 1000
+
+void init_logging(int level, int json);
+int log_enabled(int level);
+void log_message(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void write_log_entry(FILE *out, const struct Log_Entry *entry);
+int drain_log(FILE *out);
+void flush_log(void);
+void *run_logger(void *arg);
+
+/*********************/
+/* METRICS FUNCTIONS */
+/*********************/
+
+/* The counter of connections accepted from remote players. */
+#define METRIC_ACCEPTS 0
+/* The counter of connections and games turned down for lack of an open game. */
+#define METRIC_REFUSED 1
+/* The counter of REQUEST_GAME commands received from the multicast group. */
+#define METRIC_REQUEST_GAME 2
+/* The counter of REQUEST_GAME commands coalesced with one already being answered. */
+#define METRIC_COALESCED 3
+/* The counter of GAME_AVAILABLE commands sent. */
+#define METRIC_GAME_AVAILABLE 4
+/* The counter of GAME_STATE commands received from the multicast group. */
+#define METRIC_GAME_STATES 5
+/* The counter of RESUME_GAME and RESUME_REPLICA commands with a board that was rejected. */
+#define METRIC_INVALID_RESUMES 6
+/* The counter of games taken over from their replica. */
+#define METRIC_REPLICAS_TAKEN 7
+/* The counter of games ended (or abandoned) by remote players. */
+#define METRIC_GAMES_ENDED 8
+/* The counter of searches for Player 1's move. */
+#define METRIC_SEARCHES 9
+/* The counter of board states searched. */
+#define METRIC_SEARCH_NODES 10
+/* The counter of games and connections ended for missing a deadline. */
+#define METRIC_TIMEOUTS 11
+/* The counter of games reserved for a GAME_AVAILABLE reply that the remote player never claimed. */
+#define METRIC_RESERVATIONS_EXPIRED 12
+/* The counter of Player 1 moves found in the position cache. */
+#define METRIC_POSITION_HITS 13
+/* The counter of Player 1 moves not found in the position cache (and searched for instead). */
+#define METRIC_POSITION_MISSES 14
+/* The counter of datagrams published to the spectators on the watch channel. */
+#define METRIC_WATCH_DATAGRAMS 15
+/* The histogram of the time taken to handle NEW_GAME commands. */
+#define HIST_NEW_GAME 0
+/* The histogram of the time taken to handle MOVE commands. */
+#define HIST_MOVE 1
+/* The histogram of the time taken to handle GAME_OVER commands. */
+#define HIST_GAME_OVER 2
+/* The histogram of the time taken to handle RESUME_GAME commands. */
+#define HIST_RESUME_GAME 3
+/* The histogram of the time taken to handle RESUME_REPLICA commands. */
+#define HIST_RESUME_REPLICA 4
+/* The histogram of the time taken to drain the multicast group and answer its commands. */
+#define HIST_UDP 5
+/* The histogram of the time taken to search for Player 1's move. */
+#define HIST_SEARCH 6
+/* The smallest power of 2 nanoseconds with its own histogram buckets (smaller latencies underflow). */
+#define HISTOGRAM_MIN_OCTAVE 10
+/* The number of histogram buckets per power of 2. */
+#define HISTOGRAM_SUB_BUCKETS 4
+/* The maximum length of a request to the metrics endpoint that is read. */
+#define METRICS_REQUEST_SIZE 1024
+/* The time (in seconds) a request to the metrics endpoint may take to arrive. */
+#define METRICS_TIMEOUT 1
+
+uint64_t monotonic_time(void);
+void count_metric(int counter, unsigned long amount);
+void record_latency(int histogram, uint64_t start);
+int histogram_bucket(uint64_t latency);
+double histogram_bound(int bucket);
+void init_metrics(struct Server *serv, int port);
+void collect_metrics(const struct Server *serv, struct Metrics *total);
+void write_metrics(FILE *out, const struct Server *serv);
+void answer_metrics_request(const struct Server *serv, int sd);
+void *run_metrics(void *arg);
 
 /********************************/
 /* SOCKET AND NETWORK FUNCTIONS */
@@ -92,16 +721,221 @@ void extract_args(char *argv[], int *port);
 
 /* The protocol version number used. */
 #define VERSION 6
-/* The maximum length to which the queue of pending connections may grow. */
-#define BACKLOG_MAX 5
-/* The port number for the multicast group. */
+/* The protocol version number of the framed protocol, spoken by remote players that send it. */
+#define FRAMED_VERSION 7
+/* The smallest length to which the queue of pending connections may grow. */
+#define BACKLOG_MIN 5
+/* The default port number for the multicast groups. */
 #define MC_PORT 1818
-/* The network IP address for the multicast group. */
+/* The default network IP address for the multicast group. */
 #define MC_GROUP "239.0.0.1"
+/* The default number of hops game states are replicated across (the local network only). */
+#define DEFAULT_MC_TTL 1
 
 int create_endpoint(struct sockaddr_in *socketAddr, int type, unsigned long address, int port);
-void join_multicast_group(const struct Server *serv, const char *groupAddr);
+int parse_groups(const char *list, int port, struct sockaddr_in *groups);
+int parse_interface(const char *name, struct in_addr *addr);
+void join_multicast_groups(const struct Server *serv, const struct Server_Config *config);
 void print_server_info(const struct Server *serv);
+void set_nonblocking(int sd);
+
+/*******************************/
+/* ADMISSION CONTROL FUNCTIONS */
+/*******************************/
+
+/* The time (in milliseconds) a game is held for a remote player sent GAME_AVAILABLE. */
+#define RESERVATION_TTL 2000
+
+int listen_backlog(int maxGames);
+void init_admission(struct Server *serv, int maxGames);
+int unreserved_games(const struct Server *serv);
+int reserve_game(struct Server *serv, const struct sockaddr_in *playerAddr);
+int take_reservation(struct Server *serv, const struct in_addr *playerAddr);
+void expire_reservation(struct Timer *timer);
+void refuse_connection(int sd);
+
+/**************************/
+/* EVENT ENGINE FUNCTIONS */
+/**************************/
+
+/* The maximum number of ready socket descriptors handled per wakeup. */
+#define MAX_EVENTS 64
+/* The event tag used for the server socket. */
+#define SERVER_TAG -2
+/* The event tag used for the multicast group socket. */
+#define MULTICAST_TAG -3
+/* The event tag used for the pipe that wakes a shard. */
+#define WAKEUP_TAG -4
+/* The maximum number of sockets whose queued commands are sent together. */
+#define SEND_BATCH_SIZE 64
+/* The number of entries of an io_uring instance's submission ring (its completion ring holds 16 times as many). */
+#define URING_ENTRIES 256
+/* The size (in bytes) of each buffer an io_uring instance receives into. */
+#define URING_BUFFER_SIZE 1024
+/* The kinds of io_uring requests, kept in the request's user data with the socket descriptor and its generation. */
+#define URING_POLL 1
+#define URING_ACCEPT 2
+#define URING_RECV 3
+#define URING_SEND 4
+#define URING_CANCEL 5
+#define URING_WRITABLE 6
+/* Packs and unpacks the user data of an io_uring request. */
+#define URING_DATA(generation, kind, fd) (((uint64_t)(generation) << 32) | ((uint64_t)(kind) << 24) | (uint32_t)(fd))
+#define URING_GENERATION(data) ((uint32_t)((data) >> 32))
+#define URING_KIND(data) ((int)(((data) >> 24) & 0xFF))
+#define URING_FD(data) ((int)((data) & 0xFFFFFF))
+/* The closed state of a socket whose peer closed the connection. */
+#define URING_EOF 1
+
+void init_event_engine(struct Event_Engine *engine, const char *backendName);
+int register_socket(struct Event_Engine *engine, int sd, int tag);
+void unregister_socket(struct Event_Engine *engine, int sd);
+int wait_for_events(struct Event_Engine *engine, struct Ready_Event *events, int maxEvents, int timeout);
+int accept_socket(struct Event_Engine *engine, int sd, struct sockaddr_in *addr, socklen_t *addrLength);
+int receive_socket(struct Event_Engine *engine, int sd, char *buffer, int length);
+void send_sockets(struct Event_Engine *engine, struct Send_Request *requests, int count);
+void watch_output(struct Event_Engine *engine, int sd, int tag, int blocked);
+
+/*************************/
+/* TIMER WHEEL FUNCTIONS */
+/*************************/
+
+/* The length (in milliseconds) of a tick of a timer wheel. */
+#define TIMER_TICK_MS 100
+/* The longest delay (in ticks) a timer can be scheduled with (later deadlines are brought forward). */
+#define TIMER_MAX_TICKS ((1 << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1)
+/* The default time (in seconds) a new connection has to send its first command. */
+#define DEFAULT_HANDSHAKE_TIMEOUT 10
+/* The default time (in seconds) a connection may go without sending anything. */
+#define DEFAULT_IDLE_TIMEOUT 300
+/* The default time (in seconds) Player 2 has to answer each move. */
+#define DEFAULT_MOVE_TIMEOUT 120
+/* The longest timeout (in seconds) that can be configured. */
+#define MAX_TIMEOUT 3600
+
+uint64_t current_tick(void);
+void init_timer_wheel(struct Timer_Wheel *wheel);
+void schedule_timer(struct Timer_Wheel *wheel, struct Timer *timer, uint64_t expires);
+void cancel_timer(struct Timer_Wheel *wheel, struct Timer *timer);
+void run_timers(struct Timer_Wheel *wheel);
+int timer_timeout(const struct Timer_Wheel *wheel);
+void expire_connection(struct Timer *timer);
+void expire_move(struct Timer *timer);
+
+/**************************/
+/* SERVER SHARD FUNCTIONS */
+/**************************/
+
+/* The maximum number of threads (shards) the server can run. */
+#define MAX_THREADS 64
+/* Systems without MAP_NORESERVE reserve arena memory in full up front. */
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+void *reserve_arena(size_t size);
+void init_shards(struct Server *serv, const struct Server_Config *config);
+void start_shards(struct Server *serv);
+void *run_shard(void *arg);
+int open_game_count(struct Shard *shard);
+int find_open_shard(struct Server *serv);
+void hand_off_connection(struct Shard *shard, int sd);
+void accept_handoffs(struct Shard *shard);
+void assign_connection(struct Shard *shard, int sd);
+void attach_game(struct Connection *conn, struct TTT_Game *game, int channel);
+void detach_game(struct Connection *conn, struct TTT_Game *game);
+struct TTT_Game *find_channel(const struct Connection *conn, int channel);
+void close_connection(struct Connection *conn);
+void release_connections(struct Shard *shard);
+void flush_connections(struct Shard *shard);
+void defer_input(struct Connection *conn);
+void process_deferred_input(struct Shard *shard);
+void finish_searches(struct Shard *shard);
+
+/*************************/
+/* WORKER POOL FUNCTIONS */
+/*************************/
+
+/* The default number of worker threads searching for moves. */
+#define DEFAULT_WORKERS 2
+/* The maximum number of worker threads the server can run. */
+#define MAX_WORKERS 64
+
+void init_worker_pool(struct Worker_Pool *pool, int numWorkers);
+void *run_worker(void *arg);
+int submit_search(struct Worker_Pool *pool, struct TTT_Game *game, int timeLimit);
+struct Search_Job *take_job(struct Worker *worker);
+void post_search(struct Search_Job *job);
+
+/*************************/
+/* REPLICATION FUNCTIONS */
+/*************************/
+
+/* The number of buckets in the table of games replicated from other servers (must be a power of 2). */
+#define REPLICA_BUCKETS 1024
+/* The maximum number of games replicated from other servers that are kept. */
+#define MAX_REPLICAS 65536
+/* The number of seconds a replicated game is kept without an update. */
+#define REPLICA_TTL 600
+/* The number of bytes of a packed bitboard for a board with the given number of squares. */
+#define MASK_BYTES(numSquares) (((numSquares) + 7) / 8)
+
+void init_replication(struct Server *serv, const struct Server_Config *config);
+void pack_bytes(unsigned char *dest, uint64_t value, int length);
+uint64_t unpack_bytes(const unsigned char *src, int length);
+void replicate_game(const struct TTT_Game *game, int closed);
+void hold_state(struct TTT_Game *game);
+void unhold_state(struct TTT_Game *game);
+void release_states(struct Connection *conn);
+void store_replica(const struct sockaddr_in *originAddr, const struct Game_State *state, struct Journal_Entry *record);
+int take_replica(int originPort, int wireNum, const struct Board_Variant *variant, uint64_t p1Marks, uint64_t p2Marks);
+int count_replicas(void);
+
+/***********************/
+/* SPECTATOR FUNCTIONS */
+/***********************/
+
+/* The default port number of the watch channel. */
+#define WATCH_PORT 1819
+/* The version number of the datagrams published to the watch channel. */
+#define WATCH_VERSION 1
+/* The time (in milliseconds) between snapshots of every game published to the watch channel. */
+#define WATCH_SNAPSHOT_INTERVAL 1000
+/* The size (in bytes) of the header of a datagram published to the watch channel. */
+#define WATCH_HEADER_SIZE sizeof(struct Watch_Header)
+/* The kind of a published move made by Player 1. */
+#define WATCH_P1_MOVE 1
+/* The kind of a published move made by Player 2. */
+#define WATCH_P2_MOVE 2
+/* The kind of a published end of a game. */
+#define WATCH_GAME_END 3
+/* The winner published for a game that was left before it was over. */
+#define WATCH_ABANDONED 0xFF
+
+int parse_channel(const char *arg, struct sockaddr_in *addr);
+void init_watch_channel(struct Server *serv, const struct Server_Config *config);
+void init_watch_feed(struct Shard *shard);
+void publish_move(struct TTT_Game *game, int kind, int square);
+void flush_watch_feed(struct Shard *shard);
+void publish_snapshot(struct Timer *timer);
+
+/*********************/
+/* JOURNAL FUNCTIONS */
+/*********************/
+
+/* The bytes identifying a game state journal file. */
+#define JOURNAL_MAGIC "TTTJ"
+/* The version number of the journal file layout. */
+#define JOURNAL_LAYOUT 2
+/* The number of entries in each shard's move log (a checkpoint is taken each time it fills up). */
+#define JOURNAL_LOG_SIZE 4096
+
+void init_journal(struct Server *serv, const char *path);
+int recover_journal(int fd, struct Journal_Entry **recovered);
+uint64_t journal_checksum(const struct Journal_Entry *entry);
+int valid_journal_entry(const struct Journal_Entry *entry, uint32_t numSlots);
+void journal_game(const struct TTT_Game *game, int closed);
+void checkpoint_journal(struct Shard *shard);
 
 /******************************/
 /* TIC-TAC-TOE GAME FUNCTIONS */
@@ -111,25 +945,95 @@ void print_server_info(const struct Server *serv);
 #define P1_MARK 'X'
 /* The baord marker used for Player 2 */
 #define P2_MARK 'O'
+/* The maximum number of commands handled for a connection each time it is ready (the rest wait for the next pass). */
+#define MAX_COMMANDS_PER_READ 256
+/* The number of possible default board states (each square is empty, P1_MARK, or P2_MARK). */
+#define MOVE_TABLE_SIZE 19683
+/* The number of possible bitboards of the default board. */
+#define BASE3_TABLE_SIZE (1 << GAME_SIZE)
 
 void init_shared_state(struct TTT_Game *game);
+const struct Board_Variant *parse_variant(char data);
+char encode_variant(const struct Board_Variant *variant);
+int validate_marks(const struct TTT_Game *game, uint64_t p1Marks, uint64_t p2Marks);
 int load_shared_state(struct TTT_Game *game);
-void init_game_roster(struct Server *serv);
-int find_open_game(const struct Server *serv);
-int get_udp_command(int sd, struct sockaddr_in *playerAddr, struct UDP_Buffer *datagram);
-void send_game_available(const struct Server *serv, const struct sockaddr_in *playerAddr);
-int get_tcp_command(int sd, struct TCP_Buffer *msg);
+void init_game_roster(struct Game_Roster *roster, int capacity, int firstID);
+int grow_game_roster(struct Game_Roster *roster);
+struct TTT_Game *get_game(const struct Game_Roster *roster, int slot);
+int find_open_game(struct Game_Roster *roster);
+struct TTT_Game *claim_open_game(struct Game_Roster *roster);
+int wire_game_num(int gameNum);
+int game_channel(const struct TTT_Game *game);
+int get_udp_commands(int sd, struct UDP_Batch *batch);
+void send_game_available(const struct Server *serv, const struct UDP_Batch *replies);
+int read_input(struct Connection *conn);
+void peek_input(const struct Connection *conn, char *dest, int length);
+void consume_input(struct Connection *conn, int length);
+int trailing_length(const struct TCP_Buffer *msg);
+int get_tcp_command(struct Connection *conn, struct TCP_Buffer *msg);
+struct TTT_Game *route_command(struct Connection *conn, const struct TCP_Buffer *msg);
+void process_input(struct Connection *conn);
+void schedule_flush(struct Connection *conn);
+int send_command(struct Connection *conn, char command, char data, int gameNum);
+int seal_output(struct Connection *conn);
+int send_bytes(int sd, const char *data, int length);
+void output_sent(struct Connection *conn, int sent);
+int flush_output(struct Connection *conn);
 void send_game_over(struct TTT_Game *game);
-int minimax(struct TTT_Game *game, int depth, int isMax);
-int find_best_move(struct TTT_Game *game);
+int encode_board(const struct TTT_Game *game);
+void init_move_table(void);
+int find_table_move(const struct TTT_Game *game);
+int reachable_board(const struct Board_Variant *variant, uint64_t p1Marks, uint64_t p2Marks);
+void play_p1_move(struct TTT_Game *game);
+void finish_p1_move(struct TTT_Game *game, int move);
 int validate_move(int choice, const struct TTT_Game *game);
-int send_p1_move(struct TTT_Game *game);
+int send_p1_move(struct TTT_Game *game, int move);
+int is_open_square(int square, const struct TTT_Game *game);
 int check_win(const struct TTT_Game *game);
 int check_draw(const struct TTT_Game *game);
 int check_game_over(struct TTT_Game *game);
 void print_board(const struct TTT_Game *game);
 void reset_game(struct TTT_Game *game);
-void tictactoe(struct Server *serv);
+void tictactoe(struct Shard *shard);
+
+/***************************/
+/* SEARCH ENGINE FUNCTIONS */
+/***************************/
+
+/* The default maximum time (in milliseconds) spent searching for each move. */
+#define DEFAULT_SEARCH_TIME 100
+/* The number of entries in the transposition table (must be a power of 2). */
+#define TT_SIZE (1 << 19)
+/* The score of a win found with no moves left to search. */
+#define WIN_SCORE 1000000
+/* Scores beyond this are wins (or losses) a number of moves away. */
+#define WIN_THRESHOLD (WIN_SCORE - 1000)
+/* The largest score a board state that has not been searched to the end can be given. */
+#define EVAL_LIMIT (WIN_THRESHOLD / 2)
+/* The transposition table bounds for exact scores, lower bounds, and upper bounds. */
+#define TT_EXACT 1
+#define TT_LOWER 2
+#define TT_UPPER 3
+/* Accessors for the packed data of a transposition table entry. */
+#define TT_SCORE(data) ((int32_t)((data) >> 32))
+#define TT_SQUARE(data) ((int8_t)(((data) >> 16) & 0xFF))
+#define TT_DEPTH(data) ((int)(((data) >> 8) & 0xFF))
+#define TT_BOUND(data) ((int)((data) & 0xFF))
+/* The number of entries in the position cache (must be a power of 2). */
+#define POSITION_CACHE_SIZE (1 << 16)
+/* Accessors for the packed data of a position cache entry. */
+#define PC_MOVE(data) ((int)((data) & 0xFF))
+#define PC_DEPTH(data) ((int)(((data) >> 8) & 0xFF))
+
+void init_search_engine(int timeLimit);
+const struct Board_Variant *get_variant(int size, int winLength);
+void hash_board(const struct Board_Variant *variant, uint64_t p1Marks, uint64_t p2Marks, uint64_t *keys);
+int alpha_beta(struct Search *search, uint64_t own, uint64_t opp, int player, const uint64_t *keys, int depth, int ply, int alpha, int beta, int lastSquare);
+int search_best_move(struct TTT_Game *game, int timeLimit);
+uint64_t transform_marks(const struct Board_Variant *variant, int symmetry, uint64_t marks);
+int canonical_board(const struct Board_Variant *variant, uint64_t p1Marks, uint64_t p2Marks, uint64_t *canonP1, uint64_t *canonP2);
+int probe_position_cache(const struct TTT_Game *game);
+void store_position_cache(const struct TTT_Game *game, int move, int depth);
 
 /*******************/
 /* PLAYER COMMANDS */
@@ -137,8 +1041,22 @@ void tictactoe(struct Server *serv);
 
 /* The size (in bytes) of each UDP game command. */
 #define UDP_CMD_SIZE 2
+/* The size (in bytes) of the GAME_AVAILABLE command with the server's load. */
+#define GAME_AVAILABLE_SIZE (UDP_CMD_SIZE + sizeof(struct Server_Load))
+/* The version number of the load information sent with the GAME_AVAILABLE command. */
+#define LOAD_VERSION 1
+/* The size (in bytes) of the GAME_STATE command with the state of a replicated game. */
+#define GAME_STATE_SIZE (UDP_CMD_SIZE + sizeof(struct Game_State))
 /* The size (in bytes) of each TCP game command. */
 #define TCP_CMD_SIZE 4
+/* The size (in bytes) of the header of a version 7 frame (version, flags, and length of the commands). */
+#define FRAME_HEADER_SIZE 4
+/* The size (in bytes) of each command of a version 7 frame (command, data, and 32-bit game number). */
+#define FRAMED_CMD_SIZE 6
+/* The size (in bytes) of the packed board following the version 7 RESUME_GAME command (both packed bitboards). */
+#define PACKED_BOARD_SIZE(numSquares) (2 * MASK_BYTES(numSquares))
+/* The size (in bytes) of the ticket following the RESUME_REPLICA command (origin port and both packed bitboards). */
+#define RESUME_TICKET_SIZE(numSquares) (2 + PACKED_BOARD_SIZE(numSquares))
 
 /* Function pointer type for function to handle player commands. */
 typedef void (*Command_Handler)(const struct TCP_Buffer *msg, struct TTT_Game *game);
@@ -150,17 +1068,32 @@ typedef void (*Command_Handler)(const struct TCP_Buffer *msg, struct TTT_Game *g
 #define GAME_OVER 0x02
 /* The TCP command to resume a previously started game. */
 #define RESUME_GAME 0x03
+/* The TCP command to resume a game replicated from the server it was being played on. */
+#define RESUME_REPLICA 0x07
+/* The TCP command to play a game for every game number over the connection. */
+#define MULTIPLEX 0x08
+/* The TCP command turning away a player the server has no game for, so it finds another server. */
+#define SERVER_FULL 0x09
 
 /* The UDP command for a client to request an open game from the multicast group. */
 #define REQUEST_GAME 0x04
 /* The UDP command from a server in the multicast group that a game is available. */
 #define GAME_AVAILABLE 0x05
+/* The UDP command from a server in the multicast group with the state of a game it is playing. */
+#define GAME_STATE 0x06
+/* The UDP command from a server to the watch channel with the moves made in its games. */
+#define WATCH_MOVES 0x0A
+/* The UDP command from a server to the watch channel with the boards of the games it is playing. */
+#define WATCH_SNAPSHOT 0x0B
 
 void new_game(const struct TCP_Buffer *msg, struct TTT_Game *game);
 void move(const struct TCP_Buffer *msg, struct TTT_Game *game);
 void game_over(const struct TCP_Buffer *msg, struct TTT_Game *game);
 void resume_game(const struct TCP_Buffer *msg, struct TTT_Game *game);
-void request_game(const struct Server *serv, const struct sockaddr_in *playerAddr);
+void resume_replica(const struct TCP_Buffer *msg, struct TTT_Game *game);
+void multiplex(struct Connection *conn);
+void request_game(struct Server *serv, const struct sockaddr_in *playerAddr, struct UDP_Batch *replies);
+void get_server_load(const struct Server *serv, struct Server_Load *load);
 
 /**
  * @brief This program creates and sets up a TicTacToe server which acts as Player 1 in a
@@ -184,26 +1117,43 @@ void request_game(const struct Server *serv, const struct sockaddr_in *playerAdd
  * implicit call to exit(). The values zero and EXIT_SUCCESS indicate successful termination,
  * the value EXIT_FAILURE indicates unsuccessful termination.
  */
+#ifndef TTT_NO_MAIN
 int main(int argc, char *argv[]) {
     int portNumber;
     struct Server serv;
+    struct Server_Config config;
 
-    /* If arg count correct, extract arguments to their respective variables */
-    if (argc != NUM_ARGS) handle_init_error("argc: Invalid number of command line arguments", 0);
-    extract_args(argv, &portNumber);
+    /* Extract arguments to their respective variables */
+    extract_args(argc, argv, &config);
+    portNumber = config.port;
+    /* Start writing log messages off the threads playing games */
+    init_logging(config.logLevel, config.logJSON);
 
-    /* Create multicast socket and join multicast group */
-    serv.mcd = create_endpoint(&serv.multicastAddr, SOCK_DGRAM, INADDR_ANY, MC_PORT);
-    join_multicast_group(&serv, MC_GROUP);
+    /* Create multicast socket and join the multicast groups */
+    serv.mcd = create_endpoint(&serv.multicastAddr, SOCK_DGRAM, INADDR_ANY, ntohs(config.groups[0].sin_port));
+    join_multicast_groups(&serv, &config);
     /* Create multicast socket to respond from */
     serv.mcrd = create_endpoint(&serv.mcResponseAddr, SOCK_DGRAM, INADDR_ANY, portNumber);
     /* Create server socket */
     serv.sd = create_endpoint(&serv.serverAddr, SOCK_STREAM, INADDR_ANY, portNumber);
     /* Print server information and listen for waiting clients */
-    if (listen(serv.sd, BACKLOG_MAX) == 0) {
+    if (listen(serv.sd, listen_backlog(config.maxGames)) == 0) {
         print_server_info(&serv);
-        /* Start the TicTacToe server */
-        tictactoe(&serv);
+        /* Prepare the search engine and precompute Player 1's moves */
+        init_search_engine(config.searchTime);
+        init_move_table();
+        /* Start replicating games to the other servers of the multicast group */
+        init_replication(&serv, &config);
+        /* Start publishing the games to spectators if asked to */
+        init_watch_channel(&serv, &config);
+        /* Initialize all games and start the TicTacToe server on every shard */
+        init_shards(&serv, &config);
+        init_journal(&serv, config.journalPath);
+        init_admission(&serv, config.maxGames);
+        init_worker_pool(&serv.pool, config.numWorkers);
+        init_metrics(&serv, config.metricsPort);
+        start_shards(&serv);
+        tictactoe(&serv.shards[0]);
     } else {
         print_error("listen", errno, 0);
         if (close(serv.mcd) < 0) print_error("main: close-multicast", errno, 0);
@@ -213,10 +1163,11 @@ int main(int argc, char *argv[]) {
 
     return 0;
 }
+#endif
 
 /**
- * @brief Prints the provided error message and corresponding errno message (if present) and
- * terminates the process if asked to do so.
+ * @brief Logs the provided error message and corresponding errno message (if present) and
+ * terminates the process, once everything logged has been written, if asked to do so.
  * 
  * @param msg The error description message to display.
  * @param errnum This is the error number, usually errno.
@@ -225,12 +1176,15 @@ int main(int argc, char *argv[]) {
 void print_error(const char *msg, int errnum, int terminate) {
     /* Check for valid error code and generate error message */
     if (errnum) {
-        printf("ERROR: %s: %s\n", msg, strerror(errnum));
+        log_message(LOG_ERROR, "%s: %s", msg, strerror(errnum));
     } else {
-        printf("ERROR: %s\n", msg);
+        log_message(LOG_ERROR, "%s", msg);
     }
     /* Exits process if it should be terminated */
-    if (terminate) exit(EXIT_FAILURE);
+    if (terminate) {
+        flush_log();
+        exit(EXIT_FAILURE);
+    }
 }
 
 /**
@@ -242,7 +1196,8 @@ void print_error(const char *msg, int errnum, int terminate) {
  */
 void handle_init_error(const char *msg, int errnum) {
     print_error(msg, errnum, 0);
-    printf("Usage is: tictactoeServer <remote-port>\n");
+    flush_log();
+    printf("Usage is: tictactoeServer [-g max-games] [-t threads] [-m search-ms] [-w workers] [-l log-level] [-j] [-M metrics-port] [-J journal-file] [-H handshake-secs] [-I idle-secs] [-D move-secs] [-e epoll|select|io_uring] [-G group[,group...]] [-P multicast-port] [-i interface] [-L ttl] [-x] [-W group[:port]] <remote-port>\n");
     /* Exits the process signaling unsuccessful termination */
     exit(EXIT_FAILURE);
 }
@@ -251,530 +1206,4803 @@ void handle_init_error(const char *msg, int errnum) {
  * @brief Extracts the user provided arguments to their respective local variables and performs
  * validation on their formatting. If any errors are found, the function terminates the process.
  * 
+ * @param argc Non-negative value representing the number of arguments passed to the program
+ * from the environment in which the program is run.
  * @param argv Pointer to the first element of an array of argc + 1 pointers, of which the
  * last one is NULL and the previous ones, if any, point to strings that represent the
  * arguments passed to the program from the host environment. If argv[0] is not a NULL
  * pointer (or, equivalently, if argc > 0), it points to a string that represents the program
  * name, which is empty if the program name is not available from the host environment.
- * @param port The remote port number that the server should listen on
+ * @param config The server options to store the extracted arguments in.
  */
-void extract_args(char *argv[], int *port) {
+void extract_args(int argc, char *argv[], struct Server_Config *config) {
+    int opt, mcPort = MC_PORT;
+    const char *groupList = MC_GROUP;
+    config->maxGames = DEFAULT_MAX_GAMES;
+    config->numThreads = 1;
+    config->searchTime = DEFAULT_SEARCH_TIME;
+    config->numWorkers = DEFAULT_WORKERS;
+    config->logLevel = LOG_INFO;
+    config->logJSON = 0;
+    config->metricsPort = 0;
+    config->journalPath = NULL;
+    config->handshakeTimeout = DEFAULT_HANDSHAKE_TIMEOUT;
+    config->idleTimeout = DEFAULT_IDLE_TIMEOUT;
+    config->moveTimeout = DEFAULT_MOVE_TIMEOUT;
+    config->eventBackend = NULL;
+    config->mcInterface.s_addr = htonl(INADDR_ANY);
+    config->mcTTL = DEFAULT_MC_TTL;
+    config->mcLoop = 1;
+    config->watch = 0;
+    /* Extract and validate the optional arguments */
+    while ((opt = getopt(argc, argv, "g:t:m:w:l:jM:J:H:I:D:e:G:P:i:L:xW:")) != -1) {
+        switch (opt) {
+            case 'g':
+                config->maxGames = strtol(optarg, NULL, 10);
+                if (config->maxGames < 1 || config->maxGames > MAX_GAMES) handle_init_error("extract_args: Invalid maximum number of games", 0);
+                break;
+            case 't':
+                config->numThreads = strtol(optarg, NULL, 10);
+                if (config->numThreads < 1 || config->numThreads > MAX_THREADS) handle_init_error("extract_args: Invalid number of threads", 0);
+                break;
+            case 'm':
+                config->searchTime = strtol(optarg, NULL, 10);
+                if (config->searchTime < 1) handle_init_error("extract_args: Invalid search time", 0);
+                break;
+            case 'w':
+                config->numWorkers = strtol(optarg, NULL, 10);
+                if (config->numWorkers < 0 || config->numWorkers > MAX_WORKERS) handle_init_error("extract_args: Invalid number of workers", 0);
+                break;
+            case 'l':
+                if (strcmp(optarg, "error") == 0) {
+                    config->logLevel = LOG_ERROR;
+                } else if (strcmp(optarg, "info") == 0) {
+                    config->logLevel = LOG_INFO;
+                } else if (strcmp(optarg, "debug") == 0) {
+                    config->logLevel = LOG_DEBUG;
+                } else {
+                    handle_init_error("extract_args: Invalid log level", 0);
+                }
+                break;
+            case 'j':
+                config->logJSON = 1;
+                break;
+            case 'M':
+                config->metricsPort = strtol(optarg, NULL, 10);
+                if (config->metricsPort < 1 || config->metricsPort != (u_int16_t)(config->metricsPort)) handle_init_error("extract_args: Invalid metrics port number", 0);
+                break;
+            case 'J':
+                config->journalPath = optarg;
+                break;
+            case 'H':
+                config->handshakeTimeout = strtol(optarg, NULL, 10);
+                if (config->handshakeTimeout < 0 || config->handshakeTimeout > MAX_TIMEOUT) handle_init_error("extract_args: Invalid handshake timeout", 0);
+                break;
+            case 'I':
+                config->idleTimeout = strtol(optarg, NULL, 10);
+                if (config->idleTimeout < 0 || config->idleTimeout > MAX_TIMEOUT) handle_init_error("extract_args: Invalid idle timeout", 0);
+                break;
+            case 'D':
+                config->moveTimeout = strtol(optarg, NULL, 10);
+                if (config->moveTimeout < 0 || config->moveTimeout > MAX_TIMEOUT) handle_init_error("extract_args: Invalid move deadline", 0);
+                break;
+            case 'e':
+                if (strcmp(optarg, "epoll") != 0 && strcmp(optarg, "select") != 0 && strcmp(optarg, "io_uring") != 0) {
+                    handle_init_error("extract_args: Invalid event backend", 0);
+                }
+                config->eventBackend = optarg;
+                break;
+            case 'G':
+                groupList = optarg;
+                break;
+            case 'P':
+                mcPort = strtol(optarg, NULL, 10);
+                if (mcPort < 1 || mcPort != (u_int16_t)mcPort) handle_init_error("extract_args: Invalid multicast port number", 0);
+                break;
+            case 'i':
+                if (parse_interface(optarg, &config->mcInterface) == ERROR_CODE) handle_init_error("extract_args: Invalid multicast interface", 0);
+                break;
+            case 'L':
+                config->mcTTL = strtol(optarg, NULL, 10);
+                if (config->mcTTL < 0 || config->mcTTL > 255) handle_init_error("extract_args: Invalid multicast TTL", 0);
+                break;
+            case 'x':
+                config->mcLoop = 0;
+                break;
+            case 'W':
+                if (parse_channel(optarg, &config->watchAddr) == ERROR_CODE) handle_init_error("extract_args: Invalid watch channel", 0);
+                config->watch = 1;
+                break;
+            default:
+                handle_init_error("extract_args: Invalid option", 0);
+        }
+    }
+    /* Check that the positional arg count is correct */
+    if (argc - optind != NUM_ARGS) handle_init_error("argc: Invalid number of command line arguments", 0);
+    if (config->numThreads > config->maxGames) handle_init_error("extract_args: More threads than games", 0);
+    if ((config->numGroups = parse_groups(groupList, mcPort, config->groups)) == ERROR_CODE) handle_init_error("extract_args: Invalid multicast groups", 0);
     /* Extract and validate remote port number */
-    *port = strtol(argv[1], NULL, 10);
-    if (*port < 1 || *port != (u_int16_t)(*port)) handle_init_error("extract_args: Invalid port number", 0);
+    config->port = strtol(argv[optind], NULL, 10);
+    if (config->port < 1 || config->port != (u_int16_t)(config->port)) handle_init_error("extract_args: Invalid port number", 0);
+    if (config->metricsPort == config->port) handle_init_error("extract_args: Metrics port is the server port", 0);
 }
 
+/* The ring buffer of messages waiting for the logger to write them. */
+static struct Log_Entry logRing[LOG_RING_SIZE];
+/* The positions the next message is logged at and written from. */
+static atomic_size_t logHead, logTail;
+/* The number of messages dropped because the ring buffer was full. */
+static atomic_long logDropped;
+/* The most detailed log level written. */
+static int logLevel = LOG_INFO;
+/* Whether log messages are written as JSON lines. */
+static int logJSON;
+/* Whether the logger thread is writing the ring buffer (messages are written right away until then). */
+static int logRunning;
+
 /**
- * @brief Creates the comminication endpoint with the provided IP address and port number. If any
- * errors are found, the function terminates the process.
+ * @brief Starts the logger thread, which writes the logged messages to stdout so the threads
+ * playing games never block on it. Logging never waits for the logger: a message logged while
+ * the ring buffer is full is dropped and counted.
  * 
- * @param socketAddr The socket address structure created for the comminication endpoint.
- * @param address The IP address for the socket address structure.
- * @param port The port number for the socket address structure.
- * @return The socket descriptor of the created comminication endpoint.
+ * @param level The most detailed log level written.
+ * @param json Whether log messages are written as JSON lines.
  */
-int create_endpoint(struct sockaddr_in *socketAddr, int type, unsigned long address, int port) {
-    int sd;
-    /* Create socket */
-    if ((sd = socket(AF_INET, type, 0)) >= 0) {
-        /* Clear the initial socket address structure */
-        bzero((char *)socketAddr, sizeof(struct sockaddr_in *));
-        /* Assign address family to socket */
-        socketAddr->sin_family = AF_INET;
-        /* Assign IP address to socket */
-        socketAddr->sin_addr.s_addr = htonl(address);
-        /* Assign port number to socket */
-        socketAddr->sin_port = htons(port);
-    } else {
-        print_error("create_endpoint: socket", errno, 1);
-    }
-    /* Bind socket to communication endpoint */
-    if (bind(sd, (struct sockaddr *)socketAddr, sizeof(struct sockaddr_in)) < 0) {
-        print_error("create_endpoint: bind", errno, 1);
-    }
-    /* Check socket type if successful */
-    if (type == SOCK_DGRAM) {
-        printf("[+]DGRAM socket created successfully.\n");
-    } else if (type == SOCK_STREAM) {
-        printf("[+]STREAM socket created successfully.\n");
-    } else {
-        printf("[+]UNKNOWN socket created successfully.\n");
+void init_logging(int level, int json) {
+    int i, err;
+    pthread_t thread;
+    logLevel = level;
+    logJSON = json;
+    for (i = 0; i < LOG_RING_SIZE; i++) atomic_init(&logRing[i].sequence, i);
+    if ((err = pthread_create(&thread, NULL, run_logger, NULL)) != 0) {
+        print_error("init_logging: pthread_create", err, 0);
+        return;
     }
-    return sd;
+    pthread_detach(thread);
+    logRunning = 1;
 }
 
 /**
- * @brief Join the multicast group at the specified address.
+ * @brief Determines if messages of a log level are written, so expensive messages (like the
+ * game board) are only put together when they will be written.
  * 
- * @param serv The server communication endpoint.
- * @param groupAddr The IP address of the multicast group.
+ * @param level The log level.
+ * @return True if messages of the log level are written, false otherwise.
  */
-void join_multicast_group(const struct Server *serv, const char *groupAddr) {
-    struct ip_mreq mreq;
-    /* Setup address of the multicast group */
-    mreq.imr_multiaddr.s_addr = inet_addr(groupAddr);
-    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
-    /* Join the multicast group */
-    if (setsockopt(serv->mcd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(struct ip_mreq)) < 0) {
-        print_error("join_multicast_group: setsockopt", errno, 1);
-    }
-    printf("Server joined multicast group at %s (port %hu)\n", groupAddr, serv->multicastAddr.sin_port);
+int log_enabled(int level) {
+    return level <= logLevel;
 }
 
 /**
- * @brief Prints the server information needed for the client to comminicate with the server.
+ * @brief Logs a message. The message is formatted straight into a free entry of the ring
+ * buffer, which more than one thread can claim at once without locking.
  * 
- * @param serv The server communication endpoint.
+ * @param level The log level of the message.
+ * @param format The printf format of the message (without a trailing newline).
  */
-void print_server_info(const struct Server *serv) {
-    int hostname;
-    char hostbuffer[BUFFER_SIZE], *IP_addr;
-    struct hostent *host_entry;
-
-    /* Retrieve the hostname */
-    if ((hostname = gethostname(hostbuffer, sizeof(hostbuffer))) == -1) {
-        print_error("print_server_info: gethostname", errno, 1);
+void log_message(int level, const char *format, ...) {
+    va_list args;
+    struct Log_Entry *entry;
+    size_t pos;
+    if (level > logLevel) return;
+    if (!logRunning) {
+        /* Before the logger starts, messages are written right away */
+        struct Log_Entry direct;
+        direct.level = level;
+        clock_gettime(CLOCK_REALTIME, &direct.time);
+        va_start(args, format);
+        vsnprintf(direct.text, sizeof(direct.text), format, args);
+        va_end(args);
+        write_log_entry(stdout, &direct);
+        fflush(stdout);
+        return;
     }
-    /* Retrieve the host information */
-    if ((host_entry = gethostbyname(hostbuffer)) == NULL) {
-        print_error("print_server_info: gethostbyname", errno, 1);
+    /* Claim the next free entry, unless the logger has fallen a whole ring buffer behind */
+    pos = atomic_load_explicit(&logHead, memory_order_relaxed);
+    while (1) {
+        intptr_t diff;
+        entry = &logRing[pos & (LOG_RING_SIZE - 1)];
+        diff = (intptr_t)atomic_load_explicit(&entry->sequence, memory_order_acquire) - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&logHead, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&logDropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&logHead, memory_order_relaxed);
+        }
     }
-    /* Convert the host internet network address to an ASCII string */
-    IP_addr = inet_ntoa(*((struct in_addr *)host_entry->h_addr_list[0]));
-    /* Print the IP address and port number for the server */
-    printf("Server listening at %s on port %hu\n", IP_addr, serv->serverAddr.sin_port);
+    /* Fill in the entry, then hand it to the logger */
+    entry->level = level;
+    clock_gettime(CLOCK_REALTIME, &entry->time);
+    va_start(args, format);
+    vsnprintf(entry->text, sizeof(entry->text), format, args);
+    va_end(args);
+    atomic_store_explicit(&entry->sequence, pos + 1, memory_order_release);
 }
 
 /**
- * @brief Initializes the starting state of the game board that both players start with.
+ * @brief Writes a logged message as a line of text (errors prefixed with "ERROR: ") or as a
+ * JSON object with its time, level, and message.
  * 
- * @param game The current game of TicTacToe being played.
+ * @param out The stream to write the message to.
+ * @param entry The logged message.
  */
-void init_shared_state(struct TTT_Game *game) {    
-    int i;
-    /* Initializes the shared state (aka the board)  */
-    for (i = 1; i <= sizeof(game->board); i++) {
-        game->board[i-1] = i + '0';
+void write_log_entry(FILE *out, const struct Log_Entry *entry) {
+    static const char *levels[] = {"error", "info", "debug"};
+    const char *c;
+    if (!logJSON) {
+        fprintf(out, (entry->level == LOG_ERROR) ? "ERROR: %s\n" : "%s\n", entry->text);
+        return;
+    }
+    fprintf(out, "{\"time\":%ld.%06ld,\"level\":\"%s\",\"message\":\"", (long)entry->time.tv_sec, entry->time.tv_nsec / 1000, levels[entry->level]);
+    for (c = entry->text; *c != '\0'; c++) {
+        /* Escape the characters JSON strings can't hold */
+        if (*c == '"' || *c == '\\') {
+            fprintf(out, "\\%c", *c);
+        } else if ((unsigned char)*c < 0x20) {
+            fprintf(out, "\\u%04x", *c);
+        } else {
+            fputc(*c, out);
+        }
     }
+    fprintf(out, "\"}\n");
 }
 
 /**
- * @brief Load the starting state of the game board from the remote player.
+ * @brief Writes every message waiting in the ring buffer, and how many were dropped.
  * 
- * @param game The current game of TicTacToe being played.
- * @return True if state loaded correctly, false otherwise.
+ * @param out The stream to write the messages to.
+ * @return The number of messages written.
  */
-int load_shared_state(struct TTT_Game *game) {    
-    int i, bytes = 0, moveCountP1 = 0, moveCountP2 = 0;
-    char boardState[GAME_SIZE];
-    /* Receive shared state (aka the board) from remote player */
-    while (bytes < GAME_SIZE) {
-        int rv;
-        /* Receive partial board state */
-        if ((rv = recv(game->sd, boardState+bytes, GAME_SIZE, 0)) <= 0) {
-            if (rv == 0) {
-                print_error("load_shared_state: Player 2 has disconnected", 0, 0);
-            } else {
-                print_error("load_shared_state", errno, 0);
-            }
-            return 0;
-        }
-        /* Update total bytes received for shared state */
-        bytes += rv;
-    }
-
-    /* Check that the received board contains valid marks */
-    for (i = 0; i < GAME_SIZE; i++) {
-        char mark = boardState[i];
-        if (mark == 0 || mark == P1_MARK || mark == P2_MARK) {
-            if (mark != 0) {
-                game->board[i] = mark;
-                (mark == P1_MARK) ? moveCountP1++ : moveCountP2++;
-            }
+int drain_log(FILE *out) {
+    int written = 0;
+    long dropped;
+    size_t pos = atomic_load_explicit(&logTail, memory_order_relaxed);
+    while (1) {
+        struct Log_Entry *entry = &logRing[pos & (LOG_RING_SIZE - 1)];
+        intptr_t diff = (intptr_t)atomic_load_explicit(&entry->sequence, memory_order_acquire) - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (!atomic_compare_exchange_weak_explicit(&logTail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) continue;
+            write_log_entry(out, entry);
+            written++;
+            /* Free the entry for the message logged a whole ring buffer later */
+            atomic_store_explicit(&entry->sequence, pos + LOG_RING_SIZE, memory_order_release);
+            pos++;
+        } else if (diff < 0) {
+            break;
         } else {
-            print_error("load_shared_state: The received board contains invalid marks", 0, 0);
-            return 0;
+            pos = atomic_load_explicit(&logTail, memory_order_relaxed);
         }
     }
-    /* Validate valid number of moves */
-    if (moveCountP1 != moveCountP2) {
-        print_error("load_shared_state: Board state contains an invalid number of moves", 0, 0);
-        return 0;
+    if ((dropped = atomic_exchange_explicit(&logDropped, 0, memory_order_relaxed)) > 0) {
+        struct Log_Entry notice = {.level = LOG_ERROR};
+        clock_gettime(CLOCK_REALTIME, &notice.time);
+        snprintf(notice.text, sizeof(notice.text), "Logger fell behind and dropped %ld message(s)", dropped);
+        write_log_entry(out, &notice);
+        written++;
     }
+    if (written > 0) fflush(out);
+    return written;
+}
 
-    return 1;
+/**
+ * @brief Writes every message logged so far from the calling thread (before the process exits).
+ */
+void flush_log(void) {
+    if (logRunning) drain_log(stdout);
 }
 
 /**
- * @brief Initializes the starting state of each game of TicTacToe in the current game roster.
+ * @brief Runs the logger thread, which writes the messages in the ring buffer as they are
+ * logged and sleeps briefly whenever there is nothing to write.
  * 
- * @param serv The server communication endpoint.
+ * @param arg Unused.
+ * @return Never returns.
  */
-void init_game_roster(struct Server *serv) {
-    int i;
-    printf("[+]Initializing shared game states.\n");
-    memset(serv->gameRoster, 0, sizeof(serv->gameRoster));
-    /* Iterates over all games */
-    for (i = 0;  i < MAX_GAMES; i++) {
-        struct TTT_Game *game = &serv->gameRoster[i];
-        /* Initialize current game attributes to default values */
-        reset_game(game);
-        /* Set current game number */
-        game->gameNum = i+1;
+void *run_logger(void *arg) {
+    while (1) {
+        if (drain_log(stdout) == 0) usleep(LOG_IDLE_WAIT);
     }
+    return NULL;
 }
 
+/* The metrics of the calling thread (NULL if the thread keeps none, e.g. while initializing). */
+static _Thread_local struct Metrics *threadMetrics;
+/* The name and description of each counter, as exported by the metrics endpoint. */
+static const char *const counterNames[NUM_COUNTERS][2] = {
+    {"tictactoe_connections_accepted_total", "Connections accepted from remote players."},
+    {"tictactoe_connections_refused_total", "Connections and games turned down for lack of an open game."},
+    {"tictactoe_game_requests_total", "REQUEST_GAME commands received from the multicast group."},
+    {"tictactoe_game_requests_coalesced_total", "REQUEST_GAME commands coalesced with one already being answered."},
+    {"tictactoe_games_advertised_total", "GAME_AVAILABLE commands sent."},
+    {"tictactoe_game_states_received_total", "GAME_STATE commands received from the multicast group."},
+    {"tictactoe_invalid_resumes_total", "Resumed games with a board that was rejected."},
+    {"tictactoe_replicas_taken_total", "Games taken over from their replica."},
+    {"tictactoe_games_ended_total", "Games ended or abandoned by remote players."},
+    {"tictactoe_searches_total", "Searches for Player 1's move."},
+    {"tictactoe_search_nodes_total", "Board states searched."},
+    {"tictactoe_timeouts_total", "Games and connections ended for missing a deadline."},
+    {"tictactoe_reservations_expired_total", "Games reserved with GAME_AVAILABLE that were never claimed."},
+    {"tictactoe_position_cache_hits_total", "Player 1 moves found in the position cache."},
+    {"tictactoe_position_cache_misses_total", "Player 1 moves not found in the position cache."},
+    {"tictactoe_watch_datagrams_total", "Datagrams of moves and snapshots published to spectators."}
+};
+/* The name, label, and description of each histogram, as exported by the metrics endpoint. */
+static const char *const histogramNames[NUM_HISTOGRAMS][3] = {
+    {"tictactoe_command_duration_seconds", "command=\"new_game\",", "Time taken to handle each TCP command."},
+    {"tictactoe_command_duration_seconds", "command=\"move\",", NULL},
+    {"tictactoe_command_duration_seconds", "command=\"game_over\",", NULL},
+    {"tictactoe_command_duration_seconds", "command=\"resume_game\",", NULL},
+    {"tictactoe_command_duration_seconds", "command=\"resume_replica\",", NULL},
+    {"tictactoe_multicast_duration_seconds", "", "Time taken to drain the multicast group and answer its commands."},
+    {"tictactoe_search_duration_seconds", "", "Time taken to search for Player 1's move."}
+};
+
 /**
- * @brief Finds an open game of TicTacToe to play if one is available.
+ * @brief Gets the time of a monotonic clock to measure latencies with.
  * 
- * @param serv The server communication endpoint.
- * @return The index of an open game if one is available, otherwise an error code is returned.
+ * @return The time (in nanoseconds) since an arbitrary point in the past.
  */
-int find_open_game(const struct Server *serv) {
-    int i, gameIndex = ERROR_CODE;
-    /* Searches over all games */
-    for (i = 0; i < MAX_GAMES; i++) {
-        const struct TTT_Game *game = &serv->gameRoster[i];
-        /* Check that a client is not connected to the game */
-        if (game->sd < 0) {
-            gameIndex = i;
-            break;
-        }
-    }
-    return gameIndex;
+uint64_t monotonic_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
 }
 
 /**
- * @brief Gets a UDP command from the remote player and attempts to validate the data and
- * syntax based on the current protocol.
+ * @brief Adds to a counter of the calling thread. Only the thread itself writes its counters,
+ * so a relaxed atomic add is enough for the metrics endpoint to read them safely.
  * 
- * @param sd The socket descriptor of the multicast group.
- * @param playerAddr The address of the remote player.
- * @param datagram The datagram to store the command that the remote player sent.
- * @return The number of bytes received for the command, or an error code if an error occured. 
+ * @param counter The counter to add to.
+ * @param amount The amount to add.
  */
-int get_udp_command(int sd, struct sockaddr_in *playerAddr, struct UDP_Buffer *datagram) {
-    int bytes = 0;
-    socklen_t fromLength = sizeof(struct sockaddr_in);
-    /* Receive and validate command from remote player */
-    if ((bytes = recvfrom(sd, datagram, UDP_CMD_SIZE, 0, (struct sockaddr *)playerAddr, &fromLength)) <= 0) {
-        /* Check for error receiving command */
-        if (bytes == 0) {
-            print_error("get_udp_command: Received empty datagram. Datagram discarded", 0, 0);
-        } else {
-            print_error("get_udp_command", errno, 0);
-        }
-        return ERROR_CODE;
-    }
-    /* Validate the received message */
-    if (datagram->version != VERSION) {  // check for correct version
-        print_error("get_udp_command: Protocol version not supported", 0, 0);
-        return ERROR_CODE;
-    } else if (datagram->command < REQUEST_GAME || datagram->command > GAME_AVAILABLE) {  // check for valid command
-        print_error("get_udp_command: Invalid UDP command", 0, 0);
-        return ERROR_CODE;
-    }
-    return bytes;
+void count_metric(int counter, unsigned long amount) {
+    if (threadMetrics != NULL) atomic_fetch_add_explicit(&threadMetrics->counters[counter], amount, memory_order_relaxed);
 }
 
 /**
- * @brief Handles the REQUEST_GAME command from the remote player. Checks whethere there is
- * a game available to play and sends the GAME_AVAILABLE command to the remote player if so.
+ * @brief Records the time an operation of the calling thread has taken in one of its histograms.
  * 
- * @param serv The server communication endpoint.
- * @param playerAddr The address of the remote player.
+ * @param histogram The histogram to record the latency in.
+ * @param start The time (from monotonic_time) the operation started.
  */
-void request_game(const struct Server *serv, const struct sockaddr_in *playerAddr) {
-    printf("A remote player issued a REQUEST_GAME command\n");
-    /* Check is there is a game available */
-    if (find_open_game(serv) >= 0) {
-        send_game_available(serv, playerAddr);
-    } else {
-        print_error("request_game: Unable to find an open game", 0, 0);
-    }
+void record_latency(int histogram, uint64_t start) {
+    uint64_t latency;
+    struct Histogram *hist;
+    if (threadMetrics == NULL) return;
+    latency = monotonic_time() - start;
+    hist = &threadMetrics->histograms[histogram];
+    atomic_fetch_add_explicit(&hist->buckets[histogram_bucket(latency)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum, latency, memory_order_relaxed);
 }
 
 /**
- * @brief Sends the GAME_AVAILABLE command to the remote player.
+ * @brief Finds the histogram bucket of a latency. Each power of 2 nanoseconds from
+ * 2^HISTOGRAM_MIN_OCTAVE on is split into HISTOGRAM_SUB_BUCKETS buckets of equal width, so
+ * every bucket is within 25% of the latencies it holds.
  * 
- * @param serv The server communication endpoint.
- * @param playerAddr The address of the remote player.
+ * @param latency The latency (in nanoseconds).
+ * @return The index of the bucket.
  */
-void send_game_available(const struct Server *serv, const struct sockaddr_in *playerAddr) {
-    struct UDP_Buffer datagram = {0};
-    /* Pack command information into datagram */
-    datagram.version = VERSION;
-    datagram.command = GAME_AVAILABLE;
-    /* Send the command to the remote player */
-    printf("Server sent the GAME_AVAILABLE command to the remote player\n");
-    if (sendto(serv->mcrd, &datagram, UDP_CMD_SIZE, 0, (struct sockaddr *)playerAddr, sizeof(struct sockaddr_in)) < 0) {
-        print_error("send_game_available", errno, 0);
-    }
+int histogram_bucket(uint64_t latency) {
+    int octave, bucket;
+    if (latency < ((uint64_t)1 << HISTOGRAM_MIN_OCTAVE)) return 0;
+    octave = 63 - __builtin_clzll(latency);
+    bucket = 1 + (octave - HISTOGRAM_MIN_OCTAVE) * HISTOGRAM_SUB_BUCKETS + (int)((latency >> (octave - 2)) & (HISTOGRAM_SUB_BUCKETS - 1));
+    return (bucket < HISTOGRAM_BUCKETS - 1) ? bucket : HISTOGRAM_BUCKETS - 1;
 }
 
 /**
- * @brief Gets a TCP command from the remote player and attempts to validate the data and
- * syntax based on the current protocol.
+ * @brief Finds the upper bound of a histogram bucket (other than the overflow bucket).
  * 
- * @param sd The socket descriptor of the connected player's comminication endpoint.
- * @param msg The buffer to store the command that the remote player sent.
- * @return The number of bytes received for the command, or an error code if an error occured. 
+ * @param bucket The index of the bucket.
+ * @return The upper bound (in seconds) of the latencies in the bucket.
  */
-int get_tcp_command(int sd, struct TCP_Buffer *msg) {
-    int bytes = 0;
-    /* Receive message from remote player */
-    while (bytes < TCP_CMD_SIZE) {
-        int rv;
-        /* Receive partial message */
-        if ((rv = recv(sd, msg+bytes, TCP_CMD_SIZE, 0)) <= 0) {
-            if (rv == 0) {
-                print_error("get_tcp_command: Player 2 has disconnected", 0, 0);
-            } else {
-                print_error("get_tcp_command", errno, 0);
-            }
-            return ERROR_CODE;
-        }
-        /* Update total bytes received for message */
-        bytes += rv;
-    }
-    /* Validate the received message */
-    if (msg->version != VERSION) {  // check for correct version
-        print_error("get_tcp_command: Protocol version not supported", 0, 0);
-        return ERROR_CODE;
-    } else if (msg->command < NEW_GAME || msg->command > RESUME_GAME) {  // check for valid command
-        print_error("get_tcp_command: Invalid TCP command", 0, 0);
-        return ERROR_CODE;
-    } else if (!(msg->command == NEW_GAME || msg->command == RESUME_GAME) && (msg->gameNum < 1 || msg->gameNum > MAX_GAMES)) { // check for valid game number
-        print_error("get_tcp_command: Invalid game number", 0, 0);
-        return ERROR_CODE;
-    }
-    return bytes;
+double histogram_bound(int bucket) {
+    int octave, sub;
+    if (bucket == 0) return ((uint64_t)1 << HISTOGRAM_MIN_OCTAVE) / 1e9;
+    octave = HISTOGRAM_MIN_OCTAVE + (bucket - 1) / HISTOGRAM_SUB_BUCKETS;
+    sub = (bucket - 1) % HISTOGRAM_SUB_BUCKETS;
+    return ((uint64_t)(HISTOGRAM_SUB_BUCKETS + sub + 1) << (octave - 2)) / 1e9;
 }
 
 /**
- * @brief Handles the NEW_GAME command from the remote player. Initializes a new game, if
- * available, and sends the first move to the remote player.
+ * @brief Creates the metrics endpoint and starts the thread answering its requests, if the
+ * server was asked for one. If any errors are found, the function terminates the process.
  * 
- * @param msg The message containing the command that the remote player sent.
- * @param game The current game of TicTacToe being played.
+ * @param serv The server communication endpoint.
+ * @param port The port number of the metrics endpoint, or 0 if it is disabled.
  */
-void new_game(const struct TCP_Buffer *msg, struct TTT_Game *game) {
-    int move;
-    printf("The remote player issued a NEW_GAME command\n");
-    /* Initialize the board */
+void init_metrics(struct Server *serv, int port) {
+    int err;
+    serv->metricsSD = ERROR_CODE;
+    if (port == 0) return;
+    serv->metricsSD = create_endpoint(&serv->metricsAddr, SOCK_STREAM, INADDR_ANY, port);
+    if (listen(serv->metricsSD, BACKLOG_MIN) < 0) print_error("init_metrics: listen", errno, 1);
+    if ((err = pthread_create(&serv->metricsThread, NULL, run_metrics, serv)) != 0) print_error("init_metrics: pthread_create", err, 1);
+    log_message(LOG_INFO, "[+]Server exporting metrics at port %d.", port);
+}
+
+/**
+ * @brief Adds up the metrics of every shard and worker of the server.
+ * 
+ * @param serv The server communication endpoint.
+ * @param total The metrics to add the metrics of every thread to (zeroed by the caller).
+ */
+void collect_metrics(const struct Server *serv, struct Metrics *total) {
+    int i, j, k, numThreads = serv->numShards + serv->pool.numWorkers;
+    for (i = 0; i < numThreads; i++) {
+        struct Metrics *metrics = (i < serv->numShards) ? &serv->shards[i].metrics : &serv->pool.workers[i - serv->numShards].metrics;
+        for (j = 0; j < NUM_COUNTERS; j++) {
+            total->counters[j] += atomic_load_explicit(&metrics->counters[j], memory_order_relaxed);
+        }
+        for (j = 0; j < NUM_HISTOGRAMS; j++) {
+            for (k = 0; k < HISTOGRAM_BUCKETS; k++) {
+                total->histograms[j].buckets[k] += atomic_load_explicit(&metrics->histograms[j].buckets[k], memory_order_relaxed);
+            }
+            total->histograms[j].sum += atomic_load_explicit(&metrics->histograms[j].sum, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * @brief Writes the metrics of the server in the Prometheus text format: the counters and
+ * latency histograms of every thread added up and gauges of the server's current load.
+ * 
+ * @param out The stream to write the metrics to.
+ * @param serv The server communication endpoint.
+ */
+void write_metrics(FILE *out, const struct Server *serv) {
+    int i, j;
+    struct Server_Load load;
+    static struct Metrics total;    // only used by the metrics thread (too large for its stack to need)
+    memset(&total, 0, sizeof(total));
+    collect_metrics(serv, &total);
+    for (i = 0; i < NUM_COUNTERS; i++) {
+        fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n", counterNames[i][0], counterNames[i][1], counterNames[i][0], counterNames[i][0], (unsigned long)total.counters[i]);
+    }
+    for (i = 0; i < NUM_HISTOGRAMS; i++) {
+        const char *name = histogramNames[i][0], *label = histogramNames[i][1];
+        /* The label (if any) without its trailing comma, for the sum and count */
+        const int labelLength = (label[0] != '\0') ? (int)strlen(label) - 1 : 0;
+        unsigned long count = 0;
+        /* Describe each metric once, before the histogram of its first label */
+        if (histogramNames[i][2] != NULL) fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, histogramNames[i][2], name);
+        for (j = 0; j < HISTOGRAM_BUCKETS - 1; j++) {
+            count += total.histograms[i].buckets[j];
+            fprintf(out, "%s_bucket{%sle=\"%g\"} %lu\n", name, label, histogram_bound(j), count);
+        }
+        count += total.histograms[i].buckets[HISTOGRAM_BUCKETS-1];
+        fprintf(out, "%s_bucket{%sle=\"+Inf\"} %lu\n", name, label, count);
+        if (labelLength > 0) {
+            fprintf(out, "%s_sum{%.*s} %.9f\n%s_count{%.*s} %lu\n", name, labelLength, label, total.histograms[i].sum / 1e9, name, labelLength, label, count);
+        } else {
+            fprintf(out, "%s_sum %.9f\n%s_count %lu\n", name, total.histograms[i].sum / 1e9, name, count);
+        }
+    }
+    /* Add the gauges of the server's current load */
+    get_server_load(serv, &load);
+    fprintf(out, "# HELP tictactoe_active_games Games being played.\n# TYPE tictactoe_active_games gauge\ntictactoe_active_games %d\n", ntohs(load.activeGames));
+    fprintf(out, "# HELP tictactoe_open_games Games available to new players.\n# TYPE tictactoe_open_games gauge\ntictactoe_open_games %d\n", ntohs(load.freeSlots));
+    fprintf(out, "# HELP tictactoe_pending_searches Searches for Player 1's move submitted and not yet finished.\n# TYPE tictactoe_pending_searches gauge\ntictactoe_pending_searches %d\n", atomic_load(&serv->pool.numSearches));
+    fprintf(out, "# HELP tictactoe_replicas Games replicated from the other servers of the multicast group.\n# TYPE tictactoe_replicas gauge\ntictactoe_replicas %d\n", count_replicas());
+}
+
+/**
+ * @brief Answers a request to the metrics endpoint with the metrics of the server. Whatever
+ * is requested, the reply is an HTTP response with the metrics in the Prometheus text format.
+ * 
+ * @param serv The server communication endpoint.
+ * @param sd The socket descriptor of the connected scraper.
+ */
+void answer_metrics_request(const struct Server *serv, int sd) {
+    char request[METRICS_REQUEST_SIZE+1], header[BUFFER_SIZE+1];
+    char *body = NULL;
+    size_t bodyLength = 0;
+    int length = 0, headerLength, sent = 0, rv;
+    FILE *out;
+    struct timeval timeout = {METRICS_TIMEOUT, 0};
+    if (setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) print_error("answer_metrics_request: setsockopt", errno, 0);
+    /* Read the request headers (closing with unread bytes would reset the connection) */
+    while (length < METRICS_REQUEST_SIZE && (rv = recv(sd, request + length, METRICS_REQUEST_SIZE - length, 0)) > 0) {
+        length += rv;
+        request[length] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL) break;
+    }
+    /* Write the metrics, then send them after the response header */
+    if ((out = open_memstream(&body, &bodyLength)) == NULL) {
+        print_error("answer_metrics_request: open_memstream", errno, 0);
+        return;
+    }
+    write_metrics(out, serv);
+    fclose(out);
+    headerLength = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", bodyLength);
+    if (send(sd, header, headerLength, MSG_NOSIGNAL) != headerLength) {
+        print_error("answer_metrics_request: send", errno, 0);
+    } else {
+        while (sent < (int)bodyLength && (rv = send(sd, body + sent, bodyLength - sent, MSG_NOSIGNAL)) > 0) sent += rv;
+        if (sent < (int)bodyLength) print_error("answer_metrics_request: send", errno, 0);
+    }
+    free(body);
+}
+
+/**
+ * @brief Runs the metrics thread, which answers one request to the metrics endpoint at a time
+ * so scraping the metrics never takes time from the threads playing games.
+ * 
+ * @param arg The server communication endpoint.
+ * @return Never returns.
+ */
+void *run_metrics(void *arg) {
+    const struct Server *serv = (const struct Server *)arg;
+    while (1) {
+        int sd = accept(serv->metricsSD, NULL, NULL);
+        if (sd < 0) {
+            print_error("run_metrics: accept", errno, 0);
+            continue;
+        }
+        answer_metrics_request(serv, sd);
+        if (close(sd) < 0) print_error("run_metrics: close", errno, 0);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Creates the comminication endpoint with the provided IP address and port number. If any
+ * errors are found, the function terminates the process.
+ * 
+ * @param socketAddr The socket address structure created for the comminication endpoint.
+ * @param address The IP address for the socket address structure.
+ * @param port The port number for the socket address structure.
+ * @return The socket descriptor of the created comminication endpoint.
+ */
+int create_endpoint(struct sockaddr_in *socketAddr, int type, unsigned long address, int port) {
+    int sd, reuse = 1;
+    /* Create socket */
+    if ((sd = socket(AF_INET, type, 0)) >= 0) {
+        /* Clear the initial socket address structure */
+        bzero((char *)socketAddr, sizeof(struct sockaddr_in *));
+        /* Assign address family to socket */
+        socketAddr->sin_family = AF_INET;
+        /* Assign IP address to socket */
+        socketAddr->sin_addr.s_addr = htonl(address);
+        /* Assign port number to socket */
+        socketAddr->sin_port = htons(port);
+    } else {
+        print_error("create_endpoint: socket", errno, 1);
+    }
+    /* Let every server on the host join the multicast group (a second server still can't listen on the same port) */
+    if (setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+        print_error("create_endpoint: setsockopt", errno, 0);
+    }
+    /* Bind socket to communication endpoint */
+    if (bind(sd, (struct sockaddr *)socketAddr, sizeof(struct sockaddr_in)) < 0) {
+        print_error("create_endpoint: bind", errno, 1);
+    }
+    /* Check socket type if successful */
+    if (type == SOCK_DGRAM) {
+        log_message(LOG_INFO, "[+]DGRAM socket created successfully.");
+    } else if (type == SOCK_STREAM) {
+        log_message(LOG_INFO, "[+]STREAM socket created successfully.");
+    } else {
+        log_message(LOG_INFO, "[+]UNKNOWN socket created successfully.");
+    }
+    return sd;
+}
+
+/**
+ * @brief Parses a comma-separated list of multicast group addresses.
+ * 
+ * @param list The list of multicast group addresses.
+ * @param port The port number of the multicast groups.
+ * @param groups The socket address structures of the multicast groups.
+ * @return The number of multicast groups, or an error code if an address is not a multicast
+ * address or there are too many of them.
+ */
+int parse_groups(const char *list, int port, struct sockaddr_in *groups) {
+    int numGroups = 0;
+    while (*list) {
+        char address[INET_ADDRSTRLEN];
+        int length = strcspn(list, ",");
+        if (numGroups == MAX_GROUPS || length == 0 || length >= INET_ADDRSTRLEN) return ERROR_CODE;
+        memcpy(address, list, length);
+        address[length] = '\0';
+        bzero(&groups[numGroups], sizeof(struct sockaddr_in));
+        groups[numGroups].sin_family = AF_INET;
+        groups[numGroups].sin_port = htons(port);
+        if (inet_pton(AF_INET, address, &groups[numGroups].sin_addr) != 1 || !IN_MULTICAST(ntohl(groups[numGroups].sin_addr.s_addr))) return ERROR_CODE;
+        numGroups++;
+        list += length;
+        if (*list == ',') list++;
+    }
+    return (numGroups > 0) ? numGroups : ERROR_CODE;
+}
+
+/**
+ * @brief Finds the IPv4 address of a network interface, given either its name (e.g. eth1) or
+ * the address itself.
+ * 
+ * @param name The name or IPv4 address of the interface.
+ * @param addr The IPv4 address of the interface.
+ * @return 0 if the interface was found, otherwise an error code.
+ */
+int parse_interface(const char *name, struct in_addr *addr) {
+    struct ifaddrs *interfaces, *ifa;
+    int rv = ERROR_CODE;
+    if (inet_pton(AF_INET, name, addr) == 1) return 0;
+    if (getifaddrs(&interfaces) < 0) {
+        print_error("parse_interface: getifaddrs", errno, 0);
+        return ERROR_CODE;
+    }
+    for (ifa = interfaces; ifa; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_INET && strcmp(ifa->ifa_name, name) == 0) {
+            *addr = ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
+            rv = 0;
+            break;
+        }
+    }
+    freeifaddrs(interfaces);
+    return rv;
+}
+
+/**
+ * @brief Joins every configured multicast group on the configured interface. The multicast
+ * socket only receives the groups it joined, even if other servers on the host joined others.
+ * 
+ * @param serv The server communication endpoint.
+ * @param config The server options with the multicast groups and interface.
+ */
+void join_multicast_groups(const struct Server *serv, const struct Server_Config *config) {
+    int i;
+#ifdef IP_MULTICAST_ALL
+    int all = 0;
+    /* Linux otherwise delivers every group joined by any socket on the host to a socket bound to INADDR_ANY */
+    if (setsockopt(serv->mcd, IPPROTO_IP, IP_MULTICAST_ALL, &all, sizeof(all)) < 0) {
+        print_error("join_multicast_groups: setsockopt-all", errno, 0);
+    }
+#endif
+    for (i = 0; i < config->numGroups; i++) {
+        struct ip_mreq mreq;
+        char group[INET_ADDRSTRLEN], interface[INET_ADDRSTRLEN] = "default";
+        /* Setup address of the multicast group */
+        mreq.imr_multiaddr = config->groups[i].sin_addr;
+        mreq.imr_interface = config->mcInterface;
+        /* Join the multicast group */
+        if (setsockopt(serv->mcd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(struct ip_mreq)) < 0) {
+            print_error("join_multicast_groups: setsockopt", errno, 1);
+        }
+        inet_ntop(AF_INET, &config->groups[i].sin_addr, group, sizeof(group));
+        if (config->mcInterface.s_addr != htonl(INADDR_ANY)) inet_ntop(AF_INET, &config->mcInterface, interface, sizeof(interface));
+        log_message(LOG_INFO, "Server joined multicast group at %s (port %hu) on interface %s", group, serv->multicastAddr.sin_port, interface);
+    }
+}
+
+/**
+ * @brief Prints the server information needed for the client to comminicate with the server.
+ * 
+ * @param serv The server communication endpoint.
+ */
+void print_server_info(const struct Server *serv) {
+    int hostname;
+    char hostbuffer[BUFFER_SIZE], *IP_addr;
+    struct hostent *host_entry;
+
+    /* Retrieve the hostname */
+    if ((hostname = gethostname(hostbuffer, sizeof(hostbuffer))) == -1) {
+        print_error("print_server_info: gethostname", errno, 1);
+    }
+    /* Retrieve the host information */
+    if ((host_entry = gethostbyname(hostbuffer)) == NULL) {
+        print_error("print_server_info: gethostbyname", errno, 1);
+    }
+    /* Convert the host internet network address to an ASCII string */
+    IP_addr = inet_ntoa(*((struct in_addr *)host_entry->h_addr_list[0]));
+    /* Print the IP address and port number for the server */
+    log_message(LOG_INFO, "Server listening at %s on port %hu", IP_addr, serv->serverAddr.sin_port);
+}
+
+/**
+ * @brief Sets the socket to non-blocking mode so that reads and accepts can be drained until
+ * the socket has no more data available.
+ *
+ * @param sd The socket descriptor of the comminication endpoint.
+ */
+void set_nonblocking(int sd) {
+    int flags;
+    /* Add the non-blocking flag to the current socket flags */
+    if ((flags = fcntl(sd, F_GETFL, 0)) < 0 || fcntl(sd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        print_error("set_nonblocking: fcntl", errno, 1);
+    }
+}
+
+/**
+ * @brief Sizes the queue of pending connections for the number of games the server can play,
+ * so a burst of players connecting at once is not turned away by the kernel before the server
+ * gets to decide whether it has a game for them.
+ *
+ * @param maxGames The maximum number of games the server plays simultaneously.
+ * @return The length of the queue of pending connections.
+ */
+int listen_backlog(int maxGames) {
+    if (maxGames < BACKLOG_MIN) return BACKLOG_MIN;
+    return (maxGames > SOMAXCONN) ? SOMAXCONN : maxGames;
+}
+
+/**
+ * @brief Prepares the table of games reserved for remote players, with a reservation for every
+ * game the server can play. Reservations are only made and claimed on shard 0, which answers
+ * the multicast group and accepts every connection, and expire on its timer wheel.
+ *
+ * @param serv The server communication endpoint.
+ * @param maxGames The maximum number of games the server plays simultaneously.
+ */
+void init_admission(struct Server *serv, int maxGames) {
+    int i;
+    struct Reservation *reservations = reserve_arena(maxGames * sizeof(struct Reservation));
+    memset(serv->reservationTable, 0, sizeof(serv->reservationTable));
+    serv->freeReservations = NULL;
+    for (i = maxGames - 1; i >= 0; i--) {
+        reservations[i].timer.expire = expire_reservation;
+        reservations[i].serv = serv;
+        reservations[i].next = serv->freeReservations;
+        serv->freeReservations = &reservations[i];
+    }
+    atomic_store(&serv->numReserved, 0);
+    serv->reservationTicks = RESERVATION_TTL / TIMER_TICK_MS;
+}
+
+/**
+ * @brief Determines the number of open games that are not held for a remote player. Safe to
+ * call from any thread.
+ *
+ * @param serv The server communication endpoint.
+ * @return The number of open games anyone can take (0 if every open game is reserved).
+ */
+int unreserved_games(const struct Server *serv) {
+    int i, numOpen = 0;
+    for (i = 0; i < serv->numShards; i++) numOpen += open_game_count(&serv->shards[i]);
+    numOpen -= atomic_load(&serv->numReserved);
+    return (numOpen > 0) ? numOpen : 0;
+}
+
+/**
+ * @brief Holds an open game for a remote player about to be sent GAME_AVAILABLE, so players
+ * that are answered never race each other for the same game. A player asking again keeps the
+ * game it already holds for another reservation period.
+ *
+ * @param serv The server communication endpoint.
+ * @param playerAddr The address the REQUEST_GAME command came from.
+ * @return True if a game is held for the player, false if every open game is taken or reserved.
+ */
+int reserve_game(struct Server *serv, const struct sockaddr_in *playerAddr) {
+    struct Timer_Wheel *timers = &serv->shards[0].timers;
+    struct Reservation **bucket = &serv->reservationTable[ntohl(playerAddr->sin_addr.s_addr) & (RESERVATION_BUCKETS - 1)];
+    struct Reservation *reservation;
+    for (reservation = *bucket; reservation != NULL; reservation = reservation->next) {
+        if (reservation->addr == playerAddr->sin_addr.s_addr && reservation->port == playerAddr->sin_port) {
+            schedule_timer(timers, &reservation->timer, timers->tick + serv->reservationTicks);
+            return 1;
+        }
+    }
+    if (unreserved_games(serv) == 0 || (reservation = serv->freeReservations) == NULL) return 0;
+    serv->freeReservations = reservation->next;
+    reservation->addr = playerAddr->sin_addr.s_addr;
+    reservation->port = playerAddr->sin_port;
+    reservation->next = *bucket;
+    *bucket = reservation;
+    atomic_fetch_add(&serv->numReserved, 1);
+    schedule_timer(timers, &reservation->timer, timers->tick + serv->reservationTicks);
+    return 1;
+}
+
+/**
+ * @brief Removes a reservation from the table and returns it to the free list.
+ *
+ * @param serv The server communication endpoint.
+ * @param link The link pointing to the reservation in its bucket of the table.
+ */
+static void release_reservation(struct Server *serv, struct Reservation **link) {
+    struct Reservation *reservation = *link;
+    cancel_timer(&serv->shards[0].timers, &reservation->timer);
+    *link = reservation->next;
+    reservation->next = serv->freeReservations;
+    serv->freeReservations = reservation;
+    atomic_fetch_sub(&serv->numReserved, 1);
+}
+
+/**
+ * @brief Claims a game held for a remote player connecting from an IP address (the connection
+ * comes from a different port than the REQUEST_GAME command, so any reservation for the
+ * address will do, oldest first).
+ *
+ * @param serv The server communication endpoint.
+ * @param playerAddr The IP address of the connecting player.
+ * @return True if a game was held for the player, false otherwise.
+ */
+int take_reservation(struct Server *serv, const struct in_addr *playerAddr) {
+    struct Reservation **link = &serv->reservationTable[ntohl(playerAddr->s_addr) & (RESERVATION_BUCKETS - 1)], **oldest = NULL;
+    for (; *link != NULL; link = &(*link)->next) {
+        if ((*link)->addr == playerAddr->s_addr && (oldest == NULL || (*link)->timer.expires <= (*oldest)->timer.expires)) oldest = link;
+    }
+    if (oldest == NULL) return 0;
+    release_reservation(serv, oldest);
+    return 1;
+}
+
+/**
+ * @brief Handles the expiry of a game held for a remote player that never connected, so the
+ * game can be offered to other players again.
+ *
+ * @param timer The timer of the reservation.
+ */
+void expire_reservation(struct Timer *timer) {
+    struct Reservation *reservation = (struct Reservation *)((char *)timer - offsetof(struct Reservation, timer));
+    struct Server *serv = reservation->serv;
+    struct Reservation **link = &serv->reservationTable[ntohl(reservation->addr) & (RESERVATION_BUCKETS - 1)];
+    while (*link != reservation) link = &(*link)->next;
+    log_message(LOG_DEBUG, "Game reserved for the player at %s expired", inet_ntoa(*(struct in_addr *)&reservation->addr));
+    count_metric(METRIC_RESERVATIONS_EXPIRED, 1);
+    release_reservation(serv, link);
+}
+
+/**
+ * @brief Turns away a connected player the server has no game for, telling it with the
+ * SERVER_FULL command that it should find another server instead of trying again. The
+ * command is sent as a version 6 command (which every client understands before it has spoken
+ * a version) before the connection is closed.
+ *
+ * @param sd The socket descriptor of the connected player.
+ */
+void refuse_connection(int sd) {
+    char discard[BUFFER_SIZE];
+    const char full[TCP_CMD_SIZE] = {VERSION, SERVER_FULL, 0, 0};
+    count_metric(METRIC_REFUSED, 1);
+    if (send(sd, full, TCP_CMD_SIZE, MSG_NOSIGNAL | MSG_DONTWAIT) < 0) print_error("refuse_connection: send", errno, 0);
+    /* Discard what the player already sent, so closing does not reset the connection before the command arrives */
+    shutdown(sd, SHUT_WR);
+    while (recv(sd, discard, sizeof(discard), MSG_DONTWAIT) > 0);
+    if (close(sd) < 0) print_error("refuse_connection: close-connection", errno, 0);
+}
+
+#ifdef __linux__
+/**
+ * @brief Creates the epoll instance for the event engine.
+ *
+ * @param engine The event engine being initialized.
+ * @return True if the backend was created successfully, false otherwise.
+ */
+static int epoll_init(struct Event_Engine *engine) {
+    if ((engine->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        print_error("epoll_init: epoll_create1", errno, 0);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Registers the socket with the epoll instance as edge-triggered so it is only
+ * reported again once new data arrives.
+ *
+ * @param engine The event engine to register the socket with.
+ * @param fd The socket descriptor to watch.
+ * @param tag The identifier reported back when the socket is ready.
+ * @return True if the socket was registered, false otherwise.
+ */
+static int epoll_add(struct Event_Engine *engine, int fd, int tag) {
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    event.data.u64 = ((uint64_t)(uint32_t)tag << 32) | (uint32_t)fd;
+    if (epoll_ctl(engine->epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        print_error("epoll_add: epoll_ctl", errno, 0);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Removes the socket from the epoll instance.
+ *
+ * @param engine The event engine the socket is registered with.
+ * @param fd The socket descriptor to stop watching.
+ */
+static void epoll_remove(struct Event_Engine *engine, int fd) {
+    if (epoll_ctl(engine->epfd, EPOLL_CTL_DEL, fd, NULL) < 0) print_error("epoll_remove: epoll_ctl", errno, 0);
+}
+
+/**
+ * @brief Blocks until at least one registered socket is ready (or the timeout runs out) and
+ * reports only those sockets.
+ *
+ * @param engine The event engine to wait on.
+ * @param events The array to store the ready sockets in.
+ * @param maxEvents The maximum number of ready sockets to report.
+ * @param timeout The maximum time (in milliseconds) to block, or -1 to block until a socket is ready.
+ * @return The number of ready sockets, or an error code if an error occured.
+ */
+static int epoll_wait_ready(struct Event_Engine *engine, struct Ready_Event *events, int maxEvents, int timeout) {
+    int i, count;
+    struct epoll_event ready[MAX_EVENTS];
+    if (maxEvents > MAX_EVENTS) maxEvents = MAX_EVENTS;
+    if ((count = epoll_wait(engine->epfd, ready, maxEvents, timeout)) < 0) {
+        if (errno == EINTR) return 0;
+        print_error("epoll_wait", errno, 0);
+        return ERROR_CODE;
+    }
+    /* Unpack the socket descriptor and tag of each ready socket */
+    for (i = 0; i < count; i++) {
+        events[i].fd = (int)(uint32_t)ready[i].data.u64;
+        events[i].tag = (int)(uint32_t)(ready[i].data.u64 >> 32);
+    }
+    return count;
+}
+
+/**
+ * @brief Watches the socket for room in its send buffer instead of input, edge-triggered, so
+ * it is reported once more as soon as it can be sent to again, or goes back to watching it for
+ * input. Input waiting is not watched meanwhile, since rearming the socket would report it
+ * again on every wait.
+ *
+ * @param engine The event engine the socket is registered with.
+ * @param fd The socket descriptor to watch.
+ * @param tag The identifier reported back when the socket is ready.
+ * @param blocked Whether the socket could not take everything sent to it.
+ */
+static void epoll_watch_output(struct Event_Engine *engine, int fd, int tag, int blocked) {
+    struct epoll_event event = {0};
+    event.events = blocked ? (EPOLLOUT | EPOLLET) : (EPOLLIN | EPOLLRDHUP | EPOLLET);
+    event.data.u64 = ((uint64_t)(uint32_t)tag << 32) | (uint32_t)fd;
+    if (epoll_ctl(engine->epfd, EPOLL_CTL_MOD, fd, &event) < 0) print_error("epoll_watch_output: epoll_ctl", errno, 0);
+}
+
+/* The edge-triggered epoll readiness backend. */
+static const struct Event_Backend epollBackend = {"epoll", epoll_init, epoll_add, epoll_remove, epoll_wait_ready, NULL, NULL, NULL, epoll_watch_output};
+#endif
+
+/**
+ * @brief Initializes the empty set of sockets for the select backend.
+ *
+ * @param engine The event engine being initialized.
+ * @return True since the backend cannot fail to initialize.
+ */
+static int select_init(struct Event_Engine *engine) {
+    FD_ZERO(&engine->activeFDS);
+    FD_ZERO(&engine->writeFDS);
+    engine->maxSD = -1;
+    return 1;
+}
+
+/**
+ * @brief Adds the socket to the set of sockets watched by select.
+ *
+ * @param engine The event engine to register the socket with.
+ * @param fd The socket descriptor to watch.
+ * @param tag The identifier reported back when the socket is ready.
+ * @return True if the socket was registered, false if it cannot be represented in an fd_set.
+ */
+static int select_add(struct Event_Engine *engine, int fd, int tag) {
+    if (fd < 0 || fd >= FD_SETSIZE) {
+        print_error("select_add: Socket descriptor exceeds FD_SETSIZE", 0, 0);
+        return 0;
+    }
+    FD_SET(fd, &engine->activeFDS);
+    engine->tags[fd] = tag;
+    if (fd > engine->maxSD) engine->maxSD = fd;
+    return 1;
+}
+
+/**
+ * @brief Removes the socket from the set of sockets watched by select.
+ *
+ * @param engine The event engine the socket is registered with.
+ * @param fd The socket descriptor to stop watching.
+ */
+static void select_remove(struct Event_Engine *engine, int fd) {
+    if (fd < 0 || fd >= FD_SETSIZE) return;
+    FD_CLR(fd, &engine->activeFDS);
+    FD_CLR(fd, &engine->writeFDS);
+    /* Lower the max socket descriptor past any unregistered sockets */
+    while (engine->maxSD >= 0 && !FD_ISSET(engine->maxSD, &engine->activeFDS)) engine->maxSD--;
+}
+
+/**
+ * @brief Blocks until at least one registered socket is ready (or the timeout runs out) and
+ * reports those sockets, along with the sockets waiting to be sent to that can be again.
+ *
+ * @param engine The event engine to wait on.
+ * @param events The array to store the ready sockets in.
+ * @param maxEvents The maximum number of ready sockets to report.
+ * @param timeout The maximum time (in milliseconds) to block, or -1 to block until a socket is ready.
+ * @return The number of ready sockets, or an error code if an error occured.
+ */
+static int select_wait_ready(struct Event_Engine *engine, struct Ready_Event *events, int maxEvents, int timeout) {
+    int fd, count = 0;
+    fd_set readFDS = engine->activeFDS, writeFDS = engine->writeFDS;
+    struct timeval limit = {timeout / 1000, (timeout % 1000) * 1000};
+    /* Sockets waiting to be sent to are not watched for input until they have been */
+    for (fd = 0; fd <= engine->maxSD; fd++) {
+        if (FD_ISSET(fd, &writeFDS)) FD_CLR(fd, &readFDS);
+    }
+    if (select(engine->maxSD+1, &readFDS, &writeFDS, NULL, (timeout >= 0) ? &limit : NULL) < 0) {
+        if (errno == EINTR) return 0;
+        print_error("select", errno, 0);
+        return ERROR_CODE;
+    }
+    /* Collect the ready sockets (sockets left over are reported again on the next wakeup) */
+    for (fd = 0; fd <= engine->maxSD && count < maxEvents; fd++) {
+        if (FD_ISSET(fd, &readFDS) || FD_ISSET(fd, &writeFDS)) {
+            events[count].fd = fd;
+            events[count].tag = engine->tags[fd];
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Moves the socket to the set of sockets watched for room in their send buffer instead
+ * of input, or back once everything sent to it has been taken.
+ *
+ * @param engine The event engine the socket is registered with.
+ * @param fd The socket descriptor to watch.
+ * @param tag The identifier reported back when the socket is ready (already known to select).
+ * @param blocked Whether the socket could not take everything sent to it.
+ */
+static void select_watch_output(struct Event_Engine *engine, int fd, int tag, int blocked) {
+    (void)tag;
+    if (fd < 0 || fd >= FD_SETSIZE) return;
+    if (blocked) FD_SET(fd, &engine->writeFDS);
+    else FD_CLR(fd, &engine->writeFDS);
+}
+
+/* The portable select readiness backend. */
+static const struct Event_Backend selectBackend = {"select", select_init, select_add, select_remove, select_wait_ready, NULL, NULL, NULL, select_watch_output};
+
+#ifdef HAVE_IO_URING
+/**
+ * @brief Submits the queued requests to the io_uring instance and, if asked to, waits for
+ * completions to arrive.
+ *
+ * @param ring The io_uring instance.
+ * @param minComplete The number of completions to wait for (0 to only submit).
+ * @param timeout The maximum time (in milliseconds) to wait, or -1 to wait until the completions arrive.
+ * @return The number of requests submitted, or an error code if the wait failed or timed out.
+ */
+static int uring_enter(struct Uring *ring, unsigned minComplete, int timeout) {
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg = {0};
+    unsigned flags = (minComplete > 0) ? IORING_ENTER_GETEVENTS : 0;
+    int rv;
+    if (minComplete > 0 && timeout >= 0) {
+        /* Pass the timeout along with the wait (as io_uring_pwait does) */
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000L;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    rv = syscall(__NR_io_uring_enter, ring->fd, ring->numQueued, minComplete, flags, (flags & IORING_ENTER_EXT_ARG) ? (void *)&arg : NULL, sizeof(arg));
+    if (rv >= 0) ring->numQueued -= ((unsigned)rv < ring->numQueued) ? (unsigned)rv : ring->numQueued;
+    return (rv < 0) ? ERROR_CODE : rv;
+}
+
+/**
+ * @brief Takes the next free entry of the submission ring, submitting the queued requests
+ * first if the ring is full.
+ *
+ * @param ring The io_uring instance.
+ * @param kind The kind of request.
+ * @param fd The socket descriptor the request is for.
+ * @param generation The generation of the socket descriptor's registration.
+ * @return The cleared submission entry, with its user data filled in.
+ */
+static struct io_uring_sqe *uring_get_sqe(struct Uring *ring, int kind, int fd, uint32_t generation) {
+    struct io_uring_sqe *sqe;
+    unsigned tail = *ring->sqTail;
+    while (tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) > ring->sqMask) {
+        if (uring_enter(ring, 0, 0) == ERROR_CODE && errno != EINTR && errno != EBUSY) print_error("uring_get_sqe: io_uring_enter", errno, 1);
+    }
+    sqe = &ring->sqes[tail & ring->sqMask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->user_data = URING_DATA(generation, kind, fd);
+    ring->sqArray[tail & ring->sqMask] = tail & ring->sqMask;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->numQueued++;
+    return sqe;
+}
+
+/**
+ * @brief Queues the multishot request watching a registered socket: a poll for sockets that
+ * are drained by the event loop itself, an accept for the listening socket, and a receive
+ * into the provided buffers for connections.
+ *
+ * @param ring The io_uring instance.
+ * @param fd The registered socket descriptor.
+ */
+static void uring_arm(struct Uring *ring, int fd) {
+    struct Uring_Watch *watch = &ring->watches[fd];
+    struct io_uring_sqe *sqe = uring_get_sqe(ring, watch->kind, fd, watch->generation);
+    sqe->fd = fd;
+    if (watch->kind == URING_POLL) {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLIN;
+        sqe->len = IORING_POLL_ADD_MULTI;
+    } else if (watch->kind == URING_ACCEPT) {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    } else {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+    }
+    watch->armed = 1;
+}
+
+/**
+ * @brief Gives a buffer back to the kernel to receive into.
+ *
+ * @param ring The io_uring instance.
+ * @param bid The ID of the buffer.
+ */
+static void uring_recycle(struct Uring *ring, int bid) {
+    unsigned short tail = ring->bufRing->tail;
+    struct io_uring_buf *buf = &ring->bufRing->bufs[tail & (URING_BUFFERS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(ring->buffers + (size_t)bid * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = bid;
+    __atomic_store_n(&ring->bufRing->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+    ring->numFreeBuffers++;
+}
+
+/**
+ * @brief Adds a registered socket to the list of ready sockets, unless it is already on it.
+ *
+ * @param ring The io_uring instance.
+ * @param fd The ready socket descriptor.
+ */
+static void uring_mark_ready(struct Uring *ring, int fd) {
+    if (ring->watches[fd].reported) return;
+    ring->watches[fd].reported = 1;
+    ring->ready[ring->numReady++] = fd;
+}
+
+/**
+ * @brief Handles every completion posted by the kernel: marks sockets ready, stages received
+ * buffers and accepted connections until the event loop takes them, records the results of
+ * sends, and rearms the multishot requests the kernel ended.
+ *
+ * @param ring The io_uring instance.
+ */
+static void uring_reap(struct Uring *ring) {
+    unsigned head = *ring->cqHead;
+    while (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & ring->cqMask];
+        int kind = URING_KIND(cqe->user_data), fd = URING_FD(cqe->user_data), res = cqe->res;
+        struct Uring_Watch *watch = (fd < ring->numWatches) ? &ring->watches[fd] : NULL;
+        head++;
+        /* Every completion holding a buffer takes it from the free ones, even a stale one that returns it right away */
+        if (cqe->flags & IORING_CQE_F_BUFFER) ring->numFreeBuffers--;
+        if (kind == URING_SEND) {
+            /* Sends are numbered by their index in the batch instead of by socket */
+            ring->sending[fd].result = res;
+            ring->numSent++;
+            continue;
+        }
+        if (kind == URING_CANCEL) continue;
+        if (kind == URING_WRITABLE) {
+            /* The socket can be sent to again (unless it was registered again since) */
+            if (watch != NULL && watch->kind != 0 && watch->generation == URING_GENERATION(cqe->user_data)) {
+                watch->awaitingOutput = 0;
+                if (res != -ECANCELED) uring_mark_ready(ring, fd);
+            }
+            continue;
+        }
+        /* Drop completions of an earlier registration of the socket, returning any buffer they hold */
+        if (watch == NULL || watch->kind != kind || watch->generation != URING_GENERATION(cqe->user_data)) {
+            if (cqe->flags & IORING_CQE_F_BUFFER) uring_recycle(ring, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            continue;
+        }
+        if (!(cqe->flags & IORING_CQE_F_MORE)) watch->armed = 0;
+        if (kind == URING_RECV) {
+            if (res > 0) {
+                /* Stage the buffer until the event loop takes its bytes */
+                int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                ring->chunkLength[bid] = res;
+                ring->chunkNext[bid] = -1;
+                if (watch->lastChunk >= 0) ring->chunkNext[watch->lastChunk] = bid;
+                else watch->firstChunk = bid;
+                watch->lastChunk = bid;
+                /* Leave the rest in the socket's own buffer while the event loop is not taking the bytes, so other sockets still have buffers */
+                if (++watch->numChunks >= URING_MAX_CHUNKS && watch->armed && !watch->paused) {
+                    struct io_uring_sqe *sqe = uring_get_sqe(ring, URING_CANCEL, fd, watch->generation);
+                    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                    sqe->addr = cqe->user_data;
+                    watch->paused = 1;
+                }
+            } else if (res == -ECANCELED) {
+                /* The receive was paused, and is armed again once the bytes are taken (or now, if they have been) */
+                if (!watch->paused && watch->closed == 0) uring_arm(ring, fd);
+                continue;
+            } else if (res == -ENOBUFS) {
+                /* Every buffer is staged; receive again once one is returned (or once a paused socket's bytes are taken) */
+                if (!watch->starved && !watch->paused) {
+                    ring->numStarved++;
+                    watch->starved = 1;
+                }
+                continue;
+            } else {
+                watch->closed = (res == 0) ? URING_EOF : res;
+            }
+        } else if (kind == URING_ACCEPT && res >= 0) {
+            /* Keep the connection until the event loop takes it, growing the list if needed */
+            if (ring->acceptedHead > 0 && ring->acceptedHead == ring->numAccepted) ring->acceptedHead = ring->numAccepted = 0;
+            if (ring->numAccepted == ring->acceptedCapacity) {
+                int capacity = (ring->acceptedCapacity > 0) ? 2 * ring->acceptedCapacity : MAX_EVENTS;
+                if ((ring->accepted = realloc(ring->accepted, capacity * sizeof(int))) == NULL) print_error("uring_reap: realloc", errno, 1);
+                ring->acceptedCapacity = capacity;
+            }
+            ring->accepted[ring->numAccepted++] = res;
+        } else if (res < 0 && res != -ECANCELED) {
+            print_error("uring_reap", -res, 0);
+        }
+        uring_mark_ready(ring, fd);
+        if (!watch->armed && watch->closed == 0 && !watch->paused) uring_arm(ring, fd);
+    }
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Creates the io_uring instance for the event engine, maps its rings, and provides the
+ * kernel with the buffers multishot receives fill.
+ *
+ * @param engine The event engine being initialized.
+ * @return True if the backend was created successfully, false otherwise.
+ */
+static int uring_init(struct Event_Engine *engine) {
+    struct io_uring_params params = {0};
+    struct io_uring_buf_reg reg = {0};
+    struct Uring *ring;
+    char *sq, *cq;
+    int i;
+    if ((ring = calloc(1, sizeof(struct Uring))) == NULL) {
+        print_error("uring_init: calloc", errno, 0);
+        return 0;
+    }
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_ENTRIES * 16;
+    if ((ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params)) < 0) {
+        print_error("uring_init: io_uring_setup", errno, 0);
+        free(ring);
+        return 0;
+    }
+    /* Map the submission ring, the completion ring, the submission entries, and the provided buffers */
+    sq = mmap(NULL, params.sq_off.array + params.sq_entries * sizeof(unsigned), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    cq = mmap(NULL, params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    ring->bufRing = mmap(NULL, URING_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring->buffers = mmap(NULL, (size_t)URING_BUFFERS * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || ring->sqes == MAP_FAILED || ring->bufRing == MAP_FAILED || ring->buffers == MAP_FAILED) {
+        print_error("uring_init: mmap", errno, 0);
+        close(ring->fd);
+        free(ring);
+        return 0;
+    }
+    ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+    ring->sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    /* Register the ring of provided buffers (kernels without multishot receives fail here) */
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->bufRing;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = 0;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        print_error("uring_init: io_uring_register", errno, 0);
+        close(ring->fd);
+        free(ring);
+        return 0;
+    }
+    for (i = 0; i < URING_BUFFERS; i++) uring_recycle(ring, i);
+    engine->uring = ring;
+    return 1;
+}
+
+/**
+ * @brief Registers the socket with the io_uring instance by queuing a multishot request for
+ * it, which is submitted along with the next wait.
+ *
+ * @param engine The event engine to register the socket with.
+ * @param fd The socket descriptor to watch.
+ * @param tag The identifier reported back when the socket is ready.
+ * @return True if the socket was registered, false otherwise.
+ */
+static int uring_add(struct Event_Engine *engine, int fd, int tag) {
+    struct Uring *ring = engine->uring;
+    struct Uring_Watch *watch;
+    int listening = 0, type = 0;
+    socklen_t length = sizeof(int);
+    /* Grow the watch table (and the ready list, which holds each socket at most once) to cover the descriptor */
+    if (fd >= ring->numWatches) {
+        int i, numWatches = (ring->numWatches > 0) ? ring->numWatches : MAX_EVENTS;
+        while (numWatches <= fd) numWatches *= 2;
+        if ((ring->watches = realloc(ring->watches, numWatches * sizeof(struct Uring_Watch))) == NULL || (ring->ready = realloc(ring->ready, numWatches * sizeof(int))) == NULL) {
+            print_error("uring_add: realloc", errno, 1);
+        }
+        for (i = ring->numWatches; i < numWatches; i++) memset(&ring->watches[i], 0, sizeof(struct Uring_Watch));
+        ring->numWatches = numWatches;
+    }
+    watch = &ring->watches[fd];
+    watch->tag = tag;
+    watch->generation++;
+    watch->starved = watch->reported = watch->closed = watch->chunkOffset = watch->numChunks = watch->paused = watch->awaitingOutput = 0;
+    watch->firstChunk = watch->lastChunk = -1;
+    /* Accept on listening sockets, receive on connections, and poll everything else (the multicast socket and pipes) */
+    if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &length) == 0 && listening) {
+        watch->kind = URING_ACCEPT;
+    } else if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &length) == 0 && type == SOCK_STREAM) {
+        watch->kind = URING_RECV;
+    } else {
+        watch->kind = URING_POLL;
+    }
+    uring_arm(ring, fd);
+    return 1;
+}
+
+/**
+ * @brief Cancels the requests watching the socket (right away, since the socket is about to
+ * be closed) and returns the buffers staged for it.
+ *
+ * @param engine The event engine the socket is registered with.
+ * @param fd The socket descriptor to stop watching.
+ */
+static void uring_remove(struct Event_Engine *engine, int fd) {
+    struct Uring *ring = engine->uring;
+    struct Uring_Watch *watch;
+    struct io_uring_sqe *sqe;
+    int i;
+    if (fd >= ring->numWatches || ring->watches[fd].kind == 0) return;
+    watch = &ring->watches[fd];
+    sqe = uring_get_sqe(ring, URING_CANCEL, fd, watch->generation);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    if (uring_enter(ring, 0, 0) == ERROR_CODE) print_error("uring_remove: io_uring_enter", errno, 0);
+    while (watch->firstChunk >= 0) {
+        int bid = watch->firstChunk;
+        watch->firstChunk = ring->chunkNext[bid];
+        uring_recycle(ring, bid);
+    }
+    if (watch->starved) ring->numStarved--;
+    if (watch->reported) {
+        for (i = 0; ring->ready[i] != fd; i++);
+        memmove(&ring->ready[i], &ring->ready[i+1], (--ring->numReady - i) * sizeof(int));
+    }
+    watch->kind = 0;
+}
+
+/**
+ * @brief Submits the queued requests, blocks until a completion arrives (or the timeout runs
+ * out), and reports the sockets the completions made ready. Sockets left over because more
+ * were ready than fit are reported by the next wait without blocking.
+ *
+ * @param engine The event engine to wait on.
+ * @param events The array to store the ready sockets in.
+ * @param maxEvents The maximum number of ready sockets to report.
+ * @param timeout The maximum time (in milliseconds) to block, or -1 to block until a socket is ready.
+ * @return The number of ready sockets, or an error code if an error occured.
+ */
+static int uring_wait(struct Event_Engine *engine, struct Ready_Event *events, int maxEvents, int timeout) {
+    struct Uring *ring = engine->uring;
+    int i, count;
+    /* Receive again on the sockets that ran out of buffers, now that some were returned */
+    if (ring->numStarved > 0 && ring->numFreeBuffers > 0) {
+        for (i = 0; i < ring->numWatches && ring->numStarved > 0; i++) {
+            if (ring->watches[i].kind != 0 && ring->watches[i].starved) {
+                ring->watches[i].starved = 0;
+                ring->numStarved--;
+                uring_arm(ring, i);
+            }
+        }
+    }
+    if (uring_enter(ring, (ring->numReady > 0) ? 0 : 1, timeout) == ERROR_CODE && errno != EINTR && errno != ETIME && errno != EBUSY) {
+        print_error("uring_wait: io_uring_enter", errno, 0);
+        return ERROR_CODE;
+    }
+    uring_reap(ring);
+    /* Report the sockets that became ready first */
+    count = (ring->numReady < maxEvents) ? ring->numReady : maxEvents;
+    for (i = 0; i < count; i++) {
+        events[i].fd = ring->ready[i];
+        events[i].tag = ring->watches[ring->ready[i]].tag;
+        ring->watches[ring->ready[i]].reported = 0;
+    }
+    ring->numReady -= count;
+    memmove(ring->ready, ring->ready + count, ring->numReady * sizeof(int));
+    return count;
+}
+
+/**
+ * @brief Takes the next connection accepted by the multishot accept, looking up the address
+ * of its remote player.
+ *
+ * @param engine The event engine the listening socket is registered with.
+ * @param fd The listening socket descriptor.
+ * @param addr The address of the remote player.
+ * @param addrLength The size of the address.
+ * @return The socket descriptor of the connection, or -1 (with errno set to EAGAIN) if none are waiting.
+ */
+static int uring_accept(struct Event_Engine *engine, int fd, struct sockaddr_in *addr, socklen_t *addrLength) {
+    struct Uring *ring = engine->uring;
+    int sd;
+    (void)fd;
+    if (ring->acceptedHead == ring->numAccepted) {
+        errno = EAGAIN;
+        return -1;
+    }
+    sd = ring->accepted[ring->acceptedHead++];
+    if (getpeername(sd, (struct sockaddr *)addr, addrLength) < 0) print_error("uring_accept: getpeername", errno, 0);
+    return sd;
+}
+
+/**
+ * @brief Takes bytes the multishot receive already placed in buffers for the socket,
+ * returning each buffer to the kernel once its bytes are all taken.
+ *
+ * @param engine The event engine the socket is registered with.
+ * @param fd The socket descriptor of the connection.
+ * @param buffer The buffer to copy the bytes to.
+ * @param length The maximum number of bytes to take.
+ * @return The number of bytes taken, 0 if the peer closed the connection, or -1 (with errno
+ * set, to EAGAIN if no bytes are waiting) otherwise.
+ */
+static int uring_recv(struct Event_Engine *engine, int fd, char *buffer, int length) {
+    struct Uring *ring = engine->uring;
+    struct Uring_Watch *watch = &ring->watches[fd];
+    int taken = 0;
+    while (taken < length && watch->firstChunk >= 0) {
+        int bid = watch->firstChunk, size = ring->chunkLength[bid] - watch->chunkOffset;
+        if (size > length - taken) size = length - taken;
+        memcpy(buffer + taken, ring->buffers + (size_t)bid * URING_BUFFER_SIZE + watch->chunkOffset, size);
+        taken += size;
+        watch->chunkOffset += size;
+        if (watch->chunkOffset == ring->chunkLength[bid]) {
+            watch->firstChunk = ring->chunkNext[bid];
+            if (watch->firstChunk < 0) watch->lastChunk = -1;
+            watch->chunkOffset = 0;
+            watch->numChunks--;
+            uring_recycle(ring, bid);
+        }
+    }
+    /* Receive again once a paused socket's bytes have been taken (the cancelled receive has ended by then unless it is still in flight) */
+    if (watch->paused && watch->firstChunk < 0) {
+        watch->paused = 0;
+        if (!watch->armed && watch->closed == 0) uring_arm(ring, fd);
+    }
+    if (taken > 0 || watch->closed == URING_EOF) return taken;
+    errno = (watch->closed < 0) ? -watch->closed : EAGAIN;
+    return -1;
+}
+
+/**
+ * @brief Submits a send for every socket of the batch in a single system call and reaps their
+ * results, so the queued commands can be reused right after. The sends do not wait for room
+ * in a full socket buffer: they take what fits and fail with EAGAIN if nothing does, so the
+ * shard only waits for each send to be tried once.
+ *
+ * @param engine The event engine the sockets are registered with.
+ * @param requests The sends to make, whose results are filled in.
+ * @param count The number of sends to make.
+ */
+static void uring_send(struct Event_Engine *engine, struct Send_Request *requests, int count) {
+    struct Uring *ring = engine->uring;
+    int i;
+    ring->sending = requests;
+    ring->numSent = 0;
+    for (i = 0; i < count; i++) {
+        struct io_uring_sqe *sqe = uring_get_sqe(ring, URING_SEND, i, 0);
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = requests[i].fd;
+        sqe->addr = (uint64_t)(uintptr_t)requests[i].data;
+        sqe->len = requests[i].length;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+    }
+    /* Other completions arriving meanwhile are staged for the next wait */
+    while (ring->numSent < count) {
+        if (uring_enter(ring, 1, -1) == ERROR_CODE && errno != EINTR && errno != EBUSY) {
+            print_error("uring_send: io_uring_enter", errno, 1);
+        }
+        uring_reap(ring);
+    }
+    ring->sending = NULL;
+}
+
+/**
+ * @brief Queues a single poll for room in the socket's send buffer, which is submitted along
+ * with the next wait, unless one is already waiting. Receives go on meanwhile, since they only
+ * complete as input arrives.
+ *
+ * @param engine The event engine the socket is registered with.
+ * @param fd The socket descriptor to watch.
+ * @param tag The identifier reported back when the socket is ready (already known to the watch).
+ * @param blocked Whether the socket could not take everything sent to it.
+ */
+static void uring_watch_output(struct Event_Engine *engine, int fd, int tag, int blocked) {
+    struct Uring *ring = engine->uring;
+    struct Uring_Watch *watch = &ring->watches[fd];
+    struct io_uring_sqe *sqe;
+    (void)tag;
+    if (!blocked || watch->awaitingOutput) return;
+    sqe = uring_get_sqe(ring, URING_WRITABLE, fd, watch->generation);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLOUT;
+    watch->awaitingOutput = 1;
+}
+
+/* The io_uring backend, with multishot accepts and receives into provided buffers, and batched sends. */
+static const struct Event_Backend uringBackend = {"io_uring", uring_init, uring_add, uring_remove, uring_wait, uring_accept, uring_recv, uring_send, uring_watch_output};
+#endif
+
+/**
+ * @brief Initializes the event engine with the backend asked for, or the best readiness
+ * backend available, falling back to select if the preferred backend cannot be created.
+ *
+ * @param engine The event engine to initialize.
+ * @param backendName The name of the backend to use, or NULL for the best available.
+ */
+void init_event_engine(struct Event_Engine *engine, const char *backendName) {
+    /* The backends that can be asked for by name */
+    static const struct Event_Backend *const backends[] = {
+#ifdef HAVE_IO_URING
+        &uringBackend,
+#endif
+#ifdef __linux__
+        &epollBackend,
+#endif
+        &selectBackend
+    };
+    int i;
+    memset(engine, 0, sizeof(struct Event_Engine));
+    engine->epfd = -1;
+    if (backendName != NULL) {
+        for (i = 0; i < (int)(sizeof(backends) / sizeof(backends[0])); i++) {
+            if (strcmp(backends[i]->name, backendName) != 0) continue;
+            engine->backend = backends[i];
+            if (engine->backend->init(engine)) {
+                log_message(LOG_INFO, "[+]Event engine using the %s backend.", engine->backend->name);
+                return;
+            }
+        }
+        print_error("init_event_engine: Event backend unavailable, using the default", 0, 0);
+    }
+#ifdef __linux__
+    engine->backend = &epollBackend;
+    if (engine->backend->init(engine)) {
+        log_message(LOG_INFO, "[+]Event engine using the %s backend.", engine->backend->name);
+        return;
+    }
+#endif
+    engine->backend = &selectBackend;
+    engine->backend->init(engine);
+    log_message(LOG_INFO, "[+]Event engine using the %s backend.", engine->backend->name);
+}
+
+/**
+ * @brief Registers the socket with the event engine so that it is reported when it is ready.
+ *
+ * @param engine The event engine to register the socket with.
+ * @param sd The socket descriptor to watch.
+ * @param tag The identifier reported back when the socket is ready.
+ * @return True if the socket was registered, false otherwise.
+ */
+int register_socket(struct Event_Engine *engine, int sd, int tag) {
+    return engine->backend->add(engine, sd, tag);
+}
+
+/**
+ * @brief Unregisters the socket from the event engine.
+ *
+ * @param engine The event engine the socket is registered with.
+ * @param sd The socket descriptor to stop watching.
+ */
+void unregister_socket(struct Event_Engine *engine, int sd) {
+    engine->backend->remove(engine, sd);
+}
+
+/**
+ * @brief Blocks until at least one registered socket is ready to be processed, or until the
+ * timeout runs out.
+ *
+ * @param engine The event engine to wait on.
+ * @param events The array to store the ready sockets in.
+ * @param maxEvents The maximum number of ready sockets to report.
+ * @param timeout The maximum time (in milliseconds) to block, or -1 to block until a socket is ready.
+ * @return The number of ready sockets (0 if the timeout ran out), or an error code if an error occured.
+ */
+int wait_for_events(struct Event_Engine *engine, struct Ready_Event *events, int maxEvents, int timeout) {
+    return engine->backend->wait(engine, events, maxEvents, timeout);
+}
+
+/**
+ * @brief Accepts a new connection on the listening socket.
+ *
+ * @param engine The event engine the listening socket is registered with.
+ * @param sd The listening socket descriptor.
+ * @param addr The address of the remote player.
+ * @param addrLength The size of the address.
+ * @return The socket descriptor of the connection, or -1 (with errno set) if none could be accepted.
+ */
+int accept_socket(struct Event_Engine *engine, int sd, struct sockaddr_in *addr, socklen_t *addrLength) {
+    if (engine->backend->accept != NULL) return engine->backend->accept(engine, sd, addr, addrLength);
+    return accept(sd, (struct sockaddr *)addr, addrLength);
+}
+
+/**
+ * @brief Receives bytes from a registered connection without blocking.
+ *
+ * @param engine The event engine the socket is registered with.
+ * @param sd The socket descriptor of the connection.
+ * @param buffer The buffer to receive into.
+ * @param length The maximum number of bytes to receive.
+ * @return The number of bytes received, 0 if the peer closed the connection, or -1 (with errno set) otherwise.
+ */
+int receive_socket(struct Event_Engine *engine, int sd, char *buffer, int length) {
+    if (engine->backend->recv != NULL) return engine->backend->recv(engine, sd, buffer, length);
+    return recv(sd, buffer, length, 0);
+}
+
+/**
+ * @brief Sends the bytes queued for each socket of a batch without blocking, filling in how
+ * much of each the socket took (a full send buffer takes less, or fails with EAGAIN).
+ * Backends that can batch sends make a single system call for the whole batch.
+ *
+ * @param engine The event engine the sockets are registered with.
+ * @param requests The sends to make, whose results are filled in.
+ * @param count The number of sends to make.
+ */
+void send_sockets(struct Event_Engine *engine, struct Send_Request *requests, int count) {
+    int i;
+    if (engine->backend->send != NULL) {
+        engine->backend->send(engine, requests, count);
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        int rv = send(requests[i].fd, requests[i].data, requests[i].length, MSG_NOSIGNAL | MSG_DONTWAIT);
+        requests[i].result = (rv < 0) ? -errno : rv;
+    }
+}
+
+/**
+ * @brief Asks the event engine to report a registered socket (with its tag) once there is room
+ * in its send buffer again, after the socket could not take everything sent to it, or to go
+ * back to reporting it for input once it has.
+ *
+ * @param engine The event engine the socket is registered with.
+ * @param sd The socket descriptor to watch.
+ * @param tag The identifier reported back when the socket is ready.
+ * @param blocked Whether the socket could not take everything sent to it.
+ */
+void watch_output(struct Event_Engine *engine, int sd, int tag, int blocked) {
+    engine->backend->watchOutput(engine, sd, tag, blocked);
+}
+
+/**
+ * @brief Gets the current tick of the monotonic clock that timer wheels count in.
+ *
+ * @return The number of ticks since an arbitrary point in the past.
+ */
+uint64_t current_tick(void) {
+    return monotonic_time() / ((uint64_t)TIMER_TICK_MS * 1000000);
+}
+
+/**
+ * @brief Initializes an empty timer wheel starting at the current tick.
+ *
+ * @param wheel The timer wheel to initialize.
+ */
+void init_timer_wheel(struct Timer_Wheel *wheel) {
+    memset(wheel->slots, 0, sizeof(wheel->slots));
+    wheel->tick = current_tick();
+    wheel->numTimers = 0;
+}
+
+/**
+ * @brief Links a timer into the slot of the lowest level of the timer wheel that reaches its
+ * expiry tick. The slot of each level is taken from the expiry tick's own bits, so a timer
+ * linked to a higher level is moved down (cascaded) by the time its slot comes around.
+ *
+ * @param wheel The timer wheel.
+ * @param timer The timer, which expires no earlier than the wheel's current tick.
+ */
+static void link_timer(struct Timer_Wheel *wheel, struct Timer *timer) {
+    int level = 0;
+    const uint64_t delay = timer->expires - wheel->tick;
+    struct Timer **slot;
+    while (level < TIMER_LEVELS - 1 && delay >= (uint64_t)1 << (TIMER_LEVEL_BITS * (level + 1))) level++;
+    slot = &wheel->slots[level][(timer->expires >> (TIMER_LEVEL_BITS * level)) & (TIMER_SLOTS - 1)];
+    timer->next = *slot;
+    if (*slot != NULL) (*slot)->pprev = &timer->next;
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+/**
+ * @brief Schedules a timer to expire at a tick, rescheduling it if it was already scheduled.
+ * A tick that has already passed expires on the next tick, and a tick beyond the wheel's reach
+ * is brought forward.
+ *
+ * @param wheel The timer wheel of the shard the timer belongs to.
+ * @param timer The timer, with its expiry handler set.
+ * @param expires The tick the timer expires at.
+ */
+void schedule_timer(struct Timer_Wheel *wheel, struct Timer *timer, uint64_t expires) {
+    cancel_timer(wheel, timer);
+    if (expires <= wheel->tick) expires = wheel->tick + 1;
+    if (expires - wheel->tick > TIMER_MAX_TICKS) expires = wheel->tick + TIMER_MAX_TICKS;
+    timer->expires = expires;
+    link_timer(wheel, timer);
+    wheel->numTimers++;
+}
+
+/**
+ * @brief Cancels a timer, if it is scheduled.
+ *
+ * @param wheel The timer wheel of the shard the timer belongs to.
+ * @param timer The timer to cancel.
+ */
+void cancel_timer(struct Timer_Wheel *wheel, struct Timer *timer) {
+    if (timer->pprev == NULL) return;
+    *timer->pprev = timer->next;
+    if (timer->next != NULL) timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+    wheel->numTimers--;
+}
+
+/**
+ * @brief Advances the timer wheel to the current tick, cascading the timers of each higher
+ * level slot that comes around down to the levels below and calling the expiry handler of
+ * every timer that expires. Handlers may schedule and cancel any timers.
+ *
+ * @param wheel The timer wheel of the shard.
+ */
+void run_timers(struct Timer_Wheel *wheel) {
+    const uint64_t now = current_tick();
+    while (wheel->tick < now && wheel->numTimers > 0) {
+        int level;
+        struct Timer *timer;
+        wheel->tick++;
+        /* Cascade the higher levels whose slots start at this tick, highest level first */
+        for (level = TIMER_LEVELS - 1; level > 0; level--) {
+            const uint64_t shift = TIMER_LEVEL_BITS * level;
+            if ((wheel->tick & (((uint64_t)1 << shift) - 1)) != 0) continue;
+            timer = wheel->slots[level][(wheel->tick >> shift) & (TIMER_SLOTS - 1)];
+            wheel->slots[level][(wheel->tick >> shift) & (TIMER_SLOTS - 1)] = NULL;
+            while (timer != NULL) {
+                struct Timer *next = timer->next;
+                link_timer(wheel, timer);
+                timer = next;
+            }
+        }
+        /* Expire every timer of the tick's slot (a handler may cancel the others) */
+        while ((timer = wheel->slots[0][wheel->tick & (TIMER_SLOTS - 1)]) != NULL) {
+            cancel_timer(wheel, timer);
+            timer->expire(timer);
+        }
+    }
+    /* With no timers left, nothing has to be cascaded on the ticks skipped */
+    if (wheel->tick < now) wheel->tick = now;
+}
+
+/**
+ * @brief Determines how long the shard can block before the timer wheel has to be advanced,
+ * which is until the next tick with timers to expire or the next tick the higher levels
+ * cascade at (at most a lowest level's worth of ticks away).
+ *
+ * @param wheel The timer wheel of the shard.
+ * @return The time (in milliseconds) to block for, or -1 if no timers are scheduled.
+ */
+int timer_timeout(const struct Timer_Wheel *wheel) {
+    uint64_t tick, now;
+    if (wheel->numTimers == 0) return -1;
+    for (tick = wheel->tick + 1; (tick & (TIMER_SLOTS - 1)) != 0 && wheel->slots[0][tick & (TIMER_SLOTS - 1)] == NULL; tick++);
+    now = monotonic_time() / 1000000;
+    return (tick * TIMER_TICK_MS > now) ? (int)(tick * TIMER_TICK_MS - now) : 0;
+}
+
+/**
+ * @brief Handles the deadline of a connection: a connection that has not sent a whole command
+ * since it was accepted, or has not sent anything in too long since, is closed.
+ *
+ * @param timer The idle timer of the connection.
+ */
+void expire_connection(struct Timer *timer) {
+    struct Connection *conn = (struct Connection *)((char *)timer - offsetof(struct Connection, idleTimer));
+    struct Shard *shard = conn->shard;
+    if (conn->handshaken && shard->serv->idleTicks == 0) return;
+    if (conn->handshaken && conn->lastInput + shard->serv->idleTicks > shard->timers.tick) {
+        /* The remote player has sent something since the timer was scheduled */
+        schedule_timer(&shard->timers, timer, conn->lastInput + shard->serv->idleTicks);
+        return;
+    }
+    if (conn->handshaken) {
+        print_error("expire_connection: Connection has been idle too long", 0, 0);
+    } else {
+        print_error("expire_connection: Connection did not send a command in time", 0, 0);
+    }
+    count_metric(METRIC_TIMEOUTS, 1);
+    close_connection(conn);
+}
+
+/**
+ * @brief Handles the deadline of a game whose remote player has not answered Player 1's move
+ * in time. The game is ended with GAME_OVER (which reset_game sends itself for a multiplexed
+ * game) and reset for a new player.
+ *
+ * @param timer The move timer of the game.
+ */
+void expire_move(struct Timer *timer) {
+    struct TTT_Game *game = (struct TTT_Game *)((char *)timer - offsetof(struct TTT_Game, moveTimer));
+    print_error("expire_move: Player 2 did not move in time", 0, 0);
+    log_message(LOG_INFO, "Game #%d has timed out", game->gameNum);
+    count_metric(METRIC_TIMEOUTS, 1);
+    if (game->channel >= 0) {
+        reset_game(game);
+    } else {
+        send_game_over(game);
+    }
+}
+
+/**
+ * @brief Reserves zeroed memory for an arena of fixed-size objects (games, connections, and
+ * searches) for everything the server can play at once, so claiming them never allocates. The
+ * kernel only commits a page of the arena once it is touched, so a large maximum number of
+ * games costs little memory until the games are played.
+ *
+ * @param size The size (in bytes) of the arena.
+ * @return The arena (aligned to a page). The process terminates if it cannot be reserved.
+ */
+void *reserve_arena(size_t size) {
+    void *arena = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (arena == MAP_FAILED) print_error("reserve_arena: mmap", errno, 1);
+    return arena;
+}
+
+/**
+ * @brief Initializes every shard of the server, splitting the maximum number of games evenly
+ * between them. Shard 0 also watches the server and multicast group sockets.
+ *
+ * @param serv The server communication endpoint.
+ * @param config The server command line options.
+ */
+void init_shards(struct Server *serv, const struct Server_Config *config) {
+    int i, firstID = 0;
+    serv->numShards = config->numThreads;
+    serv->handshakeTicks = config->handshakeTimeout * 1000 / TIMER_TICK_MS;
+    serv->idleTicks = config->idleTimeout * 1000 / TIMER_TICK_MS;
+    serv->moveTicks = config->moveTimeout * 1000 / TIMER_TICK_MS;
+    if ((serv->shards = calloc(serv->numShards, sizeof(struct Shard))) == NULL) {
+        print_error("init_shards: calloc", errno, 1);
+    }
+    set_nonblocking(serv->mcd);
+    set_nonblocking(serv->sd);
+    for (i = 0; i < serv->numShards; i++) {
+        struct Shard *shard = &serv->shards[i];
+        /* Give each shard its share of the games (earlier shards take any remainder) */
+        int capacity = config->maxGames / serv->numShards + (i < config->maxGames % serv->numShards);
+        shard->id = i;
+        shard->serv = serv;
+        init_game_roster(&shard->roster, capacity, firstID);
+        firstID += capacity;
+        /* Create the handoff queue, the list of finished searches, and the pipe used to signal them */
+        if ((shard->handoffQueue = malloc(capacity * sizeof(int))) == NULL) print_error("init_shards: malloc", errno, 1);
+        /* Reserve a connection and a search for every game the shard can play, and the table of multiplexed games */
+        shard->connectionArena = reserve_arena(capacity * sizeof(struct Connection));
+        shard->jobs = reserve_arena(capacity * sizeof(struct Search_Job));
+        for (shard->channelMask = CHANNEL_BUCKETS; shard->channelMask < capacity; shard->channelMask *= 2);
+        shard->channelTable = reserve_arena(shard->channelMask * sizeof(struct TTT_Game *));
+        shard->channelMask--;
+        init_timer_wheel(&shard->timers);
+        init_watch_feed(shard);
+        /* Create the connection table, with a slot for every game the shard can play */
+        if ((shard->connections = calloc(capacity, sizeof(struct Connection *))) == NULL) print_error("init_shards: calloc", errno, 1);
+        if ((shard->freeConnections = malloc(capacity * sizeof(int))) == NULL) print_error("init_shards: malloc", errno, 1);
+        for (shard->numFreeConnections = 0; shard->numFreeConnections < capacity; shard->numFreeConnections++) {
+            shard->freeConnections[shard->numFreeConnections] = capacity - 1 - shard->numFreeConnections;
+        }
+        pthread_mutex_init(&shard->handoffLock, NULL);
+        pthread_mutex_init(&shard->finishedLock, NULL);
+        if (pipe(shard->wakeFDS) < 0) print_error("init_shards: pipe", errno, 1);
+        set_nonblocking(shard->wakeFDS[0]);
+        set_nonblocking(shard->wakeFDS[1]);
+        /* Register the shard's sockets with its own event engine */
+        init_event_engine(&shard->engine, config->eventBackend);
+        if (!register_socket(&shard->engine, shard->wakeFDS[0], WAKEUP_TAG)) print_error("init_shards: Unable to register wakeup pipe", 0, 1);
+        if (i == 0 && (!register_socket(&shard->engine, serv->mcd, MULTICAST_TAG) || !register_socket(&shard->engine, serv->sd, SERVER_TAG))) {
+            print_error("init_shards: Unable to register server sockets", 0, 1);
+        }
+    }
+    log_message(LOG_INFO, "[+]Server playing games on %d thread(s).", serv->numShards);
+}
+
+/**
+ * @brief Starts a thread running the event loop of every shard other than shard 0, which is
+ * run by the main thread.
+ *
+ * @param serv The server communication endpoint.
+ */
+void start_shards(struct Server *serv) {
+    int i, err;
+    for (i = 1; i < serv->numShards; i++) {
+        if ((err = pthread_create(&serv->shards[i].thread, NULL, run_shard, &serv->shards[i])) != 0) {
+            print_error("start_shards: pthread_create", err, 1);
+        }
+    }
+}
+
+/**
+ * @brief Thread entry point that runs the event loop of a shard.
+ *
+ * @param arg The shard to run.
+ * @return Never returns.
+ */
+void *run_shard(void *arg) {
+    tictactoe((struct Shard *)arg);
+    return NULL;
+}
+
+/**
+ * @brief Determines the number of games a shard can still give to new players, counting
+ * connections already handed off to the shard. Safe to call from any thread.
+ *
+ * @param shard The shard of the server.
+ * @return The number of open games on the shard.
+ */
+int open_game_count(struct Shard *shard) {
+    return shard->roster.capacity - atomic_load(&shard->roster.numActive) - atomic_load(&shard->numPending);
+}
+
+/**
+ * @brief Finds the shard with the most open games, preferring shard 0 so single threaded
+ * servers never hand off connections.
+ *
+ * @param serv The server communication endpoint.
+ * @return The index of the shard with the most open games, or an error code if none are open.
+ */
+int find_open_shard(struct Server *serv) {
+    int i, best = ERROR_CODE, bestOpen = 0;
+    for (i = 0; i < serv->numShards; i++) {
+        int numOpen = open_game_count(&serv->shards[i]);
+        if (numOpen > bestOpen) {
+            bestOpen = numOpen;
+            best = i;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Queues an accepted connection for another shard to assign to one of its games and
+ * wakes the shard up.
+ *
+ * @param shard The shard to hand the connection to.
+ * @param sd The socket descriptor of the connected player.
+ */
+void hand_off_connection(struct Shard *shard, int sd) {
+    const char wake = 1;
+    atomic_fetch_add(&shard->numPending, 1);
+    pthread_mutex_lock(&shard->handoffLock);
+    shard->handoffQueue[(shard->handoffHead + shard->numHandoffs++) % shard->roster.capacity] = sd;
+    pthread_mutex_unlock(&shard->handoffLock);
+    /* A full pipe already has a wakeup pending, so a failed write can be ignored */
+    if (write(shard->wakeFDS[1], &wake, sizeof(wake)) < 0 && errno != EAGAIN) print_error("hand_off_connection: write", errno, 0);
+}
+
+/**
+ * @brief Assigns every connection handed off to the shard to one of its games.
+ *
+ * @param shard The shard of the server.
+ */
+void accept_handoffs(struct Shard *shard) {
+    char wake[BUFFER_SIZE];
+    /* Drain the wakeup pipe */
+    while (read(shard->wakeFDS[0], wake, sizeof(wake)) > 0);
+    /* Assign the queued connections */
+    pthread_mutex_lock(&shard->handoffLock);
+    while (shard->numHandoffs > 0) {
+        int sd = shard->handoffQueue[shard->handoffHead];
+        shard->handoffHead = (shard->handoffHead + 1) % shard->roster.capacity;
+        shard->numHandoffs--;
+        pthread_mutex_unlock(&shard->handoffLock);
+        assign_connection(shard, sd);
+        atomic_fetch_sub(&shard->numPending, 1);
+        pthread_mutex_lock(&shard->handoffLock);
+    }
+    pthread_mutex_unlock(&shard->handoffLock);
+}
+
+/**
+ * @brief Assigns a connected player to an open game of the shard, or closes the connection
+ * if the shard has no open games.
+ *
+ * @param shard The shard of the server.
+ * @param sd The socket descriptor of the connected player.
+ */
+void assign_connection(struct Shard *shard, int sd) {
+    struct Connection *conn = NULL;
+    int slot = (shard->numFreeConnections > 0) ? shard->freeConnections[shard->numFreeConnections-1] : ERROR_CODE;
+    if (slot >= 0 && find_open_game(&shard->roster) >= 0 && register_socket(&shard->engine, sd, slot)) {
+        /* If an open game was found, assign the connection (cleared up to its buffers) to the game */
+        struct TTT_Game *game = claim_open_game(&shard->roster);
+        conn = &shard->connectionArena[slot];
+        memset(conn, 0, offsetof(struct Connection, input));
+        shard->numFreeConnections--;
+        shard->connections[slot] = conn;
+        conn->sd = sd;
+        conn->slot = slot;
+        conn->shard = shard;
+        set_nonblocking(sd);
+        attach_game(conn, game, -1);
+        /* Give the remote player until the handshake deadline to send a command (or the idle deadline if there is none) */
+        conn->handshaken = (shard->serv->handshakeTicks == 0);
+        conn->lastInput = shard->timers.tick;
+        conn->idleTimer.expire = expire_connection;
+        if (!conn->handshaken || shard->serv->idleTicks > 0) {
+            schedule_timer(&shard->timers, &conn->idleTimer, conn->lastInput + (conn->handshaken ? shard->serv->idleTicks : shard->serv->handshakeTicks));
+        }
+        log_message(LOG_INFO, "Player assigned to Game #%d", game->gameNum);
+    } else {
+        /* If no open games found, turn the remote player away */
+        print_error("assign_connection: Unable to find an open game", 0, 0);
+        refuse_connection(sd);
+    }
+}
+
+/**
+ * @brief Gets the bucket of the shard's table of multiplexed games that holds a game number of
+ * a connection. The table is shared by every connection of the shard and has at least a bucket
+ * for every game the shard can play, so it never has to grow.
+ *
+ * @param conn The multiplexed connection of the remote player.
+ * @param channel The game number the game is routed by.
+ * @return The bucket of the table of multiplexed games.
+ */
+static struct TTT_Game **channel_bucket(const struct Connection *conn, int channel) {
+    return &conn->shard->channelTable[((uint32_t)channel * 2654435761u + (uint32_t)conn->slot * 40503u) & conn->shard->channelMask];
+}
+
+/**
+ * @brief Attaches a claimed game to the connection of the player playing it. The games of a
+ * multiplexed connection are kept in the shard's table of multiplexed games and on a list of
+ * the connection's games.
+ *
+ * @param conn The connection of the remote player.
+ * @param game The claimed game.
+ * @param channel The game number the game is routed by, or -1 if the connection is not multiplexed.
+ */
+void attach_game(struct Connection *conn, struct TTT_Game *game, int channel) {
+    struct TTT_Game **bucket;
+    game->conn = conn;
+    game->channel = channel;
+    game->shard = conn->shard;
+    conn->numGames++;
+    if (channel < 0) {
+        conn->game = game;
+        return;
+    }
+    bucket = channel_bucket(conn, channel);
+    game->nextChannel = *bucket;
+    *bucket = game;
+    game->prevGame = NULL;
+    game->nextGame = conn->games;
+    if (conn->games != NULL) conn->games->prevGame = game;
+    conn->games = game;
+}
+
+/**
+ * @brief Detaches a game from the connection of the player playing it.
+ *
+ * @param conn The connection of the remote player.
+ * @param game The game being reset.
+ */
+void detach_game(struct Connection *conn, struct TTT_Game *game) {
+    conn->numGames--;
+    unhold_state(game);
+    if (conn->game == game) {
+        conn->game = NULL;
+    } else {
+        struct TTT_Game **link = channel_bucket(conn, game->channel);
+        while (*link != game) link = &(*link)->nextChannel;
+        *link = game->nextChannel;
+        if (game->prevGame != NULL) game->prevGame->nextGame = game->nextGame;
+        else conn->games = game->nextGame;
+        if (game->nextGame != NULL) game->nextGame->prevGame = game->prevGame;
+    }
+    game->conn = NULL;
+    game->nextChannel = NULL;
+    game->nextGame = game->prevGame = NULL;
+}
+
+/**
+ * @brief Finds the game started with a game number on a multiplexed connection.
+ *
+ * @param conn The connection of the remote player.
+ * @param channel The game number the game is routed by.
+ * @return The game, or NULL if no game was started with the game number.
+ */
+struct TTT_Game *find_channel(const struct Connection *conn, int channel) {
+    struct TTT_Game *game;
+    for (game = *channel_bucket(conn, channel); game != NULL; game = game->nextChannel) {
+        if (game->conn == conn && game->channel == channel) return game;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Closes the connection of a remote player and resets every game played over it. The
+ * connection is released once the shard has handled the events it is handling.
+ *
+ * @param conn The connection of the remote player.
+ */
+void close_connection(struct Connection *conn) {
+    /* Resetting the games must not close the connection again */
+    if (conn->sd < 0 || conn->closing) return;
+    conn->closing = 1;
+    /* Take the connection off the list of connections with input left over */
+    if (conn->readPending) {
+        struct Connection **link = &conn->shard->pendingReads;
+        while (*link != conn) link = &(*link)->nextRead;
+        *link = conn->nextRead;
+        conn->readPending = 0;
+    }
+    /* Send the commands already queued, which may end the games being reset */
+    if (conn->outputLength > 0) flush_output(conn);
+    if (conn->game != NULL) reset_game(conn->game);
+    while (conn->games != NULL) reset_game(conn->games);
+    /* Stop watching and close client connection */
+    cancel_timer(&conn->shard->timers, &conn->idleTimer);
+    unregister_socket(&conn->shard->engine, conn->sd);
+    if (close(conn->sd) < 0) print_error("close_connection: close-connection", errno, 0);
+    conn->sd = -1;
+    conn->nextClosed = conn->shard->closedConnections;
+    conn->shard->closedConnections = conn;
+}
+
+/**
+ * @brief Releases the connections closed while the shard was handling its events, returning
+ * their slots to the connection table.
+ *
+ * @param shard The shard of the server.
+ */
+void release_connections(struct Shard *shard) {
+    while (shard->closedConnections != NULL) {
+        struct Connection *conn = shard->closedConnections;
+        shard->closedConnections = conn->nextClosed;
+        shard->connections[conn->slot] = NULL;
+        shard->freeConnections[shard->numFreeConnections++] = conn->slot;
+    }
+}
+
+/**
+ * @brief Sends the output queue of every connection that had commands queued while the shard
+ * was handling its events, so all the replies for a connection go out in a single send (and,
+ * in version 7, a single frame), and the sends of a batch of connections go out together.
+ * Whatever a full socket buffer could not take waits for the socket to have room again, and a
+ * connection whose queue could not be sent is closed.
+ *
+ * @param shard The shard of the server.
+ */
+void flush_connections(struct Shard *shard) {
+    struct Send_Request requests[SEND_BATCH_SIZE];
+    struct Connection *conns[SEND_BATCH_SIZE];
+    while (shard->pendingFlushes != NULL) {
+        int i, count = 0;
+        /* Take a batch of output queues */
+        while (shard->pendingFlushes != NULL && count < SEND_BATCH_SIZE) {
+            struct Connection *conn = shard->pendingFlushes;
+            shard->pendingFlushes = conn->nextFlush;
+            conn->flushPending = 0;
+            if (conn->sd < 0 || (requests[count].length = seal_output(conn)) == 0) continue;
+            requests[count].fd = conn->sd;
+            requests[count].data = conn->output;
+            conns[count++] = conn;
+        }
+        send_sockets(&shard->engine, requests, count);
+        for (i = 0; i < count; i++) {
+            int rv = requests[i].result;
+            if (rv == -EAGAIN || rv == -EWOULDBLOCK) rv = 0;
+            if (rv < 0) {
+                print_error("flush_connections", -rv, 0);
+                close_connection(conns[i]);
+            } else {
+                output_sent(conns[i], rv);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Puts a connection that used its share of a pass on the shard's list of connections
+ * with input left over, so the rest of its input is handled in the next pass instead of
+ * holding up the shard's other sockets (edge-triggered backends would not report it again).
+ *
+ * @param conn The connection of the remote player.
+ */
+void defer_input(struct Connection *conn) {
+    if (conn->readPending || conn->closing) return;
+    conn->readPending = 1;
+    conn->nextRead = conn->shard->pendingReads;
+    conn->shard->pendingReads = conn;
+}
+
+/**
+ * @brief Handles another share of the input of every connection that had input left over in
+ * the shard's last pass.
+ *
+ * @param shard The shard of the server.
+ */
+void process_deferred_input(struct Shard *shard) {
+    struct Connection *conn = shard->pendingReads;
+    /* Take the whole list, since connections with input left over again go back on it */
+    shard->pendingReads = NULL;
+    while (conn != NULL) {
+        struct Connection *next = conn->nextRead;
+        conn->readPending = 0;
+        conn->nextRead = NULL;
+        if (conn->sd >= 0) process_input(conn);
+        conn = next;
+    }
+}
+
+/**
+ * @brief Sends Player 1's move for every game whose search was finished by the worker pool.
+ * Searches for games that were reset (or given to a new player) while searching are dropped.
+ *
+ * @param shard The shard of the server.
+ */
+void finish_searches(struct Shard *shard) {
+    struct Search_Job *job;
+    /* Take every finished search at once */
+    pthread_mutex_lock(&shard->finishedLock);
+    job = shard->finishedJobs;
+    shard->finishedJobs = NULL;
+    pthread_mutex_unlock(&shard->finishedLock);
+    while (job != NULL) {
+        struct Search_Job *next = job->next;
+        struct TTT_Game *game = get_game(&shard->roster, job->slot);
+        if (game->searching && game->gameNum == job->gameNum) {
+            log_message(LOG_DEBUG, "********  Game #%d  ********", game->gameNum);
+            game->searching = 0;
+            finish_p1_move(game, job->move);
+        }
+        job->busy = 0;
+        job = next;
+    }
+}
+
+/**
+ * @brief Creates the worker threads that search for Player 1's moves so the shards never
+ * block on a search. With no workers, moves are searched by the shards themselves.
+ *
+ * @param pool The worker pool to initialize.
+ * @param numWorkers The number of worker threads.
+ */
+void init_worker_pool(struct Worker_Pool *pool, int numWorkers) {
+    int i, err;
+    pool->numWorkers = numWorkers;
+    atomic_init(&pool->numQueued, 0);
+    atomic_init(&pool->numSearches, 0);
+    atomic_init(&pool->nextWorker, 0);
+    pthread_mutex_init(&pool->sleepLock, NULL);
+    pthread_cond_init(&pool->wakeup, NULL);
+    if (numWorkers == 0) return;
+    if ((pool->workers = calloc(numWorkers, sizeof(struct Worker))) == NULL) print_error("init_worker_pool: calloc", errno, 1);
+    for (i = 0; i < numWorkers; i++) {
+        struct Worker *worker = &pool->workers[i];
+        worker->id = i;
+        worker->pool = pool;
+        pthread_mutex_init(&worker->lock, NULL);
+        if ((err = pthread_create(&worker->thread, NULL, run_worker, worker)) != 0) {
+            print_error("init_worker_pool: pthread_create", err, 1);
+        }
+    }
+    log_message(LOG_INFO, "[+]Server searching for moves on %d worker thread(s).", numWorkers);
+}
+
+/**
+ * @brief Thread entry point that runs searches from the worker's queue, stealing from the
+ * other workers when its own queue is empty, and sleeps when there are none to run.
+ *
+ * @param arg The worker to run.
+ * @return Never returns.
+ */
+void *run_worker(void *arg) {
+    struct Worker *worker = (struct Worker *)arg;
+    struct Worker_Pool *pool = worker->pool;
+    threadMetrics = &worker->metrics;
+    while (1) {
+        struct Search_Job *job = take_job(worker);
+        if (job == NULL) {
+            /* Sleep until a job is submitted */
+            pthread_mutex_lock(&pool->sleepLock);
+            while (atomic_load(&pool->numQueued) == 0) pthread_cond_wait(&pool->wakeup, &pool->sleepLock);
+            pthread_mutex_unlock(&pool->sleepLock);
+            continue;
+        }
+        job->move = search_best_move(&job->board, job->timeLimit);
+        atomic_fetch_sub(&pool->numSearches, 1);
+        post_search(job);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Hands the search for Player 1's next move to the worker pool. The shard playing the
+ * game sends the move once the search finishes.
+ *
+ * @param pool The worker pool of the server.
+ * @param game The current game of TicTacToe being played.
+ * @param timeLimit The maximum time (in milliseconds) to search.
+ * @return True if the search was submitted, false if the pool has no workers or every queue
+ * is full (in which case the caller should search for the move itself).
+ */
+int submit_search(struct Worker_Pool *pool, struct TTT_Game *game, int timeLimit) {
+    int i;
+    struct Search_Job *job = &game->shard->jobs[game->slot];
+    unsigned int first;
+    /* The game's job is still busy if a search for the previous game in its slot has not finished */
+    if (pool->numWorkers == 0 || job->busy) return 0;
+    job->busy = 1;
+    job->shard = game->shard;
+    job->slot = game->slot;
+    job->gameNum = game->gameNum;
+    job->board = *game;
+    job->timeLimit = timeLimit;
+    /* Queue the job on the next worker (round robin), or any other worker if its queue is full */
+    first = atomic_fetch_add(&pool->nextWorker, 1);
+    for (i = 0; i < pool->numWorkers; i++) {
+        struct Worker *worker = &pool->workers[(first + i) % pool->numWorkers];
+        pthread_mutex_lock(&worker->lock);
+        if (worker->numJobs < WORK_QUEUE_SIZE) {
+            worker->queue[(worker->head + worker->numJobs++) % WORK_QUEUE_SIZE] = job;
+            pthread_mutex_unlock(&worker->lock);
+            /* Wake up a sleeping worker to run the job */
+            atomic_fetch_add(&pool->numQueued, 1);
+            pthread_mutex_lock(&pool->sleepLock);
+            pthread_cond_signal(&pool->wakeup);
+            pthread_mutex_unlock(&pool->sleepLock);
+            atomic_fetch_add(&pool->numSearches, 1);
+            game->searching = 1;
+            return 1;
+        }
+        pthread_mutex_unlock(&worker->lock);
+    }
+    job->busy = 0;
+    return 0;
+}
+
+/**
+ * @brief Takes the oldest job from the worker's own queue or, if it is empty, steals the
+ * newest job from another worker's queue.
+ *
+ * @param worker The worker looking for a job.
+ * @return The job to run, or NULL if every queue is empty.
+ */
+struct Search_Job *take_job(struct Worker *worker) {
+    int i;
+    struct Worker_Pool *pool = worker->pool;
+    struct Search_Job *job = NULL;
+    /* Take from the front of the worker's own queue */
+    pthread_mutex_lock(&worker->lock);
+    if (worker->numJobs > 0) {
+        job = worker->queue[worker->head];
+        worker->head = (worker->head + 1) % WORK_QUEUE_SIZE;
+        worker->numJobs--;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    /* Steal from the back of the other workers' queues */
+    for (i = 1; job == NULL && i < pool->numWorkers; i++) {
+        struct Worker *victim = &pool->workers[(worker->id + i) % pool->numWorkers];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->numJobs > 0) job = victim->queue[(victim->head + --victim->numJobs) % WORK_QUEUE_SIZE];
+        pthread_mutex_unlock(&victim->lock);
+    }
+    if (job != NULL) atomic_fetch_sub(&pool->numQueued, 1);
+    return job;
+}
+
+/**
+ * @brief Returns a finished search to the shard playing the game and wakes the shard up.
+ *
+ * @param job The finished search.
+ */
+void post_search(struct Search_Job *job) {
+    const char wake = 1;
+    struct Shard *shard = job->shard;
+    pthread_mutex_lock(&shard->finishedLock);
+    job->next = shard->finishedJobs;
+    shard->finishedJobs = job;
+    pthread_mutex_unlock(&shard->finishedLock);
+    /* A full pipe already has a wakeup pending, so a failed write can be ignored */
+    if (write(shard->wakeFDS[1], &wake, sizeof(wake)) < 0 && errno != EAGAIN) print_error("post_search: write", errno, 0);
+}
+
+/* The random ID telling the server's own replicated games apart from those of other servers. */
+static uint32_t serverID;
+/* The games replicated from other servers, hashed by origin port and game number. */
+static struct Replica *replicaTable[REPLICA_BUCKETS];
+/* The number of games in the replica table. */
+static int numReplicas;
+/* The lock protecting the replica table (games are resumed on every shard). */
+static pthread_mutex_t replicaLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Prepares the server to replicate the games it plays to the other servers of the
+ * multicast group. Games are replicated to the first (nearest) group the server joined, which
+ * remote players ask first when they lose the server, with the configured TTL and interface.
+ *
+ * @param serv The server communication endpoint.
+ * @param config The server options with the multicast groups, interface, TTL and loopback.
+ */
+void init_replication(struct Server *serv, const struct Server_Config *config) {
+    unsigned char ttl = config->mcTTL, loop = config->mcLoop;
+    serv->groupAddr = config->groups[0];
+    if (setsockopt(serv->mcrd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) {
+        print_error("init_replication: setsockopt-ttl", errno, 0);
+    }
+    if (setsockopt(serv->mcrd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) {
+        print_error("init_replication: setsockopt-loop", errno, 0);
+    }
+    if (config->mcInterface.s_addr != htonl(INADDR_ANY) && setsockopt(serv->mcrd, IPPROTO_IP, IP_MULTICAST_IF, &config->mcInterface, sizeof(struct in_addr)) < 0) {
+        print_error("init_replication: setsockopt-interface", errno, 0);
+    }
+    /* The multicast group loops the server's own game states back to it */
+    serverID = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16) ^ ntohs(serv->serverAddr.sin_port);
+    log_message(LOG_INFO, "Server replicating games to multicast group at %s (port %hu) with TTL %d", inet_ntoa(serv->groupAddr.sin_addr), serv->groupAddr.sin_port, config->mcTTL);
+}
+
+/**
+ * @brief Packs the low bytes of a value into a buffer, least significant byte first.
+ *
+ * @param dest The buffer to pack the bytes into.
+ * @param value The value to pack.
+ * @param length The number of bytes to pack.
+ */
+void pack_bytes(unsigned char *dest, uint64_t value, int length) {
+    int i;
+    for (i = 0; i < length; i++) dest[i] = (value >> (8 * i)) & 0xFF;
+}
+
+/**
+ * @brief Unpacks a value packed into a buffer least significant byte first.
+ *
+ * @param src The buffer the bytes were packed into.
+ * @param length The number of bytes to unpack.
+ * @return The unpacked value.
+ */
+uint64_t unpack_bytes(const unsigned char *src, int length) {
+    int i;
+    uint64_t value = 0;
+    for (i = 0; i < length; i++) value |= (uint64_t)src[i] << (8 * i);
+    return value;
+}
+
+/**
+ * @brief Gets the bucket of the replica table holding the replicas of a game.
+ *
+ * @param originPort The port of the server playing the game.
+ * @param wireNum The game number the remote player was sent.
+ * @return The bucket of the replica table.
+ */
+static struct Replica **replica_bucket(int originPort, int wireNum) {
+    return &replicaTable[((uint32_t)originPort * 131 + (uint32_t)wireNum) & (REPLICA_BUCKETS - 1)];
+}
+
+/**
+ * @brief Removes a replica from the replica table (while holding its lock). A game carried
+ * over in the journal is closed there too, since it is resumed (and journaled again) or gone.
+ *
+ * @param link The link in the bucket of the replica table pointing to the replica.
+ */
+static void drop_replica(struct Replica **link) {
+    struct Replica *replica = *link;
+    if (replica->record != NULL) {
+        replica->record->closed = 1;
+        replica->record->checksum = journal_checksum(replica->record);
+    }
+    *link = replica->next;
+    free(replica);
+    numReplicas--;
+}
+
+/**
+ * @brief Sends the GAME_STATE command with the state of the game to the other servers of the
+ * multicast group, so any of them can take over the game if this server goes away.
+ *
+ * @param game The current game of TicTacToe being played.
+ * @param closed Whether the game has ended and the other servers can drop their replica.
+ */
+void replicate_game(const struct TTT_Game *game, int closed) {
+    const struct Server *serv = game->shard->serv;
+    struct UDP_Buffer datagram = {0};
+    /* Pack the game's state into the datagram */
+    datagram.version = VERSION;
+    datagram.command = GAME_STATE;
+    datagram.state.variant = encode_variant(game->variant);
+    datagram.state.closed = closed;
+    pack_bytes(datagram.state.serverID, serverID, sizeof(datagram.state.serverID));
+    pack_bytes(datagram.state.gameNum, game->gameNum, sizeof(datagram.state.gameNum));
+    pack_bytes(datagram.state.wireNum, game_channel(game), sizeof(datagram.state.wireNum));
+    pack_bytes(datagram.state.p1Marks, game->p1Marks, sizeof(datagram.state.p1Marks));
+    pack_bytes(datagram.state.p2Marks, game->p2Marks, sizeof(datagram.state.p2Marks));
+    /* Send from the game port so the other servers know which server is playing the game */
+    if (sendto(serv->mcrd, &datagram, GAME_STATE_SIZE, 0, (struct sockaddr *)&serv->groupAddr, sizeof(struct sockaddr_in)) < 0) {
+        print_error("replicate_game", errno, 0);
+    }
+}
+
+/**
+ * @brief Holds back replicating (and journaling) the state of the game until the moves queued
+ * for the remote player have been sent, since a server taking the game over from a replica
+ * must find the board the remote player has.
+ *
+ * @param game The current game of TicTacToe being played.
+ */
+void hold_state(struct TTT_Game *game) {
+    struct Connection *conn = game->conn;
+    if (game->pprevHeld != NULL) return;
+    game->nextHeld = conn->heldStates;
+    if (conn->heldStates != NULL) conn->heldStates->pprevHeld = &game->nextHeld;
+    conn->heldStates = game;
+    game->pprevHeld = &conn->heldStates;
+}
+
+/**
+ * @brief Stops holding back the state of the game, if it is, without replicating it.
+ *
+ * @param game The current game of TicTacToe being played.
+ */
+void unhold_state(struct TTT_Game *game) {
+    if (game->pprevHeld == NULL) return;
+    *game->pprevHeld = game->nextHeld;
+    if (game->nextHeld != NULL) game->nextHeld->pprevHeld = game->pprevHeld;
+    game->nextHeld = NULL;
+    game->pprevHeld = NULL;
+}
+
+/**
+ * @brief Replicates (and journals) the state of every game held back on the connection, once
+ * everything queued for the remote player has been sent.
+ *
+ * @param conn The connection of the remote player.
+ */
+void release_states(struct Connection *conn) {
+    while (conn->heldStates != NULL) {
+        struct TTT_Game *game = conn->heldStates;
+        unhold_state(game);
+        replicate_game(game, 0);
+        journal_game(game, 0);
+    }
+}
+
+/**
+ * @brief Handles the GAME_STATE command from another server of the multicast group. Stores
+ * the replicated game, or drops it if the game has ended. Game states that arrive out of order
+ * are ignored, and replicas that have not been updated in a while are dropped along the way.
+ *
+ * @param originAddr The address of the server playing the game.
+ * @param state The state of the game.
+ * @param record The journal record carrying the game over, if it was recovered from the
+ * journal (NULL otherwise).
+ */
+void store_replica(const struct sockaddr_in *originAddr, const struct Game_State *state, struct Journal_Entry *record) {
+    const uint32_t originID = unpack_bytes(state->serverID, sizeof(state->serverID));
+    const int gameNum = unpack_bytes(state->gameNum, sizeof(state->gameNum)), originPort = ntohs(originAddr->sin_port);
+    const int wireNum = unpack_bytes(state->wireNum, sizeof(state->wireNum));
+    const uint64_t p1Marks = unpack_bytes(state->p1Marks, sizeof(state->p1Marks)), p2Marks = unpack_bytes(state->p2Marks, sizeof(state->p2Marks));
+    const struct Board_Variant *variant = parse_variant(state->variant);
+    const time_t now = time(NULL);
+    struct Replica **link, *replica = NULL;
+    /* Ignore the server's own games (looped back by the multicast group) */
+    if (originID == serverID) return;
+    if (variant == NULL) {
+        print_error("store_replica: Board variant not supported", 0, 0);
+        return;
+    }
+    pthread_mutex_lock(&replicaLock);
+    /* Find the game's replica in its bucket */
+    link = replica_bucket(originPort, wireNum);
+    while (*link != NULL) {
+        if ((*link)->serverID == originID && (*link)->gameNum == gameNum) {
+            replica = *link;
+            break;
+        } else if (now - (*link)->updated > REPLICA_TTL) {
+            drop_replica(link);
+        } else {
+            link = &(*link)->next;
+        }
+    }
+    if (state->closed) {
+        /* The game has ended, so it can no longer be resumed */
+        if (replica != NULL) drop_replica(link);
+    } else if (replica != NULL) {
+        /* Marks are never removed, so a board with fewer marks is an older state */
+        if (__builtin_popcountll(p1Marks | p2Marks) >= __builtin_popcountll(replica->p1Marks | replica->p2Marks)) {
+            replica->variant = variant;
+            replica->p1Marks = p1Marks;
+            replica->p2Marks = p2Marks;
+            replica->updated = now;
+        }
+    } else if (numReplicas >= MAX_REPLICAS) {
+        print_error("store_replica: Replica table is full. Game state discarded", 0, 0);
+    } else if ((replica = malloc(sizeof(struct Replica))) == NULL) {
+        print_error("store_replica: malloc", errno, 0);
+    } else {
+        replica->serverID = originID;
+        replica->gameNum = gameNum;
+        replica->originPort = originPort;
+        replica->wireNum = wireNum;
+        replica->variant = variant;
+        replica->p1Marks = p1Marks;
+        replica->p2Marks = p2Marks;
+        replica->updated = now;
+        replica->record = record;
+        replica->next = *link;
+        *link = replica;
+        numReplicas++;
+    }
+    pthread_mutex_unlock(&replicaLock);
+    log_message(LOG_DEBUG, "Server at %s (port %d) replicated Game #%d", inet_ntoa(originAddr->sin_addr), originPort, gameNum);
+}
+
+/**
+ * @brief Takes over a game replicated from another server for a remote player resuming it.
+ * The remote player's board has to be the replicated board plus Player 2's reply to the last
+ * move, and the replica is removed so the game can only be resumed once. Servers on other
+ * hosts can share the origin port and hand out the same game numbers, so a replica with the
+ * same key but another board may belong to another game and is left alone.
+ *
+ * @param originPort The port of the server the game was being played on.
+ * @param wireNum The game number the remote player was sent.
+ * @param variant The board variant of the game.
+ * @param p1Marks The bitboard of the squares marked by Player 1 on the remote player's board.
+ * @param p2Marks The bitboard of the squares marked by Player 2 on the remote player's board.
+ * @return True if the game was taken over, false if no replica the remote player's board
+ * follows was found.
+ */
+int take_replica(int originPort, int wireNum, const struct Board_Variant *variant, uint64_t p1Marks, uint64_t p2Marks) {
+    int rv = 0;
+    const time_t now = time(NULL);
+    struct Replica **link;
+    pthread_mutex_lock(&replicaLock);
+    link = replica_bucket(originPort, wireNum);
+    while (*link != NULL) {
+        struct Replica *replica = *link;
+        uint64_t reply = p2Marks & ~replica->p2Marks & BOARD_MASK(variant->numSquares);
+        if (now - replica->updated > REPLICA_TTL) {
+            drop_replica(link);
+            continue;
+        }
+        if (replica->originPort == originPort && replica->wireNum == wireNum && replica->variant == variant) {
+            /* Player 2's reply has to be on an empty square of the board */
+            if (replica->p1Marks == p1Marks && (replica->p2Marks | reply) == p2Marks && __builtin_popcountll(reply) == 1 && !(reply & p1Marks)) {
+                drop_replica(link);
+                rv = 1;
+                break;
+            }
+        }
+        link = &replica->next;
+    }
+    pthread_mutex_unlock(&replicaLock);
+    return rv;
+}
+
+/**
+ * @brief Counts the games replicated from the other servers of the multicast group. Safe to
+ * call from any thread.
+ * 
+ * @return The number of replicas in the replica table.
+ */
+int count_replicas(void) {
+    int count;
+    pthread_mutex_lock(&replicaLock);
+    count = numReplicas;
+    pthread_mutex_unlock(&replicaLock);
+    return count;
+}
+
+/**
+ * @brief Parses the multicast group (and optional port) of a watch channel.
+ *
+ * @param arg The watch channel, as group[:port].
+ * @param addr The address to store the watch channel in.
+ * @return 0 if the watch channel is valid, ERROR_CODE otherwise.
+ */
+int parse_channel(const char *arg, struct sockaddr_in *addr) {
+    char group[INET_ADDRSTRLEN];
+    int port = WATCH_PORT, length = strcspn(arg, ":");
+    if (length == 0 || length >= INET_ADDRSTRLEN) return ERROR_CODE;
+    memcpy(group, arg, length);
+    group[length] = '\0';
+    if (arg[length] == ':') {
+        port = strtol(arg + length + 1, NULL, 10);
+        if (port < 1 || port != (u_int16_t)port) return ERROR_CODE;
+    }
+    bzero(addr, sizeof(struct sockaddr_in));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    if (inet_pton(AF_INET, group, &addr->sin_addr) != 1 || !IN_MULTICAST(ntohl(addr->sin_addr.s_addr))) return ERROR_CODE;
+    return 0;
+}
+
+/**
+ * @brief Opens the socket every shard publishes its games to the watch channel from, with the
+ * same TTL, loopback and interface the games are replicated with. The network fans each
+ * datagram out to however many spectators joined the channel, so watchers cost the server
+ * nothing.
+ *
+ * @param serv The server communication endpoint.
+ * @param config The server options with the watch channel, interface, TTL and loopback.
+ */
+void init_watch_channel(struct Server *serv, const struct Server_Config *config) {
+    unsigned char ttl = config->mcTTL, loop = config->mcLoop;
+    serv->watchSD = -1;
+    if (!config->watch) return;
+    if ((serv->watchSD = socket(AF_INET, SOCK_DGRAM, 0)) < 0) print_error("init_watch_channel: socket", errno, 1);
+    serv->watchAddr = config->watchAddr;
+    if (setsockopt(serv->watchSD, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) {
+        print_error("init_watch_channel: setsockopt-ttl", errno, 0);
+    }
+    if (setsockopt(serv->watchSD, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) {
+        print_error("init_watch_channel: setsockopt-loop", errno, 0);
+    }
+    if (config->mcInterface.s_addr != htonl(INADDR_ANY) && setsockopt(serv->watchSD, IPPROTO_IP, IP_MULTICAST_IF, &config->mcInterface, sizeof(struct in_addr)) < 0) {
+        print_error("init_watch_channel: setsockopt-interface", errno, 0);
+    }
+    log_message(LOG_INFO, "Server publishing games to watch channel at %s (port %hu)", inet_ntoa(serv->watchAddr.sin_addr), ntohs(serv->watchAddr.sin_port));
+}
+
+/**
+ * @brief Empties a shard's feed of moves and schedules its first snapshot, if the games are
+ * published to spectators.
+ *
+ * @param shard The shard publishing its games.
+ */
+void init_watch_feed(struct Shard *shard) {
+    shard->watch.length = 0;
+    shard->watch.snapshotTimer.expire = publish_snapshot;
+    if (shard->serv->watchSD >= 0) schedule_timer(&shard->timers, &shard->watch.snapshotTimer, shard->timers.tick + WATCH_SNAPSHOT_INTERVAL / TIMER_TICK_MS);
+}
+
+/**
+ * @brief Sends a datagram of moves or boards to the watch channel. Datagrams the socket has no
+ * room for are dropped, since spectators catch up from the next snapshot.
+ *
+ * @param shard The shard publishing its games.
+ * @param datagram The datagram, with room for its header.
+ * @param command The WATCH_MOVES or WATCH_SNAPSHOT command.
+ * @param count The number of records following the header.
+ * @param length The number of bytes of the datagram.
+ */
+static void send_watch_datagram(struct Shard *shard, unsigned char *datagram, int command, int count, int length) {
+    struct Watch_Header *header = (struct Watch_Header *)datagram;
+    header->version = WATCH_VERSION;
+    header->command = command;
+    pack_bytes(header->count, count, sizeof(header->count));
+    pack_bytes(header->serverID, serverID, sizeof(header->serverID));
+    if (sendto(shard->serv->watchSD, datagram, length, MSG_DONTWAIT, (struct sockaddr *)&shard->serv->watchAddr, sizeof(struct sockaddr_in)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) print_error("send_watch_datagram", errno, 0);
+        return;
+    }
+    count_metric(METRIC_WATCH_DATAGRAMS, 1);
+}
+
+/**
+ * @brief Queues a move (or the end) of a game on its shard's feed, to be published with the
+ * other moves made before the shard next waits for events.
+ *
+ * @param game The current game of TicTacToe being played.
+ * @param kind WATCH_P1_MOVE, WATCH_P2_MOVE, or WATCH_GAME_END.
+ * @param square The square marked (from 1), or the winner of an ended game.
+ */
+void publish_move(struct TTT_Game *game, int kind, int square) {
+    struct Watch_Feed *feed = &game->shard->watch;
+    struct Watch_Move *record;
+    if (game->shard->serv->watchSD < 0) return;
+    /* Publish the moves already queued if the datagram is full */
+    if (feed->length + (int)sizeof(struct Watch_Move) > WATCH_DATAGRAM_SIZE) flush_watch_feed(game->shard);
+    if (feed->length == 0) feed->length = WATCH_HEADER_SIZE;
+    record = (struct Watch_Move *)(feed->datagram + feed->length);
+    pack_bytes(record->gameNum, game->gameNum, sizeof(record->gameNum));
+    record->variant = encode_variant(game->variant);
+    record->kind = kind;
+    record->square = square;
+    record->numMoves = __builtin_popcountll(game->p1Marks | game->p2Marks);
+    feed->length += sizeof(struct Watch_Move);
+}
+
+/**
+ * @brief Publishes the moves queued on a shard's feed to the watch channel in one datagram.
+ *
+ * @param shard The shard publishing its games.
+ */
+void flush_watch_feed(struct Shard *shard) {
+    struct Watch_Feed *feed = &shard->watch;
+    if (feed->length == 0) return;
+    send_watch_datagram(shard, feed->datagram, WATCH_MOVES, (feed->length - WATCH_HEADER_SIZE) / sizeof(struct Watch_Move), feed->length);
+    feed->length = 0;
+}
+
+/**
+ * @brief Publishes the boards of every game a shard is playing to the watch channel, so
+ * spectators that joined late (or missed a move) can follow them, and schedules the next
+ * snapshot. Called once the shard's snapshot timer expires.
+ *
+ * @param timer The snapshot timer of the shard's feed.
+ */
+void publish_snapshot(struct Timer *timer) {
+    struct Shard *shard = (struct Shard *)((char *)timer - offsetof(struct Shard, watch.snapshotTimer));
+    unsigned char datagram[WATCH_DATAGRAM_SIZE];
+    int slot, count = 0, length = WATCH_HEADER_SIZE;
+    /* The moves already queued come before the boards that include them */
+    flush_watch_feed(shard);
+    for (slot = 0; slot < shard->roster.size; slot++) {
+        const struct TTT_Game *game = get_game(&shard->roster, slot);
+        struct Watch_Board *record;
+        if (game->conn == NULL || (game->p1Marks | game->p2Marks) == 0) continue;
+        if (length + (int)sizeof(struct Watch_Board) > WATCH_DATAGRAM_SIZE) {
+            send_watch_datagram(shard, datagram, WATCH_SNAPSHOT, count, length);
+            count = 0;
+            length = WATCH_HEADER_SIZE;
+        }
+        record = (struct Watch_Board *)(datagram + length);
+        pack_bytes(record->gameNum, game->gameNum, sizeof(record->gameNum));
+        record->variant = encode_variant(game->variant);
+        record->numMoves = __builtin_popcountll(game->p1Marks | game->p2Marks);
+        record->reserved[0] = record->reserved[1] = 0;
+        pack_bytes(record->p1Marks, game->p1Marks, sizeof(record->p1Marks));
+        pack_bytes(record->p2Marks, game->p2Marks, sizeof(record->p2Marks));
+        length += sizeof(struct Watch_Board);
+        count++;
+    }
+    if (count > 0) send_watch_datagram(shard, datagram, WATCH_SNAPSHOT, count, length);
+    schedule_timer(&shard->timers, timer, shard->timers.tick + WATCH_SNAPSHOT_INTERVAL / TIMER_TICK_MS);
+}
+
+/**
+ * @brief Opens the game state journal, so the games being played survive the server being
+ * restarted. The games of the journal left by the server's last run are held as replicas
+ * until their remote players resume them, then a fresh journal is laid out for this run: a
+ * checkpoint table with a record for every game and a move log for every shard. The recovered
+ * games are carried over into records of their own past those of the games, until they are
+ * resumed, so they survive the server crashing again before their players come back.
+ *
+ * @param serv The server communication endpoint (its shards already initialized).
+ * @param path The path of the journal file, or NULL if the journal is disabled.
+ */
+void init_journal(struct Server *serv, const char *path) {
+    int i, fd, numRecovered, numGames = 0, numSlots;
+    uint64_t start = monotonic_time();
+    struct Journal_Header *header;
+    struct Journal_Entry *entries, *recovered = NULL;
+    serv->journal = NULL;
+    if (path == NULL) return;
+    if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) print_error("init_journal: open", errno, 1);
+    if ((numRecovered = recover_journal(fd, &recovered)) > 0) {
+        log_message(LOG_INFO, "[+]Recovered %d game(s) from the journal in %llu us", numRecovered, (unsigned long long)(monotonic_time() - start) / 1000);
+    }
+    /* Lay out the fresh journal, zeroed so every entry starts unused */
+    for (i = 0; i < serv->numShards; i++) numGames += serv->shards[i].roster.capacity;
+    numSlots = numGames + numRecovered;
+    serv->journalSize = sizeof(struct Journal_Header) + ((size_t)numSlots + (size_t)serv->numShards * JOURNAL_LOG_SIZE) * sizeof(struct Journal_Entry);
+    if (ftruncate(fd, 0) < 0 || ftruncate(fd, serv->journalSize) < 0) print_error("init_journal: ftruncate", errno, 1);
+    if ((header = mmap(NULL, serv->journalSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) print_error("init_journal: mmap", errno, 1);
+    if (close(fd) < 0) print_error("init_journal: close", errno, 0);
+    header->layout = JOURNAL_LAYOUT;
+    header->serverID = serverID;
+    header->port = ntohs(serv->serverAddr.sin_port);
+    header->numSlots = numSlots;
+    header->numShards = serv->numShards;
+    header->logSize = JOURNAL_LOG_SIZE;
+    /* Give each shard the checkpoint table and its own move log */
+    entries = (struct Journal_Entry *)(header + 1);
+    for (i = 0; i < serv->numShards; i++) {
+        struct Journal *journal = &serv->shards[i].journal;
+        journal->table = entries;
+        journal->log = entries + numSlots + (size_t)i * JOURNAL_LOG_SIZE;
+        journal->logLength = 0;
+        journal->sequence = 0;
+    }
+    /* Carry every recovered game over (no move log ever has a later entry for its record) and hold it as a replica of the server it was played on */
+    for (i = 0; i < numRecovered; i++) {
+        struct Journal_Entry *record = &entries[numGames + i];
+        struct sockaddr_in originAddr = {0};
+        struct Game_State state = {0};
+        *record = recovered[i];
+        record->sequence = 1;
+        record->slot = numGames + i;
+        record->checksum = journal_checksum(record);
+        originAddr.sin_family = AF_INET;
+        originAddr.sin_port = htons(record->originPort);
+        state.variant = record->variant;
+        pack_bytes(state.serverID, record->originID, sizeof(state.serverID));
+        pack_bytes(state.gameNum, record->gameNum, sizeof(state.gameNum));
+        pack_bytes(state.wireNum, record->wireNum, sizeof(state.wireNum));
+        pack_bytes(state.p1Marks, record->p1Marks, sizeof(state.p1Marks));
+        pack_bytes(state.p2Marks, record->p2Marks, sizeof(state.p2Marks));
+        store_replica(&originAddr, &state, record);
+    }
+    free(recovered);
+    memcpy(header->magic, JOURNAL_MAGIC, sizeof(header->magic));
+    serv->journal = header;
+    log_message(LOG_INFO, "Server journaling games to %s", path);
+}
+
+/**
+ * @brief Reads the journal left by the server's last run and collects every game it was still
+ * playing (including games it had carried over from an earlier run), so a remote player
+ * resuming the game with the RESUME_REPLICA command can be taken straight back into it. The
+ * latest state of each game is the entry with the highest sequence number among its checkpoint
+ * record and its shard's move log, and torn entries (from a crash in the middle of writing
+ * them) are skipped.
+ *
+ * @param fd The file descriptor of the journal file.
+ * @param recovered Set to the latest entries of the games recovered (NULL if none), to be
+ * freed by the caller.
+ * @return The number of games recovered (0 if the file is not a journal).
+ */
+int recover_journal(int fd, struct Journal_Entry **recovered) {
+    int numRecovered = 0;
+    uint32_t i;
+    struct stat info;
+    struct Journal_Header *header;
+    const struct Journal_Entry *entries;
+    struct Journal_Entry *latest;
+    *recovered = NULL;
+    if (fstat(fd, &info) < 0) print_error("recover_journal: fstat", errno, 1);
+    if (info.st_size < (off_t)sizeof(struct Journal_Header)) return 0;
+    if ((header = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) print_error("recover_journal: mmap", errno, 1);
+    if (memcmp(header->magic, JOURNAL_MAGIC, sizeof(header->magic)) != 0 || header->layout != JOURNAL_LAYOUT ||
+        info.st_size != (off_t)(sizeof(struct Journal_Header) + ((size_t)header->numSlots + (size_t)header->numShards * header->logSize) * sizeof(struct Journal_Entry))) {
+        print_error("recover_journal: Not a journal of this server version. Starting a fresh journal", 0, 0);
+        munmap(header, info.st_size);
+        return 0;
+    }
+    if ((latest = calloc(header->numSlots, sizeof(struct Journal_Entry))) == NULL) print_error("recover_journal: calloc", errno, 1);
+    /* Start from the checkpoint table, then replay every move log over it */
+    entries = (const struct Journal_Entry *)(header + 1);
+    for (i = 0; i < header->numSlots; i++) {
+        if (valid_journal_entry(&entries[i], header->numSlots) && entries[i].slot == (int32_t)i) latest[i] = entries[i];
+    }
+    for (i = header->numSlots; i < header->numSlots + header->numShards * header->logSize; i++) {
+        if (valid_journal_entry(&entries[i], header->numSlots) && entries[i].sequence > latest[entries[i].slot].sequence) latest[entries[i].slot] = entries[i];
+    }
+    /* Keep every game still being played, packed at the front */
+    for (i = 0; i < header->numSlots; i++) {
+        if (latest[i].sequence != 0 && !latest[i].closed) latest[numRecovered++] = latest[i];
+    }
+    munmap(header, info.st_size);
+    if (numRecovered == 0) {
+        free(latest);
+    } else {
+        *recovered = latest;
+    }
+    return numRecovered;
+}
+
+/**
+ * @brief Computes the checksum (64-bit FNV-1a) of a journal entry, every field but the
+ * checksum itself.
+ *
+ * @param entry The journal entry.
+ * @return The checksum of the entry.
+ */
+uint64_t journal_checksum(const struct Journal_Entry *entry) {
+    size_t i;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    const unsigned char *bytes = (const unsigned char *)entry;
+    for (i = 0; i < offsetof(struct Journal_Entry, checksum); i++) hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    return hash;
+}
+
+/**
+ * @brief Determines if a journal entry read back from the journal file holds a game state:
+ * the entry is in use, whole, and for a game of the checkpoint table.
+ *
+ * @param entry The journal entry.
+ * @param numSlots The number of records in the checkpoint table.
+ * @return True if the entry is valid, false otherwise.
+ */
+int valid_journal_entry(const struct Journal_Entry *entry, uint32_t numSlots) {
+    return entry->sequence != 0 && entry->slot >= 0 && (uint32_t)entry->slot < numSlots && entry->checksum == journal_checksum(entry) && parse_variant(entry->variant) != NULL;
+}
+
+/**
+ * @brief Appends the state of a game to its shard's move log, at the same points the game
+ * is replicated to the other servers. The journal file is mapped into memory, so the entry
+ * is kept by the kernel even if the server crashes right after writing it. A checkpoint is
+ * taken first if the move log is full.
+ *
+ * @param game The current game of TicTacToe being played.
+ * @param closed Whether the game has ended and will not be resumed.
+ */
+void journal_game(const struct TTT_Game *game, int closed) {
+    struct Journal *journal = &game->shard->journal;
+    struct Journal_Entry *entry;
+    if (journal->table == NULL) return;
+    if (journal->logLength == JOURNAL_LOG_SIZE) checkpoint_journal(game->shard);
+    entry = &journal->log[journal->logLength++];
+    entry->sequence = ++journal->sequence;
+    entry->p1Marks = game->p1Marks;
+    entry->p2Marks = game->p2Marks;
+    entry->gameNum = game->gameNum;
+    entry->wireNum = game_channel(game);
+    entry->slot = game->roster->firstID + game->slot;
+    entry->originID = serverID;
+    entry->originPort = ntohs(game->shard->serv->serverAddr.sin_port);
+    entry->variant = encode_variant(game->variant);
+    entry->closed = closed;
+    entry->checksum = journal_checksum(entry);
+}
+
+/**
+ * @brief Takes a checkpoint of a shard's games: the latest entry of each game in the move
+ * log is copied into its record of the checkpoint table, and the move log starts over. A
+ * crash part way through is safe, since the move log is only overwritten afterwards and
+ * recovery keeps whichever copy is newest. Writing the journal back to disk is started (but
+ * not waited for) so the checkpoint also survives the machine going down soon after.
+ *
+ * @param shard The shard whose games are checkpointed.
+ */
+void checkpoint_journal(struct Shard *shard) {
+    int i;
+    struct Journal *journal = &shard->journal;
+    for (i = 0; i < journal->logLength; i++) journal->table[journal->log[i].slot] = journal->log[i];
+    journal->logLength = 0;
+    if (msync(shard->serv->journal, shard->serv->journalSize, MS_ASYNC) < 0) print_error("checkpoint_journal: msync", errno, 0);
+}
+
+/**
+ * @brief Initializes the starting state of the game board that both players start with.
+ * 
+ * @param game The current game of TicTacToe being played.
+ */
+void init_shared_state(struct TTT_Game *game) {    
+    /* Initializes the shared state (aka the board) with every square empty */
+    game->p1Marks = 0;
+    game->p2Marks = 0;
+}
+
+/**
+ * @brief Parses the board variant requested by the remote player. The low 4 bits of the data
+ * are the board size and the high 4 bits are the number of marks in a row needed to win (the
+ * board size if 0). No data requests the default board.
+ * 
+ * @param data The data of the NEW_GAME or RESUME_GAME command.
+ * @return The requested board variant, or NULL if the variant is not supported.
+ */
+const struct Board_Variant *parse_variant(char data) {
+    int size = data & 0x0F, winLength = (data >> 4) & 0x0F;
+    if (data == 0) return get_variant(ROWS, ROWS);
+    return get_variant(size, (winLength == 0) ? size : winLength);
+}
+
+/**
+ * @brief Encodes the board variant the way the remote player requests it (see parse_variant).
+ * 
+ * @param variant The board variant.
+ * @return The encoded board variant.
+ */
+char encode_variant(const struct Board_Variant *variant) {
+    if (variant->size == ROWS && variant->winLength == ROWS) return 0;
+    return (char)((variant->winLength << 4) | variant->size);
+}
+
+/**
+ * @brief Checks that the bitboards of a board received from the remote player only mark
+ * squares of the board, never mark a square twice, have Player 1 to move, and could be
+ * reached by a game (e.g. not both players have won).
+ * 
+ * @param game The current game of TicTacToe being played.
+ * @param p1Marks The bitboard of the squares marked by Player 1.
+ * @param p2Marks The bitboard of the squares marked by Player 2.
+ * @return True if the board is valid, false otherwise.
+ */
+int validate_marks(const struct TTT_Game *game, uint64_t p1Marks, uint64_t p2Marks) {
+    /* Check that the marks are on empty squares of the board */
+    if (((p1Marks | p2Marks) & ~BOARD_MASK(game->variant->numSquares)) || (p1Marks & p2Marks)) {
+        print_error("validate_marks: The received board contains invalid marks", 0, 0);
+        return 0;
+    }
+    /* Validate valid number of moves */
+    if (__builtin_popcountll(p1Marks) != __builtin_popcountll(p2Marks)) {
+        print_error("validate_marks: Board state contains an invalid number of moves", 0, 0);
+        return 0;
+    }
+    /* Validate that a game could have been played to the board state */
+    if (!reachable_board(game->variant, p1Marks, p2Marks)) {
+        print_error("validate_marks: Board state cannot be reached by any game", 0, 0);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Load the starting state of the game board from the remote player. Version 6 sends
+ * a mark for every square, and version 7 sends the packed bitboards of both players.
+ * 
+ * @param game The current game of TicTacToe being played.
+ * @return True if state loaded correctly, false otherwise.
+ */
+int load_shared_state(struct TTT_Game *game) {    
+    int i;
+    uint64_t p1Marks = 0, p2Marks = 0;
+    char boardState[MAX_SQUARES];
+    const int numSquares = game->variant->numSquares;
+    if (game->conn->version == FRAMED_VERSION) {
+        /* Take the packed bitboards, which arrived with the command, from the input buffer */
+        peek_input(game->conn, boardState, PACKED_BOARD_SIZE(numSquares));
+        consume_input(game->conn, PACKED_BOARD_SIZE(numSquares));
+        p1Marks = unpack_bytes((unsigned char *)boardState, MASK_BYTES(numSquares));
+        p2Marks = unpack_bytes((unsigned char *)boardState + MASK_BYTES(numSquares), MASK_BYTES(numSquares));
+    } else {
+        /* Take the shared state (aka the board), which arrived with the command, from the input buffer */
+        peek_input(game->conn, boardState, numSquares);
+        consume_input(game->conn, numSquares);
+        /* Check that the received board contains valid marks */
+        for (i = 0; i < numSquares; i++) {
+            char mark = boardState[i];
+            if (mark == P1_MARK) {
+                p1Marks |= SQUARE_BIT(i);
+            } else if (mark == P2_MARK) {
+                p2Marks |= SQUARE_BIT(i);
+            } else if (mark != 0) {
+                print_error("load_shared_state: The received board contains invalid marks", 0, 0);
+                return 0;
+            }
+        }
+    }
+    if (!validate_marks(game, p1Marks, p2Marks)) return 0;
+    game->p1Marks = p1Marks;
+    game->p2Marks = p2Marks;
+
+    return 1;
+}
+
+/**
+ * @brief Initializes the empty game roster. Games for the whole capacity are reserved up front
+ * (see reserve_arena) and initialized in slabs as players need them.
+ * 
+ * @param roster The roster of playable TicTacToe games.
+ * @param capacity The maximum number of games that can be played simultaneously.
+ * @param firstID The game ID slot of the roster's first game, so IDs are unique across shards.
+ */
+void init_game_roster(struct Game_Roster *roster, int capacity, int firstID) {
+    log_message(LOG_INFO, "[+]Initializing game roster for up to %d games.", capacity);
+    memset(roster, 0, sizeof(struct Game_Roster));
+    roster->capacity = capacity;
+    roster->firstID = firstID;
+    roster->games = reserve_arena(capacity * sizeof(struct TTT_Game));
+    if ((roster->openSlots = malloc(capacity * sizeof(int))) == NULL) print_error("init_game_roster: malloc", errno, 1);
+    /* Initialize the first slab of games up front */
+    grow_game_roster(roster);
+}
+
+/**
+ * @brief Initializes another slab of the games reserved for the game roster and adds them to
+ * the stack of open games. Games are never moved, so pointers to them stay valid.
+ * 
+ * @param roster The roster of playable TicTacToe games.
+ * @return True if more games were added to the roster, false otherwise.
+ */
+int grow_game_roster(struct Game_Roster *roster) {
+    int i, slabSize;
+    /* Check that the roster is not already at capacity */
+    if (roster->size >= roster->capacity) return 0;
+    slabSize = roster->capacity - roster->size;
+    if (slabSize > ROSTER_SLAB_SIZE) slabSize = ROSTER_SLAB_SIZE;
+    /* Initialize the new games to default values, pushing them so the lowest slot is on top */
+    for (i = slabSize-1; i >= 0; i--) {
+        struct TTT_Game *game = &roster->games[roster->size + i];
+        game->slot = roster->size + i;
+        game->roster = roster;
+        game->conn = NULL;
+        reset_game(game);
+        roster->openSlots[roster->numOpen++] = game->slot;
+    }
+    roster->size += slabSize;
+    return 1;
+}
+
+/**
+ * @brief Gets the game in the given slot of the game roster.
+ * 
+ * @param roster The roster of playable TicTacToe games.
+ * @param slot The index of the game in the game roster.
+ * @return The game in the given slot.
+ */
+struct TTT_Game *get_game(const struct Game_Roster *roster, int slot) {
+    return &roster->games[slot];
+}
+
+/**
+ * @brief Finds an open game of TicTacToe to play if one is available, growing the game roster
+ * if every allocated game is in use. The game is not claimed.
+ * 
+ * @param roster The roster of playable TicTacToe games.
+ * @return The index of an open game if one is available, otherwise an error code is returned.
+ */
+int find_open_game(struct Game_Roster *roster) {
+    /* Grow the roster if there are no open games left */
+    if (roster->numOpen == 0 && !grow_game_roster(roster)) return ERROR_CODE;
+    return roster->openSlots[roster->numOpen-1];
+}
+
+/**
+ * @brief Claims an open game of TicTacToe for a new player and gives it a new game ID, so
+ * commands for the previous game played in the same slot are not mistaken for this game.
+ * 
+ * @param roster The roster of playable TicTacToe games.
+ * @return The claimed game if one is available, otherwise NULL.
+ */
+struct TTT_Game *claim_open_game(struct Game_Roster *roster) {
+    struct TTT_Game *game;
+    if (find_open_game(roster) == ERROR_CODE) return NULL;
+    game = get_game(roster, roster->openSlots[--roster->numOpen]);
+    /* Tag the game ID with a new generation, skipping zero so IDs are never zero */
+    game->generation = (game->generation + 1) & (INT32_MAX >> GAME_SLOT_BITS);
+    if (game->generation == 0) game->generation = 1;
+    game->gameNum = (int)(game->generation << GAME_SLOT_BITS) | (roster->firstID + game->slot);
+    atomic_fetch_add(&roster->numActive, 1);
+    return game;
+}
+
+/**
+ * @brief Gets the game number sent over the wire for a game. The version 6 protocol only has
+ * a single byte for the game number, so the game ID is hashed into the range [1-127].
+ * 
+ * @param gameNum The generation-tagged game ID.
+ * @return The game number used in version 6 messages for the game.
+ */
+int wire_game_num(int gameNum) {
+    return 1 + (int)(((uint32_t)gameNum * 2654435761u) >> 8) % 127;
+}
+
+/**
+ * @brief Gets the game number the remote player knows a game by: the game number it started
+ * the game with on a multiplexed connection, otherwise the game ID itself in version 7 or
+ * the game number sent over the wire in version 6.
+ * 
+ * @param game The current game of TicTacToe being played.
+ * @return The game number of the game on its connection.
+ */
+int game_channel(const struct TTT_Game *game) {
+    if (game->channel >= 0) return game->channel;
+    return (game->conn->version == FRAMED_VERSION) ? game->gameNum : wire_game_num(game->gameNum);
+}
+
+/**
+ * @brief Gets every UDP command waiting from the remote players (up to a batch) in as few
+ * system calls as possible and attempts to validate the data and syntax of each based on the
+ * current protocol. Invalid commands are discarded from the batch.
+ * 
+ * @param sd The socket descriptor of the multicast group.
+ * @param batch The batch to store the valid commands and the addresses of the remote players.
+ * @return The number of datagrams received (valid or not), 0 if no datagram is waiting, or an
+ * error code if an error occured. 
+ */
+int get_udp_commands(int sd, struct UDP_Batch *batch) {
+    int i, received, lengths[UDP_BATCH_SIZE];
+#ifdef __linux__
+    struct mmsghdr headers[UDP_BATCH_SIZE];
+    struct iovec vectors[UDP_BATCH_SIZE];
+    /* Receive the whole batch with one system call */
+    memset(headers, 0, sizeof(headers));
+    for (i = 0; i < UDP_BATCH_SIZE; i++) {
+        vectors[i].iov_base = &batch->datagrams[i];
+        vectors[i].iov_len = sizeof(struct UDP_Buffer);
+        headers[i].msg_hdr.msg_name = &batch->addrs[i];
+        headers[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        headers[i].msg_hdr.msg_iov = &vectors[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+    }
+    if ((received = recvmmsg(sd, headers, UDP_BATCH_SIZE, MSG_DONTWAIT, NULL)) < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;   // no more datagrams waiting
+        print_error("get_udp_commands", errno, 0);
+        return ERROR_CODE;
+    }
+    for (i = 0; i < received; i++) lengths[i] = headers[i].msg_len;
+#else
+    /* Receive datagrams one at a time until none are waiting */
+    for (received = 0; received < UDP_BATCH_SIZE; received++) {
+        socklen_t fromLength = sizeof(struct sockaddr_in);
+        if ((lengths[received] = recvfrom(sd, &batch->datagrams[received], sizeof(struct UDP_Buffer), 0, (struct sockaddr *)&batch->addrs[received], &fromLength)) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;   // no more datagrams waiting
+            print_error("get_udp_commands", errno, 0);
+            return ERROR_CODE;
+        }
+    }
+#endif
+    /* Validate the received messages, keeping only the valid ones */
+    batch->count = 0;
+    for (i = 0; i < received; i++) {
+        struct UDP_Buffer *datagram = &batch->datagrams[i];
+        if (lengths[i] < UDP_CMD_SIZE) {  // check for a complete datagram
+            print_error("get_udp_commands: Received empty datagram. Datagram discarded", 0, 0);
+        } else if (datagram->version != VERSION) {  // check for correct version
+            print_error("get_udp_commands: Protocol version not supported", 0, 0);
+        } else if (datagram->command < REQUEST_GAME || datagram->command > GAME_STATE) {  // check for valid command
+            print_error("get_udp_commands: Invalid UDP command", 0, 0);
+        } else if (datagram->command == GAME_STATE && lengths[i] < (int)GAME_STATE_SIZE) {  // check for the whole game state
+            print_error("get_udp_commands: Received incomplete game state. Datagram discarded", 0, 0);
+        } else {
+            batch->datagrams[batch->count] = *datagram;
+            batch->addrs[batch->count++] = batch->addrs[i];
+        }
+    }
+    return received;
+}
+
+/**
+ * @brief Handles the REQUEST_GAME command from the remote player. Checks whethere there is
+ * a game available to play and queues the GAME_AVAILABLE command, with the server's load, to
+ * the remote player if so. Repeated requests from a remote player already being answered are
+ * coalesced into one reply. Each reply holds a game for the remote player until it connects
+ * (or the reservation expires), so the server stops answering once every open game is held
+ * and players that are answered never race each other for the same game.
+ * 
+ * @param serv The server communication endpoint.
+ * @param playerAddr The address of the remote player.
+ * @param replies The batch of GAME_AVAILABLE commands to send.
+ */
+void request_game(struct Server *serv, const struct sockaddr_in *playerAddr, struct UDP_Batch *replies) {
+    int i;
+    struct Server_Load load;
+    log_message(LOG_DEBUG, "A remote player issued a REQUEST_GAME command");
+    count_metric(METRIC_REQUEST_GAME, 1);
+    /* Check if the remote player is already being answered */
+    for (i = 0; i < replies->count; i++) {
+        if (replies->addrs[i].sin_addr.s_addr == playerAddr->sin_addr.s_addr && replies->addrs[i].sin_port == playerAddr->sin_port) {
+            log_message(LOG_DEBUG, "Duplicate REQUEST_GAME command coalesced");
+            count_metric(METRIC_COALESCED, 1);
+            return;
+        }
+    }
+    /* Hold a game for the remote player (or keep the one it holds), and advertise the games left */
+    if (reserve_game(serv, playerAddr)) {
+        get_server_load(serv, &load);
+        replies->datagrams[replies->count].version = VERSION;
+        replies->datagrams[replies->count].command = GAME_AVAILABLE;
+        replies->datagrams[replies->count].load = load;
+        replies->addrs[replies->count++] = *playerAddr;
+    } else {
+        print_error("request_game: Unable to find an open game", 0, 0);
+    }
+}
+
+/**
+ * @brief Gets the current load of the server to advertise with the GAME_AVAILABLE command.
+ * 
+ * @param serv The server communication endpoint.
+ * @param load The load of the server (in network byte order).
+ */
+void get_server_load(const struct Server *serv, struct Server_Load *load) {
+    int i, freeSlots = unreserved_games(serv), activeGames = 0;
+    for (i = 0; i < serv->numShards; i++) activeGames += atomic_load(&serv->shards[i].roster.numActive);
+    load->version = LOAD_VERSION;
+    load->reserved = 0;
+    load->freeSlots = htons((freeSlots > UINT16_MAX) ? UINT16_MAX : freeSlots);
+    load->activeGames = htons((activeGames > UINT16_MAX) ? UINT16_MAX : activeGames);
+    load->pendingSearches = htons(atomic_load(&serv->pool.numSearches));
+}
+
+/**
+ * @brief Sends a batch of GAME_AVAILABLE commands to the remote players in as few system
+ * calls as possible.
+ * 
+ * @param serv The server communication endpoint.
+ * @param replies The batch of GAME_AVAILABLE commands and the addresses to send them to.
+ */
+void send_game_available(const struct Server *serv, const struct UDP_Batch *replies) {
+    int sent = 0;
+#ifdef __linux__
+    int i;
+    struct mmsghdr headers[UDP_BATCH_SIZE];
+    struct iovec vectors[UDP_BATCH_SIZE];
+    memset(headers, 0, sizeof(headers));
+    for (i = 0; i < replies->count; i++) {
+        vectors[i].iov_base = (void *)&replies->datagrams[i];
+        vectors[i].iov_len = GAME_AVAILABLE_SIZE;
+        headers[i].msg_hdr.msg_name = (void *)&replies->addrs[i];
+        headers[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        headers[i].msg_hdr.msg_iov = &vectors[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+    }
+    /* Send the batch, picking up after any datagram the system call stopped at */
+    while (sent < replies->count) {
+        int rv = sendmmsg(serv->mcrd, headers + sent, replies->count - sent, 0);
+        if (rv < 0) {
+            print_error("send_game_available", errno, 0);
+            rv = 1;     // skip the datagram that could not be sent
+        }
+        sent += rv;
+    }
+#else
+    for (sent = 0; sent < replies->count; sent++) {
+        if (sendto(serv->mcrd, &replies->datagrams[sent], GAME_AVAILABLE_SIZE, 0, (struct sockaddr *)&replies->addrs[sent], sizeof(struct sockaddr_in)) < 0) {
+            print_error("send_game_available", errno, 0);
+        }
+    }
+#endif
+    count_metric(METRIC_GAME_AVAILABLE, replies->count);
+    if (replies->count > 0) log_message(LOG_DEBUG, "Server sent the GAME_AVAILABLE command to %d remote player(s)", replies->count);
+}
+
+/**
+ * @brief Receives all the bytes the remote player has sent that fit in the connection's input
+ * buffer without blocking.
+ * 
+ * @param conn The connection of the remote player.
+ * @return The number of bytes received (0 if none are waiting), or an error code if the
+ * remote player disconnected or an error occured.
+ */
+int read_input(struct Connection *conn) {
+    int bytes = 0;
+    /* Receive into the free space of the ring buffer (in up to 2 pieces if it wraps around) */
+    while (conn->inputLength < INPUT_BUFFER_SIZE) {
+        int rv, tail = (conn->inputHead + conn->inputLength) & (INPUT_BUFFER_SIZE - 1);
+        int space = (tail < conn->inputHead) ? conn->inputHead - tail : INPUT_BUFFER_SIZE - tail;
+        if ((rv = receive_socket(&conn->shard->engine, conn->sd, conn->input + tail, space)) <= 0) {
+            if (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (rv == 0) {
+                print_error("read_input: Player 2 has disconnected", 0, 0);
+            } else {
+                print_error("read_input", errno, 0);
+            }
+            return ERROR_CODE;
+        }
+        conn->inputLength += rv;
+        bytes += rv;
+        if (rv < space) break;
+    }
+    return bytes;
+}
+
+/**
+ * @brief Copies bytes from the front of the connection's input buffer without removing them.
+ * 
+ * @param conn The connection of the remote player.
+ * @param dest The buffer to copy the bytes to.
+ * @param length The number of bytes to copy (no more than are in the input buffer).
+ */
+void peek_input(const struct Connection *conn, char *dest, int length) {
+    int i;
+    for (i = 0; i < length; i++) dest[i] = conn->input[(conn->inputHead + i) & (INPUT_BUFFER_SIZE - 1)];
+}
+
+/**
+ * @brief Removes bytes from the front of the connection's input buffer.
+ * 
+ * @param conn The connection of the remote player.
+ * @param length The number of bytes to remove (no more than are in the input buffer).
+ */
+void consume_input(struct Connection *conn, int length) {
+    conn->inputHead = (conn->inputHead + length) & (INPUT_BUFFER_SIZE - 1);
+    conn->inputLength -= length;
+}
+
+/**
+ * @brief Gets the number of bytes that follow a TCP command: the board following a RESUME_GAME
+ * command (packed in version 7) or the ticket following a RESUME_REPLICA command.
+ * 
+ * @param msg The command that the remote player sent.
+ * @return The number of bytes following the command (0 if its board variant is not supported).
+ */
+int trailing_length(const struct TCP_Buffer *msg) {
+    const struct Board_Variant *variant;
+    if ((msg->command != RESUME_GAME && msg->command != RESUME_REPLICA) || (variant = parse_variant(msg->data)) == NULL) return 0;
+    if (msg->command == RESUME_REPLICA) return RESUME_TICKET_SIZE(variant->numSquares);
+    return (msg->version == FRAMED_VERSION) ? PACKED_BOARD_SIZE(variant->numSquares) : variant->numSquares;
+}
+
+/**
+ * @brief Takes the next complete TCP command the remote player sent from the connection's input
+ * buffer and attempts to validate the data and syntax based on the protocol version the remote
+ * player speaks, which is the version of the first byte it sends. A version 7 frame is only
+ * taken apart once the whole frame has arrived. A RESUME_GAME or RESUME_REPLICA command is only
+ * complete once the board or ticket that follows it has arrived, which is left in the input
+ * buffer for the command's handler.
+ * 
+ * @param conn The connection of the remote player.
+ * @param msg The buffer to store the command that the remote player sent.
+ * @return The number of bytes taken for the command, 0 if no complete command has arrived,
+ * or an error code if the command is invalid.
+ */
+int get_tcp_command(struct Connection *conn, struct TCP_Buffer *msg) {
+    unsigned char bytes[FRAMED_CMD_SIZE];
+    int size;
+    if (conn->frameLength == 0) {
+        /* Between frames, the first byte is the version of what comes next */
+        if (conn->inputLength < 1) return 0;
+        peek_input(conn, (char *)bytes, 1);
+        if (bytes[0] != VERSION && bytes[0] != FRAMED_VERSION) {  // check for correct version
+            print_error("get_tcp_command: Protocol version not supported", 0, 0);
+            return ERROR_CODE;
+        } else if (conn->version != 0 && conn->version != bytes[0]) {  // check for the version the remote player started with
+            print_error("get_tcp_command: Protocol version changed", 0, 0);
+            return ERROR_CODE;
+        }
+        conn->version = bytes[0];
+        if (conn->version == FRAMED_VERSION) {
+            /* Wait for the whole frame to arrive */
+            int length;
+            if (conn->inputLength < FRAME_HEADER_SIZE) return 0;
+            peek_input(conn, (char *)bytes, FRAME_HEADER_SIZE);
+            length = (bytes[2] << 8) | bytes[3];
+            if (length < FRAMED_CMD_SIZE || FRAME_HEADER_SIZE + length > MAX_FRAME_SIZE) {
+                print_error("get_tcp_command: Invalid frame length", 0, 0);
+                return ERROR_CODE;
+            } else if (conn->inputLength < FRAME_HEADER_SIZE + length) {
+                return 0;
+            }
+            consume_input(conn, FRAME_HEADER_SIZE);
+            conn->frameLength = length;
+        }
+    }
+    if (conn->version == FRAMED_VERSION) {
+        /* Take the next command of the frame, whose board or ticket has to fit in the frame */
+        if (conn->frameLength < FRAMED_CMD_SIZE) {
+            print_error("get_tcp_command: Truncated command in frame", 0, 0);
+            return ERROR_CODE;
+        }
+        size = FRAMED_CMD_SIZE;
+        peek_input(conn, (char *)bytes, size);
+        msg->version = FRAMED_VERSION;
+        msg->command = bytes[0];
+        /* Moves are sent as the square number itself */
+        msg->data = (msg->command == MOVE) ? bytes[1] + '0' : bytes[1];
+        msg->gameNum = (int)(((uint32_t)bytes[2] << 24) | ((uint32_t)bytes[3] << 16) | ((uint32_t)bytes[4] << 8) | bytes[5]);
+        if (size + trailing_length(msg) > conn->frameLength) {
+            print_error("get_tcp_command: Truncated command in frame", 0, 0);
+            return ERROR_CODE;
+        }
+        conn->frameLength -= size + trailing_length(msg);
+    } else {
+        /* Wait for the whole board or ticket to arrive with a RESUME_GAME or RESUME_REPLICA command */
+        if (conn->inputLength < TCP_CMD_SIZE) return 0;
+        size = TCP_CMD_SIZE;
+        peek_input(conn, (char *)bytes, size);
+        msg->version = bytes[0];
+        msg->command = bytes[1];
+        msg->data = bytes[2];
+        msg->gameNum = bytes[3];
+        if (conn->inputLength < size + trailing_length(msg)) return 0;
+    }
+    consume_input(conn, size);
+    /* Validate the received message */
+    if ((msg->command < NEW_GAME || msg->command > RESUME_GAME) && msg->command != RESUME_REPLICA && msg->command != MULTIPLEX) {  // check for valid command
+        print_error("get_tcp_command: Invalid TCP command", 0, 0);
+        return ERROR_CODE;
+    }
+    return size;
+}
+
+/**
+ * @brief Finds the game a TCP command is for. A connection that is not multiplexed plays a
+ * single game and commands have to carry its game number. A multiplexed connection starts a
+ * game for each game number a NEW_GAME, RESUME_GAME, or RESUME_REPLICA command is sent with,
+ * and other commands are for the game started with their game number. The connection is
+ * closed if the command is invalid.
+ * 
+ * @param conn The connection of the remote player.
+ * @param msg The command that the remote player sent.
+ * @return The game the command is for, or NULL if the command has no game to handle it.
+ */
+struct TTT_Game *route_command(struct Connection *conn, const struct TCP_Buffer *msg) {
+    const int starting = (msg->command == NEW_GAME || msg->command == RESUME_GAME || msg->command == RESUME_REPLICA);
+    const int channel = msg->gameNum;
+    struct TTT_Game *game;
+    if (!conn->multiplexed) {
+        game = conn->game;
+        if (!starting && msg->gameNum != game_channel(game)) { // check for valid game number
+            print_error("route_command: Invalid game number", 0, 0);
+            close_connection(conn);
+            return NULL;
+        }
+        return game;
+    } else if (channel < 0) {  // the top bit of a version 7 game number is reserved
+        print_error("route_command: Invalid game number", 0, 0);
+        close_connection(conn);
+        return NULL;
+    }
+    game = find_channel(conn, channel);
+    if (!starting) {
+        /* The game may have ended while the command was on its way */
+        if (game == NULL) print_error("route_command: No game with the game number. Command discarded", 0, 0);
+        return game;
+    } else if (game != NULL) {
+        print_error("route_command: Game number already in use", 0, 0);
+        close_connection(conn);
+        return NULL;
+    } else if (unreserved_games(conn->shard->serv) == 0 || (game = claim_open_game(&conn->shard->roster)) == NULL) {
+        /* Turn the game down (the open games left are held for players sent GAME_AVAILABLE), skipping the board or ticket that came with the command */
+        print_error("route_command: Unable to find an open game", 0, 0);
+        count_metric(METRIC_REFUSED, 1);
+        consume_input(conn, trailing_length(msg));
+        if (send_command(conn, GAME_OVER, 0, channel) == ERROR_CODE) close_connection(conn);
+        return NULL;
+    }
+    attach_game(conn, game, channel);
+    log_message(LOG_INFO, "Player assigned to Game #%d (game number %d)", game->gameNum, channel);
+    return game;
+}
+
+/**
+ * @brief Receives what the remote player has sent and processes the complete commands in the
+ * order they were sent, up to MAX_COMMANDS_PER_READ of them, so one busy connection cannot
+ * hold up the shard. A connection with input left over is handled again in the next pass.
+ * Partial commands are kept in the connection's input buffer until the rest arrives. The
+ * connection is closed if the remote player disconnects or sends an invalid command.
+ * 
+ * @param conn The connection of the remote player.
+ */
+void process_input(struct Connection *conn) {
+    Command_Handler commands[] = {new_game, move, game_over, resume_game, NULL, NULL, NULL, resume_replica};
+    const int histograms[] = {HIST_NEW_GAME, HIST_MOVE, HIST_GAME_OVER, HIST_RESUME_GAME, 0, 0, 0, HIST_RESUME_REPLICA};
+    int bytes, handled = 0;
+    /* Wait for the socket to take the commands already queued (trying again now) before handling more */
+    if (conn->outputBlocked) {
+        schedule_flush(conn);
+        return;
+    }
+    do {
+        int rv;
+        struct TCP_Buffer msg = {0};
+        /* Receive what fits in the input buffer, then process every complete command in it */
+        if ((bytes = read_input(conn)) == ERROR_CODE) {
+            close_connection(conn);
+            return;
+        }
+        if (bytes > 0) conn->lastInput = conn->shard->timers.tick;
+        while (conn->sd >= 0 && !conn->outputBlocked && handled < MAX_COMMANDS_PER_READ && (rv = get_tcp_command(conn, &msg)) != 0) {
+            struct TTT_Game *game;
+            uint64_t start;
+            handled++;
+            if (rv < 0) {
+                /* Invalid command received -> close the connection */
+                close_connection(conn);
+                return;
+            }
+            conn->handshaken = 1;
+            if (msg.command == MULTIPLEX) {
+                multiplex(conn);
+                continue;
+            } else if ((game = route_command(conn, &msg)) == NULL) {
+                continue;
+            }
+            /* Player 2 has answered in time, whatever the command */
+            cancel_timer(&conn->shard->timers, &game->moveTimer);
+            /* Player 2 may not issue commands while Player 1's move is being searched for */
+            if (game->searching) {
+                print_error("process_input: Command received during Player 1's turn", 0, 0);
+                reset_game(game);
+                continue;
+            }
+            /* Process received command for current game, timing how long it takes */
+            start = monotonic_time();
+            commands[(int)msg.command](&msg, game);
+            record_latency(histograms[(int)msg.command], start);
+        }
+        /* Leave the rest for the next pass once the connection has had its share */
+        if (conn->sd >= 0 && handled == MAX_COMMANDS_PER_READ) {
+            defer_input(conn);
+            return;
+        }
+    } while (conn->sd >= 0 && !conn->outputBlocked && bytes > 0);
+}
+
+/**
+ * @brief Handles the MULTIPLEX command from the remote player. From then on, the connection
+ * plays a game for each game number the remote player starts one with, and moves for the
+ * games are sent as they are found, in any order. The game the connection was assigned is
+ * returned to the open games until the remote player starts one.
+ * 
+ * @param conn The connection of the remote player.
+ */
+void multiplex(struct Connection *conn) {
+    struct TTT_Game *game = conn->game;
+    log_message(LOG_DEBUG, "The remote player issued a MULTIPLEX command");
+    /* Only a connection whose game has not started can be multiplexed */
+    if (conn->multiplexed || game->p1Marks != 0 || game->p2Marks != 0 || game->searching) {
+        print_error("multiplex: Game already in progress", 0, 0);
+        close_connection(conn);
+        return;
+    }
+    conn->multiplexed = 1;
+    reset_game(game);
+}
+
+/**
+ * @brief Handles the NEW_GAME command from the remote player. Initializes a new game, if
+ * available, and sends the first move to the remote player.
+ * 
+ * @param msg The message containing the command that the remote player sent.
+ * @param game The current game of TicTacToe being played.
+ */
+void new_game(const struct TCP_Buffer *msg, struct TTT_Game *game) {
+    log_message(LOG_DEBUG, "The remote player issued a NEW_GAME command");
+    /* Initialize the board for the requested variant */
+    if ((game->variant = parse_variant(msg->data)) == NULL) {
+        print_error("new_game: Board variant not supported", 0, 0);
+        reset_game(game);
+        return;
+    }
     init_shared_state(game);
-    /* Get first move to send to remote player */
-    if ((move = send_p1_move(game)) == ERROR_CODE) {
-        /* Reset game if there was an error sending the move */
+    /* Make the first move to send to remote player */
+    play_p1_move(game);
+}
+
+/**
+ * @brief Handles the MOVE command from the remote player. Receives and processes a move
+ * from the remote player and sends a move back. If the game has ended from a move, an
+ * appropriate message is printed. If the game ends from a move from the remote player,
+ * a GAME_OVER command is sent back in response.
+ * 
+ * @param msg The message containing the command that the remote player sent.
+ * @param game The current game of TicTacToe being played.
+ */
+void move(const struct TCP_Buffer *msg, struct TTT_Game *game) {
+    /* Get move from remote player */
+    int move = msg->data - '0';
+    log_message(LOG_DEBUG, "The remote player issued a MOVE command");
+    log_message(LOG_DEBUG, "Player 2 chose the move:  %d", move);
+    /* Check that the received move is valid */
+    if (validate_move(move, game)) {
+        /* Update the board (for Player 2) and check if someone won */
+        game->p2Marks |= SQUARE_BIT(move-1);
+        publish_move(game, WATCH_P2_MOVE, move);
+        if (check_game_over(game)) {
+            /* If Player 2 won, send GAME_OVER command and reset game (in version 7 Player 2 sends it along with the move) */
+            if (game->conn->version != FRAMED_VERSION) send_game_over(game);
+            return;
+        }
+        /* If nobody won, make a move to send to the remote player */
+        play_p1_move(game);
+    } else {
+        reset_game(game);
+    }
+}
+
+/**
+ * @brief Handles the GAME_OVER command from the remote player. Determines the reason for
+ * ending the game, prints the appropriate message, and resets the game.
+ * 
+ * @param msg The message containing the command that the remote player sent.
+ * @param game The current game of TicTacToe being played.
+ */
+void game_over(const struct TCP_Buffer *msg, struct TTT_Game *game) {
+    log_message(LOG_DEBUG, "The remote player issued a GAME_OVER command");
+    log_message(LOG_DEBUG, "Player 2 has signaled that the game is over");
+    /* Check if the game is actually over */
+    if (game->winner < 0) {
+        /* If not over, player decided to leave prematurely */
+        print_error("game_over: Game is still in progress", 0, 0);
+        log_message(LOG_INFO, "Player 2 has decided to leave the game");
+    } else {
+        /* If over, print appropriate message for who won */
+        (game->winner == 0) ? log_message(LOG_INFO, "==>\a It's a draw") : log_message(LOG_INFO, "==>\a Player %d wins", game->winner);
+    }
+    /* Reset the game */
+    reset_game(game);
+}
+
+/**
+ * @brief Handles the RESUME_GAME command from the remote player. Loads a new game, if
+ * available, and sends the next move to the remote player. If the game has ended from a move,
+ * an appropriate message is printed. If the game ends from a move from the remote player,
+ * a GAME_OVER command is sent back in response.
+ * 
+ * @param msg The message containing the command that the remote player sent.
+ * @param game The current game of TicTacToe being played.
+ */
+void resume_game(const struct TCP_Buffer *msg, struct TTT_Game *game) {
+    log_message(LOG_DEBUG, "The remote player issued a RESUME_GAME command");
+    /* Load and print board (for the requested variant) from remote player */
+    if ((game->variant = parse_variant(msg->data)) == NULL) {
+        print_error("resume_game: Board variant not supported", 0, 0);
+        count_metric(METRIC_INVALID_RESUMES, 1);
+        reset_game(game);
+        return;
+    }
+    if (load_shared_state(game)) {
+        print_board(game);
+    } else {
+        count_metric(METRIC_INVALID_RESUMES, 1);
+        reset_game(game);
+        return;
+    }
+    /* Check if the loaded game is over  */
+    if (check_game_over(game)) {
+        /* If Player 2 won, send GAME_OVER command and reset game */
+        send_game_over(game);
+        return;
+    }
+    /* If nobody won, make a move to send to the remote player */
+    play_p1_move(game);
+}
+
+/**
+ * @brief Handles the RESUME_REPLICA command from the remote player. Takes over the game from
+ * its replica if the server it was being played on replicated it, so the board neither has
+ * to be uploaded in full nor revalidated, and sends the next move to the remote player. A
+ * game with no replica its board follows (it was not replicated, or the replica with its key
+ * belongs to another game) is validated like a RESUME_GAME command.
+ * 
+ * @param msg The message containing the command that the remote player sent.
+ * @param game The current game of TicTacToe being played.
+ */
+void resume_replica(const struct TCP_Buffer *msg, struct TTT_Game *game) {
+    int maskBytes, originPort;
+    uint64_t p1Marks, p2Marks;
+    unsigned char ticket[RESUME_TICKET_SIZE(MAX_SQUARES)];
+    log_message(LOG_DEBUG, "The remote player issued a RESUME_REPLICA command");
+    if ((game->variant = parse_variant(msg->data)) == NULL) {
+        print_error("resume_replica: Board variant not supported", 0, 0);
+        count_metric(METRIC_INVALID_RESUMES, 1);
+        reset_game(game);
+        return;
+    }
+    /* Take the ticket (origin port and packed bitboards), which arrived with the command, from the input buffer */
+    maskBytes = MASK_BYTES(game->variant->numSquares);
+    peek_input(game->conn, (char *)ticket, RESUME_TICKET_SIZE(game->variant->numSquares));
+    consume_input(game->conn, RESUME_TICKET_SIZE(game->variant->numSquares));
+    originPort = (ticket[0] << 8) | ticket[1];
+    p1Marks = unpack_bytes(ticket + 2, maskBytes);
+    p2Marks = unpack_bytes(ticket + 2 + maskBytes, maskBytes);
+    /* Take over the game from its replica, or fall back to validating the board */
+    if (take_replica(originPort, msg->gameNum, game->variant, p1Marks, p2Marks)) {
+        log_message(LOG_INFO, "Game taken over from its replica on the server at port %d", originPort);
+        count_metric(METRIC_REPLICAS_TAKEN, 1);
+    } else if (!validate_marks(game, p1Marks, p2Marks)) {
+        count_metric(METRIC_INVALID_RESUMES, 1);
         reset_game(game);
         return;
     }
-    /* Update and print game board */
-    game->board[move-1] = P1_MARK;
-    print_board(game);
+    game->p1Marks = p1Marks;
+    game->p2Marks = p2Marks;
+    print_board(game);
+    /* Check if the loaded game is over  */
+    if (check_game_over(game)) {
+        /* If Player 2 won, send GAME_OVER command and reset game */
+        send_game_over(game);
+        return;
+    }
+    /* If nobody won, make a move to send to the remote player */
+    play_p1_move(game);
+}
+
+/**
+ * @brief Queues the connection's output to be sent once the shard has handled its events.
+ *
+ * @param conn The connection of the remote player.
+ */
+void schedule_flush(struct Connection *conn) {
+    if (conn->flushPending) return;
+    conn->flushPending = 1;
+    conn->nextFlush = conn->shard->pendingFlushes;
+    conn->shard->pendingFlushes = conn;
+}
+
+/**
+ * @brief Sends a TCP command to the remote player. The command is queued on the connection,
+ * in the connection's frame in version 7, and the queue is sent once the shard has handled
+ * its events (or sooner if the queue fills up), so every reply produced while handling the
+ * events (e.g. a winning MOVE and its GAME_OVER) goes out together. A remote player that
+ * stops reading its replies until the queue has no room left is disconnected, since a
+ * dropped reply would leave its games out of step.
+ * 
+ * @param conn The connection of the remote player.
+ * @param command The command to send.
+ * @param data The data for the command.
+ * @param gameNum The game number the remote player knows the game by.
+ * @return The number of bytes queued, or an error code if there was an issue.
+ */
+int send_command(struct Connection *conn, char command, char data, int gameNum) {
+    unsigned char *bytes;
+    const int size = (conn->version == FRAMED_VERSION) ? FRAMED_CMD_SIZE : TCP_CMD_SIZE;
+    /* Make room for the command, leaving room for the frame header in version 7 */
+    if (conn->outputLength + size + FRAME_HEADER_SIZE > OUTPUT_BUFFER_SIZE) {
+        if (flush_output(conn) == ERROR_CODE || conn->outputLength + size + FRAME_HEADER_SIZE > OUTPUT_BUFFER_SIZE) {
+            if (conn->sd >= 0) print_error("send_command: Player 2 is not reading the commands sent", 0, 0);
+            close_connection(conn);
+            return ERROR_CODE;
+        }
+    }
+    if (conn->outputLength == conn->outputSealed && conn->version == FRAMED_VERSION) conn->outputLength += FRAME_HEADER_SIZE;
+    bytes = (unsigned char *)conn->output + conn->outputLength;
+    if (conn->version == FRAMED_VERSION) {
+        bytes[0] = command;
+        /* Moves are sent as the square number itself */
+        bytes[1] = (command == MOVE) ? data - '0' : data;
+        bytes[2] = (uint32_t)gameNum >> 24;
+        bytes[3] = (uint32_t)gameNum >> 16;
+        bytes[4] = (uint32_t)gameNum >> 8;
+        bytes[5] = gameNum;
+    } else {
+        /* Pack command information into message */
+        bytes[0] = VERSION;
+        bytes[1] = command;
+        bytes[2] = data;
+        bytes[3] = gameNum;
+    }
+    conn->outputLength += size;
+    /* Send the queue once the shard has handled its events */
+    schedule_flush(conn);
+    return size;
+}
+
+/**
+ * @brief Takes the commands queued for the remote player to be sent, filling in the header of
+ * the frame being queued first in version 7. The bytes stay at the front of the output queue
+ * until the socket takes them, and new commands are queued after them.
+ * 
+ * @param conn The connection of the remote player.
+ * @return The number of bytes to send from the start of the output queue (0 if no commands were queued).
+ */
+int seal_output(struct Connection *conn) {
+    int length = conn->outputLength - conn->outputSealed;
+    if (length > 0 && conn->version == FRAMED_VERSION) {
+        /* Fill in the frame header with the length of the commands */
+        char *header = conn->output + conn->outputSealed;
+        header[0] = FRAMED_VERSION;
+        header[1] = 0;
+        header[2] = (length - FRAME_HEADER_SIZE) >> 8;
+        header[3] = length - FRAME_HEADER_SIZE;
+    }
+    conn->outputSealed = conn->outputLength;
+    return conn->outputSealed;
+}
+
+/**
+ * @brief Sends bytes to the remote player until all of them are sent or the socket's send
+ * buffer is full.
+ * 
+ * @param sd The socket descriptor of the remote player.
+ * @param data The bytes to send.
+ * @param length The number of bytes to send.
+ * @return The number of bytes sent, or an error code if there was an issue.
+ */
+int send_bytes(int sd, const char *data, int length) {
+    int sent = 0;
+    while (sent < length) {
+        int rv = send(sd, data + sent, length - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (rv < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            print_error("flush_output", errno, 0);
+            return ERROR_CODE;
+        }
+        sent += rv;
+    }
+    return sent;
+}
+
+/**
+ * @brief Removes the bytes the socket took from the front of the output queue. If the socket
+ * could not take them all, the rest waits for the socket to have room again and the remote
+ * player's input waits with it; once they have all been sent, the states of the games held
+ * back are replicated and the input left waiting is handled again.
+ * 
+ * @param conn The connection of the remote player.
+ * @param sent The number of bytes sent from the start of the output queue.
+ */
+void output_sent(struct Connection *conn, int sent) {
+    if (sent > 0) {
+        memmove(conn->output, conn->output + sent, conn->outputLength - sent);
+        conn->outputLength -= sent;
+        conn->outputSealed -= sent;
+    }
+    if (conn->outputSealed > 0) {
+        conn->outputBlocked = 1;
+        watch_output(&conn->shard->engine, conn->sd, conn->slot, 1);
+        return;
+    }
+    /* The moves sent can be taken over from a replica now */
+    release_states(conn);
+    if (conn->outputBlocked) {
+        conn->outputBlocked = 0;
+        watch_output(&conn->shard->engine, conn->sd, conn->slot, 0);
+        defer_input(conn);
+    }
+}
+
+/**
+ * @brief Sends the commands queued for the remote player, filling in the frame header first
+ * in version 7, as far as the socket's send buffer takes them.
+ * 
+ * @param conn The connection of the remote player.
+ * @return The number of bytes sent (0 if no commands were queued), or an error code if there was an issue.
+ */
+int flush_output(struct Connection *conn) {
+    int length = seal_output(conn), sent;
+    if (length == 0) return 0;
+    if ((sent = send_bytes(conn->sd, conn->output, length)) != ERROR_CODE) output_sent(conn, sent);
+    return sent;
+}
+
+/**
+ * @brief Sends GAME_OVER command to the remote player and resets the current game for
+ * a new player.
+ * 
+ * @param game The current game of TicTacToe being played.
+ */
+void send_game_over(struct TTT_Game *game) {
+    /* Send the command to the remote player */
+    log_message(LOG_DEBUG, "Server sent the GAME_OVER command to Player 2");
+    send_command(game->conn, GAME_OVER, 0, game_channel(game));
+    /* Reset the game */
+    reset_game(game);
+}
+
+/* The Zobrist hash keys for each player marking each square of the game board. */
+static uint64_t zobristKeys[2][MAX_SQUARES];
+/* The board variants indexed by board size and number of marks in a row needed to win. */
+static struct Board_Variant variants[MAX_BOARD_SIZE+1][MAX_BOARD_SIZE+1];
+/* The transposition table shared by every game (and thread) of the server. */
+static struct TT_Entry *transpositionTable;
+/* The best move found for each board state (folded by symmetry), shared by every game (and thread) of the server. */
+static struct TT_Entry *positionCache;
+/* The symmetry undoing each rotation or reflection (a quarter turn is undone by a quarter turn the other way). */
+static const int inverseSymmetries[NUM_SYMMETRIES] = {0, 3, 2, 1, 4, 5, 6, 7};
+/* The maximum amount of time (in milliseconds) spent searching for each move. */
+static int searchTimeLimit = DEFAULT_SEARCH_TIME;
+
+/**
+ * @brief Generates the next number of a xorshift pseudo-random sequence.
+ * 
+ * @param state The state of the pseudo-random sequence.
+ * @return The next pseudo-random number in the sequence.
+ */
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/**
+ * @brief Builds the winning lines, move ordering, and symmetries of a board variant.
+ * 
+ * @param variant The board variant being initialized.
+ * @param size The number of rows and columns of the board.
+ * @param winLength The number of marks in a row needed to win.
+ * @param key The hash key distinguishing the variant in the transposition table.
+ */
+static void init_variant(struct Board_Variant *variant, int size, int winLength, uint64_t key) {
+    /* The row and column steps of the 4 line directions (row, column, diagonal, anti-diagonal) */
+    static const int steps[4][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}};
+    int i, j, row, col, dir;
+    variant->size = size;
+    variant->winLength = winLength;
+    variant->numSquares = size * size;
+    variant->zobristKey = key;
+    /* Build every line of winLength squares in each direction */
+    for (dir = 0; dir < 4; dir++) {
+        for (row = 0; row < size; row++) {
+            for (col = 0; col < size; col++) {
+                int endRow = row + steps[dir][0] * (winLength-1), endCol = col + steps[dir][1] * (winLength-1);
+                uint64_t line = 0;
+                if (endRow < 0 || endRow >= size || endCol < 0 || endCol >= size) continue;
+                for (i = 0; i < winLength; i++) {
+                    line |= SQUARE_BIT((row + steps[dir][0] * i) * size + col + steps[dir][1] * i);
+                }
+                variant->lines[variant->numLines++] = line;
+            }
+        }
+    }
+    /* Index the lines through each square so a move only checks the lines it completes */
+    for (i = 0; i < variant->numLines; i++) {
+        for (j = 0; j < variant->numSquares; j++) {
+            if (variant->lines[i] & SQUARE_BIT(j)) variant->squareLines[j][variant->numSquareLines[j]++] = variant->lines[i];
+        }
+    }
+    /* Order the squares from the center of the board outward (insertion sort by distance) */
+    for (i = 0; i < variant->numSquares; i++) {
+        int dist = abs(2 * (i / size) - (size-1)) + abs(2 * (i % size) - (size-1));
+        for (j = i; j > 0; j--) {
+            int prev = variant->moveOrder[j-1];
+            if (abs(2 * (prev / size) - (size-1)) + abs(2 * (prev % size) - (size-1)) <= dist) break;
+            variant->moveOrder[j] = prev;
+        }
+        variant->moveOrder[j] = i;
+    }
+    /* Map each square through the 4 rotations and 4 reflections of the board */
+    for (i = 0; i < variant->numSquares; i++) {
+        int r = i / size, c = i % size, n = size-1;
+        variant->symmetries[0][i] = i;
+        variant->symmetries[1][i] = c * size + (n-r);
+        variant->symmetries[2][i] = (n-r) * size + (n-c);
+        variant->symmetries[3][i] = (n-c) * size + r;
+        variant->symmetries[4][i] = r * size + (n-c);
+        variant->symmetries[5][i] = (n-r) * size + c;
+        variant->symmetries[6][i] = c * size + r;
+        variant->symmetries[7][i] = (n-c) * size + (n-r);
+    }
 }
 
 /**
- * @brief Handles the MOVE command from the remote player. Receives and processes a move
- * from the remote player and sends a move back. If the game has ended from a move, an
- * appropriate message is printed. If the game ends from a move from the remote player,
- * a GAME_OVER command is sent back in response.
+ * @brief Builds the table moving the marks of each row of a board through each rotation or
+ * reflection, so a whole bitboard is transformed with one lookup per row, and shares it with
+ * every variant of the board size. Also sees each square's Zobrist keys through each symmetry.
  * 
- * @param msg The message containing the command that the remote player sent.
- * @param game The current game of TicTacToe being played.
+ * @param size The number of rows and columns of the board.
  */
-void move(const struct TCP_Buffer *msg, struct TTT_Game *game) {
-    /* Get move from remote player */
-    int move = msg->data - '0';
-    printf("The remote player issued a MOVE command\n");
-    printf("Player 2 chose the move:  %c\n", msg->data);
-    /* Check that the received move is valid */
-    if (validate_move(move, game)) {
-        /* Update the board (for Player 2) and check if someone won */
-        game->board[move-1] = P2_MARK;
-        if (check_game_over(game)) {
-            /* If Player 2 won, send GAME_OVER command and reset game */
-            send_game_over(game);
-            return;
+static void init_row_symmetries(int size) {
+    int symmetry, row, pattern, col, winLength, i;
+    const struct Board_Variant *base = &variants[size][size];
+    uint64_t *table;
+    if ((table = malloc((sizeof(uint64_t) * NUM_SYMMETRIES * size) << size)) == NULL) {
+        print_error("init_row_symmetries: malloc", errno, 1);
+    }
+    for (symmetry = 0; symmetry < NUM_SYMMETRIES; symmetry++) {
+        for (row = 0; row < size; row++) {
+            for (pattern = 0; pattern < (1 << size); pattern++) {
+                uint64_t marks = 0;
+                for (col = 0; col < size; col++) {
+                    if (pattern & (1 << col)) marks |= SQUARE_BIT(base->symmetries[symmetry][row * size + col]);
+                }
+                table[((symmetry * size + row) << size) | pattern] = marks;
+            }
         }
-        /* If nobody won, make a move to send to the remote player */
-        if ((move = send_p1_move(game)) == ERROR_CODE) {
-            /* Reset game if there was an error sending the move */
-            reset_game(game);    
-            return;
+    }
+    for (winLength = MIN_BOARD_SIZE; winLength <= size; winLength++) {
+        struct Board_Variant *variant = &variants[size][winLength];
+        variant->rowSymmetries = table;
+        for (i = 0; i < variant->numSquares; i++) {
+            for (symmetry = 0; symmetry < NUM_SYMMETRIES; symmetry++) {
+                variant->symmetryKeys[0][i][symmetry] = zobristKeys[0][variant->symmetries[symmetry][i]];
+                variant->symmetryKeys[1][i][symmetry] = zobristKeys[1][variant->symmetries[symmetry][i]];
+            }
         }
-        /* Update the board (for Player 1) and check if someone won after the exchange */
-        game->board[move-1] = P1_MARK;
-        if (!check_game_over(game)) print_board(game);
-    } else {
-        reset_game(game);
     }
 }
 
 /**
- * @brief Handles the GAME_OVER command from the remote player. Determines the reason for
- * ending the game, prints the appropriate message, and resets the game.
+ * @brief Initializes every board variant, the Zobrist hash keys, the shared transposition
+ * table, and the shared position cache. Must be called before any games are played.
  * 
- * @param msg The message containing the command that the remote player sent.
- * @param game The current game of TicTacToe being played.
+ * @param timeLimit The maximum amount of time (in milliseconds) spent searching for each move.
  */
-void game_over(const struct TCP_Buffer *msg, struct TTT_Game *game) {
-    printf("The remote player issued a GAME_OVER command\n");
-    printf("Player 2 has signaled that the game is over\n");
-    /* Check if the game is actually over */
-    if (game->winner < 0) {
-        /* If not over, player decided to leave prematurely */
-        print_error("game_over: Game is still in progress", 0, 0);
-        printf("Player 2 has decided to leave the game\n");
-    } else {
-        /* If over, print appropriate message for who won */
-        (game->winner == 0) ? printf("==>\a It's a draw\n") : printf("==>\a Player %d wins\n", game->winner);
+void init_search_engine(int timeLimit) {
+    int i, size, winLength;
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    searchTimeLimit = timeLimit;
+    for (i = 0; i < MAX_SQUARES; i++) {
+        zobristKeys[0][i] = next_random(&state);
+        zobristKeys[1][i] = next_random(&state);
+    }
+    for (size = MIN_BOARD_SIZE; size <= MAX_BOARD_SIZE; size++) {
+        for (winLength = MIN_BOARD_SIZE; winLength <= size; winLength++) {
+            init_variant(&variants[size][winLength], size, winLength, next_random(&state));
+        }
+        init_row_symmetries(size);
+    }
+    if ((transpositionTable = calloc(TT_SIZE, sizeof(struct TT_Entry))) == NULL) {
+        print_error("init_search_engine: calloc", errno, 1);
+    }
+    if ((positionCache = calloc(POSITION_CACHE_SIZE, sizeof(struct TT_Entry))) == NULL) {
+        print_error("init_search_engine: calloc", errno, 1);
     }
-    /* Reset the game */
-    reset_game(game);
 }
 
 /**
- * @brief Handles the RESUME_GAME command from the remote player. Loads a new game, if
- * available, and sends the next move to the remote player. If the game has ended from a move,
- * an appropriate message is printed. If the game ends from a move from the remote player,
- * a GAME_OVER command is sent back in response.
+ * @brief Gets the board variant with the given board size and number of marks in a row needed
+ * to win.
  * 
- * @param msg The message containing the command that the remote player sent.
- * @param game The current game of TicTacToe being played.
+ * @param size The number of rows and columns of the board.
+ * @param winLength The number of marks in a row needed to win.
+ * @return The board variant, or NULL if the variant is not supported.
  */
-void resume_game(const struct TCP_Buffer *msg, struct TTT_Game *game) {
-    int move;
-    printf("The remote player issued a RESUME_GAME command\n");
-    /* Load and print board from remote player */
-    if (load_shared_state(game)) {
-        print_board(game);
-    } else {
-        reset_game(game);
-        return;
+const struct Board_Variant *get_variant(int size, int winLength) {
+    if (size < MIN_BOARD_SIZE || size > MAX_BOARD_SIZE || winLength < MIN_BOARD_SIZE || winLength > size) return NULL;
+    return &variants[size][winLength];
+}
+
+/**
+ * @brief Looks up a board state in the shared transposition table. Entries are stored with
+ * their key XORed with their data, so an entry torn by another thread never matches.
+ * 
+ * @param key The Zobrist hash of the board state.
+ * @param data The data stored for the board state, if found.
+ * @return True if the board state was found, false otherwise.
+ */
+static int probe_transposition(uint64_t key, uint64_t *data) {
+    struct TT_Entry *entry = &transpositionTable[key & (TT_SIZE-1)];
+    uint64_t check = __atomic_load_n(&entry->check, __ATOMIC_RELAXED);
+    *data = __atomic_load_n(&entry->data, __ATOMIC_RELAXED);
+    return (check ^ *data) == key;
+}
+
+/**
+ * @brief Stores the search result for a board state in the shared transposition table,
+ * keeping deeper results for the same board state.
+ * 
+ * @param key The Zobrist hash of the board state.
+ * @param score The score of the board state relative to the current search depth.
+ * @param ply The number of moves from the root of the search to the board state.
+ * @param depth The depth the board state was searched to.
+ * @param bound Whether the score is exact, a lower bound, or an upper bound.
+ * @param bestSquare The best square found for the board state, or -1 if none.
+ */
+static void store_transposition(uint64_t key, int score, int ply, int depth, int bound, int bestSquare) {
+    struct TT_Entry *entry = &transpositionTable[key & (TT_SIZE-1)];
+    uint64_t data, oldData;
+    /* Keep a deeper result for the same board state */
+    if (probe_transposition(key, &oldData) && TT_DEPTH(oldData) > depth) return;
+    /* Store win scores relative to the board state instead of the root of the search */
+    if (score > WIN_THRESHOLD) score += ply;
+    else if (score < -WIN_THRESHOLD) score -= ply;
+    data = ((uint64_t)(uint32_t)score << 32) | ((uint64_t)(bestSquare & 0xFF) << 16) | ((uint64_t)(depth & 0xFF) << 8) | bound;
+    __atomic_store_n(&entry->check, key ^ data, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->data, data, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Determines whether the search has run out of time, checking the clock only
+ * periodically so the check does not slow down the search.
+ * 
+ * @param search The state of the current search.
+ * @return True if the search should stop, false otherwise.
+ */
+static int out_of_time(struct Search *search) {
+    struct timespec now;
+    if (search->aborted) return 1;
+    if (search->timeLimit <= 0 || (search->nodes & 1023) != 0) return 0;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec - search->start.tv_sec) * 1000 + (now.tv_nsec - search->start.tv_nsec) / 1000000 >= search->timeLimit) {
+        search->aborted = 1;
     }
-    /* Check if the loaded game is over  */
-    if (check_game_over(game)) {
-        /* If Player 2 won, send GAME_OVER command and reset game */
-        send_game_over(game);
-        return;
+    return search->aborted;
+}
+
+/**
+ * @brief Scores a board state that was not searched to the end of the game by counting the
+ * lines each player can still complete, weighting lines with more marks more heavily.
+ * 
+ * @param variant The board variant being played.
+ * @param own The bitboard of the player to move.
+ * @param opp The bitboard of the other player.
+ * @return The estimated score of the board state for the player to move.
+ */
+static int evaluate(const struct Board_Variant *variant, uint64_t own, uint64_t opp) {
+    int i, score = 0;
+    for (i = 0; i < variant->numLines; i++) {
+        uint64_t line = variant->lines[i];
+        int ownCount = __builtin_popcountll(own & line), oppCount = __builtin_popcountll(opp & line);
+        /* Only lines not blocked by the other player count */
+        if (oppCount == 0) score += (1 << (2 * ownCount)) - 1;
+        if (ownCount == 0) score -= (1 << (2 * oppCount)) - 1;
     }
-    /* If nobody won, make a move to send to the remote player */
-    if ((move = send_p1_move(game)) == ERROR_CODE) {
-        /* Reset game if there was an error sending the move */
-        reset_game(game);
-        return;
+    if (score > EVAL_LIMIT) return EVAL_LIMIT;
+    return (score < -EVAL_LIMIT) ? -EVAL_LIMIT : score;
+}
+
+/**
+ * @brief Orders the open squares so the most promising moves are searched first: the best
+ * square from the transposition table, then squares that caused cutoffs, then central squares.
+ * 
+ * @param search The state of the current search.
+ * @param marked The bitboard of every marked square.
+ * @param firstSquare The square to search first, or -1 if none.
+ * @param moves The array to store the ordered squares in.
+ * @return The number of open squares.
+ */
+static int order_moves(const struct Search *search, uint64_t marked, int firstSquare, int *moves) {
+    int i, j, numMoves = 0, scores[MAX_SQUARES];
+    const struct Board_Variant *variant = search->variant;
+    for (i = 0; i < variant->numSquares; i++) {
+        int square = variant->moveOrder[i], score;
+        if (marked & SQUARE_BIT(square)) continue;
+        score = (square == firstSquare) ? INT32_MAX : search->history[square];
+        /* Insert the square after every square with a better or equal score */
+        for (j = numMoves; j > 0 && scores[j-1] < score; j--) {
+            moves[j] = moves[j-1];
+            scores[j] = scores[j-1];
+        }
+        moves[j] = square;
+        scores[j] = score;
+        numMoves++;
     }
-    /* Update and print game board */
-    game->board[move-1] = P1_MARK;
-    if (!check_game_over(game)) print_board(game);
+    return numMoves;
 }
 
 /**
- * @brief Sends GAME_OVER command to the remote player and resets the current game for
- * a new player.
+ * @brief Hashes a board state as seen through each rotation and reflection of the board. The
+ * smallest of the hashes is the same for every symmetric board state, so the transposition
+ * table stores them all as one.
+ * 
+ * @param variant The board variant being played.
+ * @param p1Marks The bitboard of the squares marked by Player 1.
+ * @param p2Marks The bitboard of the squares marked by Player 2.
+ * @param keys The array to store the Zobrist hash seen through each symmetry in.
+ */
+void hash_board(const struct Board_Variant *variant, uint64_t p1Marks, uint64_t p2Marks, uint64_t *keys) {
+    int i, symmetry;
+    for (symmetry = 0; symmetry < NUM_SYMMETRIES; symmetry++) keys[symmetry] = variant->zobristKey;
+    for (i = 0; i < variant->numSquares; i++) {
+        for (symmetry = 0; symmetry < NUM_SYMMETRIES; symmetry++) {
+            if (p1Marks & SQUARE_BIT(i)) keys[symmetry] ^= variant->symmetryKeys[0][i][symmetry];
+            if (p2Marks & SQUARE_BIT(i)) keys[symmetry] ^= variant->symmetryKeys[1][i][symmetry];
+        }
+    }
+}
+
+/**
+ * @brief Finds the canonical hash of a board state, the smallest of its hashes through each
+ * rotation and reflection.
+ * 
+ * @param keys The Zobrist hash of the board state seen through each symmetry.
+ * @param symmetry The symmetry giving the canonical hash.
+ * @return The canonical hash of the board state.
+ */
+static uint64_t canonical_key(const uint64_t *keys, int *symmetry) {
+    int i;
+    *symmetry = 0;
+    for (i = 1; i < NUM_SYMMETRIES; i++) {
+        if (keys[i] < keys[*symmetry]) *symmetry = i;
+    }
+    return keys[*symmetry];
+}
+
+/**
+ * @brief Determines whether playing a square leads to a board state that is a rotation or
+ * reflection of one reached by an earlier square, and so needs no search of its own. Only a
+ * board state that is symmetric itself can have such squares.
+ * 
+ * @param variant The board variant being played.
+ * @param keys The Zobrist hash of the board state seen through each symmetry.
+ * @param player The player to move (0 for Player 1, 1 for Player 2).
+ * @param square The square being played.
+ * @param seen The canonical hashes reached by the earlier squares.
+ * @param numSeen The number of earlier squares, updated if the square is not a duplicate.
+ * @return True if the square is a duplicate, false otherwise.
+ */
+static int duplicate_move(const struct Board_Variant *variant, const uint64_t *keys, int player, int square, uint64_t *seen, int *numSeen) {
+    int i, symmetry;
+    uint64_t childKeys[NUM_SYMMETRIES], key;
+    for (i = 0; i < NUM_SYMMETRIES; i++) childKeys[i] = keys[i] ^ variant->symmetryKeys[player][square][i];
+    key = canonical_key(childKeys, &symmetry);
+    for (i = 0; i < *numSeen; i++) {
+        if (seen[i] == key) return 1;
+    }
+    seen[(*numSeen)++] = key;
+    return 0;
+}
+
+/**
+ * @brief Determines whether a board state is the same as one of its rotations or reflections.
+ * 
+ * @param keys The Zobrist hash of the board state seen through each symmetry.
+ * @return True if the board state is symmetric, false otherwise.
+ */
+static int symmetric_board(const uint64_t *keys) {
+    int i;
+    for (i = 1; i < NUM_SYMMETRIES; i++) {
+        if (keys[i] == keys[0]) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Provides the score of the board state for the player to move using negamax search
+ * with alpha-beta pruning and the shared transposition table, where every rotation and
+ * reflection of a board state shares one entry.
+ * 
+ * @param search The state of the current search.
+ * @param own The bitboard of the player to move.
+ * @param opp The bitboard of the other player, who made the last move.
+ * @param player The player to move (0 for Player 1, 1 for Player 2).
+ * @param keys The Zobrist hash of the board state seen through each symmetry.
+ * @param depth The number of moves left to search.
+ * @param ply The number of moves from the root of the search.
+ * @param alpha The score the player to move is already guaranteed.
+ * @param beta The score the other player is already guaranteed.
+ * @param lastSquare The square of the last move, or -1 if unknown.
+ * @return The score of the board state for the player to move.
+ */
+int alpha_beta(struct Search *search, uint64_t own, uint64_t opp, int player, const uint64_t *keys, int depth, int ply, int alpha, int beta, int lastSquare) {
+    const struct Board_Variant *variant = search->variant;
+    int i, j, numMoves, best = -INT32_MAX, bestSquare = -1, ttSquare = -1, origAlpha = alpha, symmetry, symmetric, numSeen = 0;
+    int moves[MAX_SQUARES];
+    uint64_t data, key, childKeys[NUM_SYMMETRIES], seen[MAX_SQUARES];
+    search->nodes++;
+    /* Check for base cases: the last move won, the board is full, or the search is cut off */
+    if (lastSquare >= 0) {
+        for (i = 0; i < variant->numSquareLines[lastSquare]; i++) {
+            if ((opp & variant->squareLines[lastSquare][i]) == variant->squareLines[lastSquare][i]) return -(WIN_SCORE - ply);
+        }
+    }
+    if (__builtin_popcountll(own | opp) == variant->numSquares) return 0;
+    if (depth == 0) return evaluate(variant, own, opp);
+    if (out_of_time(search)) return 0;
+    /* Use the stored result for the board state (or a symmetric one) if it was searched deep enough */
+    key = canonical_key(keys, &symmetry);
+    if (probe_transposition(key, &data)) {
+        int score = TT_SCORE(data);
+        if (score > WIN_THRESHOLD) score -= ply;
+        else if (score < -WIN_THRESHOLD) score += ply;
+        /* The best square is stored as seen through the canonical symmetry */
+        if (TT_SQUARE(data) >= 0) ttSquare = variant->symmetries[inverseSymmetries[symmetry]][TT_SQUARE(data)];
+        if (TT_DEPTH(data) >= depth) {
+            if (TT_BOUND(data) == TT_EXACT) return score;
+            if (TT_BOUND(data) == TT_LOWER && score >= beta) return score;
+            if (TT_BOUND(data) == TT_UPPER && score <= alpha) return score;
+        }
+    }
+    /* Searches over all possible moves, most promising first */
+    numMoves = order_moves(search, own | opp, ttSquare, moves);
+    symmetric = symmetric_board(keys);
+    for (i = 0; i < numMoves; i++) {
+        int square = moves[i], value;
+        /* Moves leading to the same board state up to symmetry have the same score */
+        if (symmetric && duplicate_move(variant, keys, player, square, seen, &numSeen)) continue;
+        /* Board states at the search horizon are evaluated without being hashed */
+        if (depth > 1) {
+            for (j = 0; j < NUM_SYMMETRIES; j++) childKeys[j] = keys[j] ^ variant->symmetryKeys[player][square][j];
+        }
+        value = -alpha_beta(search, opp, own | SQUARE_BIT(square), !player, childKeys, depth-1, ply+1, -beta, -alpha, square);
+        if (search->aborted) return 0;
+        if (value > best) {
+            best = value;
+            bestSquare = square;
+        }
+        if (value > alpha) alpha = value;
+        /* Stop searching once the other player would avoid this board state */
+        if (alpha >= beta) {
+            search->history[square] += depth * depth;
+            break;
+        }
+    }
+    if (bestSquare >= 0) bestSquare = variant->symmetries[symmetry][bestSquare];
+    store_transposition(key, best, ply, depth, (best <= origAlpha) ? TT_UPPER : (best >= beta) ? TT_LOWER : TT_EXACT, bestSquare);
+    return best;
+}
+
+/**
+ * @brief Searches the game tree for the optimal move to make to win the game based on the
+ * current state of the game board. The search is deepened one move at a time until the end
+ * of the game is reached or the time limit runs out, keeping the best move of the deepest
+ * completed search.
  * 
  * @param game The current game of TicTacToe being played.
+ * @param timeLimit The maximum amount of time (in milliseconds) to search, or 0 for no limit.
+ * @return The optimal move to make in order to win. 
  */
-void send_game_over(struct TTT_Game *game) {
-    struct TCP_Buffer msg = {0};
-    /* Pack command information into message */
-    msg.version = VERSION;
-    msg.command = GAME_OVER;
-    msg.gameNum = game->gameNum;
-    /* Send the command to the remote player */
-    printf("Server sent the GAME_OVER command to Player 2\n");
-    if (send(game->sd, &msg, TCP_CMD_SIZE, MSG_NOSIGNAL) < 0) {
-        print_error("send_game_over", errno, 0);
+int search_best_move(struct TTT_Game *game, int timeLimit) {
+    const struct Board_Variant *variant = game->variant;
+    int i, j, depth, bestMove = -1, bestDepth = 0, numEmpty = variant->numSquares - __builtin_popcountll(game->p1Marks | game->p2Marks);
+    uint64_t keys[NUM_SYMMETRIES], childKeys[NUM_SYMMETRIES];
+    uint64_t start = monotonic_time();
+    struct Search search = {0};
+    search.variant = variant;
+    search.timeLimit = timeLimit;
+    clock_gettime(CLOCK_MONOTONIC, &search.start);
+    /* Hash the current board state through each symmetry */
+    hash_board(variant, game->p1Marks, game->p2Marks, keys);
+    /* Deepen the search one move at a time */
+    for (depth = 1; depth <= numEmpty; depth++) {
+        int moves[MAX_SQUARES], numMoves, bestValue = -INT32_MAX, iterMove = -1, alpha = -INT32_MAX, symmetric, numSeen = 0;
+        uint64_t seen[MAX_SQUARES];
+        /* Search the best move of the previous iteration first */
+        numMoves = order_moves(&search, game->p1Marks | game->p2Marks, bestMove-1, moves);
+        symmetric = symmetric_board(keys);
+        for (i = 0; i < numMoves; i++) {
+            int square = moves[i], value;
+            /* Moves leading to the same board state up to symmetry have the same score (e.g. every corner of an empty board) */
+            if (symmetric && duplicate_move(variant, keys, 0, square, seen, &numSeen)) continue;
+            for (j = 0; j < NUM_SYMMETRIES; j++) childKeys[j] = keys[j] ^ variant->symmetryKeys[0][square][j];
+            value = -alpha_beta(&search, game->p2Marks, game->p1Marks | SQUARE_BIT(square), 1, childKeys, depth-1, 1, -INT32_MAX, -alpha, square);
+            if (search.aborted) break;
+            if (value > bestValue) {
+                bestValue = value;
+                iterMove = square+1;
+            }
+            if (value > alpha) alpha = value;
+        }
+        /* Keep the result of the deepest completed iteration */
+        if (search.aborted && bestMove > 0) break;
+        if (iterMove > 0) bestMove = iterMove;
+        if (search.aborted) break;
+        bestDepth = depth;
+        if (bestValue > WIN_THRESHOLD) {
+            /* A forced win needs no deeper search than the end of the game */
+            bestDepth = numEmpty;
+            break;
+        }
     }
-    /* Reset the game */
-    reset_game(game);
+    /* Let every other game reaching this board state (or a rotation or reflection of it) skip the search */
+    if (bestDepth > 0) store_position_cache(game, bestMove, bestDepth);
+    count_metric(METRIC_SEARCHES, 1);
+    count_metric(METRIC_SEARCH_NODES, search.nodes);
+    record_latency(HIST_SEARCH, start);
+    return bestMove;
+}
+
+/**
+ * @brief Moves every marked square of a bitboard through one of the rotations or reflections
+ * of the board, looking up where the marks of each row go.
+ * 
+ * @param variant The board variant being played.
+ * @param symmetry The rotation or reflection (0 leaves the board as is).
+ * @param marks The bitboard to transform.
+ * @return The transformed bitboard.
+ */
+uint64_t transform_marks(const struct Board_Variant *variant, int symmetry, uint64_t marks) {
+    const int size = variant->size;
+    const uint64_t *table = variant->rowSymmetries + ((symmetry * size) << size);
+    uint64_t result = 0;
+    int row;
+    for (row = 0; row < size; row++) {
+        result |= table[(row << size) | ((marks >> (row * size)) & ((1 << size) - 1))];
+    }
+    return result;
+}
+
+/**
+ * @brief Finds the canonical form of a board state: the smallest of its 8 rotations and
+ * reflections, so board states that are the same up to symmetry share one form.
+ * 
+ * @param variant The board variant being played.
+ * @param p1Marks The bitboard of the squares marked by Player 1.
+ * @param p2Marks The bitboard of the squares marked by Player 2.
+ * @param canonP1 The bitboard of Player 1's squares in the canonical form.
+ * @param canonP2 The bitboard of Player 2's squares in the canonical form.
+ * @return The rotation or reflection that turns the board state into its canonical form.
+ */
+int canonical_board(const struct Board_Variant *variant, uint64_t p1Marks, uint64_t p2Marks, uint64_t *canonP1, uint64_t *canonP2) {
+    int i, symmetry = 0;
+    *canonP1 = p1Marks;
+    *canonP2 = p2Marks;
+    for (i = 1; i < NUM_SYMMETRIES; i++) {
+        uint64_t p1 = transform_marks(variant, i, p1Marks), p2;
+        if (p1 > *canonP1) continue;
+        p2 = transform_marks(variant, i, p2Marks);
+        if (p1 < *canonP1 || p2 < *canonP2) {
+            *canonP1 = p1;
+            *canonP2 = p2;
+            symmetry = i;
+        }
+    }
+    return symmetry;
+}
+
+/**
+ * @brief Hashes the canonical form of a board state for the position cache.
+ * 
+ * @param variant The board variant being played.
+ * @param canonP1 The bitboard of Player 1's squares in the canonical form.
+ * @param canonP2 The bitboard of Player 2's squares in the canonical form.
+ * @return The hash of the board state, distinct for each variant.
+ */
+static uint64_t position_key(const struct Board_Variant *variant, uint64_t canonP1, uint64_t canonP2) {
+    /* Mix both bitboards with a multiply-xorshift so nearby boards land in distant entries */
+    uint64_t key = variant->zobristKey ^ canonP1 ^ (canonP2 * 0x9E3779B97F4A7C15ULL);
+    key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+    return key ^ (key >> 31);
 }
 
 /**
- * @brief Provides an optimal move for the maximizing player assuming that minimizing player
- * is also playing optimally.
+ * @brief Looks up Player 1's move in the position cache shared by every game, where each
+ * board state is stored once for all its rotations and reflections. Entries are stored with
+ * their key XORed with their data, so an entry torn by another thread never matches.
  * 
  * @param game The current game of TicTacToe being played.
- * @param depth The current depth in game tree.
- * @param isMax Whether it is the maximizers turn or not.
- * @return The best score achievable for the maximizer based on the current state of the game.
- */
-int minimax(struct TTT_Game *game, int depth, int isMax) {
-    /* Get score for current turn */
-    int score = check_win(game);
-    /* Check for base case */
-    if (score > 0) {    // maximizer won
-        return score - depth;
-    } else if (score < 0) {    // minimizer won
-        return score + depth;
-    } else if (check_draw(game)) {  // nobody won
+ * @return The move found by an earlier search of the board state (turned back to the game's
+ * orientation), or 0 if the board state has not been searched yet.
+ */
+int probe_position_cache(const struct TTT_Game *game) {
+    const struct Board_Variant *variant = game->variant;
+    uint64_t canonP1, canonP2, key, check, data;
+    int symmetry = canonical_board(variant, game->p1Marks, game->p2Marks, &canonP1, &canonP2);
+    struct TT_Entry *entry;
+    key = position_key(variant, canonP1, canonP2);
+    entry = &positionCache[key & (POSITION_CACHE_SIZE-1)];
+    check = __atomic_load_n(&entry->check, __ATOMIC_RELAXED);
+    data = __atomic_load_n(&entry->data, __ATOMIC_RELAXED);
+    if ((check ^ data) != key || PC_MOVE(data) < 1 || PC_MOVE(data) > variant->numSquares) {
+        count_metric(METRIC_POSITION_MISSES, 1);
         return 0;
-    } else {
-        /* Initialize best score for maximizer/minimizer */
-        int i, best = (isMax) ? INT32_MIN : INT16_MAX;
-        if (isMax) {    // maximizers turn
-            /* Searches over all possible moves */
-            for (i = 0; i < sizeof(game->board); i++) {
-                /* Checks that current move is valid based on the current board */
-                if (game->board[i] == (i+1)+'0') {
-                    int value;
-                    /* Make the move */
-                    game->board[i] = P1_MARK;
-                    /* Get best score for move and update best move if the score was better */
-                    if ((value = minimax(game, depth+1, !isMax)) > best) best = value;
-                    /* Undo previous move */
-                    game->board[i] = (i+1)+'0';
-                }
-            }
-            return best;
-        } else {    // minimizers turn
-            /* Searches over all possible moves */
-            for (i = 0; i < sizeof(game->board); i++) {
-                /* Checks that current move is valid based on the current board */
-                if (game->board[i] == (i+1)+'0') {
-                    int value;
-                    /* Make the move */
-                    game->board[i] = P2_MARK;
-                    /* Get best score for move and update best move if the score was better */
-                    if ((value = minimax(game, depth+1, !isMax)) < best) best = value;
-                    /* Undo previous move */
-                    game->board[i] = (i+1)+'0';
-                }
-            }
-            return best;
+    }
+    count_metric(METRIC_POSITION_HITS, 1);
+    return variant->symmetries[inverseSymmetries[symmetry]][PC_MOVE(data)-1] + 1;
+}
+
+/**
+ * @brief Stores the move found by a search in the position cache, in the orientation of the
+ * board state's canonical form, keeping deeper results for the same board state.
+ * 
+ * @param game The game whose board state was searched.
+ * @param move The move found by the search.
+ * @param depth The depth of the deepest completed search.
+ */
+void store_position_cache(const struct TTT_Game *game, int move, int depth) {
+    const struct Board_Variant *variant = game->variant;
+    uint64_t canonP1, canonP2, key, data, oldData;
+    int symmetry = canonical_board(variant, game->p1Marks, game->p2Marks, &canonP1, &canonP2);
+    struct TT_Entry *entry;
+    key = position_key(variant, canonP1, canonP2);
+    entry = &positionCache[key & (POSITION_CACHE_SIZE-1)];
+    /* Keep a deeper result for the same board state */
+    oldData = __atomic_load_n(&entry->data, __ATOMIC_RELAXED);
+    if ((__atomic_load_n(&entry->check, __ATOMIC_RELAXED) ^ oldData) == key && PC_DEPTH(oldData) > depth) return;
+    data = ((uint64_t)(depth & 0xFF) << 8) | (variant->symmetries[symmetry][move-1] + 1);
+    __atomic_store_n(&entry->check, key ^ data, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->data, data, __ATOMIC_RELAXED);
+}
+
+/* The optimal move for Player 1 indexed by board state, or 0 if Player 1 has no move. */
+static unsigned char moveTable[MOVE_TABLE_SIZE];
+/* The base 3 encoding of each bitboard, where every set square is a digit of 1. */
+static uint16_t base3Table[BASE3_TABLE_SIZE];
+/* The bitset of every board state a game on the default board can reach, indexed like the move table. */
+static unsigned char reachableTable[(MOVE_TABLE_SIZE + 7) / 8];
+
+/**
+ * @brief Encodes the state of the default game board as a base 3 number where each square is
+ * a digit that is 0 if the square is empty, 1 for Player 1, and 2 for Player 2.
+ * 
+ * @param game The current game of TicTacToe being played.
+ * @return The index of the board state in the move table.
+ */
+int encode_board(const struct TTT_Game *game) {
+    return base3Table[game->p1Marks] + 2 * base3Table[game->p2Marks];
+}
+
+/**
+ * @brief Visits every board state reachable from the current one, marking it as reachable, and
+ * records the optimal move for each state in which it is Player 1's turn and the game is not over.
+ * 
+ * @param game The game board being explored.
+ * @param isP1Turn Whether it is Player 1's turn or not.
+ * @param visited The board states that have already been visited.
+ */
+static void fill_move_table(struct TTT_Game *game, int isP1Turn, char *visited) {
+    int i, index = encode_board(game);
+    /* Skip states already visited and states where the game is over (which are still reachable) */
+    if (visited[index]) return;
+    reachableTable[index >> 3] |= 1 << (index & 7);
+    if (check_win(game) || check_draw(game)) return;
+    visited[index] = 1;
+    if (isP1Turn) moveTable[index] = search_best_move(game, 0);
+    /* Visit the states reached by each possible move */
+    for (i = 0; i < GAME_SIZE; i++) {
+        if (is_open_square(i, game)) {
+            uint64_t *marks = (isP1Turn) ? &game->p1Marks : &game->p2Marks;
+            *marks |= SQUARE_BIT(i);
+            fill_move_table(game, !isP1Turn, visited);
+            *marks &= ~SQUARE_BIT(i);
+        }
+    }
+}
+
+/**
+ * @brief Builds the table of optimal moves for Player 1 so the server never has to search the
+ * game tree while playing. Must be called before any games are played.
+ */
+void init_move_table(void) {
+    int i, numStates = 0;
+    char *visited;
+    struct TTT_Game game = {0};
+    log_message(LOG_INFO, "[+]Precomputing the move table.");
+    /* Build the base 3 encoding of every bitboard (square 0 is the most significant digit) */
+    for (i = 0; i < BASE3_TABLE_SIZE; i++) {
+        int square;
+        for (square = 0; square < GAME_SIZE; square++) {
+            base3Table[i] = base3Table[i] * 3 + ((i & SQUARE_BIT(square)) != 0);
         }
     }
+    if ((visited = calloc(MOVE_TABLE_SIZE, sizeof(char))) == NULL) print_error("init_move_table: calloc", errno, 1);
+    /* Explore every board state reachable from an empty board (Player 1 moves first) */
+    game.variant = get_variant(ROWS, ROWS);
+    init_shared_state(&game);
+    fill_move_table(&game, 1, visited);
+    for (i = 0; i < MOVE_TABLE_SIZE; i++) numStates += (moveTable[i] != 0);
+    free(visited);
+    log_message(LOG_INFO, "[+]Move table holds %d board states.", numStates);
 }
 
 /**
  * @brief Finds the optimal move to make to win the game based on the current state of
- * the game board.
+ * the game board by looking it up in the move table.
  * 
  * @param game The current game of TicTacToe being played.
- * @return The optimal move to make in order to win. 
+ * @return The optimal move to make in order to win, or 0 if the move must be searched for
+ * (the board is not the default board or the board state is not in the table).
  */
-int find_best_move(struct TTT_Game *game) {
-    int i, bestMove = -1, bestValue = INT32_MIN;
-    /* Searches over all possible moves */
-    for (i = 0; i < sizeof(game->board); i++) {
-        /* Checks that current move is valid based on the current board */
-        if (game->board[i] == (i+1)+'0') {
-            int moveValue;
-            /* Make the move */
-            game->board[i] = P1_MARK;
-            /* Get the move score */
-            moveValue = minimax(game, 0, 0);
-            /* Undo previous move */
-            game->board[i] = (i+1)+'0';
-            /* Update the best move if the current score was better */
-            if (moveValue > bestValue) {
-                bestValue = moveValue;
-                bestMove = i+1;
-            }
+int find_table_move(const struct TTT_Game *game) {
+    return (game->variant == get_variant(ROWS, ROWS)) ? moveTable[encode_board(game)] : 0;
+}
+
+/**
+ * @brief Determines whether a game could reach a board state with Player 1 to move. On the
+ * default board this is a single lookup in the table of reachable board states. On larger
+ * boards Player 1 must not have won (Player 2 moved last), and every line Player 2 won must
+ * pass through one square, the move that ended the game.
+ * 
+ * @param variant The board variant being played.
+ * @param p1Marks The bitboard of the squares marked by Player 1.
+ * @param p2Marks The bitboard of the squares marked by Player 2 (as many as Player 1's).
+ * @return True if the board state is reachable, false otherwise.
+ */
+int reachable_board(const struct Board_Variant *variant, uint64_t p1Marks, uint64_t p2Marks) {
+    int i, p2Won = 0;
+    uint64_t lastMove = p2Marks;
+    if (variant == get_variant(ROWS, ROWS)) {
+        int index = base3Table[p1Marks] + 2 * base3Table[p2Marks];
+        return (reachableTable[index >> 3] >> (index & 7)) & 1;
+    }
+    for (i = 0; i < variant->numLines; i++) {
+        uint64_t line = variant->lines[i];
+        if ((p1Marks & line) == line) return 0;
+        if ((p2Marks & line) == line) {
+            lastMove &= line;
+            p2Won = 1;
         }
     }
-    return bestMove;
+    return !p2Won || lastMove != 0;
+}
+
+/**
+ * @brief Makes Player 1's next move. Moves in the move table or the position cache are sent
+ * right away, and all other moves are searched for by the worker pool and sent once the
+ * search finishes.
+ * 
+ * @param game The current game of TicTacToe being played.
+ */
+void play_p1_move(struct TTT_Game *game) {
+    int move = find_table_move(game);
+    if (move == 0) move = probe_position_cache(game);
+    if (move == 0) {
+        /* The shard finishes the move when the worker pool finishes the search */
+        if (submit_search(&game->shard->serv->pool, game, searchTimeLimit)) return;
+        move = search_best_move(game, searchTimeLimit);
+    }
+    finish_p1_move(game, move);
+}
+
+/**
+ * @brief Sends Player 1's move to the remote player, updates the game board, and checks if
+ * someone won after the exchange. The game is reset if the move could not be sent.
+ * 
+ * @param game The current game of TicTacToe being played.
+ * @param move The move Player 1 makes.
+ */
+void finish_p1_move(struct TTT_Game *game, int move) {
+    if (send_p1_move(game, move) == ERROR_CODE) {
+        /* Reset game if there was an error sending the move */
+        reset_game(game);
+        return;
+    }
+    /* Update the board (for Player 1) and check if someone won after the exchange */
+    game->p1Marks |= SQUARE_BIT(move-1);
+    publish_move(game, WATCH_P1_MOVE, move);
+    if (!check_game_over(game)) {
+        /* Let the other servers (or this one, once restarted) take over the game while Player 2 is choosing a move (once it is sent) */
+        hold_state(game);
+        print_board(game);
+    } else if (game->conn->version == FRAMED_VERSION) {
+        /* In version 7 the player making the last move sends GAME_OVER in the same frame */
+        send_game_over(game);
+        return;
+    }
+    /* Give Player 2 until the move deadline to answer (with a move, or GAME_OVER if the game is over) */
+    if (game->shard->serv->moveTicks > 0) {
+        game->moveTimer.expire = expire_move;
+        schedule_timer(&game->shard->timers, &game->moveTimer, game->shard->timers.tick + game->shard->serv->moveTicks);
+    }
 }
 
 /**
@@ -787,13 +6015,12 @@ int find_best_move(struct TTT_Game *game) {
  */
 int validate_move(int choice, const struct TTT_Game *game) {
     /* Check to see if the choice is a move on the board */
-    if (choice < 1 || choice > 9) {
-        print_error("Invalid move: Must be a number [1-9]", 0, 0);
+    if (choice < 1 || choice > game->variant->numSquares) {
+        print_error("Invalid move: Must be a square on the board", 0, 0);
         return 0;
     }
-    /* Check to see if the square chosen has a digit in it, if */
-    /* square 8 has an '8' then it is a valid choice */
-    if (game->board[choice-1] != (choice + '0')) {
+    /* Check to see if the square chosen has not been marked by either player */
+    if (!is_open_square(choice-1, game)) {
         print_error("Invalid move: Square already taken", 0, 0);
         return 0;
     }
@@ -809,25 +6036,27 @@ int validate_move(int choice, const struct TTT_Game *game) {
  * @brief Sends Player 1's move to the remote player.
  * 
  * @param game The current game of TicTacToe being played.
+ * @param move The move to send to the remote player.
  * @return The move that was sent, or an error code if there was an issue. 
  */
-int send_p1_move(struct TTT_Game *game) {
-    struct TCP_Buffer msg = {0};
-    /* Get move to send to remote player */
-    int move = find_best_move(game);
-    while (!validate_move(move, game)) move = find_best_move(game);
-    /* Pack move information into message */
-    msg.version = VERSION;
-    msg.command = MOVE;
-    msg.data = move + '0';
-    msg.gameNum = game->gameNum;
+int send_p1_move(struct TTT_Game *game, int move) {
+    /* Check the move before sending it to remote player */
+    if (!validate_move(move, game)) return ERROR_CODE;
     /* Send the move to the remote player */
-    printf("Server sent the move:  %c\n", msg.data);
-    if (send(game->sd, &msg, TCP_CMD_SIZE, MSG_NOSIGNAL) < 0) {
-        print_error("send_p1_move", errno, 0);
-        return ERROR_CODE;
-    }
-    return (msg.data - '0');
+    log_message(LOG_DEBUG, "Server sent the move:  %c", move + '0');
+    if (send_command(game->conn, MOVE, move + '0', game_channel(game)) == ERROR_CODE) return ERROR_CODE;
+    return move;
+}
+
+/**
+ * @brief Determines if a square of the game board has not been marked by either player.
+ * 
+ * @param square The square (starting from 0) of the game board.
+ * @param game The current game of TicTacToe being played.
+ * @return True if the square is empty, false otherwise.
+ */
+int is_open_square(int square, const struct TTT_Game *game) {
+    return !((game->p1Marks | game->p2Marks) & SQUARE_BIT(square));
 }
 
 /**
@@ -837,30 +6066,18 @@ int send_p1_move(struct TTT_Game *game) {
  * @return True if a player has won the game and false if the game is still going on. 
  */
 int check_win(const struct TTT_Game *game) {
-    const int score = sizeof(game->board) + 1;
+    const struct Board_Variant *variant = game->variant;
+    const int score = variant->numSquares + 1;
+    int i, p1Won = 0, p2Won = 0;
     /***********************************************************************/
-    /* Brute force check to see if someone won. Return a +/- score if the  */
-    /* game is 'over' or return 0 if game should go on.                    */
+    /* Check every winning line against both players' marks. Return a +/-  */
+    /* score if the game is 'over' or return 0 if game should go on.       */
     /***********************************************************************/
-    if (game->board[0] == game->board[1] && game->board[1] == game->board[2]) { // row matches
-        return (game->board[0] == P1_MARK) ? score : -score;
-    } else if (game->board[3] == game->board[4] && game->board[4] == game->board[5]) { // row matches
-        return (game->board[3] == P1_MARK) ? score : -score;
-    } else if (game->board[6] == game->board[7] && game->board[7] == game->board[8]) { // row matches
-        return (game->board[6] == P1_MARK) ? score : -score;
-    } else if (game->board[0] == game->board[3] && game->board[3] == game->board[6]) { // column matches
-        return (game->board[0] == P1_MARK) ? score : -score;
-    } else if (game->board[1] == game->board[4] && game->board[4] == game->board[7]) { // column matches
-        return (game->board[1] == P1_MARK) ? score : -score;
-    } else if (game->board[2] == game->board[5] && game->board[5] == game->board[8]) { // column matches
-        return (game->board[2] == P1_MARK) ? score : -score;
-    } else if (game->board[0] == game->board[4] && game->board[4] == game->board[8]) { // diagonal matches
-        return (game->board[0] == P1_MARK) ? score : -score;
-    } else if (game->board[2] == game->board[4] && game->board[4] == game->board[6]) { // diagonal matches
-        return (game->board[2] == P1_MARK) ? score : -score;
-    } else {
-        return 0;  // return of 0 means keep playing
+    for (i = 0; i < variant->numLines; i++) {
+        p1Won |= ((game->p1Marks & variant->lines[i]) == variant->lines[i]);
+        p2Won |= ((game->p2Marks & variant->lines[i]) == variant->lines[i]);
     }
+    return (p1Won) ? score : -p2Won * score;
 }
 
 /**
@@ -870,13 +6087,8 @@ int check_win(const struct TTT_Game *game) {
  * @return True if there are no moves left to be made, false otherwise. 
  */
 int check_draw(const struct TTT_Game *game) {
-    int i;
-    /* Check each board square */
-    for (i = 0; i < sizeof(game->board); i++) {
-        /* Check if current square has been played */
-        if (game->board[i] == (i+1)+'0') return 0;
-    }
-    return 1;
+    /* Check if every board square has been played */
+    return __builtin_popcountll(game->p1Marks | game->p2Marks) == game->variant->numSquares;
 }
 
 /**
@@ -897,32 +6109,48 @@ int check_game_over(struct TTT_Game *game) {
     }
     /* Print final game board and winning player */
     print_board(game);
-    (game->winner == 0) ? printf("==>\a It's a draw\n") : printf("==>\a Player %d wins\n", game->winner);
+    (game->winner == 0) ? log_message(LOG_INFO, "==>\a It's a draw") : log_message(LOG_INFO, "==>\a Player %d wins", game->winner);
     return 1;
 }
 
 /**
- * @brief Prints out the current state of the game board nicely formatted.
+ * @brief Logs the current state of the game board nicely formatted, one line at a time. The
+ * board is only put together when debug messages are written.
  * 
  * @param game The current game of TicTacToe being played.
  */
 void print_board(const struct TTT_Game *game) {
+    int row, col, length, size = game->variant->size;
+    char line[BUFFER_SIZE];
+    if (!log_enabled(LOG_DEBUG)) return;
     /*****************************************************************/
     /* Brute force print out the board and all the squares/values    */
     /*****************************************************************/
     /* Print header info */
-    printf("\n\n\tTicTacToe Game #%d\n\n", game->gameNum);
-    printf("Player 1 (%c)  -  Player 2 (%c)\n\n\n", P1_MARK, P2_MARK);
-    /* Print current state of board */
-    printf("     |     |     \n");
-    printf("  %c  |  %c  |  %c \n", game->board[0], game->board[1], game->board[2]);
-    printf("_____|_____|_____\n");
-    printf("     |     |     \n");
-    printf("  %c  |  %c  |  %c \n", game->board[3], game->board[4], game->board[5]);
-    printf("_____|_____|_____\n");
-    printf("     |     |     \n");
-    printf("  %c  |  %c  |  %c \n", game->board[6], game->board[7], game->board[8]);
-    printf("     |     |     \n\n");
+    log_message(LOG_DEBUG, "\tTicTacToe Game #%d", game->gameNum);
+    log_message(LOG_DEBUG, "Player 1 (%c)  -  Player 2 (%c)", P1_MARK, P2_MARK);
+    /* Print current state of board (the mark or the square number of each square) */
+    for (row = 0; row < size; row++) {
+        for (col = 0, length = 0; col < size; col++) length += snprintf(line + length, sizeof(line) - length, (col < size-1) ? "     |" : "     ");
+        log_message(LOG_DEBUG, "%s", line);
+        for (col = 0, length = 0; col < size; col++) {
+            int square = row * size + col;
+            if (game->p1Marks & SQUARE_BIT(square)) {
+                length += snprintf(line + length, sizeof(line) - length, "  %c  ", P1_MARK);
+            } else if (game->p2Marks & SQUARE_BIT(square)) {
+                length += snprintf(line + length, sizeof(line) - length, "  %c  ", P2_MARK);
+            } else {
+                length += snprintf(line + length, sizeof(line) - length, "%3d  ", square+1);
+            }
+            if (col < size-1) length += snprintf(line + length, sizeof(line) - length, "|");
+        }
+        log_message(LOG_DEBUG, "%s", line);
+        if (row == size-1) break;
+        for (col = 0, length = 0; col < size; col++) length += snprintf(line + length, sizeof(line) - length, (col < size-1) ? "_____|" : "_____");
+        log_message(LOG_DEBUG, "%s", line);
+    }
+    for (col = 0, length = 0; col < size; col++) length += snprintf(line + length, sizeof(line) - length, (col < size-1) ? "     |" : "     ");
+    log_message(LOG_DEBUG, "%s", line);
 }
 
 /**
@@ -931,117 +6159,138 @@ void print_board(const struct TTT_Game *game) {
  * @param game The current game of TicTacToe being played.
  */
 void reset_game(struct TTT_Game *game) {
-    /* Check if game has been initialized */
-    if (game->gameNum != 0) {
-        printf("Game #%d has ended. Resetting game for new player\n", game->gameNum);
-        /* Close client connection to game */
-        if (close(game->sd) < 0) print_error("reset_game: close-connection", errno, 0);
+    struct Connection *conn = game->conn;
+    /* Check if game has a client connected to it */
+    if (conn != NULL) {
+        const int channel = game->channel, endedEarly = (game->channel >= 0 && game->winner < 0 && !conn->closing);
+        log_message(LOG_INFO, "Game #%d has ended. Resetting game for new player", game->gameNum);
+        cancel_timer(&game->shard->timers, &game->moveTimer);
+        count_metric(METRIC_GAMES_ENDED, 1);
+        /* Let the other servers drop the game if it was replicated */
+        if (game->p1Marks != 0) {
+            replicate_game(game, 1);
+            journal_game(game, 1);
+        }
+        /* Let the spectators know how the game they were watching ended */
+        if ((game->p1Marks | game->p2Marks) != 0) publish_move(game, WATCH_GAME_END, (game->winner < 0) ? WATCH_ABANDONED : game->winner);
+        /* Detach the game from its connection and return it to the stack of open games */
+        detach_game(conn, game);
+        game->roster->openSlots[game->roster->numOpen++] = game->slot;
+        atomic_fetch_sub(&game->roster->numActive, 1);
+        /* Tell the remote player a multiplexed game has ended early (the connection goes on) */
+        if (endedEarly) send_command(conn, GAME_OVER, 0, channel);
+        /* Close the connection unless it is multiplexed */
+        if (!conn->multiplexed) close_connection(conn);
     }
     /* Reset game attributes */
-    game->sd = -1;
+    game->channel = -1;
     game->winner = -1;
+    game->searching = 0;
+    game->variant = get_variant(ROWS, ROWS);
     /* Reset game board */
     init_shared_state(game);
 }
 
 /**
  * @brief Plays multiple games of TicTacToe with remote players that end when either
- * someone wins, there is a draw, or the remote player leaves the game.
+ * someone wins, there is a draw, or the remote player leaves the game. Each shard runs this
+ * loop for its own games, and shard 0 also handles the multicast group and new connections.
  * 
- * @param serv The server communication endpoint.
+ * @param shard The shard of the server playing the games.
  */
-void tictactoe(struct Server *serv) {
-    serv->maxSD = (serv->mcd > serv->sd) ? serv->mcd : serv->sd;
-    Command_Handler commands[] = {new_game, move, game_over, resume_game};
+void tictactoe(struct Shard *shard) {
+    struct Server *serv = shard->serv;
+    struct Ready_Event events[MAX_EVENTS];
+    threadMetrics = &shard->metrics;
 
-    /* Initialize all games */
-    init_game_roster(serv);
     /* Play all the games */
     while (1) {
-        int i;
-        /* Clear previously processed games */
-        FD_ZERO(&serv->socketFDS);
-        /* Set the multicast group and the server to be active */
-        FD_SET(serv->mcd, &serv->socketFDS);
-        FD_SET(serv->sd, &serv->socketFDS);
-        /* Set games that have a client connection to be active */
-        for (i = 0; i < MAX_GAMES; i++) {
-            int gameSD = serv->gameRoster[i].sd;
-            if (gameSD > 0) {
-                FD_SET(gameSD, &serv->socketFDS);
-                if (gameSD > serv->maxSD) serv->maxSD = gameSD;
-            }
-        }
-
-        /* Block until there is a new connection or a command is received */
-        printf("[+]Waiting for other players to issue commands...\n");
-        if (select(serv->maxSD+1, &serv->socketFDS, NULL, NULL, NULL) == -1) {
-            print_error("select", errno, 0);
-            continue;
-        }
+        int i, numReady;
+        /* Block until there is a new connection, a command is received, or a deadline may have passed */
+        log_message(LOG_DEBUG, "[+]Waiting for other players to issue commands...");
+        if ((numReady = wait_for_events(&shard->engine, events, MAX_EVENTS, (shard->pendingReads != NULL) ? 0 : timer_timeout(&shard->timers))) == ERROR_CODE) continue;
+        /* End the games and connections whose deadlines have passed (bringing the shard's clock up to date) */
+        run_timers(&shard->timers);
+        /* Handle another share of the input left over in the last pass */
+        process_deferred_input(shard);
 
-        /* Check if a command was received from the multicast group */
-        if (FD_ISSET(serv->mcd, &serv->socketFDS)) {
-            struct sockaddr_in clientAddress;
-            struct UDP_Buffer datagram = {0};
-            if (get_udp_command(serv->mcd, &clientAddress, &datagram) > 0) {
-                printf("********  Multicast Group  ********\n");
-                /* Process received command */
-                switch (datagram.command) {
-                    case REQUEST_GAME:
-                        request_game(serv, &clientAddress);
-                        break;
-                    case GAME_AVAILABLE:
-                        print_error("tictactoe: handling of UDP command GAME_AVAILABLE unsupporded by server", 0, 0);
-                        break;
+        /* Process only the sockets that are ready */
+        for (i = 0; i < numReady; i++) {
+            if (events[i].tag == MULTICAST_TAG) {
+                /* Process all commands received from the multicast group, a batch at a time */
+                int received, j;
+                struct UDP_Batch requests, replies;
+                uint64_t start = monotonic_time();
+                replies.count = 0;
+                while ((received = get_udp_commands(serv->mcd, &requests)) > 0) {
+                    log_message(LOG_DEBUG, "********  Multicast Group  ********");
+                    /* Process received commands, answering every REQUEST_GAME together */
+                    for (j = 0; j < requests.count; j++) {
+                        switch (requests.datagrams[j].command) {
+                            case REQUEST_GAME:
+                                if (replies.count == UDP_BATCH_SIZE) {
+                                    send_game_available(serv, &replies);
+                                    replies.count = 0;
+                                }
+                                request_game(serv, &requests.addrs[j], &replies);
+                                break;
+                            case GAME_AVAILABLE:
+                                print_error("tictactoe: handling of UDP command GAME_AVAILABLE unsupporded by server", 0, 0);
+                                break;
+                            case GAME_STATE:
+                                count_metric(METRIC_GAME_STATES, 1);
+                                store_replica(&requests.addrs[j], &requests.datagrams[j].state, NULL);
+                                break;
+                        }
+                    }
+                    if (received < UDP_BATCH_SIZE) break;
                 }
-            }
-        }
-
-        /* Check if a remote player is asking for a new connection */
-        if (FD_ISSET(serv->sd, &serv->socketFDS)) {
-            int connected_sd;
-            struct sockaddr_in clientAddress;
-            socklen_t fromLength = sizeof(struct sockaddr_in);
-            /* Accept player connection if able to */
-            bzero(&clientAddress, sizeof(struct sockaddr_in));
-            if ((connected_sd = accept(serv->sd, (struct sockaddr *)&clientAddress, &fromLength))) {
-                printf("********  TCP Connection  ********\n");
-                printf("Connection request from player at %s (port %d)\n", inet_ntoa(clientAddress.sin_addr), clientAddress.sin_port);
-                /* Find an open game to assign the connection */
-                int gameIndx = find_open_game(serv);
-                if (gameIndx >= 0) {
-                    /* If an open game was found, assign the connection to the game */
-                    struct TTT_Game *currentGame = &serv->gameRoster[gameIndx];
-                    printf("Player assigned to Game #%d\n", currentGame->gameNum);
-                    currentGame->sd = connected_sd;
-                } else {
-                    /* If no open games found, close the connection to the remote player */
-                    print_error("tictactoe: Unable to find an open game", 0, 0);
-                    if (close(connected_sd) < 0) print_error("tistactoe: close-connection", errno, 0);
+                send_game_available(serv, &replies);
+                record_latency(HIST_UDP, start);
+            } else if (events[i].tag == SERVER_TAG) {
+                /* Accept all remote players asking for a new connection */
+                int connected_sd;
+                struct sockaddr_in clientAddress;
+                socklen_t fromLength = sizeof(struct sockaddr_in);
+                bzero(&clientAddress, sizeof(struct sockaddr_in));
+                while ((connected_sd = accept_socket(&shard->engine, serv->sd, &clientAddress, &fromLength)) >= 0) {
+                    int shardIndx;
+                    count_metric(METRIC_ACCEPTS, 1);
+                    log_message(LOG_DEBUG, "********  TCP Connection  ********");
+                    log_message(LOG_INFO, "Connection request from player at %s (port %d)", inet_ntoa(clientAddress.sin_addr), clientAddress.sin_port);
+                    /* Admit the player with a game held for it, or with a game nobody holds, and turn everyone else away */
+                    if (!take_reservation(serv, &clientAddress.sin_addr) && unreserved_games(serv) == 0) {
+                        print_error("tictactoe: Unable to find an open game", 0, 0);
+                        refuse_connection(connected_sd);
+                    } else if ((shardIndx = find_open_shard(serv)) > 0) {
+                        /* Give the connection to the shard with the most open games */
+                        hand_off_connection(&serv->shards[shardIndx], connected_sd);
+                    } else {
+                        assign_connection(shard, connected_sd);
+                    }
+                    fromLength = sizeof(struct sockaddr_in);
                 }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) print_error("accept", errno, 0);
+            } else if (events[i].tag == WAKEUP_TAG) {
+                /* Assign connections handed off by shard 0 and send moves found by the worker pool */
+                accept_handoffs(shard);
+                finish_searches(shard);
             } else {
-                print_error("accept", errno, 0);
-            }
-        }
-
-        /* Process received commands from active games */
-        for (i = 0; i < MAX_GAMES; i++) {
-            struct TTT_Game *currentGame = &serv->gameRoster[i];
-            /* Check if game is currently active */
-            if (FD_ISSET(currentGame->sd, &serv->socketFDS)) {
-                int rv;
-                struct TCP_Buffer msg = {0};
-                printf("********  Game #%d  ********\n", currentGame->gameNum);
-                /* Get the command for the current game */
-                if ((rv = get_tcp_command(currentGame->sd, &msg)) > 0) {
-                    /* Process received command for current game */
-                    commands[(int)msg.command](&msg, currentGame);
+                /* Process received commands for the games of the ready connection */
+                struct Connection *conn = shard->connections[events[i].tag];
+                /* A connection with input left over has already had its share of the pass */
+                if (conn == NULL || conn->sd < 0 || conn->readPending) continue;
+                if (conn->multiplexed) {
+                    log_message(LOG_DEBUG, "********  Connection #%d (%d games)  ********", conn->slot, conn->numGames);
                 } else {
-                    /* Invalid command received -> reset game */
-                    reset_game(currentGame);
+                    log_message(LOG_DEBUG, "********  Game #%d  ********", conn->game->gameNum);
                 }
+                process_input(conn);
             }
         }
+        /* Send the frames queued while handling the events and the moves made in them, then free the connections closed */
+        flush_connections(shard);
+        flush_watch_feed(shard);
+        release_connections(shard);
     }
 }